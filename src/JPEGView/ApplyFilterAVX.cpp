@@ -1,114 +1,433 @@
 #include "StdAfx.h"
 #include "XMMImage.h"
 #include "ResizeFilter.h"
+#include "Helpers.h"
+#include "BasicProcessing.h"
 #include "ApplyFilterAVX.h"
+#include "ApplyFilterAVX512.h"
+#include "YCbCrImage.h"
+#include <immintrin.h>
 
 #ifdef _WIN64
 
-CFloatImage* ApplyFilter_AVX_f32(int nSourceHeight, int nTargetHeight, int nWidth,
-	int nStartY_FP, int nStartX, int nIncrementY_FP,
-	const AVXFilterKernelBlock& filter,
-	int nFilterOffset, const CFloatImage* pSourceImg, bool bRoundResult) {
+// Same as the SSE version, see GetSourceRange_SSE_f32()
+static void GetSourceRange_AVX_f32(AVXFilterKernel** pKernels, uint32 nStart_FP, uint32 nIncrement_FP, int nCount, int nMax,
+	int& nFirst, int& nLast) {
+	nFirst = nMax;
+	nLast = 0;
+	uint32 nCur = nStart_FP;
+	for (int i = 0; i < nCount; i++) {
+		int nStart = (int)(nCur >> 16) - pKernels[i]->FilterOffset;
+		nFirst = min(nFirst, nStart);
+		nLast = max(nLast, nStart + pKernels[i]->FilterLen - 1);
+		nCur += nIncrement_FP;
+	}
+	nFirst = max(0, nFirst);
+	nLast = min(nMax, nLast);
+}
+
+// sRGB8_LinRGB12 as f32 and LinRGB12_sRGB8 widened to 32 bit, the tables used with the gather instructions
+static struct CGatherTables {
+	float sRGB8_LinF32[256];
+	int LinRGB12_sRGB8_32[4096];
+	CGatherTables() {
+		for (int i = 0; i < 256; i++) {
+			sRGB8_LinF32[i] = (float)sRGB8_LinRGB12[i];
+		}
+		for (int i = 0; i < 4096; i++) {
+			LinRGB12_sRGB8_32[i] = LinRGB12_sRGB8[i];
+		}
+	}
+} s_GatherTables;
 
-	int nStartXAligned = nStartX & ~7;
-	int nEndXAligned = (nStartX + nWidth + 7) & ~7;
+// Converts one row of nWidth 24 or 32 bpp DIB pixels to linear light, deinterleaving to the three planes at pTarget
+// (channel length nChannelLen). The planes are f32 or, if bHalfFloat, half floats. Blocks of 8 pixels are converted with
+// a gather from the f32 table, the planes must be padded to 8 pixels.
+static void ConvertRowFromDIB_AVX(const uint8* pSource, int nChannels, int nWidth, uint8* pTarget, int nChannelLen, bool bHalfFloat) {
+	// pshufb masks collecting the B, G, R bytes of 8 BGR pixels from the first 16 and the last 8 bytes
+	const __m128i xmmShuffleB0 = _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i xmmShuffleB1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i xmmShuffleG0 = _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i xmmShuffleG1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i xmmShuffleR0 = _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i xmmShuffleR1 = _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i ymmMask = _mm256_set1_epi32(0xFF);
+	const float* pTable = s_GatherTables.sRGB8_LinF32;
+	int nElementSize = bHalfFloat ? 2 : 4;
+	uint8 lastBlock[32];
 
+	for (int x = 0; x < nWidth; x += 8) {
+		const uint8* pBlock = pSource + x * nChannels;
+		if (x + 8 > nWidth) {
+			// copy the last pixels to not read beyond the end of the DIB, the padding of the planes takes the rest
+			memset(lastBlock, 0, sizeof(lastBlock));
+			memcpy(lastBlock, pBlock, (nWidth - x) * nChannels);
+			pBlock = lastBlock;
+		}
+		__m256i ymmB, ymmG, ymmR;
+		if (nChannels == 4) {
+			__m256i ymm0 = _mm256_loadu_si256((const __m256i*)pBlock);
+			ymmB = _mm256_and_si256(ymm0, ymmMask);
+			ymmG = _mm256_and_si256(_mm256_srli_epi32(ymm0, 8), ymmMask);
+			ymmR = _mm256_and_si256(_mm256_srli_epi32(ymm0, 16), ymmMask);
+		} else {
+			__m128i xmm0 = _mm_loadu_si128((const __m128i*)pBlock);
+			__m128i xmm1 = _mm_loadl_epi64((const __m128i*)(pBlock + 16));
+			ymmB = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(xmm0, xmmShuffleB0), _mm_shuffle_epi8(xmm1, xmmShuffleB1)));
+			ymmG = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(xmm0, xmmShuffleG0), _mm_shuffle_epi8(xmm1, xmmShuffleG1)));
+			ymmR = _mm256_cvtepu8_epi32(_mm_or_si128(_mm_shuffle_epi8(xmm0, xmmShuffleR0), _mm_shuffle_epi8(xmm1, xmmShuffleR1)));
+		}
+		__m256 ymm4 = _mm256_i32gather_ps(pTable, ymmB, 4);
+		__m256 ymm5 = _mm256_i32gather_ps(pTable, ymmG, 4);
+		__m256 ymm6 = _mm256_i32gather_ps(pTable, ymmR, 4);
 
-	CFloatImage* tempImage = new CFloatImage(nEndXAligned - nStartXAligned, nTargetHeight, 8);
-	if (tempImage->AlignedPtr() == NULL) {
-		delete tempImage;
-		return NULL;
+		uint8* pDest = pTarget + x * nElementSize;
+		if (bHalfFloat) {
+			_mm_store_si128((__m128i*)pDest, _mm256_cvtps_ph(ymm4, _MM_FROUND_TO_NEAREST_INT));
+			_mm_store_si128((__m128i*)(pDest + nChannelLen * 2), _mm256_cvtps_ph(ymm5, _MM_FROUND_TO_NEAREST_INT));
+			_mm_store_si128((__m128i*)(pDest + nChannelLen * 4), _mm256_cvtps_ph(ymm6, _MM_FROUND_TO_NEAREST_INT));
+		} else {
+			_mm256_store_ps((float*)pDest, ymm4);
+			_mm256_store_ps((float*)(pDest + nChannelLen * 4), ymm5);
+			_mm256_store_ps((float*)(pDest + nChannelLen * 8), ymm6);
+		}
 	}
+}
 
-	int nCurY = nStartY_FP;
-	int nChannelLenBytes = pSourceImg->GetPaddedWidth() * sizeof(float);
-	int nRowLenBytes = nChannelLenBytes * 3;
-	int nNumberOfBlocksX = (nEndXAligned - nStartXAligned) >> 3;
+// Converts a row of nWidth linear light BGRx pixels (one per __m128, as written by the FilterRowX functions) to sRGB and
+// writes them to the 32 bpp DIB. Blocks of 4 pixels are converted with a gather from the 32 bit table, bit exact with the
+// scalar conversion in FilterRowXToDIB_SSE_f32().
+static void ConvertRowToDIB_AVX(const __m128* pSource, int nWidth, uint8* pTarget) {
+	const __m256 ymm0 = _mm256_setzero_ps();
+	const __m256 ymm1 = _mm256_set1_ps(4095.0f);
+	const __m256i ymmOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	const __m128i xmmAlpha = _mm_set1_epi32(0xFF000000);
+	const int* pTable = s_GatherTables.LinRGB12_sRGB8_32;
+	uint32* pDestination = (uint32*)pTarget;
 
-	const uint8* pSourceStart = (const uint8*)pSourceImg->AlignedPtr() + nStartXAligned * sizeof(float);
-	AVXFilterKernel** pKernelIndexStart = filter.Indices;
+	int x = 0;
+	for (; x + 3 < nWidth; x += 4) {
+		// limit to range 0..4095 and round to nearest integer
+		__m256 ymm4 = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps((const float*)(pSource + x)), ymm1), ymm0);
+		__m256 ymm5 = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps((const float*)(pSource + x + 2)), ymm1), ymm0);
+		__m256i ymm2 = _mm256_i32gather_epi32(pTable, _mm256_cvtps_epi32(ymm4), 4);
+		__m256i ymm3 = _mm256_i32gather_epi32(pTable, _mm256_cvtps_epi32(ymm5), 4);
 
-	_MM_ALIGN16 float YMM255[8] = {4095.0, 4095.0, 4095.0, 4095.0, 4095.0, 4095.0, 4095.0, 4095.0};
+		// pack to bytes, the lanes are in order pixel 0, 2, 1, 3 afterwards
+		__m256i ymm6 = _mm256_packus_epi32(ymm2, ymm3);
+		ymm6 = _mm256_packus_epi16(ymm6, ymm6);
+		ymm6 = _mm256_permutevar8x32_epi32(ymm6, ymmOrder);
+		_mm_storeu_si128((__m128i*)(pDestination + x), _mm_or_si128(_mm256_castsi256_si128(ymm6), xmmAlpha));
+	}
+	for (; x < nWidth; x++) {
+		__m128 xmm4 = _mm_max_ps(_mm_min_ps(pSource[x], _mm256_castps256_ps128(ymm1)), _mm256_castps256_ps128(ymm0));
+		__m128i xmm2 = _mm_cvtps_epi32(xmm4);
+		pDestination[x] = 0xFF000000 | (LinRGB12_sRGB8[_mm_extract_epi32(xmm2, 2)] << 16) |
+			(LinRGB12_sRGB8[_mm_extract_epi32(xmm2, 1)] << 8) | LinRGB12_sRGB8[_mm_cvtsi128_si32(xmm2)];
+	}
+}
+
+// Applies the filter in y-direction to one row of the linear light tile image, see FilterRowY_SSE_f32().
+// pRow is padded to 8 pixels.
+static void FilterRowY_AVX_f32(const void** pSourceRows, int nChannelLen, int nWidth, const AVXFilterKernel* pKernel, __m128* pRow) {
+	int nFilterLen = pKernel->FilterLen;
+	int nNumberOfBlocksX = (nWidth + 7) >> 3;
+
+	for (int x = 0; x < nNumberOfBlocksX; x++) {
+		int nOffset = x * 8;
+		__m256 ymm4 = _mm256_setzero_ps();
+		__m256 ymm5 = _mm256_setzero_ps();
+		__m256 ymm6 = _mm256_setzero_ps();
+		for (int i = 0; i < nFilterLen; i++) {
+			const float* pSource = (const float*)pSourceRows[i] + nOffset;
+			__m256 ymm7 = _mm256_broadcast_ss(&(pKernel->Kernel[i]));
+			ymm4 = _mm256_add_ps(ymm4, _mm256_mul_ps(_mm256_load_ps(pSource), ymm7));
+			ymm5 = _mm256_add_ps(ymm5, _mm256_mul_ps(_mm256_load_ps(pSource + nChannelLen), ymm7));
+			ymm6 = _mm256_add_ps(ymm6, _mm256_mul_ps(_mm256_load_ps(pSource + 2 * nChannelLen), ymm7));
+		}
+
+		// blocks of 8 B, G, R values -> 8 BGRx pixels
+		__m128 xmm0 = _mm256_castps256_ps128(ymm4);
+		__m128 xmm1 = _mm256_castps256_ps128(ymm5);
+		__m128 xmm2 = _mm256_castps256_ps128(ymm6);
+		__m128 xmm3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(xmm0, xmm1, xmm2, xmm3);
+		pRow[0] = xmm0;
+		pRow[1] = xmm1;
+		pRow[2] = xmm2;
+		pRow[3] = xmm3;
+		xmm0 = _mm256_extractf128_ps(ymm4, 1);
+		xmm1 = _mm256_extractf128_ps(ymm5, 1);
+		xmm2 = _mm256_extractf128_ps(ymm6, 1);
+		xmm3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(xmm0, xmm1, xmm2, xmm3);
+		pRow[4] = xmm0;
+		pRow[5] = xmm1;
+		pRow[6] = xmm2;
+		pRow[7] = xmm3;
+		pRow += 8;
+	}
+}
 
-	__m256 ymm0 = _mm256_setzero_ps();
-	__m256 ymm1 = *((__m256*)YMM255);
-	__m256 ymm2;
-	__m256 ymm3;
-	__m256 ymm4 = _mm256_setzero_ps();
-	__m256 ymm5 = _mm256_setzero_ps();
-	__m256 ymm6 = _mm256_setzero_ps();
-	__m256 ymm7;
+// Applies the filter in x-direction, see FilterRowXToDIB_SSE_f32(). The result is kept in linear light, one BGRx pixel per
+// __m128 in pTarget, ConvertRowToDIB_AVX() converts it to the DIB. Two filter taps (two BGRx pixels) are processed per AVX register.
+static void FilterRowX_AVX_f32(const __m128* pRow, int nTargetWidth, uint32 nStartX_FP, uint32 nIncrementX_FP, int nRowStartX,
+	AVXFilterKernel** pKernels, __m128* pTarget) {
+	uint32 nCurX = nStartX_FP;
 
-	__m256* pDestination = (__m256*)tempImage->AlignedPtr();
+	for (int x = 0; x < nTargetWidth; x++) {
+		const AVXFilterKernel* pKernel = pKernels[x];
+		int nFilterLen = pKernel->FilterLen;
+		const float* pSource = (const float*)(pRow + ((int)(nCurX >> 16) - pKernel->FilterOffset - nRowStartX));
+		__m256 ymm4 = _mm256_setzero_ps();
+		int i = 0;
+		for (; i + 1 < nFilterLen; i += 2) {
+			__m256 ymm7 = _mm256_set_m128(_mm_broadcast_ss(&(pKernel->Kernel[i + 1])), _mm_broadcast_ss(&(pKernel->Kernel[i])));
+			ymm4 = _mm256_add_ps(ymm4, _mm256_mul_ps(_mm256_loadu_ps(pSource + i * 4), ymm7));
+		}
+		__m128 xmm4 = _mm_add_ps(_mm256_castps256_ps128(ymm4), _mm256_extractf128_ps(ymm4, 1));
+		if (i < nFilterLen) {
+			xmm4 = _mm_add_ps(xmm4, _mm_mul_ps(_mm_load_ps(pSource + i * 4), _mm_broadcast_ss(&(pKernel->Kernel[i]))));
+		}
+		*pTarget++ = xmm4;
 
+		nCurX += nIncrementX_FP;
+	}
+}
+
+// Same as FilterRowY_AVX_f32() but using fused multiply-add (FMA3)
+static void FilterRowY_FMA_f32(const void** pSourceRows, int nChannelLen, int nWidth, const AVXFilterKernel* pKernel, __m128* pRow) {
+	int nFilterLen = pKernel->FilterLen;
+	int nNumberOfBlocksX = (nWidth + 7) >> 3;
+
+	for (int x = 0; x < nNumberOfBlocksX; x++) {
+		int nOffset = x * 8;
+		__m256 ymm4 = _mm256_setzero_ps();
+		__m256 ymm5 = _mm256_setzero_ps();
+		__m256 ymm6 = _mm256_setzero_ps();
+		for (int i = 0; i < nFilterLen; i++) {
+			const float* pSource = (const float*)pSourceRows[i] + nOffset;
+			__m256 ymm7 = _mm256_broadcast_ss(&(pKernel->Kernel[i]));
+			ymm4 = _mm256_fmadd_ps(_mm256_load_ps(pSource), ymm7, ymm4);
+			ymm5 = _mm256_fmadd_ps(_mm256_load_ps(pSource + nChannelLen), ymm7, ymm5);
+			ymm6 = _mm256_fmadd_ps(_mm256_load_ps(pSource + 2 * nChannelLen), ymm7, ymm6);
+		}
+
+		// blocks of 8 B, G, R values -> 8 BGRx pixels
+		__m128 xmm0 = _mm256_castps256_ps128(ymm4);
+		__m128 xmm1 = _mm256_castps256_ps128(ymm5);
+		__m128 xmm2 = _mm256_castps256_ps128(ymm6);
+		__m128 xmm3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(xmm0, xmm1, xmm2, xmm3);
+		pRow[0] = xmm0;
+		pRow[1] = xmm1;
+		pRow[2] = xmm2;
+		pRow[3] = xmm3;
+		xmm0 = _mm256_extractf128_ps(ymm4, 1);
+		xmm1 = _mm256_extractf128_ps(ymm5, 1);
+		xmm2 = _mm256_extractf128_ps(ymm6, 1);
+		xmm3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(xmm0, xmm1, xmm2, xmm3);
+		pRow[4] = xmm0;
+		pRow[5] = xmm1;
+		pRow[6] = xmm2;
+		pRow[7] = xmm3;
+		pRow += 8;
+	}
+}
+
+// Same as FilterRowY_FMA_f32() but for source rows stored as half floats, converted with F16C when loading
+static void FilterRowY_F16_f32(const void** pSourceRows, int nChannelLen, int nWidth, const AVXFilterKernel* pKernel, __m128* pRow) {
+	int nFilterLen = pKernel->FilterLen;
+	int nNumberOfBlocksX = (nWidth + 7) >> 3;
+
+	for (int x = 0; x < nNumberOfBlocksX; x++) {
+		int nOffset = x * 8;
+		__m256 ymm4 = _mm256_setzero_ps();
+		__m256 ymm5 = _mm256_setzero_ps();
+		__m256 ymm6 = _mm256_setzero_ps();
+		for (int i = 0; i < nFilterLen; i++) {
+			const uint16* pSource = (const uint16*)pSourceRows[i] + nOffset;
+			__m256 ymm7 = _mm256_broadcast_ss(&(pKernel->Kernel[i]));
+			ymm4 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_load_si128((const __m128i*)pSource)), ymm7, ymm4);
+			ymm5 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_load_si128((const __m128i*)(pSource + nChannelLen))), ymm7, ymm5);
+			ymm6 = _mm256_fmadd_ps(_mm256_cvtph_ps(_mm_load_si128((const __m128i*)(pSource + 2 * nChannelLen))), ymm7, ymm6);
+		}
+
+		// blocks of 8 B, G, R values -> 8 BGRx pixels
+		__m128 xmm0 = _mm256_castps256_ps128(ymm4);
+		__m128 xmm1 = _mm256_castps256_ps128(ymm5);
+		__m128 xmm2 = _mm256_castps256_ps128(ymm6);
+		__m128 xmm3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(xmm0, xmm1, xmm2, xmm3);
+		pRow[0] = xmm0;
+		pRow[1] = xmm1;
+		pRow[2] = xmm2;
+		pRow[3] = xmm3;
+		xmm0 = _mm256_extractf128_ps(ymm4, 1);
+		xmm1 = _mm256_extractf128_ps(ymm5, 1);
+		xmm2 = _mm256_extractf128_ps(ymm6, 1);
+		xmm3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(xmm0, xmm1, xmm2, xmm3);
+		pRow[4] = xmm0;
+		pRow[5] = xmm1;
+		pRow[6] = xmm2;
+		pRow[7] = xmm3;
+		pRow += 8;
+	}
+}
+
+// Same as FilterRowX_AVX_f32() but using fused multiply-add (FMA3)
+static void FilterRowX_FMA_f32(const __m128* pRow, int nTargetWidth, uint32 nStartX_FP, uint32 nIncrementX_FP, int nRowStartX,
+	AVXFilterKernel** pKernels, __m128* pTarget) {
+	uint32 nCurX = nStartX_FP;
+
+	for (int x = 0; x < nTargetWidth; x++) {
+		const AVXFilterKernel* pKernel = pKernels[x];
+		int nFilterLen = pKernel->FilterLen;
+		const float* pSource = (const float*)(pRow + ((int)(nCurX >> 16) - pKernel->FilterOffset - nRowStartX));
+		__m256 ymm4 = _mm256_setzero_ps();
+		int i = 0;
+		for (; i + 1 < nFilterLen; i += 2) {
+			__m256 ymm7 = _mm256_set_m128(_mm_broadcast_ss(&(pKernel->Kernel[i + 1])), _mm_broadcast_ss(&(pKernel->Kernel[i])));
+			ymm4 = _mm256_fmadd_ps(_mm256_loadu_ps(pSource + i * 4), ymm7, ymm4);
+		}
+		__m128 xmm4 = _mm_add_ps(_mm256_castps256_ps128(ymm4), _mm256_extractf128_ps(ymm4, 1));
+		if (i < nFilterLen) {
+			xmm4 = _mm_fmadd_ps(_mm_load_ps(pSource + i * 4), _mm_broadcast_ss(&(pKernel->Kernel[i])), xmm4);
+		}
+		*pTarget++ = xmm4;
+
+		nCurX += nIncrementX_FP;
+	}
+}
+
+typedef void (*FilterRowYProc)(const void** pSourceRows, int nChannelLen, int nWidth, const AVXFilterKernel* pKernel, __m128* pRow);
+typedef void (*FilterRowXProc)(const __m128* pRow, int nTargetWidth, uint32 nStartX_FP, uint32 nIncrementX_FP, int nRowStartX,
+	AVXFilterKernel** pKernels, __m128* pTarget);
+
+bool ResampleFused_AVX_f32(int nTargetWidth, int nTargetHeight,
+	uint32 nStartX_FP, uint32 nStartY_FP, uint32 nIncrementX_FP, uint32 nIncrementY_FP,
+	const AVXFilterKernelBlock& filterX, const AVXFilterKernelBlock& filterY, int nFilterOffsetX, int nFilterOffsetY,
+	CSize sourceSize, const void* pPixels, int nChannels, int nFirstX, int nLastX, int nFirstY, int nLastY,
+	uint8* pTarget, int nTargetStride, double& dConvertTime, double& dFilterTime, CBasicProcessing::SIMDArchitecture simd, bool bHalfFloat) {
+
+	// The row filters are selected once, the driver below is the same for all AVX variants.
+	// Half float source rows are only supported with FMA and AVX-512, the conversions need F16C.
+	bHalfFloat = bHalfFloat && simd != CBasicProcessing::AVX2 && Helpers::CPUSupportsF16C();
+	FilterRowYProc pFilterRowY = FilterRowY_AVX_f32;
+	FilterRowXProc pFilterRowX = FilterRowX_AVX_f32;
+	int nPadding = 8;
+	if (simd == CBasicProcessing::AVX2_FMA) {
+		pFilterRowY = bHalfFloat ? FilterRowY_F16_f32 : FilterRowY_FMA_f32;
+		pFilterRowX = FilterRowX_FMA_f32;
+	} else if (simd == CBasicProcessing::AVX512) {
+		pFilterRowY = bHalfFloat ? FilterRowY_AVX512_f16 : FilterRowY_AVX512_f32;
+		pFilterRowX = FilterRowX_AVX512_f32;
+		nPadding = 16;
+	}
+	int nElementSize = bHalfFloat ? (int)sizeof(uint16) : (int)sizeof(float);
+
+	int nSectionWidth = nLastX - nFirstX + 1;
+	int nSectionHeight = nLastY - nFirstY + 1;
+	AVXFilterKernel** pKernelsX = filterX.Indices + nFilterOffsetX;
+	AVXFilterKernel** pKernelsY = filterY.Indices + nFilterOffsetY;
+
+	// The ring buffer holds the source rows of the longest kernel in y-direction
+	int nRingRows = 1;
 	for (int y = 0; y < nTargetHeight; y++) {
-		uint32 nCurYInt = (uint32)nCurY >> 16; // integer part of Y
-		int filterIndex = y + nFilterOffset;
-		AVXFilterKernel* pKernel = pKernelIndexStart[filterIndex];
-		int filterLen = pKernel->FilterLen;
-		int filterOffset = pKernel->FilterOffset;
-		const __m256* pFilterStart = (__m256*)&(pKernel->Kernel);
-		const __m256* pSourceRow = (const __m256*)(pSourceStart + ((int)nCurYInt - filterOffset) * nRowLenBytes);
-
-		for (int x = 0; x < nNumberOfBlocksX; x++) {
-			const __m256* pSource = pSourceRow;
-			const __m256* pFilter = pFilterStart;
-			ymm4 = _mm256_setzero_ps();
-			ymm5 = _mm256_setzero_ps();
-			ymm6 = _mm256_setzero_ps();
-			for (int i = 0; i < filterLen; i++) {
-				ymm7 = *pFilter;
-
-				// the pixel data RED channel
-				ymm2 = *pSource;
-				ymm2 = _mm256_mul_ps(ymm2, ymm7);
-				ymm4 = _mm256_add_ps(ymm4, ymm2);
-				pSource = (__m256*)((uint8*)pSource + nChannelLenBytes);
-
-				// the pixel data GREEN channel
-				ymm3 = *pSource;
-				ymm3 = _mm256_mul_ps(ymm2, ymm7);
-				ymm5 = _mm256_add_ps(ymm5, ymm3);
-				pSource = (__m256*)((uint8*)pSource + nChannelLenBytes);
-
-				// the pixel data BLUE channel
-				ymm2 = *pSource;
-				ymm2 = _mm256_mul_ps(ymm2, ymm7);
-				ymm6 = _mm256_add_ps(ymm6, ymm2);
-				pSource = (__m256*)((uint8*)pSource + nChannelLenBytes);
-
-				pFilter++;
-			}
+		nRingRows = max(nRingRows, pKernelsY[y]->FilterLen);
+	}
+	nRingRows = min(nRingRows, nSectionHeight);
 
-			if (bRoundResult == true) {
-				// limit to range <=255 (in ymm1)
-				ymm4 = _mm256_min_ps(ymm4, ymm1);
-				ymm5 = _mm256_min_ps(ymm5, ymm1);
-				ymm6 = _mm256_min_ps(ymm6, ymm1);
-
-				// limit to range >=0 (in ymm0)
-				ymm4 = _mm256_max_ps(ymm4, ymm0);
-				ymm5 = _mm256_max_ps(ymm5, ymm0);
-				ymm6 = _mm256_max_ps(ymm6, ymm0);
-
-				// round to nearest integer
-				ymm4 = _mm256_round_ps(ymm4, _MM_FROUND_TO_NEAREST_INT);
-				ymm5 = _mm256_round_ps(ymm5, _MM_FROUND_TO_NEAREST_INT);
-				ymm6 = _mm256_round_ps(ymm6, _MM_FROUND_TO_NEAREST_INT);
-				}
+	int nTileSourceWidth = max(64, FUSED_TILE_SOURCE_BYTES / (nRingRows * 3 * nElementSize));
+	int nTileWidth = (int)min((double)nTargetWidth, max(16.0, (double)nTileSourceWidth * nTargetWidth / nSectionWidth));
+	nTileWidth = (nTileWidth < nTargetWidth) ? (nTileWidth & ~(nPadding - 1)) : nTargetWidth;
+	int nNumTiles = (nTargetWidth + nTileWidth - 1) / nTileWidth;
+
+	int nMaxTileSourceWidth = 1;
+	for (int nTile = 0; nTile < nNumTiles; nTile++) {
+		int nTileX = nTile * nTileWidth;
+		int nFirst, nLast;
+		GetSourceRange_AVX_f32(pKernelsX + nTileX, nStartX_FP + nTileX * nIncrementX_FP, nIncrementX_FP,
+			min(nTileWidth, nTargetWidth - nTileX), nSectionWidth - 1, nFirst, nLast);
+		nMaxTileSourceWidth = max(nMaxTileSourceWidth, nLast - nFirst + 1);
+	}
+
+	CFloatImage* pRingImage = new CFloatImage(nMaxTileSourceWidth, nRingRows, nPadding, bHalfFloat);
+	if (pRingImage->AlignedPtr() == NULL) {
+		delete pRingImage;
+		return false;
+	}
+	__m128* pRow = new(std::nothrow) __m128[Helpers::DoPadding(nMaxTileSourceWidth, nPadding)];
+	__m128* pTargetPixels = new(std::nothrow) __m128[nTileWidth];
+	const CYCbCrImage* pYCbCrImage = (nChannels == YCBCR_IMAGE_CHANNELS) ? (const CYCbCrImage*)pPixels : NULL;
+	uint8* pBGRRow = (pYCbCrImage != NULL) ? new(std::nothrow) uint8[nMaxTileSourceWidth * 3] : NULL;
+	if (pRow == NULL || pTargetPixels == NULL || (pYCbCrImage != NULL && pBGRRow == NULL)) {
+		delete[] pRow;
+		delete[] pTargetPixels;
+		delete[] pBGRRow;
+		delete pRingImage;
+		return false;
+	}
+	int nSourceStride = Helpers::DoPadding(sourceSize.cx * nChannels, 4);
+	int nChannelLen = pRingImage->GetPaddedWidth();
+	uint8* pRingStart = (uint8*)pRingImage->AlignedPtr();
+	const void* pSourceRows[MAX_FILTER_LEN];
+
+	for (int nTile = 0; nTile < nNumTiles; nTile++) {
+		int nTileX = nTile * nTileWidth;
+		int nCurTileWidth = min(nTileWidth, nTargetWidth - nTileX);
+		uint32 nTileStartX_FP = nStartX_FP + nTileX * nIncrementX_FP;
+		int nFirst, nLast;
+		GetSourceRange_AVX_f32(pKernelsX + nTileX, nTileStartX_FP, nIncrementX_FP, nCurTileWidth, nSectionWidth - 1, nFirst, nLast);
 
-			// store result in blocks
-			*pDestination++ = ymm4;
-			*pDestination++ = ymm5;
-			*pDestination++ = ymm6;
+		double t1 = Helpers::GetExactTickCount();
+		double dTileConvertTime = 0.0;
+		int nNextRow = 0; // next row of the source section to convert into the ring buffer
+		uint32 nCurY = nStartY_FP;
+		uint8* pTargetRow = pTarget + nTileX * 4;
+		for (int y = 0; y < nTargetHeight; y++) {
+			const AVXFilterKernel* pKernel = pKernelsY[y];
+			int nRowStart = (int)(nCurY >> 16) - pKernel->FilterOffset;
+			int nRowEnd = nRowStart + pKernel->FilterLen;
+			// Kernel windows only move downwards, rows skipped by the windows are never converted
+			nNextRow = max(nNextRow, nRowStart);
+			if (nNextRow < nRowEnd) {
+				double t2 = Helpers::GetExactTickCount();
+				for (; nNextRow < nRowEnd; nNextRow++) {
+					const uint8* pSourceRow;
+					if (pYCbCrImage != NULL) {
+						pYCbCrImage->ConvertRowToBGR(nFirstY + nNextRow, nFirstX + nFirst, nFirstX + nLast, pBGRRow);
+						pSourceRow = pBGRRow;
+					} else {
+						pSourceRow = (const uint8*)pPixels + (long long)(nFirstY + nNextRow) * nSourceStride + (long long)(nFirstX + nFirst) * nChannels;
+					}
+					ConvertRowFromDIB_AVX(pSourceRow, (pYCbCrImage != NULL) ? 3 : nChannels, nLast - nFirst + 1,
+						pRingStart + (nNextRow % nRingRows) * 3 * nChannelLen * nElementSize, nChannelLen, bHalfFloat);
+				}
+				dTileConvertTime += Helpers::GetExactTickCount() - t2;
+			}
+			for (int i = 0; i < pKernel->FilterLen; i++) {
+				pSourceRows[i] = pRingStart + ((nRowStart + i) % nRingRows) * 3 * nChannelLen * nElementSize;
+			}
+			pFilterRowY(pSourceRows, nChannelLen, nLast - nFirst + 1, pKernel, pRow);
+			pFilterRowX(pRow, nCurTileWidth, nTileStartX_FP, nIncrementX_FP, nFirst, pKernelsX + nTileX, pTargetPixels);
+			ConvertRowToDIB_AVX(pTargetPixels, nCurTileWidth, pTargetRow);
+			pTargetRow += nTargetStride;
+			nCurY += nIncrementY_FP;
+		}
 
-			pSourceRow++;
-		};
+		dConvertTime += dTileConvertTime;
+		dFilterTime += Helpers::GetExactTickCount() - t1 - dTileConvertTime;
+	}
 
-		nCurY += nIncrementY_FP;
-	};
+	delete[] pRow;
+	delete[] pTargetPixels;
+	delete[] pBGRRow;
+	delete pRingImage;
 
-	return tempImage;
+	return true;
 }
 
-#endif
\ No newline at end of file
+#endif
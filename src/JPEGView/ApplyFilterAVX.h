@@ -3,9 +3,13 @@
 class CFloatImage;
 struct AVXFilterKernelBlock;
 
-// Used by BasicProcessing.cpp: Applies a filter using AVX. Own compilation unit to be able to compile this with AVX compiler flag.
+// Used by BasicProcessing.cpp: Resamples a strip using AVX. Own compilation unit to be able to compile this with AVX compiler flag.
+// See ResampleFused_SSE_f32() in BasicProcessing.cpp for the description of the parameters.
+// simd selects the row filters: AVX2 (multiply and add), AVX2_FMA (fused multiply-add) or AVX512 (see ApplyFilterAVX512.h)
+// bHalfFloat: Store the linear light source rows as half floats, ignored for AVX2
 
-CFloatImage* ApplyFilter_AVX_f32(int nSourceHeight, int nTargetHeight, int nWidth,
-	int nStartY_FP, int nStartX, int nIncrementY_FP,
-	const AVXFilterKernelBlock& filter,
-	int nFilterOffset, const CFloatImage* pSourceImg, bool bRoundResult);
+bool ResampleFused_AVX_f32(int nTargetWidth, int nTargetHeight,
+	uint32 nStartX_FP, uint32 nStartY_FP, uint32 nIncrementX_FP, uint32 nIncrementY_FP,
+	const AVXFilterKernelBlock& filterX, const AVXFilterKernelBlock& filterY, int nFilterOffsetX, int nFilterOffsetY,
+	CSize sourceSize, const void* pPixels, int nChannels, int nFirstX, int nLastX, int nFirstY, int nLastY,
+	uint8* pTarget, int nTargetStride, double& dConvertTime, double& dFilterTime, CBasicProcessing::SIMDArchitecture simd, bool bHalfFloat);
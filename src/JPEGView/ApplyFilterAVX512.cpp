@@ -0,0 +1,130 @@
+#include "StdAfx.h"
+#include "ResizeFilter.h"
+#include "Helpers.h"
+#include "ApplyFilterAVX512.h"
+
+#ifdef _WIN64
+
+// Applies the filter in y-direction to one row of 16 pixel blocks, see FilterRowY_SSE_f32().
+void FilterRowY_AVX512_f32(const void** pSourceRows, int nChannelLen, int nWidth, const AVXFilterKernel* pKernel, __m128* pRow) {
+	int nFilterLen = pKernel->FilterLen;
+	int nNumberOfBlocksX = (nWidth + 15) >> 4;
+	const __m512 zmm3 = _mm512_setzero_ps();
+	float* pDest = (float*)pRow;
+
+	for (int x = 0; x < nNumberOfBlocksX; x++) {
+		int nOffset = x * 16;
+		__m512 zmm4 = _mm512_setzero_ps();
+		__m512 zmm5 = _mm512_setzero_ps();
+		__m512 zmm6 = _mm512_setzero_ps();
+		for (int i = 0; i < nFilterLen; i++) {
+			const float* pSource = (const float*)pSourceRows[i] + nOffset;
+			__m512 zmm7 = _mm512_set1_ps(pKernel->Kernel[i]);
+			zmm4 = _mm512_fmadd_ps(_mm512_load_ps(pSource), zmm7, zmm4);
+			zmm5 = _mm512_fmadd_ps(_mm512_load_ps(pSource + nChannelLen), zmm7, zmm5);
+			zmm6 = _mm512_fmadd_ps(_mm512_load_ps(pSource + 2 * nChannelLen), zmm7, zmm6);
+		}
+
+		// blocks of 16 B, G, R values -> 16 BGRx pixels
+		// within each 128 bit lane l, zmm0..zmm3 get the pixels 4*l + 0..3
+		__m512 zmm0 = _mm512_unpacklo_ps(zmm4, zmm5); // B0 G0 B1 G1
+		__m512 zmm1 = _mm512_unpackhi_ps(zmm4, zmm5); // B2 G2 B3 G3
+		__m512 zmm2 = _mm512_unpacklo_ps(zmm6, zmm3); // R0 0 R1 0
+		__m512 zmm7 = _mm512_unpackhi_ps(zmm6, zmm3); // R2 0 R3 0
+		__m512 zmmP0 = _mm512_shuffle_ps(zmm0, zmm2, _MM_SHUFFLE(1, 0, 1, 0));
+		__m512 zmmP1 = _mm512_shuffle_ps(zmm0, zmm2, _MM_SHUFFLE(3, 2, 3, 2));
+		__m512 zmmP2 = _mm512_shuffle_ps(zmm1, zmm7, _MM_SHUFFLE(1, 0, 1, 0));
+		__m512 zmmP3 = _mm512_shuffle_ps(zmm1, zmm7, _MM_SHUFFLE(3, 2, 3, 2));
+
+		// transpose the 4x4 block of 128 bit lanes to get the pixels in order
+		zmm0 = _mm512_shuffle_f32x4(zmmP0, zmmP1, _MM_SHUFFLE(1, 0, 1, 0));
+		zmm1 = _mm512_shuffle_f32x4(zmmP2, zmmP3, _MM_SHUFFLE(1, 0, 1, 0));
+		zmm2 = _mm512_shuffle_f32x4(zmmP0, zmmP1, _MM_SHUFFLE(3, 2, 3, 2));
+		zmm7 = _mm512_shuffle_f32x4(zmmP2, zmmP3, _MM_SHUFFLE(3, 2, 3, 2));
+		_mm512_storeu_ps(pDest, _mm512_shuffle_f32x4(zmm0, zmm1, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm512_storeu_ps(pDest + 16, _mm512_shuffle_f32x4(zmm0, zmm1, _MM_SHUFFLE(3, 1, 3, 1)));
+		_mm512_storeu_ps(pDest + 32, _mm512_shuffle_f32x4(zmm2, zmm7, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm512_storeu_ps(pDest + 48, _mm512_shuffle_f32x4(zmm2, zmm7, _MM_SHUFFLE(3, 1, 3, 1)));
+		pDest += 64;
+	}
+}
+
+// Same as FilterRowY_AVX512_f32() but for source rows stored as half floats
+void FilterRowY_AVX512_f16(const void** pSourceRows, int nChannelLen, int nWidth, const AVXFilterKernel* pKernel, __m128* pRow) {
+	int nFilterLen = pKernel->FilterLen;
+	int nNumberOfBlocksX = (nWidth + 15) >> 4;
+	const __m512 zmm3 = _mm512_setzero_ps();
+	float* pDest = (float*)pRow;
+
+	for (int x = 0; x < nNumberOfBlocksX; x++) {
+		int nOffset = x * 16;
+		__m512 zmm4 = _mm512_setzero_ps();
+		__m512 zmm5 = _mm512_setzero_ps();
+		__m512 zmm6 = _mm512_setzero_ps();
+		for (int i = 0; i < nFilterLen; i++) {
+			const uint16* pSource = (const uint16*)pSourceRows[i] + nOffset;
+			__m512 zmm7 = _mm512_set1_ps(pKernel->Kernel[i]);
+			zmm4 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_load_si256((const __m256i*)pSource)), zmm7, zmm4);
+			zmm5 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_load_si256((const __m256i*)(pSource + nChannelLen))), zmm7, zmm5);
+			zmm6 = _mm512_fmadd_ps(_mm512_cvtph_ps(_mm256_load_si256((const __m256i*)(pSource + 2 * nChannelLen))), zmm7, zmm6);
+		}
+
+		// blocks of 16 B, G, R values -> 16 BGRx pixels
+		// within each 128 bit lane l, zmm0..zmm3 get the pixels 4*l + 0..3
+		__m512 zmm0 = _mm512_unpacklo_ps(zmm4, zmm5); // B0 G0 B1 G1
+		__m512 zmm1 = _mm512_unpackhi_ps(zmm4, zmm5); // B2 G2 B3 G3
+		__m512 zmm2 = _mm512_unpacklo_ps(zmm6, zmm3); // R0 0 R1 0
+		__m512 zmm7 = _mm512_unpackhi_ps(zmm6, zmm3); // R2 0 R3 0
+		__m512 zmmP0 = _mm512_shuffle_ps(zmm0, zmm2, _MM_SHUFFLE(1, 0, 1, 0));
+		__m512 zmmP1 = _mm512_shuffle_ps(zmm0, zmm2, _MM_SHUFFLE(3, 2, 3, 2));
+		__m512 zmmP2 = _mm512_shuffle_ps(zmm1, zmm7, _MM_SHUFFLE(1, 0, 1, 0));
+		__m512 zmmP3 = _mm512_shuffle_ps(zmm1, zmm7, _MM_SHUFFLE(3, 2, 3, 2));
+
+		// transpose the 4x4 block of 128 bit lanes to get the pixels in order
+		zmm0 = _mm512_shuffle_f32x4(zmmP0, zmmP1, _MM_SHUFFLE(1, 0, 1, 0));
+		zmm1 = _mm512_shuffle_f32x4(zmmP2, zmmP3, _MM_SHUFFLE(1, 0, 1, 0));
+		zmm2 = _mm512_shuffle_f32x4(zmmP0, zmmP1, _MM_SHUFFLE(3, 2, 3, 2));
+		zmm7 = _mm512_shuffle_f32x4(zmmP2, zmmP3, _MM_SHUFFLE(3, 2, 3, 2));
+		_mm512_storeu_ps(pDest, _mm512_shuffle_f32x4(zmm0, zmm1, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm512_storeu_ps(pDest + 16, _mm512_shuffle_f32x4(zmm0, zmm1, _MM_SHUFFLE(3, 1, 3, 1)));
+		_mm512_storeu_ps(pDest + 32, _mm512_shuffle_f32x4(zmm2, zmm7, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm512_storeu_ps(pDest + 48, _mm512_shuffle_f32x4(zmm2, zmm7, _MM_SHUFFLE(3, 1, 3, 1)));
+		pDest += 64;
+	}
+}
+
+// Applies the filter in x-direction, see FilterRowX_AVX_f32() in ApplyFilterAVX.cpp.
+// Four filter taps (four BGRx pixels) are processed per AVX-512 register.
+void FilterRowX_AVX512_f32(const __m128* pRow, int nTargetWidth, uint32 nStartX_FP, uint32 nIncrementX_FP, int nRowStartX,
+	AVXFilterKernel** pKernels, __m128* pTarget) {
+	const __m512i zmm3 = _mm512_set_epi32(3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0);
+	uint32 nCurX = nStartX_FP;
+
+	for (int x = 0; x < nTargetWidth; x++) {
+		const AVXFilterKernel* pKernel = pKernels[x];
+		int nFilterLen = pKernel->FilterLen;
+		const float* pSource = (const float*)(pRow + ((int)(nCurX >> 16) - pKernel->FilterOffset - nRowStartX));
+		__m512 zmm4 = _mm512_setzero_ps();
+		int i = 0;
+		for (; i + 3 < nFilterLen; i += 4) {
+			// broadcast each of the 4 kernel elements to one 128 bit lane
+			__m512 zmm7 = _mm512_permutexvar_ps(zmm3, _mm512_castps128_ps512(_mm_loadu_ps(&(pKernel->Kernel[i]))));
+			zmm4 = _mm512_fmadd_ps(_mm512_loadu_ps(pSource + i * 4), zmm7, zmm4);
+		}
+		__m256 ymm4 = _mm256_add_ps(_mm512_castps512_ps256(zmm4), _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(zmm4), 1)));
+		if (i + 1 < nFilterLen) {
+			__m256 ymm7 = _mm256_set_m128(_mm_broadcast_ss(&(pKernel->Kernel[i + 1])), _mm_broadcast_ss(&(pKernel->Kernel[i])));
+			ymm4 = _mm256_fmadd_ps(_mm256_loadu_ps(pSource + i * 4), ymm7, ymm4);
+			i += 2;
+		}
+		__m128 xmm4 = _mm_add_ps(_mm256_castps256_ps128(ymm4), _mm256_extractf128_ps(ymm4, 1));
+		if (i < nFilterLen) {
+			xmm4 = _mm_fmadd_ps(_mm_load_ps(pSource + i * 4), _mm_broadcast_ss(&(pKernel->Kernel[i])), xmm4);
+		}
+		*pTarget++ = xmm4;
+
+		nCurX += nIncrementX_FP;
+	}
+}
+
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <immintrin.h>
+
+struct AVXFilterKernel;
+
+// Used by ApplyFilterAVX.cpp: Row filters of the fused resampler using AVX-512F. Own compilation unit to be able to compile
+// this with AVX-512 compiler flag. The kernels of the AVX filter are used. See FilterRowY_SSE_f32() and FilterRowXToDIB_SSE_f32()
+// in BasicProcessing.cpp for the description of the parameters. The ring buffer and pRow must be padded to 16 pixels.
+
+void FilterRowY_AVX512_f32(const void** pSourceRows, int nChannelLen, int nWidth, const AVXFilterKernel* pKernel, __m128* pRow);
+
+// As above, for source rows stored as half floats
+void FilterRowY_AVX512_f16(const void** pSourceRows, int nChannelLen, int nWidth, const AVXFilterKernel* pKernel, __m128* pRow);
+
+// Writes linear light BGRx pixels to pTarget, one per __m128
+void FilterRowX_AVX512_f32(const __m128* pRow, int nTargetWidth, uint32 nStartX_FP, uint32 nIncrementX_FP, int nRowStartX,
+	AVXFilterKernel** pKernels, __m128* pTarget);
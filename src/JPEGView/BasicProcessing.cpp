@@ -5,6 +5,7 @@
 #include "Helpers.h"
 #include "WorkThread.h"
 #include "ProcessingThreadPool.h"
+#include "YCbCrImage.h"
 #ifdef _WIN64
 #include "ApplyFilterAVX.h"
 #endif
@@ -30,10 +31,11 @@ static TCHAR s_TimingInfo[256];
 /////////////////////////////////////////////////////////////////////////////////////////////
 
 // Used in ProcessStrip()
-static void* SampleDown_SSE_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pIJLPixels, int nChannels, EFilterType eFilter, uint8* pTarget);
-static void* SampleDown_AVX_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pIJLPixels, int nChannels, EFilterType eFilter, uint8* pTarget);
-static void* SampleUp_SSE_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pIJLPixels, int nChannels, uint8* pTarget);
-static void* SampleUp_AVX_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pIJLPixels, int nChannels, uint8* pTarget);
+static void* SampleDown_SSE_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pIJLPixels, int nChannels, EFilterType eFilter, uint8* pTarget, int nTargetStride);
+static void* SampleDown_AVX_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pIJLPixels, int nChannels, EFilterType eFilter, uint8* pTarget, int nTargetStride, CBasicProcessing::SIMDArchitecture simd, bool bHalfFloat);
+static void* SampleUp_SSE_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pIJLPixels, int nChannels, uint8* pTarget, int nTargetStride);
+static void* SampleUp_AVX_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pIJLPixels, int nChannels, uint8* pTarget, int nTargetStride, CBasicProcessing::SIMDArchitecture simd, bool bHalfFloat);
+static bool ReduceBox_Core(int nWidth, int nHeight, const void* pPixels, int nChannels, int nFactor, int nFirstTargetRow, int nTargetRows, uint32* pTarget);
 
 //---------------------------------------------------------------------------------------------
 
@@ -42,36 +44,68 @@ class CRequestUpDownSampling : public CProcessingRequest {
 public:
 	CRequestUpDownSampling(const void* pSourcePixels, CSize sourceSize, void* pTargetPixels,
 		CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
-		int nChannels, EFilterType eFilter, CBasicProcessing::SIMDArchitecture simd)
+		int nChannels, EFilterType eFilter, CBasicProcessing::SIMDArchitecture simd, bool bHalfFloat)
 		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, fullTargetSize, fullTargetOffset, clippedTargetSize) {
 		Channels = nChannels;
 		Filter = eFilter;
 		SIMD = simd;
+		HalfFloat = bHalfFloat;
 		//StripPadding = (simd == CBasicProcessing::AVX2) ? 16 : 8; // important to set for AVX
-		StripPadding = (simd == CBasicProcessing::AVX2) ? 8 : 4; // All slices must have a height dividable by 'StripPadding', except the last one
+		StripPadding = (simd == CBasicProcessing::SSE) ? 4 : 8; // All slices must have a height dividable by 'StripPadding', except the last one
+		// Tiles have a width dividable by the pixels per block of the SIMD row filters, except the last one
+		TilePaddingX = (simd == CBasicProcessing::SSE) ? 4 : (simd == CBasicProcessing::AVX512) ? 16 : 8;
 	}
 
 	virtual bool ProcessStrip(int offsetY, int sizeY)
 		{
+		return ProcessTile(0, offsetY, ClippedTargetSize.cx, sizeY);
+		}
+
+	virtual bool ProcessTile(int offsetX, int offsetY, int sizeX, int sizeY)
+		{
+		CPoint tileOffset(FullTargetOffset.x + offsetX, FullTargetOffset.y + offsetY);
+		int nStride = ClippedTargetSize.cx * 4;
+		uint8* pTarget = (uint8*)TargetPixels + nStride * offsetY + offsetX * 4;
 		if (Filter == Filter_Upsampling_Bicubic)
 			{
-			if (SIMD == CBasicProcessing::AVX2)
-				return NULL != SampleUp_AVX_Core_f32(FullTargetSize, CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY), CSize(ClippedTargetSize.cx, sizeY), SourceSize, SourcePixels, Channels, (uint8*)TargetPixels + ClippedTargetSize.cx * 4 * offsetY);
+			if (SIMD != CBasicProcessing::SSE)
+				return NULL != SampleUp_AVX_Core_f32(FullTargetSize, tileOffset, CSize(sizeX, sizeY), SourceSize, SourcePixels, Channels, pTarget, nStride, SIMD, HalfFloat);
 			else
-				return NULL != SampleUp_SSE_Core_f32(FullTargetSize, CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY), CSize(ClippedTargetSize.cx, sizeY), SourceSize, SourcePixels, Channels, (uint8*)TargetPixels + ClippedTargetSize.cx * 4 * offsetY);
+				return NULL != SampleUp_SSE_Core_f32(FullTargetSize, tileOffset, CSize(sizeX, sizeY), SourceSize, SourcePixels, Channels, pTarget, nStride);
 			}
 		else
 			{
-			if (SIMD == CBasicProcessing::AVX2)
-				return NULL != SampleDown_AVX_Core_f32(FullTargetSize, CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY), CSize(ClippedTargetSize.cx, sizeY), SourceSize, SourcePixels, Channels, Filter, (uint8*)TargetPixels + ClippedTargetSize.cx * 4 * offsetY);
+			if (SIMD != CBasicProcessing::SSE)
+				return NULL != SampleDown_AVX_Core_f32(FullTargetSize, tileOffset, CSize(sizeX, sizeY), SourceSize, SourcePixels, Channels, Filter, pTarget, nStride, SIMD, HalfFloat);
 			else
-				return NULL != SampleDown_SSE_Core_f32(FullTargetSize, CPoint(FullTargetOffset.x, FullTargetOffset.y + offsetY), CSize(ClippedTargetSize.cx, sizeY), SourceSize, SourcePixels, Channels, Filter, (uint8*)TargetPixels + ClippedTargetSize.cx * 4 * offsetY);
+				return NULL != SampleDown_SSE_Core_f32(FullTargetSize, tileOffset, CSize(sizeX, sizeY), SourceSize, SourcePixels, Channels, Filter, pTarget, nStride);
 			}
 		}
 
 	int Channels;
 	EFilterType Filter;
 	CBasicProcessing::SIMDArchitecture SIMD;
+	bool HalfFloat;
+};
+
+// Request for reducing an image by averaging nFactor x nFactor blocks, processed in strips of target rows
+class CRequestReduceBox : public CProcessingRequest {
+public:
+	CRequestReduceBox(const void* pSourcePixels, CSize sourceSize, void* pTargetPixels, CSize targetSize,
+		int nChannels, int nFactor)
+		: CProcessingRequest(pSourcePixels, sourceSize, pTargetPixels, targetSize, CPoint(0, 0), targetSize) {
+		Channels = nChannels;
+		Factor = nFactor;
+		StripPadding = 1; // each target row only depends on its own block of source rows
+	}
+
+	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		uint32* pTarget = (uint32*)TargetPixels + (__int64)offsetY * ClippedTargetSize.cx;
+		return ReduceBox_Core(SourceSize.cx, SourceSize.cy, SourcePixels, Channels, Factor, offsetY, sizeY, pTarget);
+	}
+
+	int Channels;
+	int Factor;
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -203,6 +237,83 @@ void CBasicProcessing::MirrorVInplace(int nWidth, int nHeight, int nStride, void
 	}
 }
 
+void* CBasicProcessing::ReduceBox(int nWidth, int nHeight, const void* pPixels, int nChannels, int nFactor) {
+	if ((nChannels != 3 && nChannels != 4 && nChannels != YCBCR_IMAGE_CHANNELS) || nFactor < 1) {
+		return NULL;
+	}
+	int nTargetWidth = (nWidth + nFactor - 1) / nFactor;
+	int nTargetHeight = (nHeight + nFactor - 1) / nFactor;
+	uint32* pTarget = new(std::nothrow) uint32[nTargetWidth * nTargetHeight];
+	if (pTarget == NULL) {
+		return NULL;
+	}
+	CRequestReduceBox request(pPixels, CSize(nWidth, nHeight), pTarget, CSize(nTargetWidth, nTargetHeight), nChannels, nFactor);
+	if (!CProcessingThreadPool::This().Process(&request)) {
+		// failed or cancelled
+		delete[] pTarget;
+		return NULL;
+	}
+	return pTarget;
+}
+
+// Reduces the target rows nFirstTargetRow to nFirstTargetRow + nTargetRows - 1, see CBasicProcessing::ReduceBox()
+static bool ReduceBox_Core(int nWidth, int nHeight, const void* pPixels, int nChannels, int nFactor, int nFirstTargetRow, int nTargetRows, uint32* pTarget) {
+	const CYCbCrImage* pYCbCrImage = (nChannels == YCBCR_IMAGE_CHANNELS) ? (const CYCbCrImage*)pPixels : NULL;
+	int nTargetWidth = (nWidth + nFactor - 1) / nFactor;
+	// sums of the linear light values of the blocks in one target row, 64 bit for blocks of more than 2^20 pixels
+	unsigned __int64* pSums = new(std::nothrow) unsigned __int64[nTargetWidth * 3];
+	// YCbCr rows are converted one by one to BGR, the planes are never converted as a whole
+	uint8* pBGRRow = (pYCbCrImage != NULL) ? new(std::nothrow) uint8[nWidth * 3] : NULL;
+	if (pSums == NULL || (pYCbCrImage != NULL && pBGRRow == NULL)) {
+		delete[] pSums;
+		delete[] pBGRRow;
+		return false;
+	}
+	int nPixelSize = (pYCbCrImage != NULL) ? 3 : nChannels;
+	int nStride = Helpers::DoPadding(nWidth * nChannels, 4);
+	uint32* pTgt = pTarget;
+	for (int j = nFirstTargetRow; j < nFirstTargetRow + nTargetRows; j++) {
+		// the blocks of the last row and column are smaller if the size is not a multiple of nFactor
+		int nFirstRow = j * nFactor;
+		int nLastRow = min(nHeight, nFirstRow + nFactor);
+		memset(pSums, 0, nTargetWidth * 3 * sizeof(unsigned __int64));
+		for (int y = nFirstRow; y < nLastRow; y++) {
+			const uint8* pRow;
+			if (pYCbCrImage != NULL) {
+				pYCbCrImage->ConvertRowToBGR(y, 0, nWidth - 1, pBGRRow);
+				pRow = pBGRRow;
+			} else {
+				pRow = (const uint8*)pPixels + (__int64)y * nStride;
+			}
+			for (int i = 0; i < nTargetWidth; i++) {
+				const uint8* pPixel = pRow + i * nFactor * nPixelSize;
+				const uint8* pEnd = pRow + min(nWidth, (i + 1) * nFactor) * nPixelSize;
+				uint32 nB = 0, nG = 0, nR = 0;
+				for (; pPixel < pEnd; pPixel += nPixelSize) {
+					nB += sRGB8_LinRGB12[pPixel[0]];
+					nG += sRGB8_LinRGB12[pPixel[1]];
+					nR += sRGB8_LinRGB12[pPixel[2]];
+				}
+				pSums[3 * i] += nB;
+				pSums[3 * i + 1] += nG;
+				pSums[3 * i + 2] += nR;
+			}
+		}
+		for (int i = 0; i < nTargetWidth; i++) {
+			// average in linear light, rounded
+			unsigned __int64 nCount = (unsigned __int64)(nLastRow - nFirstRow) * (min(nWidth, (i + 1) * nFactor) - i * nFactor);
+			uint32 nPixel = ALPHA_OPAQUE;
+			for (int c = 0; c < 3; c++) {
+				nPixel |= LinRGB12_sRGB8[(pSums[3 * i + c] + nCount / 2) / nCount] << (c * 8);
+			}
+			*pTgt++ = nPixel;
+		}
+	}
+	delete[] pSums;
+	delete[] pBGRRow;
+	return true;
+}
+
 void* CBasicProcessing::Convert8bppTo32bppDIB(int nWidth, int nHeight, const void* pDIBPixels, const uint8* pPalette) {
 	if (pDIBPixels == NULL || pPalette == NULL) {
 		return NULL;
@@ -357,7 +468,7 @@ void* CBasicProcessing::PointSample(CSize fullTargetSize, CPoint fullTargetOffse
 		fullTargetOffset.x < 0 || fullTargetOffset.x < 0 ||
 		clippedTargetSize.cx + fullTargetOffset.x > fullTargetSize.cx ||
 		clippedTargetSize.cy + fullTargetOffset.y > fullTargetSize.cy ||
-		pPixels == NULL || (nChannels != 3 && nChannels != 4)) {
+		pPixels == NULL || (nChannels != 3 && nChannels != 4 && nChannels != YCBCR_IMAGE_CHANNELS)) {
 		return NULL;
 	}
 
@@ -380,8 +491,44 @@ void* CBasicProcessing::PointSample(CSize fullTargetSize, CPoint fullTargetOffse
 	uint8* pDst = pDIB;
 	uint32 nCurY = fullTargetOffset.y*nIncrementY;
 	uint32 nStartX = fullTargetOffset.x*nIncrementX;
+
+	// Of YCbCr planes, only the sampled columns of the sampled rows are converted to BGR, the planes are kept
+	const CYCbCrImage* pYCbCrImage = (nChannels == YCBCR_IMAGE_CHANNELS) ? (const CYCbCrImage*)pPixels : NULL;
+	uint32 nFirstSourceX = 0;
+	uint8* pBGRRow = NULL;
+	int nBGRRowY = -1;
+	if (pYCbCrImage != NULL) {
+		nFirstSourceX = nStartX >> 16;
+		uint32 nLastSourceX = min((uint32)sourceSize.cx - 1, (nStartX + (clippedTargetSize.cx - 1)*nIncrementX) >> 16);
+		pBGRRow = new(std::nothrow) uint8[(nLastSourceX - nFirstSourceX + 1) * 3];
+		if (pBGRRow == NULL) {
+			delete[] pDIB;
+			return NULL;
+		}
+		for (int j = 0; j < clippedTargetSize.cy; j++) {
+			int nSourceY = (int)((nCurY + j*nIncrementY) >> 16);
+			if (nSourceY != nBGRRowY) {
+				pYCbCrImage->ConvertRowToBGR(nSourceY, nFirstSourceX, nLastSourceX, pBGRRow);
+				nBGRRowY = nSourceY;
+			}
+			uint32 nCurX = nStartX;
+			for (int i = 0; i < clippedTargetSize.cx; i++) {
+				uint32 s = ((nCurX >> 16) - nFirstSourceX)*3;
+				uint32 d = i*4;
+				pDst[d] = pBGRRow[s];
+				pDst[d+1] = pBGRRow[s+1];
+				pDst[d+2] = pBGRRow[s+2];
+				pDst[d+3] = 0xFF;
+				nCurX += nIncrementX;
+			}
+			pDst += clippedTargetSize.cx*4;
+		}
+		delete[] pBGRRow;
+		return pDIB;
+	}
+
 	for (int j = 0; j < clippedTargetSize.cy; j++) {
-		pSrc = (uint8*)pPixels + nPaddedSourceWidth * (nCurY >> 16);
+		pSrc = (uint8*)pPixels + (__int64)nPaddedSourceWidth * (nCurY >> 16);
 		uint32 nCurX = nStartX;
 		if (nChannels == 3) {
 			for (int i = 0; i < clippedTargetSize.cx; i++) {
@@ -448,7 +595,7 @@ static uint8* ApplyFilter(int nSourceWidth, int nTargetWidth, int nHeight,
 	uint8* pTargetPixelLine = NULL;
 	const int FP_05 = 255; // rounding correction because in filter 1.0 is 16383 but we shift by 14 what is a division by 16384
 	for (int j = 0; j < nHeight; j++) {
-		pSourcePixelLine = ((uint8*) pSource) + nPaddedSourceWidth * (j + nStartY);
+		pSourcePixelLine = ((uint8*) pSource) + (__int64)nPaddedSourceWidth * (j + nStartY);
 		pTargetPixelLine = pTarget + 4*j;
 		uint8* pTargetPixel = pTargetPixelLine;
 		uint32 nX = nStartX_FP;
@@ -877,37 +1024,43 @@ static CFloatImage* ApplyFilter_SSE(int nSourceHeight, int nTargetHeight, int nW
 
 void* CBasicProcessing::SampleDown_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
 	CSize sourceSize, const void* pPixels, int nChannels,
-	EFilterType eFilter, SIMDArchitecture simd) {	
+	EFilterType eFilter, SIMDArchitecture simd, bool bHalfFloat) {	
 	if (pPixels == NULL || clippedTargetSize.cx <= 0 || clippedTargetSize.cy <= 0) {
 		return NULL;
 	}
-	int padding = (simd == AVX2) ? 8 : 4;
+	int padding = (simd == SSE) ? 4 : 8;
 	uint8* pTarget = new(std::nothrow) uint8[clippedTargetSize.cx * 4 * Helpers::DoPadding(clippedTargetSize.cy, padding)];
 	if (pTarget == NULL) return NULL;
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
 	CRequestUpDownSampling request(pPixels, sourceSize,
 		pTarget, fullTargetSize, fullTargetOffset, clippedTargetSize,
-		nChannels, eFilter, simd);
-	bool bSuccess = threadPool.Process(&request);
-
-	return bSuccess ? pTarget : NULL;
+		nChannels, eFilter, simd, bHalfFloat);
+	if (!threadPool.Process(&request)) {
+		// failed or cancelled
+		delete[] pTarget;
+		return NULL;
+	}
+	return pTarget;
 	}
 
 void* CBasicProcessing::SampleUp_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
-	CSize sourceSize, const void* pPixels, int nChannels, SIMDArchitecture simd) {
+	CSize sourceSize, const void* pPixels, int nChannels, SIMDArchitecture simd, bool bHalfFloat) {
 	if (pPixels == NULL || fullTargetSize.cx < 2 || fullTargetSize.cy < 2 || clippedTargetSize.cx <= 0 || clippedTargetSize.cy <= 0) {
 		return NULL;
 	}
-	int padding = (simd == AVX2) ? 8 : 4;
+	int padding = (simd == SSE) ? 4 : 8;
 	uint8* pTarget = new(std::nothrow) uint8[clippedTargetSize.cx * 4 * Helpers::DoPadding(clippedTargetSize.cy, padding)];
 	if (pTarget == NULL) return NULL;
 	CProcessingThreadPool& threadPool = CProcessingThreadPool::This();
 	CRequestUpDownSampling request(pPixels, sourceSize,
 		pTarget, fullTargetSize, fullTargetOffset, clippedTargetSize,
-		nChannels, Filter_Upsampling_Bicubic, simd);
-	bool bSuccess = threadPool.Process(&request);
-
-	return bSuccess ? pTarget : NULL;
+		nChannels, Filter_Upsampling_Bicubic, simd, bHalfFloat);
+	if (!threadPool.Process(&request)) {
+		// failed or cancelled
+		delete[] pTarget;
+		return NULL;
+	}
+	return pTarget;
 	}
 
 LPCTSTR CBasicProcessing::TimingInfo() {
@@ -924,273 +1077,206 @@ LPCTSTR CBasicProcessing::TimingInfo() {
 
 // SSE f32 Implementation
 
-// Rotates a line of 'simdPixelsPerRegister' pixels from source to target
-inline static const float* RotateLine_f32(const float* pSource, float* pTarget, int nIncTargetLine, int simdPixelsPerRegister) {
-	for (int i = 0; i < simdPixelsPerRegister - 1; i++)
-	{
-		*pTarget = *pSource++; pTarget += nIncTargetLine;
+// Gets the range of source columns (or rows) [nFirst, nLast] needed to filter 'nCount' target pixels
+// starting at the 16.16 fixed point source position nStart_FP. nMax is the last valid source index.
+static void GetSourceRange_SSE_f32(SSEFilterKernel** pKernels, uint32 nStart_FP, uint32 nIncrement_FP, int nCount, int nMax,
+	int& nFirst, int& nLast) {
+	nFirst = nMax;
+	nLast = 0;
+	uint32 nCur = nStart_FP;
+	for (int i = 0; i < nCount; i++) {
+		int nStart = (int)(nCur >> 16) - pKernels[i]->FilterOffset;
+		nFirst = min(nFirst, nStart);
+		nLast = max(nLast, nStart + pKernels[i]->FilterLen - 1);
+		nCur += nIncrement_FP;
 	}
-	*pTarget = *pSource++;
-
-	return pSource;
+	nFirst = max(0, nFirst);
+	nLast = min(nMax, nLast);
 }
 
-inline static const float* RotateLineToDIB_1_f32(const float* pSource, uint8* pTarget, int nIncTargetLine, int simdPixelsPerRegister) {
-
-	for (int i = 0; i < simdPixelsPerRegister - 1; i++)
-	{
-		//*((uint32*)pTarget) = ALPHA_OPAQUE | (*pSource / 64);		// ALPHA_OPAQUE 0xFF000000
-		*((uint8*)pTarget) = LinRGB12_sRGB8[(INT)(*pSource)]; pSource++; pTarget += nIncTargetLine;
-	}
-
-	//*((uint32*)pTarget) = ALPHA_OPAQUE | (*pSource / 64);
-	*((uint8*)pTarget) = LinRGB12_sRGB8[(INT)(*pSource)]; pSource++;
-
-	return pSource;
-	}
-
-inline static const float* RotateLineToDIB_f32(const float* pSource, uint8* pTarget, int nIncTargetLine, int simdPixelsPerRegister) {
-
-	for (int i = 0; i < simdPixelsPerRegister - 1; i++)
-	{
-		*pTarget = LinRGB12_sRGB8[(INT)(*pSource++)]; pTarget += nIncTargetLine;
-	}
-	*pTarget = LinRGB12_sRGB8[(INT)(*pSource++)];
-
-	return pSource;
-	}
-
-// Rotate a block in a CFloatImage. Blockwise rotation is needed because with normal
-// rotation, trashing occurs, making rotation a very slow operation.
-// The input format is what the ResizeYCore() method outputs:
-// RRRRRRRRGGGGGGGGBBBBBBBB... (blocks of 'simdPixelsPerRegister' pixels of a channel).
-// After rotation, the format is line interleaved again:
-// RRRRRRRRRRR...
-// GGGGGGGGGGG...
-// BBBBBBBBBBB...
-static void RotateBlock_f32(const float* pSrc, float* pTgt, int nWidth, int nHeight,
-						int nXStart, int nYStart, int nBlockWidth, int nBlockHeight,
-						int simdPixelsPerRegister) {
-	int nPaddedWidth = Helpers::DoPadding(nWidth, simdPixelsPerRegister);
-	int nPaddedHeight = Helpers::DoPadding(nHeight, simdPixelsPerRegister);
-	int nIncTargetChannel = nPaddedHeight;
-	int nIncTargetLine = nIncTargetChannel * 3;
-	int nIncSource = nPaddedWidth * 3 - nBlockWidth * 3;
-	const float* pSource = pSrc + nPaddedWidth * 3 * nYStart + nXStart * 3;
-	float* pTarget = pTgt + nPaddedHeight * 3 * nXStart + nYStart;
-	float* pStartYPtr = pTarget;
-	int nLoopX = Helpers::DoPadding(nBlockWidth, simdPixelsPerRegister) / simdPixelsPerRegister;
-	int nTargetIncrement = ((simdPixelsPerRegister - 1) * nIncTargetLine) + nIncTargetChannel;
-
-	for (int i = 0; i < nBlockHeight; i++) {
-		for (int j = 0; j < nLoopX; j++) {
-			pSource = RotateLine_f32(pSource, pTarget, nIncTargetLine, simdPixelsPerRegister);
-			pTarget += nIncTargetChannel;
-			pSource =  RotateLine_f32(pSource, pTarget, nIncTargetLine, simdPixelsPerRegister);
-			pTarget += nIncTargetChannel;
-			pSource =  RotateLine_f32(pSource, pTarget, nIncTargetLine, simdPixelsPerRegister);
-			pTarget += nTargetIncrement;
+// Applies the filter in y-direction to one row of the linear light tile image.
+// pSourceRows: The FilterLen source rows the kernel is applied to (rows in the ring buffer of the tile)
+// nChannelLen: Length of one channel of a row in floats
+// nWidth: Number of source pixels in the row to filter
+// pRow: Target row, one BGRx pixel per __m128, padded to 4 pixels
+static void FilterRowY_SSE_f32(const float** pSourceRows, int nChannelLen, int nWidth, const SSEFilterKernel* pKernel, __m128* pRow) {
+	int nFilterLen = pKernel->FilterLen;
+	int nNumberOfBlocksX = (nWidth + 3) >> 2;
+
+	for (int x = 0; x < nNumberOfBlocksX; x++) {
+		int nOffset = x * 4;
+		__m128 xmm4 = _mm_setzero_ps();
+		__m128 xmm5 = _mm_setzero_ps();
+		__m128 xmm6 = _mm_setzero_ps();
+		for (int i = 0; i < nFilterLen; i++) {
+			const float* pSource = pSourceRows[i] + nOffset;
+			__m128 xmm7 = _mm_load1_ps(&(pKernel->Kernel[i]));
+			xmm4 = _mm_add_ps(xmm4, _mm_mul_ps(_mm_load_ps(pSource), xmm7));
+			xmm5 = _mm_add_ps(xmm5, _mm_mul_ps(_mm_load_ps(pSource + nChannelLen), xmm7));
+			xmm6 = _mm_add_ps(xmm6, _mm_mul_ps(_mm_load_ps(pSource + 2 * nChannelLen), xmm7));
 		}
-		pStartYPtr++;
-		pTarget = pStartYPtr;
-		pSource += nIncSource;
+
+		// blocks of 4 B, G, R values -> 4 BGRx pixels
+		__m128 xmm3 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(xmm4, xmm5, xmm6, xmm3);
+		pRow[0] = xmm4;
+		pRow[1] = xmm5;
+		pRow[2] = xmm6;
+		pRow[3] = xmm3;
+		pRow += 4;
 	}
 }
 
-// Same as above, directly rotates into a 32 bpp DIB
-static void RotateBlockToDIB_f32(const float* pSrc, uint8* pTgt, int nWidth, int nHeight,
-							 int nXStart, int nYStart, int nBlockWidth, int nBlockHeight,
-							 int simdPixelsPerRegister) {
-	int nPaddedWidth = Helpers::DoPadding(nWidth, simdPixelsPerRegister);
-	int nPaddedHeight = Helpers::DoPadding(nHeight, simdPixelsPerRegister);
-	int nIncTargetLine = nHeight * 4;
-	int nIncSource = nPaddedWidth * 3 - nBlockWidth * 3;
-	const float* pSource = pSrc + nPaddedWidth * 3 * nYStart + nXStart * 3;
-	uint8* pTarget = pTgt + nHeight * 4 * nXStart + nYStart * 4;
-	uint8* pStartYPtr = pTarget;
-	int nLoopX = Helpers::DoPadding(nBlockWidth, simdPixelsPerRegister) / simdPixelsPerRegister;
-	int nTargetIncrement = simdPixelsPerRegister * nIncTargetLine - 2;
-
-	for (int i = 0; i < nBlockHeight; i++) {
-		for (int j = 0; j < nLoopX; j++) {
-			pSource = RotateLineToDIB_1_f32(pSource, pTarget, nIncTargetLine, simdPixelsPerRegister);
-			pTarget++;
-			pSource = RotateLineToDIB_f32(pSource, pTarget, nIncTargetLine, simdPixelsPerRegister);
-			pTarget++;
-			pSource = RotateLineToDIB_f32(pSource, pTarget, nIncTargetLine, simdPixelsPerRegister);
-			pTarget += nTargetIncrement;
+// Applies the filter in x-direction to a row filtered by FilterRowY_SSE_f32() and writes the result to the 32 bpp DIB.
+// nStartX_FP, nIncrementX_FP: 16.16 fixed point numbers, start and increment in the source section
+// nRowStartX: Source column of the first pixel in pRow
+// pKernels: Kernels for the target pixels, pKernels[0] is used for the first target pixel
+static void FilterRowXToDIB_SSE_f32(const __m128* pRow, int nTargetWidth, uint32 nStartX_FP, uint32 nIncrementX_FP, int nRowStartX,
+	SSEFilterKernel** pKernels, uint8* pTarget) {
+	const __m128 xmm0 = _mm_setzero_ps();
+	const __m128 xmm1 = _mm_set1_ps(4095.0f);
+	uint32 nCurX = nStartX_FP;
+	uint32* pDestination = (uint32*)pTarget;
+
+	for (int x = 0; x < nTargetWidth; x++) {
+		const SSEFilterKernel* pKernel = pKernels[x];
+		int nFilterLen = pKernel->FilterLen;
+		const __m128* pSource = pRow + ((int)(nCurX >> 16) - pKernel->FilterOffset - nRowStartX);
+		__m128 xmm4 = _mm_setzero_ps();
+		for (int i = 0; i < nFilterLen; i++) {
+			xmm4 = _mm_add_ps(xmm4, _mm_mul_ps(pSource[i], _mm_load1_ps(&(pKernel->Kernel[i]))));
 		}
-		pStartYPtr += 4;
-		pTarget = pStartYPtr;
-		pSource += nIncSource;
-	}
-}
 
-// RotateFlip the source image by 90 deg and return rotated image
-// RotateFlip is invertible: img = RotateFlip(RotateFlip(img))
-static CFloatImage* Rotate_f32(const CFloatImage* pSourceImg, int simdPixelsPerRegister) {
-	CFloatImage* targetImage = new CFloatImage(pSourceImg->GetHeight(), pSourceImg->GetWidth(), true, simdPixelsPerRegister);
-	if (targetImage->AlignedPtr() == NULL) {
-		delete targetImage;
-		return NULL;
-	}
-	const float* pSource = (const float*) pSourceImg->AlignedPtr();
-	float* pTarget = (float*) targetImage->AlignedPtr();
+		// limit to range 0..4095 and round to nearest integer
+		xmm4 = _mm_max_ps(_mm_min_ps(xmm4, xmm1), xmm0);
+		__m128i xmm2 = _mm_cvtps_epi32(xmm4);
+		*pDestination++ = ALPHA_OPAQUE | (LinRGB12_sRGB8[_mm_extract_epi32(xmm2, 2)] << 16) |
+			(LinRGB12_sRGB8[_mm_extract_epi32(xmm2, 1)] << 8) | LinRGB12_sRGB8[_mm_cvtsi128_si32(xmm2)];
 
-	const int cnBlockSize = 32;
-	int nX = 0, nY = 0;
-	while (nY < pSourceImg->GetHeight()) {
-		nX = 0;
-		while (nX < pSourceImg->GetWidth()) {
-			RotateBlock_f32(pSource, pTarget, pSourceImg->GetWidth(), pSourceImg->GetHeight(),
-				nX, nY, 
-				min(cnBlockSize, pSourceImg->GetPaddedWidth() - nX), // !! here we need to use the padded width
-				min(cnBlockSize, pSourceImg->GetHeight() - nY),
-				simdPixelsPerRegister);
-			nX += cnBlockSize;
-		}
-		nY += cnBlockSize;
+		nCurX += nIncrementX_FP;
 	}
-
-	return targetImage;
 }
 
-// RotateFlip the source image by 90 deg and return rotated image as 32 bpp DIB
-static void* RotateToDIB_f32(const CFloatImage* pSourceImg, int simdPixelsPerRegister, uint8* pTarget = NULL) {
-
-	const float* pSource = (const float*) pSourceImg->AlignedPtr();
-	if (pTarget == NULL) {
-		pTarget = new(std::nothrow) uint8[pSourceImg->GetHeight() * 4 * Helpers::DoPadding(pSourceImg->GetWidth(), simdPixelsPerRegister)];
-		if (pTarget == NULL) return NULL;
+// Resamples one strip in linear light in a single pass (SSE f32 implementation).
+// The strip is processed in tiles of target columns. For each tile, the source rows are streamed through a ring buffer
+// of filter length rows (a small, reused CFloatImage): a source row is converted to linear light when the first target
+// row needs it and dropped when no later target row does. Each target row is filtered in y-direction into a row of BGRx
+// pixels, which is filtered in x-direction and written to the target DIB directly. No strip sized intermediate images
+// and no rotations are needed, memory does not depend on the height of the source section.
+// nTargetWidth, nTargetHeight: Size of the strip in the target image
+// nStartX_FP, nStartY_FP: 16.16 fixed point numbers, start of filtering in the source section (relative to nFirstX, nFirstY)
+// nIncrementX_FP, nIncrementY_FP: 16.16 fixed point numbers, increments in the source image
+// filterX, filterY, nFilterOffsetX, nFilterOffsetY: Filters to apply and offsets into the filters (to filter.Indices array)
+// sourceSize, pPixels, nChannels: Source image, 24 or 32 bpp DIB or a CYCbCrImage (nChannels YCBCR_IMAGE_CHANNELS), the
+// rows of which are converted to BGR just before the conversion to linear light
+// nFirstX, nLastX, nFirstY, nLastY: Section of the source image needed for the strip
+// pTarget, nTargetStride: 32 bpp DIB receiving the strip and the length of its rows in bytes
+// dConvertTime, dFilterTime: Accumulated time for linear light conversion and for filtering
+static bool ResampleFused_SSE_f32(int nTargetWidth, int nTargetHeight,
+	uint32 nStartX_FP, uint32 nStartY_FP, uint32 nIncrementX_FP, uint32 nIncrementY_FP,
+	const SSEFilterKernelBlock& filterX, const SSEFilterKernelBlock& filterY, int nFilterOffsetX, int nFilterOffsetY,
+	CSize sourceSize, const void* pPixels, int nChannels, int nFirstX, int nLastX, int nFirstY, int nLastY,
+	uint8* pTarget, int nTargetStride, double& dConvertTime, double& dFilterTime) {
+
+	int nSectionWidth = nLastX - nFirstX + 1;
+	int nSectionHeight = nLastY - nFirstY + 1;
+	SSEFilterKernel** pKernelsX = filterX.Indices + nFilterOffsetX;
+	SSEFilterKernel** pKernelsY = filterY.Indices + nFilterOffsetY;
+
+	// The ring buffer holds the source rows of the longest kernel in y-direction
+	int nRingRows = 1;
+	for (int y = 0; y < nTargetHeight; y++) {
+		nRingRows = max(nRingRows, pKernelsY[y]->FilterLen);
 	}
-
-	const int cnBlockSize = 32;
-	int nX = 0, nY = 0;
-	while (nY < pSourceImg->GetHeight()) {
-		nX = 0;
-		while (nX < pSourceImg->GetWidth()) {
-			RotateBlockToDIB_f32(pSource, pTarget, pSourceImg->GetWidth(), pSourceImg->GetHeight(),
-				nX, nY, 
-				min(cnBlockSize, pSourceImg->GetPaddedWidth() - nX),  // !! here we need to use the padded width
-				min(cnBlockSize, pSourceImg->GetHeight() - nY),
-				simdPixelsPerRegister);
-
-			nX += cnBlockSize;
-		}
-		nY += cnBlockSize;
+	nRingRows = min(nRingRows, nSectionHeight);
+
+	int nTileSourceWidth = max(64, FUSED_TILE_SOURCE_BYTES / (nRingRows * 3 * (int)sizeof(float)));
+	int nTileWidth = (int)min((double)nTargetWidth, max(16.0, (double)nTileSourceWidth * nTargetWidth / nSectionWidth));
+	nTileWidth = (nTileWidth < nTargetWidth) ? (nTileWidth & ~3) : nTargetWidth;
+	int nNumTiles = (nTargetWidth + nTileWidth - 1) / nTileWidth;
+
+	int nMaxTileSourceWidth = 1;
+	for (int nTile = 0; nTile < nNumTiles; nTile++) {
+		int nTileX = nTile * nTileWidth;
+		int nFirst, nLast;
+		GetSourceRange_SSE_f32(pKernelsX + nTileX, nStartX_FP + nTileX * nIncrementX_FP, nIncrementX_FP,
+			min(nTileWidth, nTargetWidth - nTileX), nSectionWidth - 1, nFirst, nLast);
+		nMaxTileSourceWidth = max(nMaxTileSourceWidth, nLast - nFirst + 1);
 	}
 
-	return pTarget;
-}
-
-static CFloatImage* ApplyFilter_SSE_f32(int nSourceHeight, int nTargetHeight, int nWidth,
-	int nStartY_FP, int nStartX, int nIncrementY_FP,
-	const SSEFilterKernelBlock& filter,
-	int nFilterOffset, const CFloatImage* pSourceImg, bool bRoundResult) {
-
-	int nStartXAligned = nStartX & ~3;
-	int nEndXAligned = (nStartX + nWidth + 3) & ~3;
-	CFloatImage* tempImage = new CFloatImage(nEndXAligned - nStartXAligned, nTargetHeight, 4);
-	if (tempImage->AlignedPtr() == NULL) {
-		delete tempImage;
-		return NULL;
+	CFloatImage* pRingImage = new CFloatImage(nMaxTileSourceWidth, nRingRows, 4);
+	if (pRingImage->AlignedPtr() == NULL) {
+		delete pRingImage;
+		return false;
 	}
-
-	int nCurY = nStartY_FP;
-	int nChannelLenBytes = pSourceImg->GetPaddedWidth() * sizeof(float);
-	int nRowLenBytes = nChannelLenBytes * 3;
-	int nNumberOfBlocksX = (nEndXAligned - nStartXAligned) >> 2;
-
-	const uint8* pSourceStart = (const uint8*)pSourceImg->AlignedPtr() + nStartXAligned * sizeof(float);
-	SSEFilterKernel** pKernelIndexStart = filter.Indices;
-
-	_MM_ALIGN16 float XMM255[4] = {4095.0,  4095.0, 4095.0, 4095.0};
-
-	__m128 xmm0 = _mm_setzero_ps();
-	__m128 xmm1 = *((__m128*)XMM255);
-	__m128 xmm2;
-	__m128 xmm3;
-	__m128 xmm4 = _mm_setzero_ps();
-	__m128 xmm5 = _mm_setzero_ps();
-	__m128 xmm6 = _mm_setzero_ps();
-	__m128 xmm7;
-
-	__m128* pDestination = (__m128*)tempImage->AlignedPtr();
-
-	for (int y = 0; y < nTargetHeight; y++) {
-		uint32 nCurYInt = (uint32)nCurY >> 16; // integer part of Y
-		int filterIndex = y + nFilterOffset;
-		SSEFilterKernel* pKernel = pKernelIndexStart[filterIndex];
-		int filterLen = pKernel->FilterLen;
-		int filterOffset = pKernel->FilterOffset;
-		const __m128* pFilterStart = (__m128*)&(pKernel->Kernel);
-		const __m128* pSourceRow = (const __m128*)(pSourceStart + ((int)nCurYInt - filterOffset) * nRowLenBytes);
-
-		for (int x = 0; x < nNumberOfBlocksX; x++) {
-			const __m128* pSource = pSourceRow;
-			const __m128* pFilter = pFilterStart;
-			xmm4 = _mm_setzero_ps();
-			xmm5 = _mm_setzero_ps();
-			xmm6 = _mm_setzero_ps();
-			for (int i = 0; i < filterLen; i++) {
-				xmm7 = *pFilter;		// filter range was adjusted to output maximum of 1.0]
-
-				// the pixel data RED channel
-				xmm2 = *pSource;
-				xmm2 = _mm_mul_ps(xmm2, xmm7);
-				xmm4 = _mm_add_ps(xmm4, xmm2);
-				pSource = (__m128*)((uint8*)pSource + nChannelLenBytes);
-
-				// the pixel data GREEN channel
-				xmm3 = *pSource;
-				xmm3 = _mm_mul_ps(xmm3, xmm7);
-				xmm5 = _mm_add_ps(xmm5, xmm3);
-				pSource = (__m128*)((uint8*)pSource + nChannelLenBytes);
-
-				// the pixel data BLUE channel
-				xmm2 = *pSource;
-				xmm2 = _mm_mul_ps(xmm2, xmm7);
-				xmm6 = _mm_add_ps(xmm6, xmm2);
-				pSource = (__m128*)((uint8*)pSource + nChannelLenBytes);
-
-				pFilter++;
-				}
-
-			if (bRoundResult == true) {
-				// limit to range <=255 (in xmm1)
-				xmm4 = _mm_min_ps(xmm4, xmm1);
-				xmm5 = _mm_min_ps(xmm5, xmm1);
-				xmm6 = _mm_min_ps(xmm6, xmm1);
-
-				// limit to range >=0 (in xmm0)
-				xmm4 = _mm_max_ps(xmm4, xmm0);
-				xmm5 = _mm_max_ps(xmm5, xmm0);
-				xmm6 = _mm_max_ps(xmm6, xmm0);
-
-				// round to nearest integer
-				xmm4 = _mm_round_ps(xmm4, _MM_FROUND_TO_NEAREST_INT);
-				xmm5 = _mm_round_ps(xmm5, _MM_FROUND_TO_NEAREST_INT);
-				xmm6 = _mm_round_ps(xmm6, _MM_FROUND_TO_NEAREST_INT);
+	__m128* pRow = new(std::nothrow) __m128[Helpers::DoPadding(nMaxTileSourceWidth, 4)];
+	const CYCbCrImage* pYCbCrImage = (nChannels == YCBCR_IMAGE_CHANNELS) ? (const CYCbCrImage*)pPixels : NULL;
+	uint8* pBGRRow = (pYCbCrImage != NULL) ? new(std::nothrow) uint8[nMaxTileSourceWidth * 3] : NULL;
+	if (pRow == NULL || (pYCbCrImage != NULL && pBGRRow == NULL)) {
+		delete[] pRow;
+		delete[] pBGRRow;
+		delete pRingImage;
+		return false;
+	}
+	int nChannelLen = pRingImage->GetPaddedWidth();
+	const float* pRingStart = (const float*)pRingImage->AlignedPtr();
+	const float* pSourceRows[MAX_FILTER_LEN];
+
+	for (int nTile = 0; nTile < nNumTiles; nTile++) {
+		int nTileX = nTile * nTileWidth;
+		int nCurTileWidth = min(nTileWidth, nTargetWidth - nTileX);
+		uint32 nTileStartX_FP = nStartX_FP + nTileX * nIncrementX_FP;
+		int nFirst, nLast;
+		GetSourceRange_SSE_f32(pKernelsX + nTileX, nTileStartX_FP, nIncrementX_FP, nCurTileWidth, nSectionWidth - 1, nFirst, nLast);
+
+		double t1 = Helpers::GetExactTickCount();
+		double dTileConvertTime = 0.0;
+		int nNextRow = 0; // next row of the source section to convert into the ring buffer
+		uint32 nCurY = nStartY_FP;
+		uint8* pTargetRow = pTarget + nTileX * 4;
+		for (int y = 0; y < nTargetHeight; y++) {
+			const SSEFilterKernel* pKernel = pKernelsY[y];
+			int nRowStart = (int)(nCurY >> 16) - pKernel->FilterOffset;
+			int nRowEnd = nRowStart + pKernel->FilterLen;
+			// Kernel windows only move downwards, rows skipped by the windows are never converted
+			nNextRow = max(nNextRow, nRowStart);
+			if (nNextRow < nRowEnd) {
+				double t2 = Helpers::GetExactTickCount();
+				for (; nNextRow < nRowEnd; nNextRow++) {
+					if (pYCbCrImage != NULL) {
+						pYCbCrImage->ConvertRowToBGR(nFirstY + nNextRow, nFirstX + nFirst, nFirstX + nLast, pBGRRow);
+						pRingImage->ConvertFromDIB(nLast - nFirst + 1, 0, nLast - nFirst, 0, 0, pBGRRow, 3, nNextRow % nRingRows);
+					} else {
+						pRingImage->ConvertFromDIB(sourceSize.cx, nFirstX + nFirst, nFirstX + nLast, nFirstY + nNextRow, nFirstY + nNextRow,
+							pPixels, nChannels, nNextRow % nRingRows);
+					}
 				}
+				dTileConvertTime += Helpers::GetExactTickCount() - t2;
+			}
+			for (int i = 0; i < pKernel->FilterLen; i++) {
+				pSourceRows[i] = pRingStart + ((nRowStart + i) % nRingRows) * 3 * nChannelLen;
+			}
+			FilterRowY_SSE_f32(pSourceRows, nChannelLen, nLast - nFirst + 1, pKernel, pRow);
+			FilterRowXToDIB_SSE_f32(pRow, nCurTileWidth, nTileStartX_FP, nIncrementX_FP, nFirst, pKernelsX + nTileX, pTargetRow);
+			pTargetRow += nTargetStride;
+			nCurY += nIncrementY_FP;
+		}
 
-			// store result in blocks
-			*pDestination++ = xmm4;
-			*pDestination++ = xmm5;
-			*pDestination++ = xmm6;
-
-			pSourceRow++;
-		};
+		dConvertTime += dTileConvertTime;
+		dFilterTime += Helpers::GetExactTickCount() - t1 - dTileConvertTime;
+	}
 
-		nCurY += nIncrementY_FP;
-	};
+	delete[] pRow;
+	delete[] pBGRRow;
+	delete pRingImage;
 
-	return tempImage;
+	return true;
 }
 
 // Used in ProcessStrip()
 void* SampleDown_SSE_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
 	CSize sourceSize, const void* pPixels, int nChannels,
-	EFilterType eFilter, uint8* pTarget) {
+	EFilterType eFilter, uint8* pTarget, int nTargetStride) {
 
 //*GF*/	TCHAR debugtext[512];
 //*GF*/	swprintf(debugtext,255,TEXT("SampleDown_SSE_Core_f32()->filterY() sourceSize.cy %d fullTargetSize.cy %d"), sourceSize.cy, fullTargetSize.cy);
@@ -1225,43 +1311,20 @@ void* SampleDown_SSE_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSi
 	int nStartX = nIncOffsetX + nIncrementX*fullTargetOffset.x - 65536*nFirstX;
 	int nStartY = nIncOffsetY + nIncrementY*fullTargetOffset.y - 65536*nFirstY;
 
-	// Resize Y
-	double t1 = Helpers::GetExactTickCount();
-	CFloatImage* pImage1 = new CFloatImage(sourceSize.cx, sourceSize.cy, nFirstX, nLastX, nFirstY, nLastY, pPixels, nChannels, 8);
-	if (pImage1->AlignedPtr() == NULL) {
-		delete pImage1;
-		return NULL;
-	}
-	double t2 = Helpers::GetExactTickCount();
-	CFloatImage* pImage2 = ApplyFilter_SSE_f32(pImage1->GetHeight(), clippedTargetSize.cy, pImage1->GetWidth(), nStartY, 0, nIncrementY, kernelsY, nFilterOffsetY, pImage1, false);
-	delete pImage1;
-	if (pImage2 == NULL) return NULL;
-	double t3 = Helpers::GetExactTickCount();
-	// Rotate
-	CFloatImage* pImage3 = Rotate_f32(pImage2, 4);
-	delete pImage2;
-	if (pImage3 == NULL) return NULL;
-	double t4 = Helpers::GetExactTickCount();
-	// Resize Y again
-	CFloatImage* pImage4 = ApplyFilter_SSE_f32(pImage3->GetHeight(), clippedTargetSize.cx, clippedTargetSize.cy, nStartX, 0, nIncrementX, kernelsX, nFilterOffsetX, pImage3, true);
-	delete pImage3;
-	if (pImage4 == NULL) return NULL;
-	double t5 = Helpers::GetExactTickCount();
-	// Rotate back
-	void* pTargetDIB = RotateToDIB_f32(pImage4, 4, pTarget);
-	double t6 = Helpers::GetExactTickCount();
-
-	delete pImage4;
-
-	_stprintf_s(s_TimingInfo, 256, _T("Create: %.2f, Filter1: %.2f, Rotate: %.2f, Filter2: %.2f, Rotate: %.2f"), t2 - t1, t3 - t2, t4 - t3, t5 - t4, t6 - t5);
-	
-	return pTargetDIB;
+	double dConvertTime = 0.0, dFilterTime = 0.0;
+	bool bSuccess = ResampleFused_SSE_f32(clippedTargetSize.cx, clippedTargetSize.cy, nStartX, nStartY, nIncrementX, nIncrementY,
+		kernelsX, kernelsY, nFilterOffsetX, nFilterOffsetY, sourceSize, pPixels, nChannels, nFirstX, nLastX, nFirstY, nLastY,
+		pTarget, nTargetStride, dConvertTime, dFilterTime);
+
+	_stprintf_s(s_TimingInfo, 256, _T("Convert: %.2f, Filter: %.2f"), dConvertTime, dFilterTime);
+
+	return bSuccess ? pTarget : NULL;
 	}
 
 // Used in ProcessStrip()
 void* SampleDown_AVX_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
 	CSize sourceSize, const void* pPixels, int nChannels,
-	EFilterType eFilter, uint8* pTarget) {
+	EFilterType eFilter, uint8* pTarget, int nTargetStride, CBasicProcessing::SIMDArchitecture simd, bool bHalfFloat) {
 
 	CAutoAVXFilter filterY(sourceSize.cy, fullTargetSize.cy, eFilter);
 	const AVXFilterKernelBlock& kernelsY = filterY.Kernels();
@@ -1289,42 +1352,19 @@ void* SampleDown_AVX_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSi
 	int nStartX = nIncOffsetX + nIncrementX*fullTargetOffset.x - 65536 * nFirstX;
 	int nStartY = nIncOffsetY + nIncrementY*fullTargetOffset.y - 65536 * nFirstY;
 
-	// Resize Y
-	double t1 = Helpers::GetExactTickCount();
-	CFloatImage* pImage1 = new CFloatImage(sourceSize.cx, sourceSize.cy, nFirstX, nLastX, nFirstY, nLastY, pPixels, nChannels, 16);
-	if (pImage1->AlignedPtr() == NULL) {
-		delete pImage1;
-		return NULL;
-	}
-	double t2 = Helpers::GetExactTickCount();
-	CFloatImage* pImage2 = ApplyFilter_AVX_f32(pImage1->GetHeight(), clippedTargetSize.cy, pImage1->GetWidth(), nStartY, 0, nIncrementY, kernelsY, nFilterOffsetY, pImage1, false);
-	delete pImage1;
-	if (pImage2 == NULL) return NULL;
-	double t3 = Helpers::GetExactTickCount();
-	// Rotate
-	CFloatImage* pImage3 = Rotate_f32(pImage2, 8);
-	delete pImage2;
-	if (pImage3 == NULL) return NULL;
-	double t4 = Helpers::GetExactTickCount();
-	// Resize Y again
-	CFloatImage* pImage4 = ApplyFilter_AVX_f32(pImage3->GetHeight(), clippedTargetSize.cx, clippedTargetSize.cy, nStartX, 0, nIncrementX, kernelsX, nFilterOffsetX, pImage3, true);
-	delete pImage3;
-	if (pImage4 == NULL) return NULL;
-	double t5 = Helpers::GetExactTickCount();
-	// Rotate back
-	void* pTargetDIB = RotateToDIB_f32(pImage4, 8, pTarget);
-	double t6 = Helpers::GetExactTickCount();
-
-	delete pImage4;
-
-	_stprintf_s(s_TimingInfo, 256, _T("Create: %.2f, Filter1: %.2f, Rotate: %.2f, Filter2: %.2f, Rotate: %.2f"), t2 - t1, t3 - t2, t4 - t3, t5 - t4, t6 - t5);
-
-	return pTargetDIB;
+	double dConvertTime = 0.0, dFilterTime = 0.0;
+	bool bSuccess = ResampleFused_AVX_f32(clippedTargetSize.cx, clippedTargetSize.cy, nStartX, nStartY, nIncrementX, nIncrementY,
+		kernelsX, kernelsY, nFilterOffsetX, nFilterOffsetY, sourceSize, pPixels, nChannels, nFirstX, nLastX, nFirstY, nLastY,
+		pTarget, nTargetStride, dConvertTime, dFilterTime, simd, bHalfFloat);
+
+	_stprintf_s(s_TimingInfo, 256, _T("Convert: %.2f, Filter: %.2f"), dConvertTime, dFilterTime);
+
+	return bSuccess ? pTarget : NULL;
 }
 
 // Used in ProcessStrip()
 void* SampleUp_SSE_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
-	CSize sourceSize, const void* pPixels, int nChannels, uint8* pTarget) {
+	CSize sourceSize, const void* pPixels, int nChannels, uint8* pTarget, int nTargetStride) {
 	int nTargetWidth = clippedTargetSize.cx;
 	int nTargetHeight = clippedTargetSize.cy;
 	int nSourceWidth = sourceSize.cx;
@@ -1350,30 +1390,17 @@ void* SampleUp_SSE_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize
 	CAutoSSEFilter filterX(nSourceWidth, fullTargetSize.cx, Filter_Upsampling_Bicubic);
 	const SSEFilterKernelBlock& kernelsX = filterX.Kernels();
 
-	// Resize Y
-	CFloatImage* pImage1 = new CFloatImage(nSourceWidth, nSourceHeight, nFirstX, nLastX, nFirstY, nLastY, pPixels, nChannels, 8);
-	if (pImage1->AlignedPtr() == NULL) {
-		delete pImage1;
-		return NULL;
-	}
-	CFloatImage* pImage2 = ApplyFilter_SSE_f32(pImage1->GetHeight(), nTargetHeight, pImage1->GetWidth(), nStartY, 0, nIncrementY, kernelsY, nFilterOffsetY, pImage1, false);
-	delete pImage1;
-	if (pImage2 == NULL) return NULL;
-	CFloatImage* pImage3 = Rotate_f32(pImage2, 4);
-	delete pImage2;
-	if (pImage3 == NULL) return NULL;
-	CFloatImage* pImage4 = ApplyFilter_SSE_f32(pImage3->GetHeight(), nTargetWidth, nTargetHeight, nStartX, 0, nIncrementX, kernelsX, nFilterOffsetX, pImage3, true);
-	delete pImage3;
-	if (pImage4 == NULL) return NULL;
-	void* pTargetDIB = RotateToDIB_f32(pImage4, 4, pTarget);
-	delete pImage4;
-
-	return pTargetDIB;
+	double dConvertTime = 0.0, dFilterTime = 0.0;
+	bool bSuccess = ResampleFused_SSE_f32(nTargetWidth, nTargetHeight, nStartX, nStartY, nIncrementX, nIncrementY,
+		kernelsX, kernelsY, nFilterOffsetX, nFilterOffsetY, sourceSize, pPixels, nChannels, nFirstX, nLastX, nFirstY, nLastY,
+		pTarget, nTargetStride, dConvertTime, dFilterTime);
+
+	return bSuccess ? pTarget : NULL;
 	}
 
 // Used in ProcessStrip()
 void* SampleUp_AVX_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize,
-	CSize sourceSize, const void* pPixels, int nChannels, uint8* pTarget) {
+	CSize sourceSize, const void* pPixels, int nChannels, uint8* pTarget, int nTargetStride, CBasicProcessing::SIMDArchitecture simd, bool bHalfFloat) {
 
 	int nTargetWidth = clippedTargetSize.cx;
 	int nTargetHeight = clippedTargetSize.cy;
@@ -1400,23 +1427,10 @@ void* SampleUp_AVX_Core_f32(CSize fullTargetSize, CPoint fullTargetOffset, CSize
 	CAutoAVXFilter filterX(nSourceWidth, fullTargetSize.cx, Filter_Upsampling_Bicubic);
 	const AVXFilterKernelBlock& kernelsX = filterX.Kernels();
 
-	// Resize Y
-	CFloatImage* pImage1 = new CFloatImage(nSourceWidth, nSourceHeight, nFirstX, nLastX, nFirstY, nLastY, pPixels, nChannels, 16);
-	if (pImage1->AlignedPtr() == NULL) {
-		delete pImage1;
-		return NULL;
-	}
-	CFloatImage* pImage2 = ApplyFilter_AVX_f32(pImage1->GetHeight(), nTargetHeight, pImage1->GetWidth(), nStartY, 0, nIncrementY, kernelsY, nFilterOffsetY, pImage1, false);
-	delete pImage1;
-	if (pImage2 == NULL) return NULL;
-	CFloatImage* pImage3 = Rotate_f32(pImage2, 8);
-	delete pImage2;
-	if (pImage3 == NULL) return NULL;
-	CFloatImage* pImage4 = ApplyFilter_AVX_f32(pImage3->GetHeight(), nTargetWidth, nTargetHeight, nStartX, 0, nIncrementX, kernelsX, nFilterOffsetX, pImage3, true);
-	delete pImage3;
-	if (pImage4 == NULL) return NULL;
-	void* pTargetDIB = RotateToDIB_f32(pImage4, 8, pTarget);
-	delete pImage4;
-
-	return pTargetDIB;
+	double dConvertTime = 0.0, dFilterTime = 0.0;
+	bool bSuccess = ResampleFused_AVX_f32(nTargetWidth, nTargetHeight, nStartX, nStartY, nIncrementX, nIncrementY,
+		kernelsX, kernelsY, nFilterOffsetX, nFilterOffsetY, sourceSize, pPixels, nChannels, nFirstX, nLastX, nFirstY, nLastY,
+		pTarget, nTargetStride, dConvertTime, dFilterTime, simd, bHalfFloat);
+
+	return bSuccess ? pTarget : NULL;
 }
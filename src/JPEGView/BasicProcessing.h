@@ -9,7 +9,9 @@ public:
 	enum SIMDArchitecture
 	{
 		SSE, // 128 bit
-		AVX2 // 256 bit
+		AVX2, // 256 bit
+		AVX2_FMA, // 256 bit, fused multiply-add
+		AVX512 // 512 bit, fused multiply-add
 	};
 
 	// Note for all methods: The caller gets ownership of the returned image and is responsible to delete 
@@ -63,6 +65,13 @@ public:
 	// Mirror 32 bit DIB vertically inplace
 	static void MirrorVInplace(int nWidth, int nHeight, int nStride, void* pDIBPixels);
 
+	// Reduce a 32 or 24 bpp BGR(A) image by an integer factor by averaging nFactor x nFactor blocks in linear light.
+	// The size is rounded up, the blocks of the last column and row then only cover the remaining pixels.
+	// pPixels can also be a CYCbCrImage, with nChannels YCBCR_IMAGE_CHANNELS, its rows are converted one at a time.
+	// The target rows are processed in strips on the processing thread pool.
+	// Notice that the returned image is always 32 bpp with the A channel set to 0xFF!
+	static void* ReduceBox(int nWidth, int nHeight, const void* pPixels, int nChannels, int nFactor);
+
 	// Resize 32 or 24 bpp BGR(A) image using point sampling (i.e. no interpolation).
 	// Point sampling is fast but produces a lot of aliasing artefacts.
 	// Notice that the A channel is kept unchanged for 32 bpp images.
@@ -74,6 +83,7 @@ public:
 	// pPixels: Source image
 	// nChannels: Number of channels (bytes) in source image, must be 3 or 4
 	// Returns a 32 bpp BGRA DIB of size 'clippedTargetSize'
+	// pPixels can also be a CYCbCrImage, with nChannels YCBCR_IMAGE_CHANNELS, then only the sampled pixels are converted
 	static void* PointSample(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pPixels, int nChannels);
 
 	// High quality downsampling of 32 or 24 bpp BGR(A) image to target size, using a set of down-sampling kernels
@@ -87,7 +97,9 @@ public:
 	// Same as above, SIMD (AVX2/SSE) implementation.
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
 	// Notice that the returned image is always 32 bpp!
-	static void* SampleDown_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pPixels, int nChannels, EFilterType eFilter, SIMDArchitecture simd);
+	// bHalfFloat: Keep the linear light intermediate rows as half floats (only used for AVX2_FMA and AVX512)
+	// pPixels can also be a CYCbCrImage, with nChannels YCBCR_IMAGE_CHANNELS (see YCbCrImage.h)
+	static void* SampleDown_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pPixels, int nChannels, EFilterType eFilter, SIMDArchitecture simd, bool bHalfFloat);
 
 	// High quality upsampling of 32 or 24 bpp BGR(A) image using bicubic interpolation.
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
@@ -98,7 +110,8 @@ public:
 	// Same as above, SIMD (AVX2/SSE) implementation.
 	// Notice that the A channel is not processed and set to fixed value 0xFF.
 	// Notice that the returned image is always 32 bpp!
-	static void* SampleUp_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pPixels, int nChannels, SIMDArchitecture simd);
+	// bHalfFloat, pPixels: See SampleDown_SIMD()
+	static void* SampleUp_SIMD(CSize fullTargetSize, CPoint fullTargetOffset, CSize clippedTargetSize, CSize sourceSize, const void* pPixels, int nChannels, SIMDArchitecture simd, bool bHalfFloat);
 
 	// Debug: Gives some timing info of the last resize operation
 	static LPCTSTR TimingInfo();
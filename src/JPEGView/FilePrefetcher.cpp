@@ -0,0 +1,210 @@
+#include "StdAfx.h"
+#include "FilePrefetcher.h"
+#include "Helpers.h"
+#include "MaxImageDef.h"
+
+// Files are read in blocks of this size, between the blocks the read is aborted if the file is no longer wanted
+static const unsigned int PREFETCH_BLOCK_SIZE = 4 * 1024 * 1024;
+
+static __int64 GetLastWriteTime(HANDLE hFile) {
+	FILETIME lastWriteTime;
+	return ::GetFileTime(hFile, NULL, NULL, &lastWriteTime) ?
+		((__int64)lastWriteTime.dwHighDateTime << 32) | lastWriteTime.dwLowDateTime : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Public
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+CFilePrefetcher::CFilePrefetcher(int nBudgetMB) : CWorkThread(false) {
+	m_nCacheSize = 0;
+	m_nBudget = (__int64)nBudgetMB * 1024 * 1024;
+	memset(&m_csCache, 0, sizeof(CRITICAL_SECTION));
+	::InitializeCriticalSection(&m_csCache);
+	m_hReadFinished = ::CreateEvent(0, TRUE, TRUE, NULL);
+}
+
+CFilePrefetcher::~CFilePrefetcher(void) {
+	Terminate();
+	std::list<CCacheEntry>::iterator iter;
+	for (iter = m_cache.begin(); iter != m_cache.end(); iter++) {
+		delete[] iter->Data;
+	}
+	::DeleteCriticalSection(&m_csCache);
+	::CloseHandle(m_hReadFinished);
+}
+
+void CFilePrefetcher::Prefetch(const std::list<CString>& fileNames) {
+	Helpers::CAutoCriticalSection criticalSectionList(m_csList);
+	CString sReadingFile;
+	{
+		Helpers::CAutoCriticalSection criticalSection(m_csCache);
+		m_wantedFiles = fileNames;
+		sReadingFile = m_sReadingFile;
+	}
+
+	// Requeue the files in the new order. The work thread processes the request queued last first, so the farthest
+	// file is queued first.
+	std::list<CRequestBase*>::iterator iterRequest;
+	for (iterRequest = m_requestList.begin(); iterRequest != m_requestList.end(); iterRequest++) {
+		if (!(*iterRequest)->Processed) {
+			(*iterRequest)->Deleted = true;
+		}
+	}
+	std::list<CString>::const_reverse_iterator iter;
+	for (iter = fileNames.rbegin(); iter != fileNames.rend(); iter++) {
+		bool bCached;
+		{
+			Helpers::CAutoCriticalSection criticalSection(m_csCache);
+			bCached = IsCached(*iter);
+		}
+		if (!bCached && sReadingFile.CompareNoCase(*iter) != 0) {
+			ProcessAsync(new CPrefetchRequest(*iter));
+		}
+	}
+}
+
+char* CFilePrefetcher::Take(LPCTSTR sFileName, HANDLE hFile, unsigned int& nSize) {
+	nSize = 0;
+	for (;;) {
+		::EnterCriticalSection(&m_csCache);
+		if (m_sReadingFile.CompareNoCase(sFileName) != 0) {
+			break;
+		}
+		// the file is read at the moment, reading it a second time would only slow down both reads
+		::LeaveCriticalSection(&m_csCache);
+		::WaitForSingleObject(m_hReadFinished, INFINITE);
+	}
+
+	char* pData = NULL;
+	std::list<CCacheEntry>::iterator iter;
+	for (iter = m_cache.begin(); iter != m_cache.end(); iter++) {
+		if (iter->FileName.CompareNoCase(sFileName) == 0) {
+			LARGE_INTEGER nFileSize;
+			if (::GetFileSizeEx(hFile, &nFileSize) && nFileSize.QuadPart == iter->Size &&
+				GetLastWriteTime(hFile) == iter->LastWriteTime) {
+				pData = iter->Data;
+				nSize = iter->Size;
+			} else {
+				// changed since it has been read
+				delete[] iter->Data;
+			}
+			m_nCacheSize -= iter->Size;
+			m_cache.erase(iter);
+			break;
+		}
+	}
+	::LeaveCriticalSection(&m_csCache);
+	return pData;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// Private
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+void CFilePrefetcher::ProcessRequest(CRequestBase& request) {
+	CPrefetchRequest& rq = (CPrefetchRequest&)request;
+	{
+		Helpers::CAutoCriticalSection criticalSection(m_csCache);
+		if (!IsWanted(rq.FileName) || IsCached(rq.FileName)) {
+			return;
+		}
+		m_sReadingFile = rq.FileName;
+		::ResetEvent(m_hReadFinished);
+	}
+
+	HANDLE hFile = ::CreateFile(rq.FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile != INVALID_HANDLE_VALUE) {
+		LARGE_INTEGER nFileSize;
+		if (::GetFileType(hFile) == FILE_TYPE_DISK && ::GetFileSizeEx(hFile, &nFileSize) &&
+			nFileSize.QuadPart > 0 && nFileSize.QuadPart <= MAX_BMP_FILE_SIZE) {
+			unsigned int nSize = (unsigned int)nFileSize.QuadPart;
+			__int64 nLastWriteTime = GetLastWriteTime(hFile);
+			bool bHasRoom;
+			{
+				Helpers::CAutoCriticalSection criticalSection(m_csCache);
+				bHasRoom = MakeRoom(nSize);
+			}
+			// only this thread adds to the cache, so the room made is still there after reading
+			char* pData = bHasRoom ? ReadContent(hFile, rq.FileName, nSize) : NULL;
+			if (pData != NULL) {
+				Helpers::CAutoCriticalSection criticalSection(m_csCache);
+				CCacheEntry entry;
+				entry.FileName = rq.FileName;
+				entry.Data = pData;
+				entry.Size = nSize;
+				entry.LastWriteTime = nLastWriteTime;
+				m_cache.push_back(entry);
+				m_nCacheSize += nSize;
+			}
+		}
+		::CloseHandle(hFile);
+	}
+
+	Helpers::CAutoCriticalSection criticalSection(m_csCache);
+	m_sReadingFile.Empty();
+	::SetEvent(m_hReadFinished);
+}
+
+void CFilePrefetcher::AfterFinishProcess(CRequestBase& request) {
+	request.Deleted = true;
+}
+
+bool CFilePrefetcher::IsWanted(LPCTSTR sFileName) {
+	std::list<CString>::iterator iter;
+	for (iter = m_wantedFiles.begin(); iter != m_wantedFiles.end(); iter++) {
+		if (iter->CompareNoCase(sFileName) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool CFilePrefetcher::IsCached(LPCTSTR sFileName) {
+	std::list<CCacheEntry>::iterator iter;
+	for (iter = m_cache.begin(); iter != m_cache.end(); iter++) {
+		if (iter->FileName.CompareNoCase(sFileName) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool CFilePrefetcher::MakeRoom(unsigned int nSize) {
+	// evict the oldest files no longer wanted, the wanted files are kept
+	std::list<CCacheEntry>::iterator iter = m_cache.begin();
+	while (m_nCacheSize + nSize > m_nBudget && iter != m_cache.end()) {
+		if (!IsWanted(iter->FileName)) {
+			m_nCacheSize -= iter->Size;
+			delete[] iter->Data;
+			iter = m_cache.erase(iter);
+		} else {
+			iter++;
+		}
+	}
+	return m_nCacheSize + nSize <= m_nBudget;
+}
+
+char* CFilePrefetcher::ReadContent(HANDLE hFile, LPCTSTR sFileName, unsigned int nSize) {
+	char* pData = new(std::nothrow) char[nSize];
+	if (pData == NULL) {
+		return NULL;
+	}
+	unsigned int nPosition = 0;
+	while (nPosition < nSize) {
+		bool bWanted;
+		{
+			Helpers::CAutoCriticalSection criticalSection(m_csCache);
+			bWanted = IsWanted(sFileName);
+		}
+		DWORD nNumBytesRead;
+		if (m_bTerminate || !bWanted ||
+			!::ReadFile(hFile, pData + nPosition, min(PREFETCH_BLOCK_SIZE, nSize - nPosition), &nNumBytesRead, NULL) ||
+			nNumBytesRead == 0) {
+			delete[] pData;
+			return NULL;
+		}
+		nPosition += nNumBytesRead;
+	}
+	return pData;
+}
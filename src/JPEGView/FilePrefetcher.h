@@ -0,0 +1,59 @@
+#pragma once
+
+#include "WorkThread.h"
+
+// Reads the raw content of the files that will be shown next into a cache with a memory budget, on its own thread and
+// with large sequential reads. This separates the I/O from decoding: the image load threads take the content from the
+// cache (see CFileSource) instead of reading the file themselves, so on slow network shares the decoders do not stall
+// on I/O. As compressed files are much smaller than the decoded images, the prefetcher can read far ahead while only
+// the nearest images are decoded.
+class CFilePrefetcher : public CWorkThread
+{
+public:
+	// nBudgetMB: Memory budget of the cache in MB
+	CFilePrefetcher(int nBudgetMB);
+	~CFilePrefetcher(void);
+
+	// Sets the files to prefetch, the nearest file first. Pending reads of files no longer in the list are dropped and
+	// cached files no longer in the list are the first to be evicted from the cache.
+	void Prefetch(const std::list<CString>& fileNames);
+
+	// Takes the content of the file out of the cache, waits if the file is read at the moment. hFile is the opened
+	// file, its size and last write time must match the cached content. Returns NULL if the file is not cached,
+	// otherwise the caller gets ownership of the returned buffer (to be deleted with delete[]).
+	char* Take(LPCTSTR sFileName, HANDLE hFile, unsigned int& nSize);
+
+private:
+	// Request to read a file into the cache
+	class CPrefetchRequest : public CRequestBase {
+	public:
+		CPrefetchRequest(LPCTSTR sFileName) : CRequestBase() {
+			FileName = sFileName;
+		}
+
+		CString FileName;
+	};
+
+	// Cached content of a file
+	struct CCacheEntry {
+		CString FileName;
+		char* Data;
+		unsigned int Size;
+		__int64 LastWriteTime; // to detect files changed after having been read
+	};
+
+	std::list<CCacheEntry> m_cache; // oldest entries first
+	std::list<CString> m_wantedFiles; // files of the last Prefetch() call, nearest first
+	CString m_sReadingFile; // file read at the moment, empty if none
+	__int64 m_nCacheSize; // sum of the sizes of the cached files
+	__int64 m_nBudget;
+	CRITICAL_SECTION m_csCache; // protects the members above
+	HANDLE m_hReadFinished; // signaled when no file is read
+
+	virtual void ProcessRequest(CRequestBase& request);
+	virtual void AfterFinishProcess(CRequestBase& request);
+	bool IsWanted(LPCTSTR sFileName);
+	bool IsCached(LPCTSTR sFileName);
+	bool MakeRoom(unsigned int nSize);
+	char* ReadContent(HANDLE hFile, LPCTSTR sFileName, unsigned int nSize);
+};
@@ -0,0 +1,110 @@
+#include "StdAfx.h"
+#include "FileSource.h"
+#include "Helpers.h"
+#include "MaxImageDef.h"
+#include "FilePrefetcher.h"
+
+// Block size for reading files that cannot be mapped
+static const unsigned int STREAM_BLOCK_SIZE = 1024 * 1024;
+
+CFileSource::CFileSource(LPCTSTR sFileName, CFilePrefetcher* pPrefetcher) {
+	m_sFileName = sFileName;
+	m_hMapping = NULL;
+	m_pData = NULL;
+	m_nSize = 0;
+	m_bMapped = false;
+	m_hFile = ::CreateFile(sFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE) {
+		return;
+	}
+
+	if (::GetFileType(m_hFile) != FILE_TYPE_DISK) {
+		ReadStream();
+		return;
+	}
+	if (pPrefetcher != NULL) {
+		m_pData = pPrefetcher->Take(sFileName, m_hFile, m_nSize);
+		if (m_pData != NULL) {
+			return;
+		}
+	}
+	LARGE_INTEGER nFileSize;
+	if (!::GetFileSizeEx(m_hFile, &nFileSize) || nFileSize.QuadPart == 0 || nFileSize.QuadPart > MAX_BMP_FILE_SIZE) {
+		return;
+	}
+	m_hMapping = ::CreateFileMapping(m_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (m_hMapping != NULL) {
+		m_pData = ::MapViewOfFile(m_hMapping, FILE_MAP_COPY, 0, 0, 0);
+		m_bMapped = m_pData != NULL;
+		m_nSize = (m_pData != NULL) ? (unsigned int)nFileSize.QuadPart : 0;
+	}
+}
+
+CFileSource::~CFileSource() {
+	if (m_bMapped) {
+		::UnmapViewOfFile(m_pData);
+	} else {
+		delete[] (char*)m_pData;
+	}
+	if (m_hMapping != NULL) {
+		::CloseHandle(m_hMapping);
+	}
+	if (m_hFile != INVALID_HANDLE_VALUE) {
+		::CloseHandle(m_hFile);
+	}
+}
+
+void CFileSource::ReadStream() {
+	unsigned int nCapacity = 0;
+	char* pBuffer = NULL;
+	for (;;) {
+		if (m_nSize == nCapacity) {
+			if (nCapacity >= MAX_BMP_FILE_SIZE) {
+				break;
+			}
+			nCapacity += STREAM_BLOCK_SIZE;
+			char* pNewBuffer = new(std::nothrow) char[nCapacity];
+			if (pNewBuffer == NULL) {
+				break;
+			}
+			memcpy(pNewBuffer, pBuffer, m_nSize);
+			delete[] pBuffer;
+			pBuffer = pNewBuffer;
+		}
+		DWORD nNumBytesRead;
+		if (!::ReadFile(m_hFile, pBuffer + m_nSize, nCapacity - m_nSize, &nNumBytesRead, NULL) || nNumBytesRead == 0) {
+			break;
+		}
+		m_nSize += nNumBytesRead;
+	}
+	if (m_nSize == 0) {
+		delete[] pBuffer;
+		pBuffer = NULL;
+	}
+	m_pData = pBuffer;
+}
+
+EImageFormat CFileSource::GetImageFormat() const {
+	if (m_nSize < 2) {
+		return IF_Unknown;
+	}
+	unsigned char header[16];
+	memset(header, 0, sizeof(header));
+	memcpy(header, m_pData, min(m_nSize, (unsigned int)sizeof(header)));
+	if (header[0] == 0x42 && header[1] == 0x4d) {
+		return IF_WindowsBMP;
+	} else if (header[0] == 0xff && header[1] == 0xd8) {
+		return IF_JPEG;
+	} else if (header[0] == 0x89 && header[1] == 'P' && header[2] == 'N' && header[3] == 'G' &&
+		header[4] == 0x0d && header[5] == 0x0a && header[6] == 0x1a && header[7] == 0x0a) {
+		return IF_PNG;
+	} else if (header[0] == 'G' && header[1] == 'I' && header[2] == 'F' && header[3] == '8' &&
+		(header[4] == '7' || header[4] == '9') && header[5] == 'a') {
+		return IF_GIF;
+	} else if (header[0] == 'R' && header[1] == 'I' && header[2] == 'F' && header[3] == 'F' &&
+		header[8] == 'W' && header[9] == 'E' && header[10] == 'B' && header[11] == 'P') {
+		return IF_WEBP;
+	} else {
+		return Helpers::GetImageFormat(m_sFileName);
+	}
+}
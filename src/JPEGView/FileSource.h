@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ImageProcessingTypes.h"
+
+class CFilePrefetcher;
+
+// Content of an image file for the decoders. The file is opened once and mapped copy-on-write into memory, so the
+// decoders read the file without copying it into a buffer (and may even write to it without changing the file).
+// Files that cannot be mapped, e.g. pipes, are read into a buffer. Files already read by the prefetcher are taken from
+// its cache instead (see CFilePrefetcher). Files larger than the largest supported file (MAX_BMP_FILE_SIZE) are not valid.
+// Reading the mapped content can raise an in-page exception if the file becomes unavailable (e.g. a network share
+// disconnects). The decoders on the load thread run inside a try/catch block (the project is compiled with asynchronous
+// exceptions), requests of the processing thread pool fail on this exception (see CProcessingThreadPool).
+class CFileSource
+{
+public:
+	// Opens the file, check with IsValid() if the content is available. If pPrefetcher is not NULL, the content is taken
+	// from its cache if the file has been prefetched.
+	CFileSource(LPCTSTR sFileName, CFilePrefetcher* pPrefetcher = NULL);
+	~CFileSource();
+
+	// Returns if the file could be opened and is not empty
+	bool IsValid() const { return m_pData != NULL; }
+
+	// Content of the file, NULL if not valid
+	void* Data() const { return m_pData; }
+	unsigned int Size() const { return m_nSize; }
+
+	// Handle of the opened file, INVALID_HANDLE_VALUE if it could not be opened
+	HANDLE FileHandle() const { return m_hFile; }
+
+	// Image format of the file as detected from its first bytes, by the file ending if not detected
+	EImageFormat GetImageFormat() const;
+
+private:
+	CString m_sFileName;
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	void* m_pData;
+	unsigned int m_nSize;
+	bool m_bMapped; // m_pData is a view of m_hMapping, else a buffer allocated with new[]
+
+	void ReadStream();
+};
+
+// Sequential reader over a block of memory, e.g. the content of a CFileSource. Bytes read beyond the end are zero.
+class CMemoryReader
+{
+public:
+	CMemoryReader(const void* pData, unsigned int nSize) {
+		m_pData = (const uint8*)pData;
+		m_nSize = nSize;
+		m_nPosition = 0;
+	}
+
+	// Reads nBytes to pTarget, returns false if the end is reached before
+	bool Read(void* pTarget, unsigned int nBytes) {
+		unsigned int nAvailable = (m_nPosition < m_nSize) ? min(nBytes, m_nSize - m_nPosition) : 0;
+		memcpy(pTarget, m_pData + m_nPosition, nAvailable);
+		memset((uint8*)pTarget + nAvailable, 0, nBytes - nAvailable);
+		m_nPosition += nBytes;
+		return nAvailable == nBytes;
+	}
+
+	// Sets the position, returns false if beyond the end
+	bool Seek(unsigned int nPosition) {
+		m_nPosition = nPosition;
+		return nPosition <= m_nSize;
+	}
+
+	unsigned int Position() const { return m_nPosition; }
+
+private:
+	const uint8* m_pData;
+	unsigned int m_nSize;
+	unsigned int m_nPosition;
+};
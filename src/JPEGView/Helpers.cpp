@@ -50,7 +50,7 @@ CPoint LimitOffsets(const CPoint& offsets, const CSize & rectSize, const CSize &
 	}
 
 #ifdef _WIN64
-static CPUType ProbeSSEorAVX2() {
+static CPUType ProbeSSEorAVX() {
 	__try {
 		// check if CPU supports AVX and the xgetbv instruction
 		int abcd[4];
@@ -67,8 +67,19 @@ static CPUType ProbeSSEorAVX2() {
 
 		// check if AVX2 instructions are supported
 		const int AVX2BITMASK = 1 << 5;
+		const int AVX512FBITMASK = 1 << 16;
+		const int FMABITMASK = 1 << 12;
+		bool bFMA = (abcd[2] & FMABITMASK) != 0;
 		__cpuidex(abcd, 7, 0);
-		return (abcd[1] & AVX2BITMASK) ? CPU_AVX2 : CPU_SSE;
+		if ((abcd[1] & AVX2BITMASK) == 0)
+			return CPU_SSE;
+		if (!bFMA)
+			return CPU_AVX2;
+
+		// check if AVX-512F is supported and the operating system saves the opmask and ZMM registers
+		if ((abcd[1] & AVX512FBITMASK) != 0 && (xcr0 & 0xE0) == 0xE0)
+			return CPU_AVX512;
+		return CPU_AVX2_FMA;
 	}
 	__except (EXCEPTION_EXECUTE_HANDLER) {
 		return CPU_SSE;
@@ -83,7 +94,8 @@ CPUType ProbeCPU(void) {
 	}
 
 #ifdef _WIN64
-	return ProbeSSEorAVX2(); // 64 bit always supports at least SSE
+	cpuType = ProbeSSEorAVX(); // 64 bit always supports at least SSE
+	return cpuType;
 #else
 	// Structured exception handling is mantatory, try/catch(...) does not catch such severe stuff.
 	cpuType = CPU_Generic;
@@ -106,6 +118,16 @@ CPUType ProbeCPU(void) {
 #endif
 }
 
+bool CPUSupportsF16C(void) {
+	static int nF16C = -1;
+	if (nF16C < 0) {
+		int abcd[4];
+		__cpuid(abcd, 1);
+		nF16C = (ProbeCPU() >= CPU_AVX2 && (abcd[2] & (1 << 29)) != 0) ? 1 : 0; // F16C bit
+	}
+	return nF16C != 0;
+}
+
 // returns if the CPU supports some form of hardware multiprocessing, e.g. hyperthreading or multicore
 static bool CPUSupportsHWMultiprocessing(void) {   
 	if (ProbeCPU() >= CPU_SSE) {
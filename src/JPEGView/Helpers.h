@@ -306,7 +306,9 @@ namespace Helpers {
 		CPU_Unknown,
 		CPU_Generic,
 		CPU_SSE,
-		CPU_AVX2
+		CPU_AVX2,
+		CPU_AVX2_FMA, // AVX2 with FMA3
+		CPU_AVX512 // AVX-512F
 		// add higher capabilities at the end!
 	};
 
@@ -380,6 +382,9 @@ namespace Helpers {
 	// Tests if the CPU supports SSE or AVX2
 	CPUType ProbeCPU(void);
 
+	// Tests if the CPU supports the F16C half float conversions, false if AVX is not supported
+	bool CPUSupportsF16C(void);
+
 	// Get number of cores per physical processor, not counting hyperthreading
 	int NumConcurrentThreads(void);
 
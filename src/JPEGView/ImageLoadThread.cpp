@@ -12,9 +12,11 @@
 #include "BasicProcessing.h"
 #include "dcraw_mod.h"
 #include "TJPEGWrapper.h"
+#include "YCbCrImage.h"
 #include "PNGWrapper.h"
 #include "WEBPWrapper.h"
 #include "MaxImageDef.h"
+#include "FileSource.h"
 #include <io.h>
 #include <fcntl.h>
 
@@ -22,41 +24,21 @@ using namespace Gdiplus;
 
 // static initializers
 volatile int CImageLoadThread::m_curHandle = 0;
+CString CImageLoadThread::sm_sLastWebpFileName;
+CString CImageLoadThread::sm_sLastPngFileName;
+
+// The PNG and WebP decoders keep the decoder of the last animated file in a static cache that is shared by all load
+// threads, the cache is only used inside this critical section.
+static struct CDecoderCacheLock {
+	CRITICAL_SECTION CriticalSection;
+	CDecoderCacheLock() { ::InitializeCriticalSection(&CriticalSection); }
+	~CDecoderCacheLock() { ::DeleteCriticalSection(&CriticalSection); }
+} s_DecoderCacheLock;
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 // static helpers
 /////////////////////////////////////////////////////////////////////////////////////////////
 
-// find image format of this image by reading some header bytes
-static EImageFormat GetImageFormat(LPCTSTR sFileName) {
-	FILE *fptr;
-	if ((fptr = _tfopen(sFileName, _T("rb"))) == NULL) {
-		return IF_Unknown;
-	}
-	unsigned char header[16];
-	int nSize = (int)fread((void*)header, 1, 16, fptr);
-	fclose(fptr);
-	if (nSize < 2) {
-		return IF_Unknown;
-	}
-	if (header[0] == 0x42 && header[1] == 0x4d) {
-		return IF_WindowsBMP;
-	} else if (header[0] == 0xff && header[1] == 0xd8) {
-		return IF_JPEG;
-	} else if (header[0] == 0x89 && header[1] == 'P' && header[2] == 'N' && header[3] == 'G' &&
-		header[4] == 0x0d && header[5] == 0x0a && header[6] == 0x1a && header[7] == 0x0a) {
-		return IF_PNG;
-	} else if (header[0] == 'G' && header[1] == 'I' && header[2] == 'F' && header[3] == '8' &&
-		(header[4] == '7' || header[4] == '9') && header[5] == 'a') {
-		return IF_GIF;
-	} else if (header[0] == 'R' && header[1] == 'I' && header[2] == 'F' && header[3] == 'F' &&
-		header[8] == 'W' && header[9] == 'E' && header[10] == 'B' && header[11] == 'P') {
-		return IF_WEBP;
-	} else {
-		return Helpers::GetImageFormat(sFileName);
-	}
-}
-
 static EImageFormat GetBitmapFormat(Gdiplus::Bitmap * pBitmap) {
 	GUID guid;
 	memset(&guid, 0, sizeof(GUID));
@@ -176,8 +158,9 @@ static CJPEGImage* ConvertGDIPlusBitmapToJPEGImage(Gdiplus::Bitmap* pBitmap, int
 // Public
 /////////////////////////////////////////////////////////////////////////////////////////////
 
-CImageLoadThread::CImageLoadThread(void) : CWorkThread(true) {
+CImageLoadThread::CImageLoadThread(CFilePrefetcher* pPrefetcher) : CWorkThread(true) {
 	m_pLastBitmap = NULL;
+	m_pPrefetcher = pPrefetcher;
 }
 
 CImageLoadThread::~CImageLoadThread(void) {
@@ -186,8 +169,10 @@ CImageLoadThread::~CImageLoadThread(void) {
 	DeleteCachedPngDecoder();
 }
 
-int CImageLoadThread::AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished) {
+int CImageLoadThread::AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished,
+								bool bBackground) {
 	CRequest* pRequest = new CRequest(strFileName, nFrameIndex, targetWnd, processParams, eventFinished);
+	pRequest->Cancel.SetBackground(bBackground);
 
 	ProcessAsync(pRequest);
 
@@ -219,6 +204,76 @@ void CImageLoadThread::ReleaseFile(LPCTSTR strFileName) {
 	ProcessAndWait(pRequest);
 }
 
+void CImageLoadThread::CancelLoad(int nHandle) {
+	Helpers::CAutoCriticalSection criticalSection(m_csList);
+	std::list<CRequestBase*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		if ((*iter)->Type != CReleaseFileRequest::ReleaseFileRequest && ((CRequest*)(*iter))->RequestHandle == nHandle) {
+			((CRequest*)(*iter))->Cancel.Cancel();
+			break;
+		}
+	}
+}
+
+void CImageLoadThread::PromoteLoad(int nHandle) {
+	Helpers::CAutoCriticalSection criticalSection(m_csList);
+	std::list<CRequestBase*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		if ((*iter)->Type != CReleaseFileRequest::ReleaseFileRequest && ((CRequest*)(*iter))->RequestHandle == nHandle) {
+			((CRequest*)(*iter))->Cancel.SetBackground(false);
+			break;
+		}
+	}
+}
+
+CJPEGImage* CImageLoadThread::LoadPreview(LPCTSTR strFileName, const CProcessParams & processParams) {
+	int nMinMegapixels = CSettingsProvider::This().PreviewMinMegapixels();
+	if (nMinMegapixels == 0 || CSettingsProvider::This().ForceGDIPlus() || CSettingsProvider::This().UseEmbeddedColorProfiles()) {
+		return NULL;
+	}
+
+	CFileSource fileSource(strFileName);
+	if (fileSource.GetImageFormat() != IF_JPEG) {
+		return NULL;
+	}
+
+	CJPEGImage* pImage = NULL;
+	try {
+		unsigned int nFileSize = fileSource.Size();
+		void* pBuffer = (nFileSize > MAX_JPEG_FILE_SIZE) ? NULL : fileSource.Data();
+		int nFullWidth, nFullHeight;
+		if (pBuffer != NULL && TurboJpeg::ReadImageSize(nFullWidth, nFullHeight, pBuffer, nFileSize) &&
+			(double)nFullWidth * nFullHeight >= nMinMegapixels * 1000000.0) {
+			int nWidth, nHeight, nBPP;
+			TJSAMP eChromoSubSampling;
+			bool bOutOfMemory;
+			void* pPixelData = TurboJpeg::ReadImageScaled(nWidth, nHeight, nFullWidth, nFullHeight, nBPP, eChromoSubSampling, bOutOfMemory,
+				pBuffer, nFileSize, 1, 1, true);
+			if (pPixelData != NULL && nBPP == 3) {
+				pImage = new CJPEGImage(nWidth, nHeight, pPixelData,
+					Helpers::FindEXIFBlock(pBuffer, nFileSize), nBPP, 
+					Helpers::CalculateJPEGFileHash(pBuffer, nFileSize), IF_JPEG, false, 0, 1, 0);
+				pImage->SetJPEGComment(Helpers::GetJPEGComment(pBuffer, nFileSize));
+				pImage->SetJPEGChromoSampling(eChromoSubSampling);
+				pImage->SetScaledJPEGSource(NULL, 0, nFullWidth, nFullHeight, 0);
+				pImage->SetIsPreview(true);
+				CProcessParams params = processParams;
+				pImage->SetFileDependentProcessParams(strFileName, &params);
+				if (!pImage->VerifyRotation(params.Rotation)) {
+					delete pImage;
+					pImage = NULL;
+				}
+			} else {
+				delete[] pPixelData;
+			}
+		}
+	} catch (...) {
+		delete pImage;
+		pImage = NULL;
+	}
+	return pImage;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Protected
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -230,41 +285,39 @@ void CImageLoadThread::ProcessRequest(CRequestBase& request) {
 		if (rq.FileName == m_sLastFileName) {
 			DeleteCachedGDIBitmap();
 		}
-		if (rq.FileName == m_sLastWebpFileName) {
-			DeleteCachedWebpDecoder();
-		}
-		if (rq.FileName == m_sLastPngFileName) {
-			DeleteCachedPngDecoder();
-		}
+		DeleteCachedDecodersOfFile(rq.FileName, true, true);
 		return;
 	}
 
 	CRequest& rq = (CRequest&)request;
+	if (rq.Cancel.IsCancelled()) {
+		return;
+	}
+	// the decoders and the processing thread pool check the cancel token of the thread
+	CCancelToken::CScope cancelScope(&rq.Cancel);
 	double dStartTime = Helpers::GetExactTickCount(); 
-	// Get image format and read the image
-	switch (GetImageFormat(rq.FileName)) {
+	// The file is opened once, the format is detected and the image decoded from its mapped content
+	CFileSource fileSource(rq.FileName, m_pPrefetcher);
+	switch (fileSource.GetImageFormat()) {
 		case IF_JPEG :
 			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			ProcessReadJPEGRequest(&rq);
+			DeleteCachedDecodersOfFile(rq.FileName, true, true);
+			ProcessReadJPEGRequest(&rq, fileSource);
 			break;
 		case IF_WindowsBMP :
 			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			ProcessReadBMPRequest(&rq);
+			DeleteCachedDecodersOfFile(rq.FileName, true, true);
+			ProcessReadBMPRequest(&rq, fileSource);
 			break;
 		case IF_TGA :
 			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
-			ProcessReadTGARequest(&rq);
+			DeleteCachedDecodersOfFile(rq.FileName, true, true);
+			ProcessReadTGARequest(&rq, fileSource);
 			break;
 		case IF_WEBP:
 			DeleteCachedGDIBitmap();
-			DeleteCachedPngDecoder();
-			ProcessReadWEBPRequest(&rq);
+			DeleteCachedDecodersOfFile(rq.FileName, false, true);
+			ProcessReadWEBPRequest(&rq, fileSource);
 			break;
 		/*
 		case IF_CameraRAW:
@@ -280,23 +333,22 @@ void CImageLoadThread::ProcessRequest(CRequestBase& request) {
 		*/
 		case IF_PNG:
 			DeleteCachedGDIBitmap();
-			DeleteCachedWebpDecoder();
+			DeleteCachedDecodersOfFile(rq.FileName, true, false);
 			if (CSettingsProvider::This().ForceGDIPlus()) {
-				DeleteCachedPngDecoder();
+				DeleteCachedDecodersOfFile(rq.FileName, false, true);
 				ProcessReadGDIPlusRequest(&rq);
 			} else {
-				ProcessReadPNGRequest(&rq);
+				ProcessReadPNGRequest(&rq, fileSource);
 			}
 			break;
 		default:
 			// try with GDI+
-			DeleteCachedWebpDecoder();
-			DeleteCachedPngDecoder();
+			DeleteCachedDecodersOfFile(rq.FileName, true, true);
 			ProcessReadGDIPlusRequest(&rq);
 			break;
 	}
 	// then process the image if read was successful
-	if (rq.Image != NULL) {
+	if (rq.Image != NULL && !rq.Cancel.IsCancelled()) {
 		rq.Image->SetLoadTickCount(Helpers::GetExactTickCount() - dStartTime); 
 		if (!ProcessImageAfterLoad(&rq)) {
 			delete rq.Image;
@@ -304,6 +356,13 @@ void CImageLoadThread::ProcessRequest(CRequestBase& request) {
 			rq.OutOfMemory = true;
 		}
 	}
+	if (rq.Cancel.IsCancelled()) {
+		// decoding and processing fail when cancelled, this is not an error
+		delete rq.Image;
+		rq.Image = NULL;
+		rq.OutOfMemory = false;
+		rq.ExceptionError = false;
+	}
 }
 
 // Called on the processing thread
@@ -341,83 +400,131 @@ void CImageLoadThread::DeleteCachedGDIBitmap() {
 }
 
 void CImageLoadThread::DeleteCachedWebpDecoder() {
+	Helpers::CAutoCriticalSection criticalSection(s_DecoderCacheLock.CriticalSection);
 	WebpReaderWriter::DeleteCache();
-	m_sLastWebpFileName.Empty();
+	sm_sLastWebpFileName.Empty();
 }
 
 void CImageLoadThread::DeleteCachedPngDecoder() {
+	Helpers::CAutoCriticalSection criticalSection(s_DecoderCacheLock.CriticalSection);
 	PngReader::DeleteCache();
-	m_sLastPngFileName.Empty();
+	sm_sLastPngFileName.Empty();
+}
+
+void CImageLoadThread::DeleteCachedDecodersOfFile(LPCTSTR sFileName, bool bWebp, bool bPng) {
+	Helpers::CAutoCriticalSection criticalSection(s_DecoderCacheLock.CriticalSection);
+	if (bWebp && sm_sLastWebpFileName == sFileName) {
+		DeleteCachedWebpDecoder();
+	}
+	if (bPng && sm_sLastPngFileName == sFileName) {
+		DeleteCachedPngDecoder();
+	}
 }
 
-void CImageLoadThread::ProcessReadJPEGRequest(CRequest * request) {
-	HANDLE hFile = ::CreateFile(request->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-	if (hFile == INVALID_HANDLE_VALUE) {
+void CImageLoadThread::ProcessReadJPEGRequest(CRequest * request, const CFileSource& fileSource) {
+	if (!fileSource.IsValid()) {
 		return;
 	}
 
 	HGLOBAL hFileBuffer = NULL;
-	void* pBuffer = NULL;
+	void* pBuffer = fileSource.Data();
 	try {
 		// Don't read too huge files
-		unsigned int nFileSize = ::GetFileSize(hFile, NULL);
+		unsigned int nFileSize = fileSource.Size();
 		if (nFileSize > MAX_JPEG_FILE_SIZE) {
 			request->OutOfMemory = true;
-			::CloseHandle(hFile);
-			return;
-		}
-		hFileBuffer  = ::GlobalAlloc(GMEM_MOVEABLE, nFileSize);
-		pBuffer = (hFileBuffer == NULL) ? NULL : ::GlobalLock(hFileBuffer);
-		if (pBuffer == NULL) {
-			if (hFileBuffer) ::GlobalFree(hFileBuffer);
-			request->OutOfMemory = true;
-			::CloseHandle(hFile);
 			return;
 		}
-		unsigned int nNumBytesRead;
-		if (::ReadFile(hFile, pBuffer, nFileSize, (LPDWORD) &nNumBytesRead, NULL) && nNumBytesRead == nFileSize) {
-			if (CSettingsProvider::This().ForceGDIPlus() || CSettingsProvider::This().UseEmbeddedColorProfiles()) {
-				IStream* pStream = NULL;
-				if (::CreateStreamOnHGlobal(hFileBuffer, FALSE, &pStream) == S_OK) {
-					Gdiplus::Bitmap* pBitmap = Gdiplus::Bitmap::FromStream(pStream, CSettingsProvider::This().UseEmbeddedColorProfiles());
-					bool isOutOfMemory, isAnimatedGIF;
-					request->Image = ConvertGDIPlusBitmapToJPEGImage(pBitmap, 0, Helpers::FindEXIFBlock(pBuffer, nFileSize),
-						Helpers::CalculateJPEGFileHash(pBuffer, nFileSize), isOutOfMemory, isAnimatedGIF);
-					request->OutOfMemory = request->Image == NULL && isOutOfMemory;
-					if (request->Image != NULL) {
-						request->Image->SetJPEGComment(Helpers::GetJPEGComment(pBuffer, nFileSize));
+		if (CSettingsProvider::This().ForceGDIPlus() || CSettingsProvider::This().UseEmbeddedColorProfiles()) {
+			// GDI+ needs the stream in global memory
+			IStream* pStream = NULL;
+			hFileBuffer = ::GlobalAlloc(GMEM_MOVEABLE, nFileSize);
+			void* pGlobalBuffer = (hFileBuffer == NULL) ? NULL : ::GlobalLock(hFileBuffer);
+			if (pGlobalBuffer != NULL) {
+				memcpy(pGlobalBuffer, pBuffer, nFileSize);
+				::GlobalUnlock(hFileBuffer);
+			}
+			if (pGlobalBuffer != NULL && ::CreateStreamOnHGlobal(hFileBuffer, FALSE, &pStream) == S_OK) {
+				Gdiplus::Bitmap* pBitmap = Gdiplus::Bitmap::FromStream(pStream, CSettingsProvider::This().UseEmbeddedColorProfiles());
+				bool isOutOfMemory, isAnimatedGIF;
+				request->Image = ConvertGDIPlusBitmapToJPEGImage(pBitmap, 0, Helpers::FindEXIFBlock(pBuffer, nFileSize),
+					Helpers::CalculateJPEGFileHash(pBuffer, nFileSize), isOutOfMemory, isAnimatedGIF);
+				request->OutOfMemory = request->Image == NULL && isOutOfMemory;
+				if (request->Image != NULL) {
+					request->Image->SetJPEGComment(Helpers::GetJPEGComment(pBuffer, nFileSize));
+				}
+				pStream->Release();
+				delete pBitmap;
+			} else {
+				request->OutOfMemory = true;
+			}
+		} else {
+			int nWidth, nHeight, nFullWidth, nFullHeight, nBPP;
+			TJSAMP eChromoSubSampling;
+			bool bOutOfMemory;
+			// int nTicks = ::GetTickCount();
+
+			// Decode DCT scaled if the image is much larger than the screen, the image decodes itself at full resolution
+			// when zooming in further (see CJPEGImage::SetScaledJPEGSource())
+			bool bScaledDecoding = CSettingsProvider::This().ScaledJPEGDecoding();
+			int nMinWidth = bScaledDecoding ? request->ProcessParams.TargetWidth : 0;
+			int nMinHeight = bScaledDecoding ? request->ProcessParams.TargetHeight : 0;
+
+			// Large JPEGs decoded at full resolution are kept as YCbCr planes (see CJPEGImage::SetYCbCrSource())
+			int nYCbCrMinMegapixels = CSettingsProvider::This().YCbCrMinMegapixels();
+			CYCbCrImage* pYCbCrImage = NULL;
+			void* pPixelData = NULL;
+			bOutOfMemory = false;
+			if (nYCbCrMinMegapixels > 0 && TurboJpeg::ReadImageSize(nFullWidth, nFullHeight, pBuffer, nFileSize) &&
+				(double)nFullWidth * nFullHeight >= nYCbCrMinMegapixels * 1000000.0 &&
+				TurboJpeg::ScalingDenominator(nFullWidth, nFullHeight, nMinWidth, nMinHeight) == 1) {
+				pYCbCrImage = TurboJpeg::ReadImageYCbCr(eChromoSubSampling, bOutOfMemory, pBuffer, nFileSize);
+			}
+			if (pYCbCrImage == NULL && !bOutOfMemory) {
+				pPixelData = TurboJpeg::ReadImageScaled(nWidth, nHeight, nFullWidth, nFullHeight, nBPP, eChromoSubSampling, bOutOfMemory, pBuffer, nFileSize,
+					nMinWidth, nMinHeight);
+			}
+
+			/*
+			TCHAR buffer[20];
+			_stprintf_s(buffer, 20, _T("%d"), ::GetTickCount() - nTicks);
+			::MessageBox(NULL, CString(_T("Elapsed ticks: ")) + buffer, _T("Time"), MB_OK);
+			*/
+
+			// Color and b/w JPEG is supported
+			if (pYCbCrImage != NULL) {
+				request->Image = new CJPEGImage(pYCbCrImage->Width(), pYCbCrImage->Height(), NULL,
+					Helpers::FindEXIFBlock(pBuffer, nFileSize), 3,
+					Helpers::CalculateJPEGFileHash(pBuffer, nFileSize), IF_JPEG, false, 0, 1, 0);
+				request->Image->SetYCbCrSource(pYCbCrImage);
+				request->Image->SetJPEGComment(Helpers::GetJPEGComment(pBuffer, nFileSize));
+				request->Image->SetJPEGChromoSampling(eChromoSubSampling);
+			} else if (pPixelData != NULL && (nBPP == 3 || nBPP == 1)) {
+				request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, 
+					Helpers::FindEXIFBlock(pBuffer, nFileSize), nBPP, 
+					Helpers::CalculateJPEGFileHash(pBuffer, nFileSize), IF_JPEG, false, 0, 1, 0);
+				request->Image->SetJPEGComment(Helpers::GetJPEGComment(pBuffer, nFileSize));
+				request->Image->SetJPEGChromoSampling(eChromoSubSampling);
+				if (nWidth != nFullWidth || nHeight != nFullHeight) {
+					char* pJPEGStream = new(std::nothrow) char[nFileSize];
+					if (pJPEGStream != NULL) {
+						memcpy(pJPEGStream, pBuffer, nFileSize);
+						FILETIME lastWriteTime;
+						__int64 nFileTime = ::GetFileTime(fileSource.FileHandle(), NULL, NULL, &lastWriteTime) ?
+							((__int64)lastWriteTime.dwHighDateTime << 32) | lastWriteTime.dwLowDateTime : 0;
+						request->Image->SetScaledJPEGSource(pJPEGStream, nFileSize, nFullWidth, nFullHeight, nFileTime);
+					} else {
+						delete request->Image;
+						request->Image = NULL;
+						request->OutOfMemory = true;
 					}
-					pStream->Release();
-					delete pBitmap;
-				} else {
-					request->OutOfMemory = true;
 				}
+			} else if (bOutOfMemory) {
+				request->OutOfMemory = true;
 			} else {
-				int nWidth, nHeight, nBPP;
-				TJSAMP eChromoSubSampling;
-				bool bOutOfMemory;
-				// int nTicks = ::GetTickCount();
-
-				void* pPixelData = TurboJpeg::ReadImage(nWidth, nHeight, nBPP, eChromoSubSampling, bOutOfMemory, pBuffer, nFileSize);
-
-				/*
-				TCHAR buffer[20];
-				_stprintf_s(buffer, 20, _T("%d"), ::GetTickCount() - nTicks);
-				::MessageBox(NULL, CString(_T("Elapsed ticks: ")) + buffer, _T("Time"), MB_OK);
-				*/
-
-				// Color and b/w JPEG is supported
-				if (pPixelData != NULL && (nBPP == 3 || nBPP == 1)) {
-					request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, 
-						Helpers::FindEXIFBlock(pBuffer, nFileSize), nBPP, 
-						Helpers::CalculateJPEGFileHash(pBuffer, nFileSize), IF_JPEG, false, 0, 1, 0);
-					request->Image->SetJPEGComment(Helpers::GetJPEGComment(pBuffer, nFileSize));
-					request->Image->SetJPEGChromoSampling(eChromoSubSampling);
-				} else if (bOutOfMemory) {
-					request->OutOfMemory = true;
-				} else {
+				delete[] pPixelData;
+				if (!request->Cancel.IsCancelled()) {
 					// failed, try GDI+
-					delete[] pPixelData;
 					ProcessReadGDIPlusRequest(request);
 				}
 			}
@@ -427,76 +534,65 @@ void CImageLoadThread::ProcessReadJPEGRequest(CRequest * request) {
 		request->Image = NULL;
 		request->ExceptionError = true;
 	}
-	::CloseHandle(hFile);
-	if (pBuffer) ::GlobalUnlock(hFileBuffer);
 	if (hFileBuffer) ::GlobalFree(hFileBuffer);
 }
 
-void CImageLoadThread::ProcessReadPNGRequest(CRequest* request) {
+void CImageLoadThread::ProcessReadPNGRequest(CRequest* request, const CFileSource& fileSource) {
 	bool bSuccess = false;
-	bool bUseCachedDecoder = false;
+	bool bUseCachedDecoder;
 	const wchar_t* sFileName;
 	sFileName = (const wchar_t*)request->FileName;
-	if (sFileName != m_sLastPngFileName) {
-		DeleteCachedPngDecoder();
-	}
-	else {
-		bUseCachedDecoder = true;
+	{
+		Helpers::CAutoCriticalSection criticalSection(s_DecoderCacheLock.CriticalSection);
+		bUseCachedDecoder = sFileName == sm_sLastPngFileName;
 	}
 
-	HANDLE hFile;
-	if (!bUseCachedDecoder) {
-		hFile = ::CreateFile(request->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-		if (hFile == INVALID_HANDLE_VALUE) {
-			return;
-		}
+	if (!bUseCachedDecoder && !fileSource.IsValid()) {
+		return;
 	}
-	char* pBuffer = NULL;
 	try {
-		unsigned int nFileSize;
-		unsigned int nNumBytesRead;
-		if (!bUseCachedDecoder) {
+		unsigned int nFileSize = 0;
+		void* pBuffer = NULL;
+		if (fileSource.IsValid()) {
 			// Don't read too huge files
-			nFileSize = ::GetFileSize(hFile, NULL);
+			nFileSize = fileSource.Size();
 			if (nFileSize > MAX_PNG_FILE_SIZE) {
-				::CloseHandle(hFile);
-				return ProcessReadGDIPlusRequest(request);
-			}
-
-			pBuffer = new(std::nothrow) char[nFileSize];
-			if (pBuffer == NULL) {
-				::CloseHandle(hFile);
 				return ProcessReadGDIPlusRequest(request);
 			}
+			pBuffer = fileSource.Data();
 		}
-		else {
-			nFileSize = 0; // to avoid compiler warnings, not used
-		}
-		if (bUseCachedDecoder || (::ReadFile(hFile, pBuffer, nFileSize, (LPDWORD)&nNumBytesRead, NULL) && nNumBytesRead == nFileSize)) {
-			int nWidth, nHeight, nBPP, nFrameCount, nFrameTimeMs;
-			bool bHasAnimation;
-			uint8* pPixelData = NULL;
-			void* pEXIFData;
-
-			// If UseEmbeddedColorProfiles is true and the image isn't animated, we should use GDI+ for better color management
-			if (bUseCachedDecoder || !CSettingsProvider::This().UseEmbeddedColorProfiles() || PngReader::IsAnimated(pBuffer, nFileSize))
-				pPixelData = (uint8*)PngReader::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory, pBuffer, nFileSize);
-
-			if (pPixelData != NULL) {
-				if (bHasAnimation)
-					m_sLastPngFileName = sFileName;
-				// Multiply alpha value into each AABBGGRR pixel
-				uint32* pImage32 = (uint32*)pPixelData;
-				for (int i = 0; i < nWidth * nHeight; i++)
-					*pImage32++ = Helpers::AlphaBlendBackground(*pImage32, CSettingsProvider::This().ColorTransparency());
-
-				request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, 4, 0, IF_PNG, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
-				free(pEXIFData);
-				bSuccess = true;
+		int nWidth, nHeight, nBPP, nFrameCount, nFrameTimeMs;
+		bool bHasAnimation;
+		uint8* pPixelData = NULL;
+		void* pEXIFData;
+
+		if (bUseCachedDecoder || PngReader::IsAnimated(pBuffer, nFileSize)) {
+			// The decoder of an animated PNG is kept to read the next frame, it is shared by all load threads. Only these
+			// decodes are serialized, the cached decoder may have been replaced by another thread in the meantime.
+			Helpers::CAutoCriticalSection criticalSection(s_DecoderCacheLock.CriticalSection);
+			if (sFileName != sm_sLastPngFileName) {
+				DeleteCachedPngDecoder();
 			}
-			else {
+			pPixelData = (uint8*)PngReader::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory, pBuffer, nFileSize, true);
+			if (pPixelData != NULL && bHasAnimation) {
+				sm_sLastPngFileName = sFileName;
+			} else {
 				DeleteCachedPngDecoder();
 			}
+		} else if (!CSettingsProvider::This().UseEmbeddedColorProfiles()) {
+			// If UseEmbeddedColorProfiles is true and the image isn't animated, we should use GDI+ for better color management
+			pPixelData = (uint8*)PngReader::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory, pBuffer, nFileSize, false);
+		}
+
+		if (pPixelData != NULL) {
+			// Multiply alpha value into each AABBGGRR pixel
+			uint32* pImage32 = (uint32*)pPixelData;
+			for (int i = 0; i < nWidth * nHeight; i++)
+				*pImage32++ = Helpers::AlphaBlendBackground(*pImage32, CSettingsProvider::This().ColorTransparency());
+
+			request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, 4, 0, IF_PNG, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
+			free(pEXIFData);
+			bSuccess = true;
 		}
 	}
 	catch (...) {
@@ -504,17 +600,20 @@ void CImageLoadThread::ProcessReadPNGRequest(CRequest* request) {
 		// request->Image = NULL;
 		request->ExceptionError = true;
 	}
-	if (!bUseCachedDecoder) {
-		::CloseHandle(hFile);
-		delete[] pBuffer;
-	}
 	if (!bSuccess)
 		return ProcessReadGDIPlusRequest(request);
 }
 
-void CImageLoadThread::ProcessReadBMPRequest(CRequest * request) {
-	bool bOutOfMemory;
-	request->Image = CReaderBMP::ReadBmpImage(request->FileName, bOutOfMemory);
+void CImageLoadThread::ProcessReadBMPRequest(CRequest * request, const CFileSource& fileSource) {
+	bool bOutOfMemory = false;
+	try {
+		request->Image = CReaderBMP::ReadBmpImage(fileSource.Data(), fileSource.Size(), bOutOfMemory);
+	} catch (...) {
+		delete request->Image;
+		request->Image = NULL;
+		request->ExceptionError = true;
+		return;
+	}
 	if (bOutOfMemory) {
 		request->OutOfMemory = true;
 	} else if (request->Image == NULL) {
@@ -523,85 +622,85 @@ void CImageLoadThread::ProcessReadBMPRequest(CRequest * request) {
 	}
 }
 
-void CImageLoadThread::ProcessReadTGARequest(CRequest * request) {
-	bool bOutOfMemory;
-	request->Image = CReaderTGA::ReadTgaImage(request->FileName, CSettingsProvider::This().ColorBackground(), bOutOfMemory);
+void CImageLoadThread::ProcessReadTGARequest(CRequest * request, const CFileSource& fileSource) {
+	bool bOutOfMemory = false;
+	try {
+		request->Image = CReaderTGA::ReadTgaImage(fileSource.Data(), fileSource.Size(), CSettingsProvider::This().ColorBackground(), bOutOfMemory);
+	} catch (...) {
+		delete request->Image;
+		request->Image = NULL;
+		request->ExceptionError = true;
+		return;
+	}
 	if (bOutOfMemory) {
 		request->OutOfMemory = true;
 	}
 }
 
-void CImageLoadThread::ProcessReadWEBPRequest(CRequest * request) {
-	bool bUseCachedDecoder = false;
+void CImageLoadThread::ProcessReadWEBPRequest(CRequest * request, const CFileSource& fileSource) {
+	bool bUseCachedDecoder;
 	const wchar_t* sFileName;
 	sFileName = (const wchar_t*)request->FileName;
-	if (sFileName != m_sLastWebpFileName) {
-		DeleteCachedWebpDecoder();
-	}
-	else {
-		bUseCachedDecoder = true;
+	{
+		Helpers::CAutoCriticalSection criticalSection(s_DecoderCacheLock.CriticalSection);
+		bUseCachedDecoder = sFileName == sm_sLastWebpFileName;
 	}
 
-	HANDLE hFile;
-	if (!bUseCachedDecoder) {
-		hFile = ::CreateFile(request->FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
-		if (hFile == INVALID_HANDLE_VALUE) {
-			return;
-		}
+	if (!bUseCachedDecoder && !fileSource.IsValid()) {
+		return;
 	}
-	char* pBuffer = NULL;
 	try {
 		unsigned int nFileSize = 0;
-		unsigned int nNumBytesRead;
-		if (!bUseCachedDecoder) {
+		void* pBuffer = NULL;
+		if (fileSource.IsValid()) {
 			// Don't read too huge files
-			nFileSize = ::GetFileSize(hFile, NULL);
+			nFileSize = fileSource.Size();
 			if (nFileSize > MAX_WEBP_FILE_SIZE) {
 				request->OutOfMemory = true;
-				::CloseHandle(hFile);
-				return;
-			}
-
-			pBuffer = new(std::nothrow) char[nFileSize];
-			if (pBuffer == NULL) {
-				request->OutOfMemory = true;
-				::CloseHandle(hFile);
 				return;
 			}
+			pBuffer = fileSource.Data();
 		}
-		if (bUseCachedDecoder || (::ReadFile(hFile, pBuffer, nFileSize, (LPDWORD)&nNumBytesRead, NULL) && nNumBytesRead == nFileSize)) {
-			int nWidth, nHeight;
-			bool bHasAnimation = bUseCachedDecoder;
-			int nFrameCount = 1;
-			int nFrameTimeMs = 0;
-			int nBPP;
-			void* pEXIFData;
-			uint8* pPixelData = (uint8*)WebpReaderWriter::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory, pBuffer, nFileSize);
-			if (pPixelData && nBPP == 4) {
-				// Multiply alpha value into each AABBGGRR pixel
-				uint32* pImage32 = (uint32*)pPixelData;
-				for (int i = 0; i < nWidth * nHeight; i++)
-					*pImage32++ = Helpers::AlphaBlendBackground(*pImage32, CSettingsProvider::This().ColorTransparency());
-
-				if (bHasAnimation) {
-					m_sLastWebpFileName = sFileName;
-				}
-				request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, nBPP, 0, IF_WEBP, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
-				free(pEXIFData);
+		int nWidth, nHeight;
+		bool bHasAnimation = false;
+		int nFrameCount = 1;
+		int nFrameTimeMs = 0;
+		int nBPP;
+		void* pEXIFData;
+		uint8* pPixelData;
+		if (bUseCachedDecoder || WebpReaderWriter::IsAnimated(pBuffer, nFileSize)) {
+			// The decoder of an animated WebP is kept to read the next frame, it is shared by all load threads. Only these
+			// decodes are serialized, the cached decoder may have been replaced by another thread in the meantime.
+			Helpers::CAutoCriticalSection criticalSection(s_DecoderCacheLock.CriticalSection);
+			bHasAnimation = sFileName == sm_sLastWebpFileName;
+			if (!bHasAnimation) {
+				DeleteCachedWebpDecoder();
 			}
-			else {
-				delete[] pPixelData;
+			pPixelData = (uint8*)WebpReaderWriter::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory, pBuffer, nFileSize, true);
+			if (pPixelData != NULL && nBPP == 4 && bHasAnimation) {
+				sm_sLastWebpFileName = sFileName;
+			} else {
 				DeleteCachedWebpDecoder();
 			}
+		} else {
+			pPixelData = (uint8*)WebpReaderWriter::ReadImage(nWidth, nHeight, nBPP, bHasAnimation, nFrameCount, nFrameTimeMs, pEXIFData, request->OutOfMemory, pBuffer, nFileSize, false);
+		}
+		if (pPixelData && nBPP == 4) {
+			// Multiply alpha value into each AABBGGRR pixel
+			uint32* pImage32 = (uint32*)pPixelData;
+			for (int i = 0; i < nWidth * nHeight; i++)
+				*pImage32++ = Helpers::AlphaBlendBackground(*pImage32, CSettingsProvider::This().ColorTransparency());
+
+			request->Image = new CJPEGImage(nWidth, nHeight, pPixelData, pEXIFData, nBPP, 0, IF_WEBP, bHasAnimation, request->FrameIndex, nFrameCount, nFrameTimeMs);
+			free(pEXIFData);
+		}
+		else {
+			delete[] pPixelData;
 		}
 	} catch (...) {
 		delete request->Image;
 		request->Image = NULL;
 	}
-	if (!bUseCachedDecoder) {
-		::CloseHandle(hFile);
-		delete[] pBuffer;
-	}
 }
 /*
 void CImageLoadThread::ProcessReadRAWRequest(CRequest * request) {
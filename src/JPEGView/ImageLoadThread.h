@@ -6,6 +6,8 @@
 #include <gdiplus.h>
 
 class CJPEGImage;
+class CFileSource;
+class CFilePrefetcher;
 
 // returned image data by CImageLoadThread.GetLoadedImage() method
 class CImageData
@@ -29,7 +31,8 @@ public:
 class CImageLoadThread : public CWorkThread
 {
 public:
-	CImageLoadThread(void);
+	// pPrefetcher: Prefetcher to take the content of prefetched files from, can be NULL
+	CImageLoadThread(CFilePrefetcher* pPrefetcher = NULL);
 	~CImageLoadThread(void);
 
 	// Asynchronous loading  of an image. The message WM_IMAGE_LOAD_COMPLETED is
@@ -38,7 +41,9 @@ public:
 	// received or the event has been signaled.
 	// The file to load is given by its filename (with path) and the frame index (for multiframe images). The
 	// frame index needs to be zero when the image only has one frame.
-	int AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished);
+	// Background loads (read ahead) give way to interactive image processing, see CCancelToken::IsBackground().
+	int AsyncLoad(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams, HWND targetWnd, HANDLE eventFinished,
+		bool bBackground = false);
 
 	// Get loaded image, CImageData::Image is null if not (yet) available - use handle returned by AsyncLoad().
 	// Call after having received the WM_IMAGE_LOAD_COMPLETED message to retrieve the loaded image.
@@ -48,9 +53,22 @@ public:
 	// Releases the cached image file if an image of the specified name is cached
 	void ReleaseFile(LPCTSTR strFileName);
 
+	// Cancels the request with the given handle (returned by AsyncLoad()). Decoding and processing stop at the next check
+	// of the cancel token, the request finishes as usual but without image.
+	void CancelLoad(int nHandle);
+
+	// Makes a background load with the given handle an interactive one, e.g. when the user navigates to an image
+	// still loading by read ahead.
+	void PromoteLoad(int nHandle);
+
 	// Gets the request handle value used for the last request
 	static int GetCurHandleValue() { return m_curHandle; }
 
+	// Synchronously loads a low resolution preview of a large JPEG: A 1/8 scaled fast DCT decode, processed as after
+	// loading (e.g. EXIF rotation). The preview has the size of the full image. Returns NULL if the file is not a JPEG
+	// or too small to be worth a preview (see INI setting PreviewMinMegapixels).
+	static CJPEGImage* LoadPreview(LPCTSTR strFileName, const CProcessParams & processParams);
+
 private:
 
 	// Request for loading an image
@@ -75,6 +93,7 @@ private:
 		CProcessParams ProcessParams;
 		bool OutOfMemory;
 		bool ExceptionError;  // an unhandled exception caused the load to fail
+		CCancelToken Cancel; // current cancel token of the thread while processing the request
 	};
 
 	// Request to release image file
@@ -94,20 +113,24 @@ private:
 
 	Gdiplus::Bitmap* m_pLastBitmap; // Last read GDI+ bitmap, cached to speed up GIF animations
 	CString m_sLastFileName; // Only for GDI+ files
-	CString m_sLastWebpFileName; // Only for animated WebP files
-	CString m_sLastPngFileName; // Only for animated PNG files
+	static CString sm_sLastWebpFileName; // Only for animated WebP files, the cached decoder is shared by all load threads
+	static CString sm_sLastPngFileName; // Only for animated PNG files, the cached decoder is shared by all load threads
+	CFilePrefetcher* m_pPrefetcher; // not owned, can be NULL
 
 	virtual void ProcessRequest(CRequestBase& request);
 	virtual void AfterFinishProcess(CRequestBase& request);
 	void DeleteCachedGDIBitmap();
 	void DeleteCachedWebpDecoder();
 	void DeleteCachedPngDecoder();
-
-	void ProcessReadJPEGRequest(CRequest * request);
-	void ProcessReadPNGRequest(CRequest * request);
-	void ProcessReadBMPRequest(CRequest * request);
-	void ProcessReadTGARequest(CRequest * request);
-	void ProcessReadWEBPRequest(CRequest * request);
+	// Deletes the cached animation decoders if they belong to the given file. Decoders of other files are kept, another
+	// load thread may be animating them.
+	void DeleteCachedDecodersOfFile(LPCTSTR sFileName, bool bWebp, bool bPng);
+
+	void ProcessReadJPEGRequest(CRequest * request, const CFileSource& fileSource);
+	void ProcessReadPNGRequest(CRequest * request, const CFileSource& fileSource);
+	void ProcessReadBMPRequest(CRequest * request, const CFileSource& fileSource);
+	void ProcessReadTGARequest(CRequest * request, const CFileSource& fileSource);
+	void ProcessReadWEBPRequest(CRequest * request, const CFileSource& fileSource);
 	void ProcessReadRAWRequest(CRequest * request);
 	void ProcessReadGDIPlusRequest(CRequest * request);
     //void ProcessReadWICRequest(CRequest* request);
@@ -4,6 +4,11 @@
 #include "XMMImage.h"
 #include "Helpers.h"
 #include "SettingsProvider.h"
+#include "TileCache.h"
+#include "TiledPixelStore.h"
+#include "JPEGIndex.h"
+#include "YCbCrImage.h"
+#include "TJPEGWrapper.h"
 //#include "HistogramCorr.h"
 //#include "LocalDensityCorr.h"
 //#include "ParameterDB.h"
@@ -32,6 +37,8 @@ static bool SupportsSIMD(Helpers::CPUType cpuType) {
 	{
 	case Helpers::CPU_SSE:
 	case Helpers::CPU_AVX2:
+	case Helpers::CPU_AVX2_FMA:
+	case Helpers::CPU_AVX512:
 		return true;
 	default:
 		return false;
@@ -45,6 +52,10 @@ static CBasicProcessing::SIMDArchitecture ToSIMDArchitecture(Helpers::CPUType cp
 		return CBasicProcessing::SSE;
 	case Helpers::CPU_AVX2:
 		return CBasicProcessing::AVX2;
+	case Helpers::CPU_AVX2_FMA:
+		return CBasicProcessing::AVX2_FMA;
+	case Helpers::CPU_AVX512:
+		return CBasicProcessing::AVX512;
 	default:
 		assert(false);
 		return (CBasicProcessing::SIMDArchitecture)(-1);
@@ -99,9 +110,21 @@ CJPEGImage::CJPEGImage(int nWidth, int nHeight, void* pPixels, void* pEXIFData,
 
 	m_nOrigWidth = m_nInitOrigWidth = nWidth;
 	m_nOrigHeight = m_nInitOrigHeight = nHeight;
+	m_nPixelWidth = nWidth;
+	m_nPixelHeight = nHeight;
+	m_pJPEGStream = NULL;
+	m_nJPEGStreamSize = 0;
+	m_pRegionStore = NULL;
+	m_bRegionValid = false;
+	m_pJPEGIndex = NULL;
+	m_bJPEGIndexPending = false;
+	m_nJPEGFileTime = 0;
+	m_pYCbCrImage = NULL;
 	m_pDIBPixels = NULL;
 	m_pDIBPixelsLUTProcessed = NULL;
 	m_pLastDIB = NULL;
+	memset(m_pPyramid, 0, sizeof(m_pPyramid));
+	m_pTileCache = new CTileCache();
 //	m_pThumbnail = NULL;
 //	m_pHistogramThumbnail = NULL;
 //	m_pGrayImage = NULL;
@@ -123,6 +146,7 @@ CJPEGImage::CJPEGImage(int nWidth, int nHeight, void* pPixels, void* pEXIFData,
 //	m_bHasZoomStoredInParamDB = false;
 //	m_bUnsharpMaskParamsValid = false;
 	m_bIsThumbnailImage = bIsThumbnailImage;
+	m_bIsPreview = false;
 //	m_pCachedProcessedHistogram = NULL;
 
 	m_bCropped = false;
@@ -161,6 +185,9 @@ CJPEGImage::~CJPEGImage(void) {
 	m_pDIBPixels = NULL;
 	delete[] m_pDIBPixelsLUTProcessed;
 	m_pDIBPixelsLUTProcessed = NULL;
+	FreePyramid();
+	delete m_pTileCache;
+	m_pTileCache = NULL;
 //	delete[] m_pGrayImage;
 //	m_pGrayImage = NULL;
 //	delete[] m_pSmoothGrayImage;
@@ -174,6 +201,14 @@ CJPEGImage::~CJPEGImage(void) {
 //	if (m_bLDCOwned) delete m_pLDC;
 //	m_pLDC = NULL;
 	m_pLastDIB = NULL;
+	delete[] m_pJPEGStream;
+	m_pJPEGStream = NULL;
+	delete m_pRegionStore;
+	m_pRegionStore = NULL;
+	delete m_pJPEGIndex;
+	m_pJPEGIndex = NULL;
+	delete m_pYCbCrImage;
+	m_pYCbCrImage = NULL;
 	delete[] m_pEXIFData;
 	m_pEXIFData = NULL;
 	delete m_pEXIFReader;
@@ -190,131 +225,104 @@ CJPEGImage::~CJPEGImage(void) {
 //	m_pRawMetadata = NULL;
 }
 
-void CJPEGImage::ResampleWithPan(void* & pDIBPixels, void* & pDIBPixelsLUTProcessed, CSize fullTargetSize, 
-								 CSize clippingSize, CPoint targetOffset, CRect oldClippingRect,
-								 EProcessingFlags eProcFlags, EResizeType eResizeType) {
-	CPoint oldOffset = oldClippingRect.TopLeft();
-	CSize oldSize = oldClippingRect.Size();
-	CRect newClippingRect = CRect(targetOffset, clippingSize);
-	CRect sourceRect;
-	if (sourceRect.IntersectRect(oldClippingRect, newClippingRect)) {
-		// there is an intersection, reuse the non LUT processed DIB
-		sourceRect.OffsetRect(-oldOffset.x, -oldOffset.y);
-		CRect targetRect = CRect(CPoint(max(0, oldOffset.x - newClippingRect.left), max(0, oldOffset.y - newClippingRect.top)), 
-			CSize(sourceRect.Width(), sourceRect.Height()));
-
-		bool bCanUseLUTProcDIB = ApplyCorrectionLUTandLDC(eProcFlags, pDIBPixelsLUTProcessed, fullTargetSize,
-			targetOffset, pDIBPixels, clippingSize, false, true, false) != NULL;
-
-		// the LUT processed pixels cannot be used and the original pixels are not available -
-		// full recreation of DIBs is needed
-		if (!bCanUseLUTProcDIB && pDIBPixels == NULL) {
-			delete[] pDIBPixelsLUTProcessed; pDIBPixelsLUTProcessed = NULL;
-			return;
-		}
+void* CJPEGImage::ResampleTiled(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, EProcessingFlags eProcFlags, EResizeType eResizeType) {
+	CRect clippingRect(targetOffset, clippingSize);
+	if (clippingRect.left < 0 || clippingRect.top < 0 || clippingRect.right > fullTargetSize.cx || clippingRect.bottom > fullTargetSize.cy) {
+		return Resample(fullTargetSize, clippingSize, targetOffset, eProcFlags, eResizeType);
+	}
 
-		// Copy the reusable part of original DIB pixels
-		void* pPannedPixels = (bCanUseLUTProcDIB == false) ? 
-			CBasicProcessing::CopyRect32bpp(NULL, pDIBPixels, clippingSize, targetRect, oldSize, sourceRect) :
-			NULL;
-
-		// get rid of original DIB, will we recreated automatically when needed
-		delete[] pDIBPixels; pDIBPixels = NULL;
-
-		// Copy the reusable part of processed DIB pixels
-		void* pPannedPixelsLUTProcessed = bCanUseLUTProcDIB ? 
-			CBasicProcessing::CopyRect32bpp(NULL, pDIBPixelsLUTProcessed, clippingSize, targetRect, oldSize, sourceRect) :
-			NULL;
-
-		// Delete old LUT processed DIB, we copied the part that can be reused to a new DIB (pPannedPixelsLUTProcessed)
-		delete[] pDIBPixelsLUTProcessed; pDIBPixelsLUTProcessed = NULL;
-
-		if (targetRect.top > 0) {
-			CSize clipSize(clippingSize.cx, targetRect.top);
-			void* pTop = Resample(fullTargetSize, clipSize, targetOffset, eProcFlags, eResizeType);
-			
-			if (!bCanUseLUTProcDIB) {
-				CBasicProcessing::CopyRect32bpp(pPannedPixels, pTop,
-					clippingSize, CRect(CPoint(0, 0), clipSize),
-					clipSize, CRect(CPoint(0, 0), clipSize));
-			} else {
-				void* pTopProc = NULL;
-				ApplyCorrectionLUTandLDC(eProcFlags, pTopProc, fullTargetSize, targetOffset, pTop, clipSize, false, false, false);
-				CBasicProcessing::CopyRect32bpp(pPannedPixelsLUTProcessed, pTopProc,
-					clippingSize, CRect(CPoint(0, 0), clipSize),
-					clipSize, CRect(CPoint(0, 0), clipSize));
-				delete[] pTopProc;
-			}
+	// If neither the region nor the full resolution image could be decoded (e.g. out of memory), Resample() upsamples
+	// the DCT scaled pixels. The tile key does not contain the source, so these tiles are not cached.
+	bool bScaledFallback = m_pJPEGStream != NULL && !(m_pRegionStore != NULL && m_bRegionValid) &&
+		(fullTargetSize.cx > m_nPixelWidth || fullTargetSize.cy > m_nPixelHeight);
+	if (bScaledFallback) {
+		return Resample(fullTargetSize, clippingSize, targetOffset, eProcFlags, eResizeType);
+	}
 
-			delete[] pTop;
-		}
-		if (targetRect.bottom < clippingSize.cy)
-			{
-			CSize clipSize(clippingSize.cx, clippingSize.cy -  targetRect.bottom);
-			CPoint offset(targetOffset.x, targetOffset.y + targetRect.bottom);
-			void* pBottom = Resample(fullTargetSize, clipSize, offset, eProcFlags, eResizeType);
-			
-			if (!bCanUseLUTProcDIB) {
-				CBasicProcessing::CopyRect32bpp(pPannedPixels, pBottom,
-					clippingSize, CRect(CPoint(0, targetRect.bottom), clipSize),
-					clipSize, CRect(CPoint(0, 0), clipSize));
-			} else {
-				void* pBottomProc = NULL;
-				ApplyCorrectionLUTandLDC(eProcFlags, pBottomProc, fullTargetSize, offset, pBottom, clipSize, false, false, false);
-				CBasicProcessing::CopyRect32bpp(pPannedPixelsLUTProcessed, pBottomProc,
-					clippingSize, CRect(CPoint(0, targetRect.bottom), clipSize),
-					clipSize, CRect(CPoint(0, 0), clipSize));
-				delete[] pBottomProc;
+	// same condition as in Resample(), tiles of all other resize types are point sampled
+	EFilterType filter = CSettingsProvider::This().DownsamplingFilter();
+	bool bHighQuality = GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling) && eResizeType != NoResize && filter > 0;
+
+	int nFirstTileX = clippingRect.left / TILE_CACHE_TILE_SIZE;
+	int nLastTileX = (clippingRect.right - 1) / TILE_CACHE_TILE_SIZE;
+	int nFirstTileY = clippingRect.top / TILE_CACHE_TILE_SIZE;
+	int nLastTileY = (clippingRect.bottom - 1) / TILE_CACHE_TILE_SIZE;
+
+	// Resample the missing tiles. Consecutive tile rows missing the same span of tiles are merged into one rectangle
+	// and resampled at once, so the thread pool can process them in parallel.
+	int nSpanFirstY = -1, nSpanFirstX = 0, nSpanLastX = 0;
+	for (int nTileY = nFirstTileY; nTileY <= nLastTileY + 1; nTileY++) {
+		int nMissingFirstX = nLastTileX + 1, nMissingLastX = -1;
+		for (int nTileX = nFirstTileX; nTileX <= nLastTileX && nTileY <= nLastTileY; nTileX++) {
+			if (m_pTileCache->GetTile(fullTargetSize, bHighQuality, filter, nTileX, nTileY) == NULL) {
+				nMissingFirstX = min(nMissingFirstX, nTileX);
+				nMissingLastX = nTileX;
 			}
-
-			delete[] pBottom;
 		}
-		if (targetRect.left > 0) {
-			CSize clipSize(targetRect.left, clippingSize.cy);
-			void* pLeft = Resample(fullTargetSize, clipSize, targetOffset, eProcFlags, eResizeType);
-			
-			if (!bCanUseLUTProcDIB) {
-				CBasicProcessing::CopyRect32bpp(pPannedPixels, pLeft,
-					clippingSize, CRect(CPoint(0, 0), clipSize),
-					clipSize, CRect(CPoint(0, 0), clipSize));
-			} else {
-				void* pLeftProc = NULL;
-				ApplyCorrectionLUTandLDC(eProcFlags, pLeftProc, fullTargetSize, targetOffset, pLeft, clipSize, false, false, false);
-				CBasicProcessing::CopyRect32bpp(pPannedPixelsLUTProcessed, pLeftProc,
-					clippingSize, CRect(CPoint(0, 0), clipSize),
-					clipSize, CRect(CPoint(0, 0), clipSize));
-				delete[] pLeftProc;
+		if (nSpanFirstY >= 0 && (nMissingFirstX != nSpanFirstX || nMissingLastX != nSpanLastX)) {
+			if (!ResampleTiles(fullTargetSize, CRect(nSpanFirstX, nSpanFirstY, nSpanLastX + 1, nTileY), bHighQuality, filter, eProcFlags, eResizeType)) {
+				return NULL;
 			}
-
-			delete[] pLeft;
+			nSpanFirstY = -1;
 		}
-		if (targetRect.right < clippingSize.cx) {
-			CSize clipSize(clippingSize.cx -  targetRect.right, clippingSize.cy);
-			CPoint offset(targetOffset.x + targetRect.right, targetOffset.y);
-			void* pRight = Resample(fullTargetSize, clipSize, offset, eProcFlags, eResizeType);
-			
-			if (!bCanUseLUTProcDIB) {
-				CBasicProcessing::CopyRect32bpp(pPannedPixels, pRight,
-					clippingSize, CRect(CPoint(targetRect.right, 0), clipSize),
-					clipSize, CRect(CPoint(0, 0), clipSize));
-			} else {
-				void* pRigthProc = NULL;
-				ApplyCorrectionLUTandLDC(eProcFlags, pRigthProc, fullTargetSize, offset, pRight, clipSize, false, false, false);
-				CBasicProcessing::CopyRect32bpp(pPannedPixelsLUTProcessed, pRigthProc,
-					clippingSize, CRect(CPoint(targetRect.right, 0), clipSize),
-					clipSize, CRect(CPoint(0, 0), clipSize));
-				delete[] pRigthProc;
-			}
+		if (nSpanFirstY < 0 && nMissingLastX >= 0) {
+			nSpanFirstY = nTileY;
+			nSpanFirstX = nMissingFirstX;
+			nSpanLastX = nMissingLastX;
+		}
+	}
 
-			delete[] pRight;
+	// compose the DIB from the tiles
+	uint32* pTarget = new(std::nothrow) uint32[clippingSize.cx * clippingSize.cy];
+	if (pTarget == NULL) return NULL;
+	for (int nTileY = nFirstTileY; nTileY <= nLastTileY; nTileY++) {
+		for (int nTileX = nFirstTileX; nTileX <= nLastTileX; nTileX++) {
+			const void* pTile = m_pTileCache->GetTile(fullTargetSize, bHighQuality, filter, nTileX, nTileY);
+			if (pTile == NULL) {
+				delete[] pTarget;
+				return NULL;
+			}
+			CSize tileSize = CTileCache::TileSize(fullTargetSize, nTileX, nTileY);
+			CRect tileRect(CPoint(nTileX * TILE_CACHE_TILE_SIZE, nTileY * TILE_CACHE_TILE_SIZE), tileSize);
+			CRect visibleRect;
+			visibleRect.IntersectRect(tileRect, clippingRect);
+			CRect targetRect = visibleRect;
+			targetRect.OffsetRect(-clippingRect.left, -clippingRect.top);
+			visibleRect.OffsetRect(-tileRect.left, -tileRect.top);
+			CBasicProcessing::CopyRect32bpp(pTarget, pTile, clippingSize, targetRect, tileSize, visibleRect);
 		}
-		pDIBPixels = pPannedPixels;
-		pDIBPixelsLUTProcessed = pPannedPixelsLUTProcessed;
-		return;
 	}
 
-	delete[] pDIBPixels; pDIBPixels = NULL;
-	delete[] pDIBPixelsLUTProcessed; pDIBPixelsLUTProcessed = NULL;
+	m_pTileCache->Trim((__int64)CSettingsProvider::This().TileCacheMB() * 1024 * 1024);
+	return pTarget;
+}
+
+bool CJPEGImage::ResampleTiles(CSize fullTargetSize, CRect tiles, bool bHighQuality, EFilterType eFilter, EProcessingFlags eProcFlags, EResizeType eResizeType) {
+	CPoint offset(tiles.left * TILE_CACHE_TILE_SIZE, tiles.top * TILE_CACHE_TILE_SIZE);
+	CSize size(min(tiles.right * TILE_CACHE_TILE_SIZE, fullTargetSize.cx) - offset.x,
+		min(tiles.bottom * TILE_CACHE_TILE_SIZE, fullTargetSize.cy) - offset.y);
+	void* pDIB = Resample(fullTargetSize, size, offset, eProcFlags, eResizeType);
+	if (pDIB == NULL) return false;
+
+	bool bSuccess = true;
+	for (int nTileY = tiles.top; nTileY < tiles.bottom && bSuccess; nTileY++) {
+		for (int nTileX = tiles.left; nTileX < tiles.right; nTileX++) {
+			// the span may contain tiles that are already cached
+			if (m_pTileCache->GetTile(fullTargetSize, bHighQuality, eFilter, nTileX, nTileY) != NULL) {
+				continue;
+			}
+			CSize tileSize = CTileCache::TileSize(fullTargetSize, nTileX, nTileY);
+			CPoint tileOffset(nTileX * TILE_CACHE_TILE_SIZE - offset.x, nTileY * TILE_CACHE_TILE_SIZE - offset.y);
+			void* pTile = CBasicProcessing::CopyRect32bpp(NULL, pDIB, tileSize, CRect(CPoint(0, 0), tileSize), size, CRect(tileOffset, tileSize));
+			if (pTile == NULL) {
+				bSuccess = false;
+				break;
+			}
+			m_pTileCache->AddTile(fullTargetSize, bHighQuality, eFilter, nTileX, nTileY, pTile);
+		}
+	}
+	delete[] pDIB;
+	return bSuccess;
 }
 
 void* CJPEGImage::Resample(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, EProcessingFlags eProcFlags, EResizeType eResizeType)
@@ -325,14 +333,42 @@ void* CJPEGImage::Resample(CSize fullTargetSize, CSize clippingSize, CPoint targ
 	if (fullTargetSize.cx > 65535 || fullTargetSize.cy > 65535)
 		return NULL;
 
+	// beyond the size of the DCT scaled pixels, the full resolution tiles decoded by DecodeRegion() are the source
+	CSize sourceSize(m_nPixelWidth, m_nPixelHeight);
+	const void* pSource = m_pOrigPixels;
+	int nChannels = m_nOriginalChannels;
+	// (only if they have been made resident for this clipping rectangle, else the DCT scaled pixels are upsampled)
+	bool bRegion = m_pJPEGStream != NULL && m_pRegionStore != NULL && m_bRegionValid &&
+		(fullTargetSize.cx > m_nPixelWidth || fullTargetSize.cy > m_nPixelHeight);
+	if (bRegion) {
+		sourceSize = CSize(m_nOrigWidth, m_nOrigHeight);
+		pSource = m_pRegionStore->Pixels();
+		nChannels = 4;
+	}
+
+	// YCbCr planes are converted row by row by the SIMD resamplers and point sampling and cropped without resizing,
+	// the other methods need the BGR image
+	bool bHighQuality = GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling) && eResizeType != NoResize && filter > 0;
+	if (m_pYCbCrImage != NULL && !bRegion) {
+		if (eResizeType == NoResize) {
+			return m_pYCbCrImage->ConvertToBGRA(CRect(targetOffset, clippingSize));
+		} else if (!bHighQuality || SupportsSIMD(cpu)) {
+			pSource = m_pYCbCrImage;
+			nChannels = YCBCR_IMAGE_CHANNELS;
+		} else if (ConvertYCbCrToBGR()) {
+			pSource = m_pOrigPixels;
+			nChannels = m_nOriginalChannels;
+		} else {
+			return NULL;
+		}
+	}
+
 	/*GF*/	TCHAR debugtext[512];
 
 	/*GF*/	swprintf(debugtext,255,TEXT("eResizeType: %d",eResizeType));
 	/*GF*/	::OutputDebugStringW(debugtext);
 				
-	if (GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling)
-		&& !(eResizeType == NoResize)
-		&& (filter>0))
+	if (bHighQuality)
 		{
 		if (SupportsSIMD(cpu))
 			{
@@ -340,24 +376,28 @@ void* CJPEGImage::Resample(CSize fullTargetSize, CSize clippingSize, CPoint targ
 				{
 				/*GF*/	swprintf(debugtext,255,TEXT("Resample()->SampleUp_SIMD()"));
 				/*GF*/	::OutputDebugStringW(debugtext);
-				return CBasicProcessing::SampleUp_SIMD(fullTargetSize, targetOffset, clippingSize, CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, ToSIMDArchitecture(cpu));
+				return CBasicProcessing::SampleUp_SIMD(fullTargetSize, targetOffset, clippingSize, sourceSize, pSource, nChannels, ToSIMDArchitecture(cpu), CSettingsProvider::This().HalfFloatIntermediates());
 				}
 			else
 				{
 				/*GF*/	swprintf(debugtext,255,TEXT("Resample()->SampleDown_SIMD()"));
 				/*GF*/	::OutputDebugStringW(debugtext);
-				return CBasicProcessing::SampleDown_SIMD(fullTargetSize, targetOffset, clippingSize, CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, filter, ToSIMDArchitecture(cpu));
+				if (!bRegion)
+					pSource = GetResampleSource(fullTargetSize, sourceSize, nChannels);
+				return CBasicProcessing::SampleDown_SIMD(fullTargetSize, targetOffset, clippingSize, sourceSize, pSource, nChannels, filter, ToSIMDArchitecture(cpu), CSettingsProvider::This().HalfFloatIntermediates());
 				}
 		} else {
 			if (eResizeType == UpSample) {
 				/*GF*/	swprintf(debugtext,255,TEXT("Resample()->SampleUp()"));
 				/*GF*/	::OutputDebugStringW(debugtext);
-				return CBasicProcessing::SampleUp(fullTargetSize, targetOffset, clippingSize, CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels);
+				return CBasicProcessing::SampleUp(fullTargetSize, targetOffset, clippingSize, sourceSize, pSource, nChannels);
 			} else
 				{
 				/*GF*/	swprintf(debugtext,255,TEXT("Resample()->SampleDown()"));
 				/*GF*/	::OutputDebugStringW(debugtext);
-				return CBasicProcessing::SampleDown(fullTargetSize, targetOffset, clippingSize, CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels, filter);
+				if (!bRegion)
+					pSource = GetResampleSource(fullTargetSize, sourceSize, nChannels);
+				return CBasicProcessing::SampleDown(fullTargetSize, targetOffset, clippingSize, sourceSize, pSource, nChannels, filter);
 				}
 			}
 		}
@@ -365,10 +405,96 @@ void* CJPEGImage::Resample(CSize fullTargetSize, CSize clippingSize, CPoint targ
 		{
 		/*GF*/	swprintf(debugtext,255,TEXT("Resample()->PointSample()"));
 		/*GF*/	::OutputDebugStringW(debugtext);
-		return CBasicProcessing::PointSample(fullTargetSize, targetOffset, clippingSize, CSize(m_nOrigWidth, m_nOrigHeight), m_pOrigPixels, m_nOriginalChannels);
+		return CBasicProcessing::PointSample(fullTargetSize, targetOffset, clippingSize, sourceSize, pSource, nChannels);
 		}
 	}
 
+const void* CJPEGImage::GetResampleSource(CSize fullTargetSize, CSize& sourceSize, int& nChannels) {
+	sourceSize = CSize(m_nPixelWidth, m_nPixelHeight);
+	nChannels = (m_pYCbCrImage != NULL) ? YCBCR_IMAGE_CHANNELS : m_nOriginalChannels;
+	const void* pOrigPixels = (m_pYCbCrImage != NULL) ? (const void*)m_pYCbCrImage : m_pOrigPixels;
+	__int64 nBudget = (__int64)CSettingsProvider::This().PyramidCacheMB() * 1024 * 1024;
+
+	// smallest level that is at least twice the target size, so the filter never reduces more than 4 times
+	int nLevel = 0;
+	CSize levelSize = sourceSize;
+	while (nLevel < MAX_PYRAMID_LEVELS) {
+		CSize nextSize((levelSize.cx + 1) >> 1, (levelSize.cy + 1) >> 1);
+		if (nextSize.cx < 2 * fullTargetSize.cx || nextSize.cy < 2 * fullTargetSize.cy) {
+			break;
+		}
+		levelSize = nextSize;
+		nLevel++;
+	}
+	if (nLevel == 0 || (__int64)levelSize.cx * levelSize.cy * 4 > nBudget) {
+		return pOrigPixels;
+	}
+
+	// The level is reduced from the original pixels, not from the next larger level, so its pixels are rounded to
+	// 8 bit sRGB only once. YCbCr planes are reduced row by row, the planes are kept.
+	if (m_pPyramid[nLevel - 1] == NULL) {
+		m_pPyramid[nLevel - 1] = (pOrigPixels == NULL) ? NULL :
+			CBasicProcessing::ReduceBox(m_nPixelWidth, m_nPixelHeight, pOrigPixels, nChannels, 1 << nLevel);
+		if (m_pPyramid[nLevel - 1] == NULL) {
+			TrimPyramid(nBudget, -1);
+			return pOrigPixels;
+		}
+		m_pyramidSize[nLevel - 1] = levelSize;
+	}
+	TrimPyramid(nBudget, nLevel);
+
+	sourceSize = m_pyramidSize[nLevel - 1];
+	nChannels = 4;
+	return m_pPyramid[nLevel - 1];
+}
+
+void CJPEGImage::TrimPyramid(__int64 nBudget, int nKeepLevel) {
+	__int64 nTotal = 0;
+	for (int i = 0; i < MAX_PYRAMID_LEVELS; i++) {
+		if (m_pPyramid[i] != NULL) {
+			nTotal += (__int64)m_pyramidSize[i].cx * m_pyramidSize[i].cy * 4;
+		}
+	}
+	for (int i = 0; i < MAX_PYRAMID_LEVELS && nTotal > nBudget; i++) {
+		if (m_pPyramid[i] != NULL && i + 1 != nKeepLevel) {
+			nTotal -= (__int64)m_pyramidSize[i].cx * m_pyramidSize[i].cy * 4;
+			delete[] m_pPyramid[i];
+			m_pPyramid[i] = NULL;
+		}
+	}
+}
+
+__int64 CJPEGImage::GetMemSize() const {
+	__int64 nSize = m_nEXIFSize + m_nJPEGStreamSize;
+	if (m_pOrigPixels != NULL) {
+		nSize += (__int64)Helpers::DoPadding(m_nPixelWidth * m_nOriginalChannels, 4) * m_nPixelHeight;
+	}
+	if (m_pYCbCrImage != NULL) {
+		nSize += m_pYCbCrImage->GetMemSize();
+	}
+	__int64 nDIBSize = (__int64)m_ClippingSize.cx * m_ClippingSize.cy * 4;
+	nSize += ((m_pDIBPixels != NULL) ? nDIBSize : 0) + ((m_pDIBPixelsLUTProcessed != NULL) ? nDIBSize : 0);
+	for (int i = 0; i < MAX_PYRAMID_LEVELS; i++) {
+		if (m_pPyramid[i] != NULL) {
+			nSize += (__int64)m_pyramidSize[i].cx * m_pyramidSize[i].cy * 4;
+		}
+	}
+	if (m_pTileCache != NULL) {
+		nSize += m_pTileCache->GetMemSize();
+	}
+	if (m_pRegionStore != NULL) {
+		nSize += m_pRegionStore->GetResidentMemSize();
+	}
+	return nSize;
+}
+
+void CJPEGImage::FreePyramid() {
+	for (int i = 0; i < MAX_PYRAMID_LEVELS; i++) {
+		delete[] m_pPyramid[i];
+		m_pPyramid[i] = NULL;
+	}
+}
+
 CPoint CJPEGImage::ConvertOffset(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset) {
 	int nStartX = (fullTargetSize.cx - clippingSize.cx)/2 - targetOffset.x;
 	int nStartY = (fullTargetSize.cy - clippingSize.cy)/2 - targetOffset.y;
@@ -400,7 +526,9 @@ bool CJPEGImage::Rotate(int nRotation) {
 	}
 
 	InvalidateAllCachedPixelData();
-	void* pNewOriginalPixels = CBasicProcessing::Rotate32bpp(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels, nRotation);
+	delete m_pRegionStore;
+	m_pRegionStore = NULL;
+	void* pNewOriginalPixels = CBasicProcessing::Rotate32bpp(m_nPixelWidth, m_nPixelHeight, m_pOrigPixels, nRotation);
 	if (pNewOriginalPixels == NULL) return false;
 	delete[] m_pOrigPixels;
 	m_pOrigPixels = pNewOriginalPixels;
@@ -409,6 +537,9 @@ bool CJPEGImage::Rotate(int nRotation) {
 		int nTemp = m_nOrigWidth;
 		m_nOrigWidth = m_nOrigHeight;
 		m_nOrigHeight = nTemp;
+		nTemp = m_nPixelWidth;
+		m_nPixelWidth = m_nPixelHeight;
+		m_nPixelHeight = nTemp;
 	}
 	m_nRotation = (m_nRotation + nRotation) % 360;
 
@@ -419,14 +550,17 @@ bool CJPEGImage::Rotate(int nRotation) {
 bool CJPEGImage::Mirror(bool bHorizontally) {
 	double dStartTickCount = Helpers::GetExactTickCount();
 
+	// Mirroring is not tracked like the rotation, so it cannot be reapplied when decoding a DCT scaled JPEG later
+	DecodeFullResolution();
+
 	// Rotation can only be done in 32 bpp
 	if (!ConvertSrcTo4Channels()) {
 		return false;
 	}
 
 	InvalidateAllCachedPixelData();
-	void* pNewOriginalPixels = bHorizontally ? CBasicProcessing::MirrorH32bpp(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels) :
-		CBasicProcessing::MirrorV32bpp(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels);
+	void* pNewOriginalPixels = bHorizontally ? CBasicProcessing::MirrorH32bpp(m_nPixelWidth, m_nPixelHeight, m_pOrigPixels) :
+		CBasicProcessing::MirrorV32bpp(m_nPixelWidth, m_nPixelHeight, m_pOrigPixels);
 	if (pNewOriginalPixels == NULL) return false;
 	delete[] m_pOrigPixels;
 	m_pOrigPixels = pNewOriginalPixels;
@@ -479,6 +613,18 @@ void* CJPEGImage::GetDIBInternal(CSize fullTargetSize, CSize clippingSize, CPoin
 								 EProcessingFlags eProcFlags,
 								 bool &bParametersChanged) {
 
+	// the DCT scaled pixels of a JPEG are only used as long as they are not smaller than the target size, beyond
+	// only the visible region is decoded at full resolution as long as it is much smaller than the image
+	m_bRegionValid = false;
+	if (m_pJPEGStream != NULL && (fullTargetSize.cx > m_nPixelWidth || fullTargetSize.cy > m_nPixelHeight)) {
+		m_bRegionValid = DecodeRegion(fullTargetSize, clippingSize, targetOffset);
+		if (!m_bRegionValid) {
+			// if this fails too (e.g. out of memory), the DCT scaled pixels are upsampled, the tiles in m_pRegionStore
+			// are not resident for the clipping rectangle and must not be used
+			DecodeFullResolution();
+		}
+	}
+
  	// Check if resampling due to bHighQualityResampling parameter change is needed
 	bool bMustResampleQuality = GetProcessingFlag(eProcFlags, PFLAG_HighQualityResampling) != GetProcessingFlag(m_eProcFlags, PFLAG_HighQualityResampling);
 	bool bTargetSizeChanged = fullTargetSize != m_FullTargetSize;
@@ -489,7 +635,6 @@ void* CJPEGImage::GetDIBInternal(CSize fullTargetSize, CSize clippingSize, CPoin
 	EResizeType eResizeType = GetResizeType(fullTargetSize, CSize(m_nOrigWidth, m_nOrigHeight));
 
 	// the geometrical parameters must be set before calling ApplyCorrectionLUT()
-	CRect oldClippingRect = CRect(m_TargetOffset, m_ClippingSize);
 	m_FullTargetSize = fullTargetSize;
 	m_ClippingSize = clippingSize;
 	m_TargetOffset = targetOffset;
@@ -509,31 +654,20 @@ void* CJPEGImage::GetDIBInternal(CSize fullTargetSize, CSize clippingSize, CPoin
 		{
 		// if the image is reprocessed more than once, it is worth to convert the original to 4 channels
 		// as this is faster for further processing
-		if (!m_bFirstReprocessing)
+		// (but not YCbCr planes, these are kept to save memory)
+		if (!m_bFirstReprocessing && m_pYCbCrImage == NULL)
 			ConvertSrcTo4Channels();
 
 		bParametersChanged = true;
-
-		// If we only pan, we can resample far more efficiently by only calculating the newly visible areas
-		bool bPanningOnly = !m_bFirstReprocessing && !bTargetSizeChanged && !bMustResampleQuality;
 		m_bFirstReprocessing = false;
-		if (bPanningOnly)
-			ResampleWithPan(m_pDIBPixels, m_pDIBPixelsLUTProcessed, fullTargetSize, clippingSize, targetOffset, oldClippingRect, eProcFlags, eResizeType);
-		else
-			{
-			delete[] m_pDIBPixelsLUTProcessed; m_pDIBPixelsLUTProcessed = NULL;
-			delete[] m_pDIBPixels; m_pDIBPixels = NULL;
-			}
+		delete[] m_pDIBPixelsLUTProcessed; m_pDIBPixelsLUTProcessed = NULL;
+		delete[] m_pDIBPixels; m_pDIBPixels = NULL;
 
-		// both DIBs are NULL, do normal resampling
-		if (m_pDIBPixels == NULL && m_pDIBPixelsLUTProcessed == NULL)
-			m_pDIBPixels = Resample(fullTargetSize, clippingSize, targetOffset, eProcFlags, eResizeType);
+		// The resampled tiles are cached, when panning or returning to an earlier zoom level only the tiles
+		// not yet cached are resampled
+		m_pDIBPixels = ResampleTiled(fullTargetSize, clippingSize, targetOffset, eProcFlags, eResizeType);
 
-		// if ResampleWithPan() has preseved this DIB, we can reuse it
-		if (m_pDIBPixelsLUTProcessed == NULL)
-			pDIB = ApplyCorrectionLUTandLDC(eProcFlags, m_pDIBPixelsLUTProcessed, fullTargetSize, targetOffset, m_pDIBPixels, clippingSize, bMustResampleGeometry, false, false);
-		else
-			pDIB = m_pDIBPixelsLUTProcessed;
+		pDIB = ApplyCorrectionLUTandLDC(eProcFlags, m_pDIBPixelsLUTProcessed, fullTargetSize, targetOffset, m_pDIBPixels, clippingSize, bMustResampleGeometry, false, false);
 		}
 
 	m_dLastOpTickCount = Helpers::GetExactTickCount() - dStartTickCount; 
@@ -571,9 +705,232 @@ void* CJPEGImage::ApplyCorrectionLUTandLDC(EProcessingFlags eProcFlags,
 	return pSourceDIB;
 	}
 
+void CJPEGImage::SetScaledJPEGSource(void* pJPEGStream, int nJPEGStreamSize, int nFullWidth, int nFullHeight, __int64 nFileTime) {
+	delete[] m_pJPEGStream;
+	m_pJPEGStream = pJPEGStream;
+	m_nJPEGStreamSize = nJPEGStreamSize;
+	m_nOrigWidth = m_nInitOrigWidth = nFullWidth;
+	m_nOrigHeight = m_nInitOrigHeight = nFullHeight;
+
+	// The random access index is only needed when zooming in beyond the DCT scaled pixels. It is built when first used,
+	// so it does not delay showing the image, see GetJPEGIndex().
+	// JPEGs beyond the size limits are decoded DCT scaled also at full size (see TurboJpeg::ReadImageScaled()), the
+	// MCU rows of the index then cannot be decoded as regions.
+	delete m_pJPEGIndex;
+	m_pJPEGIndex = NULL;
+	int nJPEGWidth, nJPEGHeight;
+	m_bJPEGIndexPending = m_pJPEGStream != NULL && max(nFullWidth, nFullHeight) >= TILED_PIXEL_STORE_TILE_SIZE &&
+		TurboJpeg::ReadImageSize(nJPEGWidth, nJPEGHeight, m_pJPEGStream, m_nJPEGStreamSize) &&
+		TurboJpeg::SizeLimitDenominator(nJPEGWidth, nJPEGHeight) == 1;
+	m_nJPEGFileTime = nFileTime;
+}
+
+CJPEGIndex* CJPEGImage::GetJPEGIndex() {
+	if (!m_bJPEGIndexPending) {
+		return m_pJPEGIndex;
+	}
+	m_bJPEGIndexPending = false;
+	if (m_pJPEGStream == NULL) {
+		return NULL;
+	}
+	int nCacheMB = CSettingsProvider::This().JPEGIndexCacheMB();
+	bool bCache = nCacheMB > 0 && m_nJPEGFileTime != 0;
+	if (bCache) {
+		m_pJPEGIndex = CJPEGIndex::Load(m_pJPEGStream, m_nJPEGStreamSize, m_nPixelHash, m_nJPEGFileTime);
+	}
+	if (m_pJPEGIndex == NULL) {
+		m_pJPEGIndex = CJPEGIndex::Build(m_pJPEGStream, m_nJPEGStreamSize);
+		if (m_pJPEGIndex != NULL && bCache) {
+			m_pJPEGIndex->Save(m_nPixelHash, m_nJPEGFileTime, nCacheMB);
+		}
+	}
+	return m_pJPEGIndex;
+}
+
+void CJPEGImage::SetYCbCrSource(CYCbCrImage* pImage) {
+	delete m_pYCbCrImage;
+	m_pYCbCrImage = pImage;
+}
+
+void CJPEGImage::DecodeFullResolution() {
+	if (m_pJPEGStream == NULL) {
+		return;
+	}
+
+	int nWidth, nHeight, nBPP;
+	TJSAMP eChromoSubSampling;
+	bool bOutOfMemory;
+	void* pPixels = NULL;
+	CJPEGIndex* pIndex = GetJPEGIndex();
+	if (pIndex != NULL) {
+		// with the index, the bands of the image can be decoded in parallel
+		pPixels = TurboJpeg::ReadImageParallel(nWidth, nHeight, nBPP, eChromoSubSampling, bOutOfMemory, m_pJPEGStream, m_nJPEGStreamSize, *pIndex);
+	}
+	if (pPixels == NULL) {
+		pPixels = TurboJpeg::ReadImage(nWidth, nHeight, nBPP, eChromoSubSampling, bOutOfMemory, m_pJPEGStream, m_nJPEGStreamSize);
+	}
+	if (pPixels == NULL) return;
+	int nChannels = nBPP;
+	if (m_nRotation != 0) {
+		// Rotation can only be done in 32 bpp
+		void* pPixels32bpp = CBasicProcessing::Convert3To4Channels(nWidth, nHeight, pPixels);
+		delete[] pPixels;
+		if (pPixels32bpp == NULL) return;
+		pPixels = CBasicProcessing::Rotate32bpp(nWidth, nHeight, pPixels32bpp, m_nRotation);
+		delete[] pPixels32bpp;
+		if (pPixels == NULL) return;
+		nChannels = 4;
+		if (m_nRotation != 180) {
+			int nTemp = nWidth;
+			nWidth = nHeight;
+			nHeight = nTemp;
+		}
+	}
+
+	InvalidateAllCachedPixelData();
+	delete[] m_pOrigPixels;
+	m_pOrigPixels = pPixels;
+	m_nOriginalChannels = nChannels;
+	m_nPixelWidth = nWidth;
+	m_nPixelHeight = nHeight;
+	delete[] m_pJPEGStream;
+	m_pJPEGStream = NULL;
+	m_nJPEGStreamSize = 0;
+	delete m_pRegionStore;
+	m_pRegionStore = NULL;
+	delete m_pJPEGIndex;
+	m_pJPEGIndex = NULL;
+	m_bJPEGIndexPending = false;
+}
+
+// Rotates a rectangle in an image of size nWidth x nHeight clockwise by 0, 90, 180 or 270 degrees
+static CRect RotateRect(CRect rect, int nWidth, int nHeight, int nRotation) {
+	switch (nRotation) {
+	case 90:
+		return CRect(nHeight - rect.bottom, rect.left, nHeight - rect.top, rect.right);
+	case 180:
+		return CRect(nWidth - rect.right, nHeight - rect.bottom, nWidth - rect.left, nHeight - rect.top);
+	case 270:
+		return CRect(rect.top, nWidth - rect.right, rect.bottom, nWidth - rect.left);
+	default:
+		return rect;
+	}
+}
+
+bool CJPEGImage::DecodeRegion(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset) {
+	// the tiles covering the clipping rectangle are resampled, see ResampleTiled()
+	CRect fullTargetRect(CPoint(0, 0), fullTargetSize);
+	CRect targetRect;
+	if (!targetRect.IntersectRect(CRect(targetOffset, clippingSize), fullTargetRect)) {
+		return true; // nothing visible, nothing to decode
+	}
+	targetRect = CRect(targetRect.left / TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE, targetRect.top / TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE,
+		min(fullTargetSize.cx, (targetRect.right + TILE_CACHE_TILE_SIZE - 1) / TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE),
+		min(fullTargetSize.cy, (targetRect.bottom + TILE_CACHE_TILE_SIZE - 1) / TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE));
+
+	// section of the full resolution image read by the filter kernels, the margin covers the kernel size of all filters
+	int nMarginX = 8 + 4 * ((m_nOrigWidth + fullTargetSize.cx - 1) / fullTargetSize.cx);
+	int nMarginY = 8 + 4 * ((m_nOrigHeight + fullTargetSize.cy - 1) / fullTargetSize.cy);
+	CRect imageRect(0, 0, m_nOrigWidth, m_nOrigHeight);
+	CRect neededRect((int)((__int64)targetRect.left * m_nOrigWidth / fullTargetSize.cx) - nMarginX,
+		(int)((__int64)targetRect.top * m_nOrigHeight / fullTargetSize.cy) - nMarginY,
+		(int)((__int64)targetRect.right * m_nOrigWidth / fullTargetSize.cx) + nMarginX,
+		(int)((__int64)targetRect.bottom * m_nOrigHeight / fullTargetSize.cy) + nMarginY);
+	neededRect.IntersectRect(neededRect, imageRect);
+
+	if (m_pRegionStore == NULL) {
+		if (m_nOrigWidth < TILED_PIXEL_STORE_TILE_SIZE) {
+			return false;
+		}
+		m_pRegionStore = new CTiledPixelStore(m_nOrigWidth, m_nOrigHeight);
+		if (m_pRegionStore->Pixels() == NULL) {
+			// e.g. no address space for the image in 32 bit builds
+			delete m_pRegionStore;
+			m_pRegionStore = NULL;
+			return false;
+		}
+	}
+
+	// when the tiles needed are not much smaller than the image, decoding the full image is the better choice
+	__int64 nBudget = (__int64)CSettingsProvider::This().RegionCacheMB() * 1024 * 1024;
+	__int64 nNeededSize = m_pRegionStore->GetMemSize(neededRect);
+	if (nNeededSize > nBudget || nNeededSize * 2 > (__int64)m_nOrigWidth * m_nOrigHeight * 4) {
+		return false;
+	}
+
+	CRect missingRect = m_pRegionStore->Touch(neededRect);
+	if (!missingRect.IsRectEmpty()) {
+		// decode the bounding rectangle of the missing tiles at once, the JPEG image is rotated by m_nRotation
+		bool bRotated = m_nRotation == 90 || m_nRotation == 270;
+		int nJPEGWidth = bRotated ? m_nOrigHeight : m_nOrigWidth;
+		int nJPEGHeight = bRotated ? m_nOrigWidth : m_nOrigHeight;
+		CRect jpegRect = RotateRect(missingRect, m_nOrigWidth, m_nOrigHeight, (360 - m_nRotation) % 360);
+		int nX = jpegRect.left, nY = jpegRect.top, nWidth = jpegRect.Width(), nHeight = jpegRect.Height(), nBPP;
+		bool bOutOfMemory;
+		void* pPixels = NULL;
+		CJPEGIndex* pIndex = GetJPEGIndex();
+		if (pIndex != NULL) {
+			// decode from a JPEG stream containing only the MCU rows of the region, no need to decode the rows above
+			int nSubImageSize, nSubImageFirstRow;
+			void* pSubImage = pIndex->CreateSubImage(m_pJPEGStream, m_nJPEGStreamSize, jpegRect.top, jpegRect.bottom,
+				nSubImageSize, nSubImageFirstRow);
+			if (pSubImage != NULL) {
+				nY -= nSubImageFirstRow;
+				pPixels = TurboJpeg::ReadImageRegion(nX, nY, nWidth, nHeight, nBPP, bOutOfMemory, pSubImage, nSubImageSize);
+				nY += nSubImageFirstRow;
+				delete[] pSubImage;
+			}
+		}
+		if (pPixels == NULL) {
+			nX = jpegRect.left; nY = jpegRect.top; nWidth = jpegRect.Width(); nHeight = jpegRect.Height();
+			pPixels = TurboJpeg::ReadImageRegion(nX, nY, nWidth, nHeight, nBPP, bOutOfMemory, m_pJPEGStream, m_nJPEGStreamSize);
+		}
+		if (pPixels == NULL) {
+			return false;
+		}
+		void* pRegion = CBasicProcessing::Convert3To4Channels(nWidth, nHeight, pPixels);
+		delete[] pPixels;
+		if (pRegion != NULL && m_nRotation != 0) {
+			void* pRotatedRegion = CBasicProcessing::Rotate32bpp(nWidth, nHeight, pRegion, m_nRotation);
+			delete[] pRegion;
+			pRegion = pRotatedRegion;
+		}
+		if (pRegion == NULL) {
+			return false;
+		}
+		// the decoded region is extended to the iMCU boundary, so it contains the missing tiles
+		CRect decodedRect = RotateRect(CRect(nX, nY, nX + nWidth, nY + nHeight), nJPEGWidth, nJPEGHeight, m_nRotation);
+		bool bSuccess = m_pRegionStore->Store(missingRect, pRegion, decodedRect);
+		delete[] pRegion;
+		if (!bSuccess) {
+			return false;
+		}
+	}
+	m_pRegionStore->Trim(nBudget);
+
+	return true;
+}
+
+bool CJPEGImage::ConvertYCbCrToBGR() {
+	if (m_pYCbCrImage != NULL) {
+		void* pPixels = m_pYCbCrImage->ConvertToBGR();
+		if (pPixels == NULL) {
+			return false;
+		}
+		m_pOrigPixels = pPixels;
+		m_nOriginalChannels = 3;
+		delete m_pYCbCrImage;
+		m_pYCbCrImage = NULL;
+	}
+	return true;
+}
+
 bool CJPEGImage::ConvertSrcTo4Channels() {
+	if (!ConvertYCbCrToBGR()) {
+		return false;
+	}
 	if (m_nOriginalChannels == 3) {
-		void* pNewOriginalPixels = CBasicProcessing::Convert3To4Channels(m_nOrigWidth, m_nOrigHeight, m_pOrigPixels);
+		void* pNewOriginalPixels = CBasicProcessing::Convert3To4Channels(m_nPixelWidth, m_nPixelHeight, m_pOrigPixels);
 		if (pNewOriginalPixels != NULL) {
 			delete[] m_pOrigPixels;
 			m_pOrigPixels = pNewOriginalPixels;
@@ -673,4 +1030,6 @@ void CJPEGImage::InvalidateAllCachedPixelData() {
 	delete[] m_pDIBPixelsLUTProcessed; 
 	m_pDIBPixelsLUTProcessed = NULL;
 	m_ClippingSize = CSize(0, 0);
+	FreePyramid();
+	m_pTileCache->Clear();
 }
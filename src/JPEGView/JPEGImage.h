@@ -6,8 +6,15 @@ class CHistogram;
 class CLocalDensityCorr;
 class CEXIFReader;
 class CRawMetadata;
+class CTileCache;
+class CTiledPixelStore;
+class CJPEGIndex;
+class CYCbCrImage;
 enum TJSAMP;
 
+// Maximum number of 2x2 reduced levels kept for an image, see CJPEGImage::GetResampleSource()
+#define MAX_PYRAMID_LEVELS 16
+
 // Represents a rectangle to dim out in the image
 struct CDimRect {
 	CDimRect() {}
@@ -63,6 +70,23 @@ public:
 	// Gets the pixel hash over the de-compressed pixels
 	__int64 GetUncompressedPixelHash() const;
 
+	// Declares the pixels passed to the constructor as a DCT scaled decode of the given JPEG stream, the original image has
+	// the size nFullWidth x nFullHeight. The stream is decoded at full resolution when a target size larger than the decoded
+	// pixels is requested. Ownership of pJPEGStream goes to the class. Must be called directly after construction.
+	// pJPEGStream can be NULL, the image then always uses the scaled pixels (used for previews).
+	// nFileTime is the modification time of the JPEG file, used together with the pixel hash as key of the persisted
+	// random access index of the JPEG stream (see CJPEGIndex), 0 if unknown.
+	void SetScaledJPEGSource(void* pJPEGStream, int nJPEGStreamSize, int nFullWidth, int nFullHeight, __int64 nFileTime);
+
+	// Declares the YCbCr planes of a JPEG decoded at full resolution as the original pixels, instead of the pixels passed
+	// to the constructor, which must be NULL. The planes are resampled directly, they are only converted to a BGR image
+	// if needed (e.g. for rotation). Ownership of pImage goes to the class. Must be called directly after construction.
+	void SetYCbCrSource(CYCbCrImage* pImage);
+
+	// Gets or sets if this image is a low resolution preview, shown until the full image has finished loading
+	bool IsPreview() const { return m_bIsPreview; }
+	void SetIsPreview(bool bIsPreview) { m_bIsPreview = bIsPreview; }
+
 	// Original image size (of the unprocessed raw image, however the raw image may have been rotated or cropped)
 	int OrigWidth() const { return m_nOrigWidth; }
 	int OrigHeight() const { return m_nOrigHeight; }
@@ -101,8 +125,8 @@ public:
 	bool IsDestructivlyProcessed() { return m_bIsDestructivlyProcessed; }
 
 	// raw access to input pixels - do not delete or store the pointer returned
-	void* IJLPixels() { return  m_pOrigPixels; }
-	const void* IJLPixels() const { return m_pOrigPixels; }
+	void* IJLPixels() { ConvertYCbCrToBGR(); return  m_pOrigPixels; }
+	const void* IJLPixels() const { return m_pOrigPixels; } // NULL while the pixels are kept as YCbCr planes
 	// remove IJL pixels form class - will be NULL afterwards
 	void DetachIJLPixels() { m_pOrigPixels = NULL; }
 
@@ -182,6 +206,10 @@ public:
 	void SetLoadTickCount(double tc) { m_dLoadTickCount = tc; }
 	double GetLoadTickCount() { return m_dLoadTickCount; }
 
+	// Memory in bytes used by the image: original pixels (or YCbCr planes), DIBs, pyramid levels, tiles and the JPEG stream
+	// of DCT scaled JPEGs
+	__int64 GetMemSize() const;
+
 	// Sets and gets the JPEG comment of this image (COM marker)
 	void SetJPEGComment(LPCTSTR sComment) { m_sJPEGComment = CString(sComment); }
 	LPCTSTR GetJPEGComment() { return m_sJPEGComment; }
@@ -210,6 +238,15 @@ private:
 	CEXIFReader* m_pEXIFReader;
 	CString m_sJPEGComment;
 	int m_nOrigWidth, m_nOrigHeight; // these may changes by rotation
+	int m_nPixelWidth, m_nPixelHeight; // size of m_pOrigPixels, smaller than the original size for DCT scaled JPEGs
+	void* m_pJPEGStream; // JPEG stream of a DCT scaled JPEG to decode at full resolution when needed, else NULL
+	int m_nJPEGStreamSize;
+	CTiledPixelStore* m_pRegionStore; // tiles of the full resolution image decoded from m_pJPEGStream, see DecodeRegion()
+	bool m_bRegionValid; // the last call of DecodeRegion() made the tiles for the current clipping rectangle resident
+	CJPEGIndex* m_pJPEGIndex; // random access index of m_pJPEGStream, NULL if not available or not yet built
+	bool m_bJPEGIndexPending; // m_pJPEGIndex is built on first use, see GetJPEGIndex()
+	__int64 m_nJPEGFileTime; // modification time of the JPEG file, key of the persisted index
+	CYCbCrImage* m_pYCbCrImage; // original pixels as YCbCr planes of a JPEG, m_pOrigPixels is NULL while these are used
 	int m_nInitOrigWidth, m_nInitOrigHeight; // original width of image when constructed (before any rotation and crop)
 	int m_nOriginalChannels;
 	__int64 m_nPixelHash;
@@ -229,6 +266,7 @@ private:
 
 	// Thumbnail related stuff
 	bool m_bIsThumbnailImage;
+	bool m_bIsPreview;
 
 	// Processed data of size m_ClippingSize, with LUT/LDC applied and without
 	// The version without LUT/LDC is used to efficiently reapply a different LUT/LDC
@@ -237,6 +275,15 @@ private:
 	void* m_pDIBPixels;
 	void* m_pLastDIB; // one of the pointers above
 
+	// Resolution pyramid of the original pixels for downsampling, built lazily. Element i is the 32 bpp level i+1,
+	// reduced 2^(i+1) times from the original pixels by box averaging in linear light, NULL if not built or freed to stay
+	// within the budget.
+	void* m_pPyramid[MAX_PYRAMID_LEVELS];
+	CSize m_pyramidSize[MAX_PYRAMID_LEVELS];
+
+	// Resampled tiles for all target sizes used so far, see ResampleTiled()
+	CTileCache* m_pTileCache;
+
 	// Image processing parameters and flags during last call to GetDIB()
 	EProcessingFlags m_eProcFlags;
 
@@ -282,10 +329,22 @@ private:
 						 EProcessingFlags eProcFlags,
 						 bool& bParametersChanged);
 
-	// Resample when panning was done, using existing data in DIBs. Old clipping rectangle is given in oldClippingRect
-	void ResampleWithPan(void* & pDIBPixels, void* & pDIBPixelsLUTProcessed, CSize fullTargetSize, 
-		CSize clippingSize, CPoint targetOffset, CRect oldClippingRect,
-		EProcessingFlags eProcFlags, EResizeType eResizeType);
+	// Resample to given target size using the tile cache, only the tiles not yet cached are resampled. Returns resampled DIB
+	void* ResampleTiled(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, EProcessingFlags eProcFlags, EResizeType eResizeType);
+
+	// Resample the given rectangle of tiles (in tile indices) at once and add the tiles not yet cached to the tile cache.
+	// Returns false if out of memory.
+	bool ResampleTiles(CSize fullTargetSize, CRect tiles, bool bHighQuality, EFilterType eFilter, EProcessingFlags eProcFlags, EResizeType eResizeType);
+
+	// Gets the source image to downsample to the given target size from: The smallest pyramid level that is at least twice
+	// the target size, built if needed and if it fits into the INI memory budget, else the original pixels.
+	const void* GetResampleSource(CSize fullTargetSize, CSize& sourceSize, int& nChannels);
+
+	// Frees pyramid levels, the largest first, until the pyramid uses at most nBudget bytes. Level nKeepLevel is not freed.
+	void TrimPyramid(__int64 nBudget, int nKeepLevel);
+
+	// Frees all pyramid levels
+	void FreePyramid();
 
 	// Resample to given target size. Returns resampled DIB
 	void* Resample(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset, EProcessingFlags eProcFlags, EResizeType eResizeType);
@@ -307,6 +366,23 @@ private:
 			pSourceDIB, dibSize, bGeometryChanged, bOnlyCheck, bCanTakeOwnershipOfSourceDIB, bNotUsed);
 	}
 
+	// Replaces the DCT scaled pixels by the full resolution image decoded from m_pJPEGStream, applying the current rotation.
+	// Nothing is done if the image is not DCT scaled, the scaled pixels are kept if decoding fails.
+	void DecodeFullResolution();
+
+	// Gets the random access index of m_pJPEGStream, loading it from the index cache or building it on the first call.
+	// NULL if the image is too small to decode regions or the JPEG cannot be indexed.
+	CJPEGIndex* GetJPEGIndex();
+
+	// Makes the tiles of the full resolution image needed to resample the tiles covering the clipping rectangle resident in
+	// m_pRegionStore, decoding the missing ones from the JPEG stream of a DCT scaled JPEG. Returns false if the tiles needed
+	// are not much smaller than the image, exceed the INI memory budget or cannot be decoded, DecodeFullResolution() must be
+	// used then. Returns true without decoding anything if the clipping rectangle is outside of the image.
+	bool DecodeRegion(CSize fullTargetSize, CSize clippingSize, CPoint targetOffset);
+
+	// converts the YCbCr planes to the input image (m_pOrigPixels), nothing is done if there are none
+	bool ConvertYCbCrToBGR();
+
 	// makes sure that the input image (m_pOrigPixels) is a 4 channel BGRA image (converts if necessary)
 	bool ConvertSrcTo4Channels();
 
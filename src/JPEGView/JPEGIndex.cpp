@@ -0,0 +1,734 @@
+#include "StdAfx.h"
+#include "JPEGIndex.h"
+#include "Helpers.h"
+#include "ProcessingThreadPool.h"
+
+static const unsigned int INDEX_FILE_MAGIC = 0x5849564A; // 'JVIX'
+static const int INDEX_FILE_VERSION = 1;
+
+// Standard luminance DC table of the JPEG specification (Annex K.3), used for the re-encoded DC coefficients of the sub images
+static const uint8 STANDARD_DC_BITS[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8 STANDARD_DC_VALUES[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const int HUFFMAN_LOOKAHEAD_BITS = 9;
+
+namespace {
+
+	// Huffman table for decoding, with the code of each symbol for copying the codes to the sub image
+	struct CHuffmanTable {
+		bool Defined;
+		uint8 LookupLength[1 << HUFFMAN_LOOKAHEAD_BITS]; // code length of the lookahead bits, 0 if the code is longer
+		uint8 LookupSymbol[1 << HUFFMAN_LOOKAHEAD_BITS];
+		int MaxCode[17]; // largest code of each length, -1 if there is none
+		int ValueOffset[17];
+		uint8 Values[256];
+		uint16 Code[256];
+		uint8 CodeLength[256];
+	};
+
+	struct CFrameHeader {
+		int Width, Height;
+		int NumComponents;
+		int ComponentIds[4];
+		int SamplingH[4], SamplingV[4];
+		int DCTable[4], ACTable[4];
+		int MCUWidth, MCUHeight;
+		int MCUsPerRow, MCURows;
+		int BlocksPerMCU;
+		int BlockComponent[10]; // component of each block of an MCU
+		int RestartInterval;
+		int SOFOffset; // offset of the SOF marker
+		int SOSOffset; // offset of the SOS marker
+		int ScanStart; // offset of the entropy coded data
+		CHuffmanTable DCTables[4], ACTables[4];
+	};
+
+	struct CBitReader {
+		const uint8* Data;
+		int Size;
+		int Position;
+		unsigned __int64 Buffer;
+		int Bits;
+		bool MarkerHit;
+
+		// Fills the buffer to at least 57 bits, after a marker zero bits are delivered
+		void Fill() {
+			while (Bits <= 56) {
+				uint8 nByte = 0;
+				if (!MarkerHit && Position < Size) {
+					nByte = Data[Position];
+					if (nByte != 0xFF) {
+						Position++;
+					} else if (Position + 1 < Size && Data[Position + 1] == 0) {
+						Position += 2;
+					} else {
+						MarkerHit = true;
+						nByte = 0;
+					}
+				}
+				Buffer |= (unsigned __int64)nByte << (56 - Bits);
+				Bits += 8;
+			}
+		}
+		unsigned int Peek(int nBits) const { return (nBits == 0) ? 0 : (unsigned int)(Buffer >> (64 - nBits)); }
+		void Skip(int nBits) { Buffer <<= nBits; Bits -= nBits; }
+
+		// Skips the restart marker at the current position and restarts reading after it
+		bool Restart() {
+			if (!MarkerHit) {
+				// skip the padding bits and search the marker
+				while (Position + 1 < Size && (Data[Position] != 0xFF || Data[Position + 1] == 0)) Position++;
+			}
+			while (Position + 1 < Size && Data[Position] == 0xFF && Data[Position + 1] == 0xFF) Position++;
+			if (Position + 1 >= Size || Data[Position + 1] < 0xD0 || Data[Position + 1] > 0xD7) {
+				return false;
+			}
+			Position += 2;
+			Buffer = 0;
+			Bits = 0;
+			MarkerHit = false;
+			return true;
+		}
+	};
+
+	// Writes entropy coded data with byte stuffing to a growing buffer
+	struct CBitWriter {
+		uint8* Data;
+		int Size;
+		int Capacity;
+		unsigned __int64 Buffer;
+		int Bits;
+
+		bool Put(unsigned int nCode, int nLength) {
+			Buffer = (Buffer << nLength) | (nCode & ((1u << nLength) - 1));
+			Bits += nLength;
+			while (Bits >= 8) {
+				uint8 nByte = (uint8)(Buffer >> (Bits - 8));
+				if (!Emit(nByte) || (nByte == 0xFF && !Emit(0))) {
+					return false;
+				}
+				Bits -= 8;
+			}
+			return true;
+		}
+		// Pads the last byte with one bits
+		bool Flush() {
+			return (Bits == 0) ? true : Put((1u << (8 - Bits)) - 1, 8 - Bits);
+		}
+		bool Emit(uint8 nByte) {
+			if (Size == Capacity) {
+				int nNewCapacity = Capacity + Capacity / 2 + 4096;
+				uint8* pNewData = new(std::nothrow) uint8[nNewCapacity];
+				if (pNewData == NULL) {
+					return false;
+				}
+				memcpy(pNewData, Data, Size);
+				delete[] Data;
+				Data = pNewData;
+				Capacity = nNewCapacity;
+			}
+			Data[Size++] = nByte;
+			return true;
+		}
+		bool Emit(const uint8* pBytes, int nNumBytes) {
+			for (int i = 0; i < nNumBytes; i++) {
+				if (!Emit(pBytes[i])) return false;
+			}
+			return true;
+		}
+	};
+}
+
+static int ReadWord(const uint8* p) {
+	return (p[0] << 8) | p[1];
+}
+
+static bool BuildHuffmanTable(CHuffmanTable& table, const uint8* pBits, const uint8* pValues, int nNumValues) {
+	memset(&table, 0, sizeof(CHuffmanTable));
+	memcpy(table.Values, pValues, nNumValues);
+	int nCode = 0, nIndex = 0;
+	for (int nLength = 1; nLength <= 16; nLength++) {
+		int nCount = pBits[nLength - 1];
+		// the codes of each length must fit into its code space, else the lookup below writes beyond the tables
+		if (nCode + nCount > (1 << nLength)) {
+			return false;
+		}
+		table.ValueOffset[nLength] = nIndex - nCode;
+		table.MaxCode[nLength] = (nCount == 0) ? -1 : nCode + nCount - 1;
+		for (int i = 0; i < nCount; i++) {
+			uint8 nSymbol = pValues[nIndex];
+			table.Code[nSymbol] = (uint16)nCode;
+			table.CodeLength[nSymbol] = (uint8)nLength;
+			if (nLength <= HUFFMAN_LOOKAHEAD_BITS) {
+				int nShift = HUFFMAN_LOOKAHEAD_BITS - nLength;
+				for (int j = 0; j < (1 << nShift); j++) {
+					table.LookupLength[(nCode << nShift) | j] = (uint8)nLength;
+					table.LookupSymbol[(nCode << nShift) | j] = nSymbol;
+				}
+			}
+			nCode++;
+			nIndex++;
+		}
+		nCode <<= 1;
+	}
+	table.Defined = true;
+	return true;
+}
+
+// Decodes a Huffman symbol, returns -1 for an invalid code. nCode and nLength return the code of the symbol.
+static inline int DecodeSymbol(CBitReader& reader, const CHuffmanTable& table, unsigned int& nCode, int& nLength) {
+	unsigned int nLookahead = reader.Peek(HUFFMAN_LOOKAHEAD_BITS);
+	nLength = table.LookupLength[nLookahead];
+	if (nLength != 0) {
+		nCode = nLookahead >> (HUFFMAN_LOOKAHEAD_BITS - nLength);
+		reader.Skip(nLength);
+		return table.LookupSymbol[nLookahead];
+	}
+	for (nLength = HUFFMAN_LOOKAHEAD_BITS + 1; nLength <= 16; nLength++) {
+		nCode = reader.Peek(nLength);
+		if ((int)nCode <= table.MaxCode[nLength]) {
+			reader.Skip(nLength);
+			return table.Values[table.ValueOffset[nLength] + nCode];
+		}
+	}
+	return -1;
+}
+
+// Parses the markers up to the first scan. Only sequential Huffman coded JPEGs with a single scan containing all
+// components are supported.
+static bool ParseHeader(const uint8* pStream, int nStreamSize, CFrameHeader& header) {
+	memset(&header, 0, sizeof(CFrameHeader));
+	if (nStreamSize < 4 || pStream[0] != 0xFF || pStream[1] != 0xD8) {
+		return false;
+	}
+	int nPos = 2;
+	bool bFrameFound = false;
+	while (nPos + 4 <= nStreamSize) {
+		if (pStream[nPos] != 0xFF) {
+			return false;
+		}
+		uint8 nMarker = pStream[nPos + 1];
+		if (nMarker == 0xFF) {
+			nPos++; // fill byte
+			continue;
+		}
+		int nLength = ReadWord(pStream + nPos + 2);
+		const uint8* pSegment = pStream + nPos + 4;
+		int nSegmentSize = nLength - 2;
+		if (nLength < 2 || nPos + 2 + nLength > nStreamSize) {
+			return false;
+		}
+		if (nMarker == 0xC0 || nMarker == 0xC1) {
+			if (nSegmentSize < 6 || pSegment[0] != 8) {
+				return false;
+			}
+			header.SOFOffset = nPos;
+			header.Height = ReadWord(pSegment + 1);
+			header.Width = ReadWord(pSegment + 3);
+			header.NumComponents = pSegment[5];
+			if (header.Width == 0 || header.Height == 0 || header.NumComponents < 1 || header.NumComponents > 4 ||
+				nSegmentSize < 6 + 3 * header.NumComponents) {
+				return false;
+			}
+			int nMaxH = 1, nMaxV = 1;
+			for (int i = 0; i < header.NumComponents; i++) {
+				header.ComponentIds[i] = pSegment[6 + 3 * i];
+				header.SamplingH[i] = pSegment[7 + 3 * i] >> 4;
+				header.SamplingV[i] = pSegment[7 + 3 * i] & 15;
+				if (header.SamplingH[i] < 1 || header.SamplingH[i] > 4 || header.SamplingV[i] < 1 || header.SamplingV[i] > 4) {
+					return false;
+				}
+				nMaxH = max(nMaxH, header.SamplingH[i]);
+				nMaxV = max(nMaxV, header.SamplingV[i]);
+			}
+			if (header.NumComponents == 1) {
+				// a single component scan is not interleaved, each block is an MCU
+				header.SamplingH[0] = header.SamplingV[0] = nMaxH = nMaxV = 1;
+			}
+			header.MCUWidth = 8 * nMaxH;
+			header.MCUHeight = 8 * nMaxV;
+			header.MCUsPerRow = (header.Width + header.MCUWidth - 1) / header.MCUWidth;
+			header.MCURows = (header.Height + header.MCUHeight - 1) / header.MCUHeight;
+			for (int i = 0; i < header.NumComponents; i++) {
+				for (int j = 0; j < header.SamplingH[i] * header.SamplingV[i]; j++) {
+					if (header.BlocksPerMCU == 10) {
+						return false;
+					}
+					header.BlockComponent[header.BlocksPerMCU++] = i;
+				}
+			}
+			bFrameFound = true;
+		} else if ((nMarker >= 0xC2 && nMarker <= 0xCF && nMarker != 0xC4 && nMarker != 0xC8) || nMarker == 0xDC) {
+			return false; // progressive, lossless, arithmetic coding or DNL
+		} else if (nMarker == 0xC4) {
+			int nOffset = 0;
+			while (nOffset + 17 <= nSegmentSize) {
+				int nClass = pSegment[nOffset] >> 4, nId = pSegment[nOffset] & 15;
+				int nNumValues = 0;
+				for (int i = 0; i < 16; i++) nNumValues += pSegment[nOffset + 1 + i];
+				if (nClass > 1 || nId > 3 || nNumValues > 256 || nOffset + 17 + nNumValues > nSegmentSize) {
+					return false;
+				}
+				CHuffmanTable& table = (nClass == 0) ? header.DCTables[nId] : header.ACTables[nId];
+				if (!BuildHuffmanTable(table, pSegment + nOffset + 1, pSegment + nOffset + 17, nNumValues)) {
+					return false;
+				}
+				nOffset += 17 + nNumValues;
+			}
+		} else if (nMarker == 0xDD) {
+			if (nSegmentSize < 2) {
+				return false;
+			}
+			header.RestartInterval = ReadWord(pSegment);
+		} else if (nMarker == 0xDA) {
+			if (!bFrameFound || nSegmentSize < 1 || pSegment[0] != header.NumComponents || nSegmentSize < 4 + 2 * header.NumComponents) {
+				return false;
+			}
+			for (int i = 0; i < header.NumComponents; i++) {
+				if (pSegment[1 + 2 * i] != header.ComponentIds[i]) {
+					return false;
+				}
+				header.DCTable[i] = pSegment[2 + 2 * i] >> 4;
+				header.ACTable[i] = pSegment[2 + 2 * i] & 15;
+				if (header.DCTable[i] > 3 || header.ACTable[i] > 3 ||
+					!header.DCTables[header.DCTable[i]].Defined || !header.ACTables[header.ACTable[i]].Defined) {
+					return false;
+				}
+			}
+			const uint8* pSpectral = pSegment + 1 + 2 * header.NumComponents;
+			if (pSpectral[0] != 0 || pSpectral[1] != 63 || pSpectral[2] != 0) {
+				return false;
+			}
+			header.SOSOffset = nPos;
+			header.ScanStart = nPos + 2 + nLength;
+			return true;
+		} else if (nMarker == 0xD9) {
+			return false;
+		}
+		nPos += 2 + nLength;
+	}
+	return false;
+}
+
+// Decodes (bCopy == false) or copies to the writer (bCopy == true) one MCU. When copying, the DC coefficients are
+// re-encoded with the standard DC table relative to pOutPredictors.
+static bool ProcessMCU(CBitReader& reader, const CFrameHeader& header, int* pPredictors,
+	CBitWriter* pWriter, int* pOutPredictors, const CHuffmanTable& standardDCTable) {
+	for (int nBlock = 0; nBlock < header.BlocksPerMCU; nBlock++) {
+		int nComponent = header.BlockComponent[nBlock];
+		const CHuffmanTable& dcTable = header.DCTables[header.DCTable[nComponent]];
+		const CHuffmanTable& acTable = header.ACTables[header.ACTable[nComponent]];
+		unsigned int nCode;
+		int nLength;
+
+		reader.Fill();
+		int nCategory = DecodeSymbol(reader, dcTable, nCode, nLength);
+		if (nCategory < 0 || nCategory > 11) {
+			return false;
+		}
+		int nDiff = (int)reader.Peek(nCategory);
+		reader.Skip(nCategory);
+		if (nCategory > 0 && nDiff < (1 << (nCategory - 1))) {
+			nDiff -= (1 << nCategory) - 1;
+		}
+		pPredictors[nComponent] += nDiff;
+		if (pWriter != NULL) {
+			int nOutDiff = pPredictors[nComponent] - pOutPredictors[nComponent];
+			pOutPredictors[nComponent] = pPredictors[nComponent];
+			int nAbsDiff = abs(nOutDiff);
+			int nOutCategory = 0;
+			while (nAbsDiff >> nOutCategory) nOutCategory++;
+			if (nOutCategory > 11 ||
+				!pWriter->Put(standardDCTable.Code[nOutCategory], standardDCTable.CodeLength[nOutCategory]) ||
+				!pWriter->Put((nOutDiff < 0) ? nOutDiff - 1 : nOutDiff, nOutCategory)) {
+				return false;
+			}
+		}
+
+		for (int k = 1; k < 64; k++) {
+			reader.Fill();
+			int nSymbol = DecodeSymbol(reader, acTable, nCode, nLength);
+			if (nSymbol < 0) {
+				return false;
+			}
+			int nRun = nSymbol >> 4, nSize = nSymbol & 15;
+			unsigned int nBits = reader.Peek(nSize);
+			reader.Skip(nSize);
+			if (pWriter != NULL && (!pWriter->Put(nCode, nLength) || !pWriter->Put(nBits, nSize))) {
+				return false;
+			}
+			if (nSize == 0 && nRun != 15) {
+				break; // end of block
+			}
+			k += nRun;
+			if (k > 63) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Walks the MCUs nFirstMCU to nEndMCU - 1, starting with the given reader and predictor state, and stores the state at
+// the start of each MCU row in pEntries
+static bool WalkMCUs(CBitReader& reader, const CFrameHeader& header, int* pPredictors, int nFirstMCU, int nEndMCU,
+	CJPEGIndex::CEntry* pEntries) {
+	for (int nMCU = nFirstMCU; nMCU < nEndMCU; nMCU++) {
+		if (header.RestartInterval != 0 && nMCU > nFirstMCU && nMCU % header.RestartInterval == 0) {
+			if (!reader.Restart()) {
+				return false;
+			}
+			memset(pPredictors, 0, 4 * sizeof(int));
+		}
+		if (nMCU % header.MCUsPerRow == 0) {
+			CJPEGIndex::CEntry& entry = pEntries[nMCU / header.MCUsPerRow];
+			entry.Position = reader.Position;
+			entry.Bits = reader.Bits;
+			entry.Buffer = reader.Buffer;
+			entry.MarkerHit = reader.MarkerHit;
+			memcpy(entry.Predictors, pPredictors, 4 * sizeof(int));
+		}
+		if (!ProcessMCU(reader, header, pPredictors, NULL, NULL, header.DCTables[0])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Finds the start of the entropy coded data of each restart interval by searching the restart markers.
+// Returns false if there are less restart markers than needed.
+static bool FindRestartIntervals(const uint8* pStream, int nStreamSize, int nScanStart, int* pIntervalStarts, int nNumIntervals) {
+	pIntervalStarts[0] = nScanStart;
+	int nInterval = 1;
+	const uint8* p = pStream + nScanStart;
+	const uint8* pEnd = pStream + nStreamSize - 1;
+	while (nInterval < nNumIntervals) {
+		p = (p < pEnd) ? (const uint8*)memchr(p, 0xFF, pEnd - p) : NULL;
+		if (p == NULL) {
+			return false;
+		}
+		uint8 nMarker = p[1];
+		if (nMarker >= 0xD0 && nMarker <= 0xD7) {
+			pIntervalStarts[nInterval++] = (int)(p + 2 - pStream);
+			p += 2;
+		} else if (nMarker == 0 || nMarker == 0xFF) {
+			p++; // stuffed zero byte or fill byte
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Request to walk the restart intervals of a JPEG in parallel, the y-coordinate of the geometry is the restart interval,
+// the x-coordinate the 8x8 blocks of an interval
+class CRequestIndexRestartIntervals : public CProcessingRequest {
+public:
+	CRequestIndexRestartIntervals(const uint8* pStream, int nStreamSize, const CFrameHeader& header,
+		const int* pIntervalStarts, int nNumIntervals, CJPEGIndex::CEntry* pEntries)
+		: CProcessingRequest(pStream, CSize(header.RestartInterval * header.BlocksPerMCU, nNumIntervals), pEntries,
+		CSize(header.RestartInterval * header.BlocksPerMCU, nNumIntervals), CPoint(0, 0),
+		CSize(header.RestartInterval * header.BlocksPerMCU, nNumIntervals)), m_header(header) {
+		m_pStream = pStream;
+		m_nStreamSize = nStreamSize;
+		m_pIntervalStarts = pIntervalStarts;
+		m_pEntries = pEntries;
+		StripPadding = 1;
+	}
+
+	virtual bool ProcessStrip(int offsetY, int sizeY) {
+		int nNumMCUs = m_header.MCUsPerRow * m_header.MCURows;
+		for (int nInterval = offsetY; nInterval < offsetY + sizeY; nInterval++) {
+			CBitReader reader = { m_pStream, m_nStreamSize, m_pIntervalStarts[nInterval], 0, 0, false };
+			int nPredictors[4] = { 0, 0, 0, 0 };
+			int nFirstMCU = nInterval * m_header.RestartInterval;
+			if (!WalkMCUs(reader, m_header, nPredictors, nFirstMCU, min(nNumMCUs, nFirstMCU + m_header.RestartInterval), m_pEntries)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+private:
+	const CFrameHeader& m_header;
+	const uint8* m_pStream;
+	int m_nStreamSize;
+	const int* m_pIntervalStarts;
+	CJPEGIndex::CEntry* m_pEntries;
+};
+
+static CString IndexFileName(__int64 nHash, int nStreamSize, __int64 nFileTime) {
+	CString sFileName;
+	sFileName.Format(_T("%sJPEGIndex\\%016I64X_%08X_%016I64X.idx"), Helpers::JPEGViewAppDataPath(), nHash, nStreamSize, nFileTime);
+	return sFileName;
+}
+
+// Sets the last write time of the index file to now, the least recently used index files are deleted first
+static void TouchIndexFile(LPCTSTR sFileName) {
+	HANDLE hFile = ::CreateFile(sFileName, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+	if (hFile != INVALID_HANDLE_VALUE) {
+		FILETIME now;
+		::GetSystemTimeAsFileTime(&now);
+		::SetFileTime(hFile, NULL, NULL, &now);
+		::CloseHandle(hFile);
+	}
+}
+
+struct CIndexFile {
+	CString FileName;
+	unsigned __int64 LastWriteTime;
+	unsigned __int64 Size;
+	bool operator < (const CIndexFile& other) const { return LastWriteTime < other.LastWriteTime; }
+};
+
+// Deletes the least recently used index files until the index files take at most nMaxSize bytes
+static void PruneIndexFiles(unsigned __int64 nMaxSize) {
+	std::list<CIndexFile> files;
+	unsigned __int64 nTotalSize = 0;
+	CFindFile fileFind;
+	if (fileFind.FindFile(CString(Helpers::JPEGViewAppDataPath()) + _T("JPEGIndex\\*.idx"))) {
+		do {
+			if (fileFind.IsDirectory()) continue;
+			FILETIME lastWriteTime;
+			fileFind.GetLastWriteTime(&lastWriteTime);
+			CIndexFile file;
+			file.FileName = fileFind.GetFilePath();
+			file.LastWriteTime = ((unsigned __int64)lastWriteTime.dwHighDateTime << 32) | lastWriteTime.dwLowDateTime;
+			file.Size = fileFind.GetFileSize();
+			nTotalSize += file.Size;
+			files.push_back(file);
+		} while (fileFind.FindNextFile());
+	}
+	if (nTotalSize <= nMaxSize) {
+		return;
+	}
+	files.sort();
+	std::list<CIndexFile>::iterator iter;
+	for (iter = files.begin(); iter != files.end() && nTotalSize > nMaxSize; iter++) {
+		if (::DeleteFile(iter->FileName)) {
+			nTotalSize -= iter->Size;
+		}
+	}
+}
+
+CJPEGIndex::CJPEGIndex() {
+	m_nStreamSize = 0;
+	m_nWidth = m_nHeight = 0;
+	m_nMCUHeight = 0;
+	m_nScanStart = 0;
+	m_nMCURows = 0;
+	m_pEntries = NULL;
+}
+
+CJPEGIndex::~CJPEGIndex() {
+	delete[] m_pEntries;
+}
+
+CJPEGIndex* CJPEGIndex::Build(const void* pJPEGStream, int nStreamSize, bool bRequireRestartMarkers) {
+	CFrameHeader* pHeader = new(std::nothrow) CFrameHeader;
+	if (pHeader == NULL) {
+		return NULL;
+	}
+	CJPEGIndex* pIndex = NULL;
+	if (ParseHeader((const uint8*)pJPEGStream, nStreamSize, *pHeader) && (pHeader->RestartInterval != 0 || !bRequireRestartMarkers)) {
+		pIndex = new(std::nothrow) CJPEGIndex();
+		CEntry* pEntries = new(std::nothrow) CEntry[pHeader->MCURows];
+		if (pIndex != NULL && pEntries != NULL) {
+			pIndex->m_nStreamSize = nStreamSize;
+			pIndex->m_nWidth = pHeader->Width;
+			pIndex->m_nHeight = pHeader->Height;
+			pIndex->m_nMCUHeight = pHeader->MCUHeight;
+			pIndex->m_nScanStart = pHeader->ScanStart;
+			pIndex->m_nMCURows = pHeader->MCURows;
+			pIndex->m_pEntries = pEntries;
+
+			int nNumMCUs = pHeader->MCUsPerRow * pHeader->MCURows;
+			bool bOk;
+			if (pHeader->RestartInterval != 0) {
+				// the restart intervals are independent, each one starts with a reset reader and DC predictors
+				int nNumIntervals = (nNumMCUs + pHeader->RestartInterval - 1) / pHeader->RestartInterval;
+				int* pIntervalStarts = new(std::nothrow) int[nNumIntervals];
+				bOk = pIntervalStarts != NULL &&
+					FindRestartIntervals((const uint8*)pJPEGStream, nStreamSize, pHeader->ScanStart, pIntervalStarts, nNumIntervals);
+				if (bOk) {
+					CRequestIndexRestartIntervals request((const uint8*)pJPEGStream, nStreamSize, *pHeader, pIntervalStarts, nNumIntervals, pEntries);
+					bOk = CProcessingThreadPool::This().Process(&request);
+				}
+				delete[] pIntervalStarts;
+			} else {
+				CBitReader reader = { (const uint8*)pJPEGStream, nStreamSize, pHeader->ScanStart, 0, 0, false };
+				int nPredictors[4] = { 0, 0, 0, 0 };
+				bOk = WalkMCUs(reader, *pHeader, nPredictors, 0, nNumMCUs, pEntries);
+			}
+			if (!bOk) {
+				delete pIndex;
+				pIndex = NULL;
+			}
+		} else {
+			delete pIndex;
+			delete[] pEntries;
+			pIndex = NULL;
+		}
+	}
+	delete pHeader;
+	return pIndex;
+}
+
+CJPEGIndex* CJPEGIndex::Load(const void* pJPEGStream, int nStreamSize, __int64 nHash, __int64 nFileTime) {
+	CString sFileName = IndexFileName(nHash, nStreamSize, nFileTime);
+	FILE* fptr;
+	if ((fptr = _tfopen(sFileName, _T("rb"))) == NULL) {
+		return NULL;
+	}
+	unsigned int nMagic = 0;
+	int nVersion = 0;
+	int nFileStreamSize = 0;
+	__int64 nFileHash = 0, nFileFileTime = 0;
+	CJPEGIndex* pIndex = new(std::nothrow) CJPEGIndex();
+	bool bOk = pIndex != NULL &&
+		fread(&nMagic, sizeof(nMagic), 1, fptr) == 1 && nMagic == INDEX_FILE_MAGIC &&
+		fread(&nVersion, sizeof(nVersion), 1, fptr) == 1 && nVersion == INDEX_FILE_VERSION &&
+		fread(&nFileStreamSize, sizeof(int), 1, fptr) == 1 && nFileStreamSize == nStreamSize &&
+		fread(&nFileHash, sizeof(__int64), 1, fptr) == 1 && nFileHash == nHash &&
+		fread(&nFileFileTime, sizeof(__int64), 1, fptr) == 1 && nFileFileTime == nFileTime &&
+		fread(&pIndex->m_nWidth, sizeof(int), 1, fptr) == 1 &&
+		fread(&pIndex->m_nHeight, sizeof(int), 1, fptr) == 1 &&
+		fread(&pIndex->m_nScanStart, sizeof(int), 1, fptr) == 1 &&
+		fread(&pIndex->m_nMCURows, sizeof(int), 1, fptr) == 1;
+
+	// the index must match the header of the JPEG and the entries must be in the entropy coded data in increasing order
+	CFrameHeader* pHeader = bOk ? new(std::nothrow) CFrameHeader : NULL;
+	bOk = pHeader != NULL && ParseHeader((const uint8*)pJPEGStream, nStreamSize, *pHeader) &&
+		pHeader->Width == pIndex->m_nWidth && pHeader->Height == pIndex->m_nHeight &&
+		pHeader->ScanStart == pIndex->m_nScanStart && pHeader->MCURows == pIndex->m_nMCURows;
+	if (bOk) {
+		pIndex->m_nMCUHeight = pHeader->MCUHeight;
+	}
+	delete pHeader;
+	if (bOk) {
+		pIndex->m_nStreamSize = nStreamSize;
+		pIndex->m_pEntries = new(std::nothrow) CEntry[pIndex->m_nMCURows];
+		bOk = pIndex->m_pEntries != NULL &&
+			fread(pIndex->m_pEntries, sizeof(CEntry), pIndex->m_nMCURows, fptr) == (size_t)pIndex->m_nMCURows;
+		int nLastPosition = pIndex->m_nScanStart;
+		for (int i = 0; i < pIndex->m_nMCURows && bOk; i++) {
+			const CEntry& entry = pIndex->m_pEntries[i];
+			bOk = entry.Position >= nLastPosition && entry.Position <= nStreamSize && entry.Bits >= 0 && entry.Bits <= 64;
+			nLastPosition = entry.Position;
+		}
+	}
+	fclose(fptr);
+	if (!bOk) {
+		delete pIndex;
+		return NULL;
+	}
+	TouchIndexFile(sFileName);
+	return pIndex;
+}
+
+bool CJPEGIndex::Save(__int64 nHash, __int64 nFileTime, int nCacheMB) const {
+	::CreateDirectory(CString(Helpers::JPEGViewAppDataPath()) + _T("JPEGIndex"), NULL);
+	CString sFileName = IndexFileName(nHash, m_nStreamSize, nFileTime);
+	FILE* fptr;
+	if ((fptr = _tfopen(sFileName, _T("wb"))) == NULL) {
+		return false;
+	}
+	bool bOk = fwrite(&INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC), 1, fptr) == 1 &&
+		fwrite(&INDEX_FILE_VERSION, sizeof(INDEX_FILE_VERSION), 1, fptr) == 1 &&
+		fwrite(&m_nStreamSize, sizeof(int), 1, fptr) == 1 &&
+		fwrite(&nHash, sizeof(__int64), 1, fptr) == 1 &&
+		fwrite(&nFileTime, sizeof(__int64), 1, fptr) == 1 &&
+		fwrite(&m_nWidth, sizeof(int), 1, fptr) == 1 &&
+		fwrite(&m_nHeight, sizeof(int), 1, fptr) == 1 &&
+		fwrite(&m_nScanStart, sizeof(int), 1, fptr) == 1 &&
+		fwrite(&m_nMCURows, sizeof(int), 1, fptr) == 1 &&
+		fwrite(m_pEntries, sizeof(CEntry), m_nMCURows, fptr) == (size_t)m_nMCURows;
+	fclose(fptr);
+	if (!bOk) {
+		::DeleteFile(sFileName);
+	}
+	PruneIndexFiles((unsigned __int64)nCacheMB * 1024 * 1024);
+	return bOk;
+}
+
+void* CJPEGIndex::CreateSubImage(const void* pJPEGStream, int nStreamSize, int nFirstRow, int nLastRow,
+	int& nSubImageSize, int& nSubImageFirstRow) const {
+	const uint8* pStream = (const uint8*)pJPEGStream;
+	CFrameHeader* pHeader = new(std::nothrow) CFrameHeader;
+	if (pHeader == NULL) {
+		return NULL;
+	}
+	CHuffmanTable* pStandardDCTable = new(std::nothrow) CHuffmanTable;
+	if (pStandardDCTable == NULL || nStreamSize != m_nStreamSize || !ParseHeader(pStream, nStreamSize, *pHeader) ||
+		pHeader->ScanStart != m_nScanStart || pHeader->MCURows != m_nMCURows) {
+		delete pStandardDCTable;
+		delete pHeader;
+		return NULL;
+	}
+	BuildHuffmanTable(*pStandardDCTable, STANDARD_DC_BITS, STANDARD_DC_VALUES, sizeof(STANDARD_DC_VALUES));
+
+	int nFirstMCURow = max(0, min(m_nMCURows - 1, nFirstRow / pHeader->MCUHeight - 1));
+	int nLastMCURow = max(nFirstMCURow, min(m_nMCURows - 1, (nLastRow - 1) / pHeader->MCUHeight + 1));
+	int nSubImageHeight = min(m_nHeight, (nLastMCURow + 1) * pHeader->MCUHeight) - nFirstMCURow * pHeader->MCUHeight;
+	int nEndPosition = (nLastMCURow + 1 < m_nMCURows) ? m_pEntries[nLastMCURow + 1].Position : nStreamSize;
+
+	CBitWriter writer = { NULL, 0, 0, 0, 0 };
+	int nCapacity = pHeader->ScanStart + (nEndPosition - m_pEntries[nFirstMCURow].Position) / 8 * 9 + 65536;
+	writer.Data = new(std::nothrow) uint8[nCapacity];
+	writer.Capacity = (writer.Data == NULL) ? 0 : nCapacity;
+	bool bOk = writer.Data != NULL;
+
+	// copy the marker segments up to the scan, except the ones not needed for decoding or not valid for the sub image
+	int nPos = 2;
+	bOk = bOk && writer.Emit(pStream, 2);
+	while (bOk && nPos < pHeader->SOSOffset) {
+		uint8 nMarker = pStream[nPos + 1];
+		if (nMarker == 0xFF) {
+			nPos++;
+			continue;
+		}
+		int nSegmentSize = 2 + ReadWord(pStream + nPos + 2);
+		bool bSkip = nMarker == 0xDD || nMarker == 0xFE || (nMarker >= 0xE1 && nMarker <= 0xEF && nMarker != 0xEE);
+		if (nPos == pHeader->SOFOffset) {
+			uint8 nHeight[2] = { (uint8)(nSubImageHeight >> 8), (uint8)nSubImageHeight };
+			bOk = writer.Emit(pStream + nPos, 5) && writer.Emit(nHeight, 2) && writer.Emit(pStream + nPos + 7, nSegmentSize - 7);
+		} else if (!bSkip) {
+			bOk = writer.Emit(pStream + nPos, nSegmentSize);
+		}
+		nPos += nSegmentSize;
+	}
+
+	// the standard DC tables replace the DC tables used by the scan
+	for (int i = 0; i < pHeader->NumComponents && bOk; i++) {
+		uint8 nDHT[5] = { 0xFF, 0xC4, 0, 2 + 1 + 16 + sizeof(STANDARD_DC_VALUES), (uint8)pHeader->DCTable[i] };
+		bOk = writer.Emit(nDHT, 5) && writer.Emit(STANDARD_DC_BITS, 16) && writer.Emit(STANDARD_DC_VALUES, sizeof(STANDARD_DC_VALUES));
+	}
+	bOk = bOk && writer.Emit(pStream + pHeader->SOSOffset, pHeader->ScanStart - pHeader->SOSOffset);
+
+	// transcode the entropy coded data of the MCU rows, starting with the reader state of the first row
+	const CEntry& entry = m_pEntries[nFirstMCURow];
+	CBitReader reader = { pStream, nStreamSize, entry.Position, entry.Buffer, entry.Bits, entry.MarkerHit != 0 };
+	int nPredictors[4], nOutPredictors[4] = { 0, 0, 0, 0 };
+	memcpy(nPredictors, entry.Predictors, sizeof(nPredictors));
+	int nFirstMCU = nFirstMCURow * pHeader->MCUsPerRow;
+	int nEndMCU = (nLastMCURow + 1) * pHeader->MCUsPerRow;
+	for (int nMCU = nFirstMCU; nMCU < nEndMCU && bOk; nMCU++) {
+		if (pHeader->RestartInterval != 0 && nMCU > nFirstMCU && nMCU % pHeader->RestartInterval == 0) {
+			bOk = reader.Restart();
+			memset(nPredictors, 0, sizeof(nPredictors));
+		}
+		bOk = bOk && ProcessMCU(reader, *pHeader, nPredictors, &writer, nOutPredictors, *pStandardDCTable);
+	}
+	uint8 nEOI[2] = { 0xFF, 0xD9 };
+	bOk = bOk && writer.Flush() && writer.Emit(nEOI, 2);
+
+	nSubImageFirstRow = nFirstMCURow * pHeader->MCUHeight;
+	delete pStandardDCTable;
+	delete pHeader;
+	if (!bOk) {
+		delete[] writer.Data;
+		return NULL;
+	}
+	nSubImageSize = writer.Size;
+	return writer.Data;
+}
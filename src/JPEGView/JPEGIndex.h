@@ -0,0 +1,55 @@
+#pragma once
+
+// Random access index into the entropy coded data of a sequential Huffman coded JPEG (baseline or extended, one scan
+// containing all components). For the start of each MCU row, the index holds the state of the Huffman bit reader and the
+// DC predictors of the components. With the index, a JPEG stream containing only the MCU rows of a region is created
+// (see CreateSubImage()), so decoding a region near the bottom of a huge JPEG does not entropy decode the scan from its
+// start. Indices are persisted in the JPEGIndex folder of the application data path, keyed by the hash, size and
+// modification time of the file. The least recently used indices are deleted when the folder exceeds its size limit.
+class CJPEGIndex
+{
+public:
+	// State of the Huffman bit reader and the DC predictors at the start of an MCU row
+	struct CEntry {
+		int Position; // next byte to read
+		int Bits; // number of valid bits in Buffer
+		unsigned __int64 Buffer; // bits read ahead, MSB first
+		int MarkerHit; // the reader hit a marker and delivers zero bits
+		int Predictors[4]; // DC predictors of the components
+	};
+
+	~CJPEGIndex();
+
+	// Builds the index by walking the entropy coded data of the JPEG stream. Returns NULL if the JPEG is not supported
+	// (progressive, lossless, arithmetic coding, more than one scan) or corrupt.
+	// If the JPEG has restart markers, the restart intervals are walked in parallel on the processing thread pool.
+	// With bRequireRestartMarkers, NULL is returned for JPEGs without restart markers.
+	static CJPEGIndex* Build(const void* pJPEGStream, int nStreamSize, bool bRequireRestartMarkers = false);
+
+	// Loads the persisted index of the JPEG stream, NULL if there is none or if it does not match the JPEG stream
+	static CJPEGIndex* Load(const void* pJPEGStream, int nStreamSize, __int64 nHash, __int64 nFileTime);
+
+	// Persists the index, returns false if it cannot be written. Afterwards the least recently loaded or saved index files
+	// are deleted until all index files take at most nCacheMB megabytes.
+	bool Save(__int64 nHash, __int64 nFileTime, int nCacheMB) const;
+
+	// Creates a JPEG stream of the MCU rows covering the pixel rows nFirstRow to nLastRow - 1 of the JPEG, plus one MCU row
+	// on each side so that chroma upsampling is identical to the full image in the rows requested.
+	// nSubImageFirstRow returns the row of the full image that is the first row of the created image.
+	// The caller gets ownership of the returned stream (delete[]). Returns NULL if the stream does not match the index.
+	void* CreateSubImage(const void* pJPEGStream, int nStreamSize, int nFirstRow, int nLastRow,
+		int& nSubImageSize, int& nSubImageFirstRow) const;
+
+	// Height of an MCU row in pixels
+	int MCURowHeight() const { return m_nMCUHeight; }
+
+private:
+	CJPEGIndex();
+
+	int m_nStreamSize;
+	int m_nWidth, m_nHeight;
+	int m_nMCUHeight;
+	int m_nScanStart;
+	int m_nMCURows;
+	CEntry* m_pEntries; // m_nMCURows entries
+};
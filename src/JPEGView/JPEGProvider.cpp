@@ -6,16 +6,25 @@
 #include "FileList.h"
 #include "ProcessParams.h"
 #include "BasicProcessing.h"
+#include "FilePrefetcher.h"
+#include "SettingsProvider.h"
 
-CJPEGProvider::CJPEGProvider(HWND handlerWnd, int nNumThreads, int nNumBuffers) {
+// Maximum number of requests kept, also when their images use little memory
+static const unsigned int MAX_CACHED_REQUESTS = 100;
+
+CJPEGProvider::CJPEGProvider(HWND handlerWnd, int nNumThreads) {
 	m_hHandlerWnd = handlerWnd;
 	m_nNumThread = nNumThreads;
-	m_nNumBuffers = nNumBuffers;
 	m_nCurrentTimeStamp = 0;
+	m_nGeneration = 0;
 	m_eOldDirection = FORWARD;
+	m_nCurrentFileIndex = -1;
+	m_nFileListSize = 0;
+	m_nCacheMemSize = 0;
+	m_pPrefetcher = (CSettingsProvider::This().PrefetchFiles() > 0) ? new CFilePrefetcher(CSettingsProvider::This().PrefetchCacheMB()) : NULL;
 	m_pWorkThreads = new CImageLoadThread*[nNumThreads];
 	for (int i = 0; i < nNumThreads; i++) {
-		m_pWorkThreads[i] = new CImageLoadThread();
+		m_pWorkThreads[i] = new CImageLoadThread(m_pPrefetcher);
 	}
 }
 
@@ -24,6 +33,7 @@ CJPEGProvider::~CJPEGProvider(void) {
 		delete m_pWorkThreads[i];
 	}
 	delete[] m_pWorkThreads;
+	delete m_pPrefetcher; // after the load threads, these take from its cache
 	std::list<CImageRequest*>::iterator iter;
 	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
 		delete (*iter)->Image;
@@ -33,7 +43,7 @@ CJPEGProvider::~CJPEGProvider(void) {
 
 CJPEGImage* CJPEGProvider::RequestImage(CFileList* pFileList, EReadAheadDirection eDirection,
                                         LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams,
-                                        bool& bOutOfMemory, bool& bExceptionError) {
+                                        bool& bOutOfMemory, bool& bExceptionError, bool bAllowPreview) {
 	if (strFileName == NULL) {
 		bOutOfMemory = false;
 		bExceptionError = false;
@@ -44,24 +54,51 @@ CJPEGImage* CJPEGProvider::RequestImage(CFileList* pFileList, EReadAheadDirectio
 	// Search if we have the requested image already present or in progress
 	CImageRequest* pRequest = FindRequest(strFileName, nFrameIndex);
 	bool bDirectionChanged = eDirection != m_eOldDirection || eDirection == TOGGLE;
-	bool bRemoveAlsoActiveRequests = bDirectionChanged; // if direction changed, all read-ahead requests are wrongly guessed
 	bool bWasOutOfMemory = false;
 	m_eOldDirection = eDirection;
+	m_nGeneration++;
+	m_nCurrentFileIndex = (pFileList != NULL) ? pFileList->CurrentIndex() : -1;
+	m_nFileListSize = (pFileList != NULL) ? pFileList->Size() : 0;
+	m_sCurrentFolder = (pFileList != NULL) ? pFileList->CurrentDirectory() : NULL;
 
-	if (pRequest == NULL) {
+	bool bNewRequest = pRequest == NULL;
+	if (bNewRequest) {
 		// no request pending for this file, add to request queue and start async
 		pRequest = StartNewRequest(strFileName, nFrameIndex, processParams);
-		// wait with read ahead when direction changed - maybe user just wants to re-see last image
-		if (!bDirectionChanged && eDirection != NONE) {
-			// start parallel if more than one thread
-			StartNewRequestBundle(pFileList, eDirection, processParams, m_nNumThread - 1, NULL);
-		}
+	} else if (pRequest->QueuedParams != NULL) {
+		// queued for read ahead but not started yet, start it now as it is needed
+		pRequest->Priority = 0;
+		StartRequest(pRequest, SearchThreadForNewRequest(), *pRequest->QueuedParams);
+	} else if (pRequest->Priority > 0 && pRequest->HandlingThread != NULL) {
+		// read ahead still loading is needed now, its processing must no longer give way to interactive processing
+		pRequest->Priority = 0;
+		pRequest->HandlingThread->PromoteLoad(pRequest->Handle);
+	}
+	pRequest->Generation = m_nGeneration;
+	// read ahead not started yet is for the old position in the file list, it is queued again below for the new one
+	RemoveQueuedRequests();
+	// wait with read ahead when direction changed - maybe user just wants to re-see last image
+	if (bNewRequest && !bDirectionChanged && eDirection != NONE) {
+		// start parallel if more than one thread
+		StartNewRequestBundle(pFileList, eDirection, processParams, m_nNumThread - 1, NULL);
 	}
+	if ((bNewRequest && eDirection != NONE) || bDirectionChanged) {
+		// read ahead loading for an old position or the old direction would delay the requested image
+		CancelRequestsOlderThan(m_nGeneration);
+	}
+	StartQueuedRequests();
 
 /*GF*/	TCHAR debugtext[512];
 
-	// wait for request if not yet ready
-	if (!pRequest->Ready) {
+	// wait for request if not yet ready, large JPEGs show a preview instead of waiting
+	CJPEGImage* pPreview = NULL;
+	if (!pRequest->Ready && bAllowPreview && ::WaitForSingleObject(pRequest->EventFinished, 0) != WAIT_OBJECT_0) {
+		pPreview = CImageLoadThread::LoadPreview(strFileName, processParams);
+	}
+	if (pPreview != NULL) {
+/*GF*/	swprintf(debugtext,255,TEXT("Showing preview for request:  %s"), pRequest->FileName);
+/*GF*/	::OutputDebugStringW(debugtext);
+	} else if (!pRequest->Ready) {
 /*GF*/	swprintf(debugtext,255,TEXT("Waiting for request:  %s"), pRequest->FileName);
 /*GF*/	::OutputDebugStringW(debugtext);
 
@@ -80,9 +117,10 @@ CJPEGImage* CJPEGProvider::RequestImage(CFileList* pFileList, EReadAheadDirectio
 /*GF*/	::OutputDebugStringW(debugtext);
 	}
 
-	// set before removing unused images!
-	pRequest->InUse = true;
+	// set before removing unused images! The request of a preview is marked as in use by RequestFullImage().
+	pRequest->InUse = pPreview == NULL;
 	pRequest->AccessTimeStamp = m_nCurrentTimeStamp++;
+	SetFilePosition(pRequest, 0);
 
 	if (pRequest->OutOfMemory) {
 		// The request could not be satisfied because the system is out of memory.
@@ -94,18 +132,49 @@ CJPEGImage* CJPEGProvider::RequestImage(CFileList* pFileList, EReadAheadDirectio
 		if (FreeAllPossibleMemory()) {
 			DeleteElement(pRequest);
 			pRequest = StartRequestAndWaitUntilReady(strFileName, nFrameIndex, processParams);
+			pRequest->InUse = true;
+			pRequest->AccessTimeStamp = m_nCurrentTimeStamp++;
+			SetFilePosition(pRequest, 0);
 		}
 	}
 
 	// cleanup stuff no longer used
-	RemoveUnusedImages(bRemoveAlsoActiveRequests);
-	ClearOldestInactiveRequest();
+	RemoveUnusedImages();
 
 	// check if we shall start new requests (don't start another request if we are short of memory!)
-	if (m_requestList.size() < (unsigned int)m_nNumBuffers && !bDirectionChanged && !bWasOutOfMemory && eDirection != NONE) {
-		StartNewRequestBundle(pFileList, eDirection, processParams, m_nNumThread, pRequest);
+	__int64 nBudget = (__int64)CSettingsProvider::This().ImageCacheMB() * 1024 * 1024;
+	if (m_nCacheMemSize < nBudget && !bDirectionChanged && !bWasOutOfMemory && eDirection != NONE) {
+		StartNewRequestBundle(pFileList, eDirection, processParams, max(1, m_nNumThread - 1), pRequest);
+		// read ahead loading for files no longer ahead would only block the load threads
+		CancelRequestsOlderThan(m_nGeneration);
+		StartQueuedRequests();
+	}
+	if (!bDirectionChanged) {
+		PrefetchFiles(pFileList, eDirection);
+	}
+
+	if (pPreview != NULL) {
+		bOutOfMemory = false;
+		bExceptionError = false;
+		return pPreview;
+	}
+	bOutOfMemory = pRequest->OutOfMemory;
+	bExceptionError = pRequest->ExceptionError;
+	return pRequest->Image;
+}
+
+CJPEGImage* CJPEGProvider::RequestFullImage(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams,
+											bool& bOutOfMemory, bool& bExceptionError) {
+	CImageRequest* pRequest = FindRequest(strFileName, nFrameIndex);
+	if (pRequest == NULL) {
+		// the request has been cleared in the meantime
+		pRequest = StartRequestAndWaitUntilReady(strFileName, nFrameIndex, processParams);
+	} else if (!pRequest->Ready) {
+		return NULL;
 	}
 
+	pRequest->InUse = pRequest->Image != NULL;
+	pRequest->AccessTimeStamp = m_nCurrentTimeStamp++;
 	bOutOfMemory = pRequest->OutOfMemory;
 	bExceptionError = pRequest->ExceptionError;
 	return pRequest->Image;
@@ -117,7 +186,6 @@ void CJPEGProvider::NotifyNotUsed(CJPEGImage* pImage) {
 	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
 		if ((*iter)->Image == pImage) {
 			(*iter)->InUse = false;
-			(*iter)->IsActive = false;
 			return;
 		}
 	}
@@ -126,6 +194,8 @@ void CJPEGProvider::NotifyNotUsed(CJPEGImage* pImage) {
 }
 
 void CJPEGProvider::ClearAllRequests() {
+	// requests still loading would be deleted when finished
+	CancelRequestsOlderThan(m_nGeneration + 1);
 	std::list<CImageRequest*>::iterator iter;
 	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
 		if (ClearRequest((*iter)->Image)) {
@@ -151,6 +221,30 @@ bool CJPEGProvider::FreeAllPossibleMemory() {
 	return bCouldFreeMemory;
 }
 
+void CJPEGProvider::CancelRequests(LPCTSTR sFileName) {
+	std::list<CImageRequest*>::iterator iter = m_requestList.begin();
+	while (iter != m_requestList.end()) {
+		if (_tcsicmp(sFileName, (*iter)->FileName) == 0 && CancelRequest(*iter)) {
+			delete *iter; // has no image yet
+			iter = m_requestList.erase(iter);
+		} else {
+			iter++;
+		}
+	}
+}
+
+void CJPEGProvider::CancelRequestsOlderThan(int nGeneration) {
+	std::list<CImageRequest*>::iterator iter = m_requestList.begin();
+	while (iter != m_requestList.end()) {
+		if ((*iter)->Generation < nGeneration && CancelRequest(*iter)) {
+			delete *iter; // has no image yet
+			iter = m_requestList.erase(iter);
+		} else {
+			iter++;
+		}
+	}
+}
+
 void CJPEGProvider::FileHasRenamed(LPCTSTR sOldFileName, LPCTSTR sNewFileName) {
 	std::list<CImageRequest*>::iterator iter;
 	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
@@ -165,10 +259,17 @@ bool CJPEGProvider::ClearRequest(CJPEGImage* pImage, bool releaseLockedFile) {
 		return false;
 	}
 	bool bErased = false;
+	CString sReleasedFileName;
 	std::list<CImageRequest*>::iterator iter;
 	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
 		if ((*iter)->Image == pImage) {
-			if (releaseLockedFile) m_pWorkThreads[0]->ReleaseFile((*iter)->FileName);
+			if (releaseLockedFile) {
+				// each load thread caches the last GDI+ bitmap
+				sReleasedFileName = (*iter)->FileName;
+				for (int i = 0; i < m_nNumThread; i++) {
+					m_pWorkThreads[i]->ReleaseFile(sReleasedFileName);
+				}
+			}
 			// images that are not ready cannot be removed yet
 			if ((*iter)->Ready) {
 				DeleteElementAt(iter);
@@ -180,6 +281,10 @@ bool CJPEGProvider::ClearRequest(CJPEGImage* pImage, bool releaseLockedFile) {
 			break;
 		}
 	}
+	if (!sReleasedFileName.IsEmpty()) {
+		// the file is going away, e.g. other frames of it are not needed anymore
+		CancelRequests(sReleasedFileName);
+	}
 	return bErased;
 }
 
@@ -189,9 +294,12 @@ void CJPEGProvider::OnImageLoadCompleted(int nHandle) {
 		if ((*iter)->Handle == nHandle) {
 			GetLoadedImageFromWorkThread(*iter);
 			if ((*iter)->Deleted) {
-				// this request was deleted, delete image now
-				ClearRequest((*iter)->Image);
+				// this request was deleted or cancelled, delete image now
+				DeleteElementAt(iter);
 			}
+			RemoveUnusedImages();
+			// the thread is idle now
+			StartQueuedRequests();
 			break;
 		}
 	}
@@ -223,32 +331,131 @@ void CJPEGProvider::StartNewRequestBundle(CFileList* pFileList, EReadAheadDirect
 		bool bSwitchImage = true;
 		int nFrameIndex = (pLastReadyRequest != NULL) ? Helpers::GetFrameIndex(pLastReadyRequest->Image, eDirection == FORWARD, true, bSwitchImage) : 0;
 		LPCTSTR sFileName = bSwitchImage ? pFileList->PeekNextPrev(i + 1, eDirection == FORWARD, eDirection == TOGGLE) : pFileList->Current();
-		if (sFileName != NULL && FindRequest(sFileName, nFrameIndex) == NULL) {
+		CImageRequest* pExistingRequest = (sFileName != NULL) ? FindRequest(sFileName, nFrameIndex) : NULL;
+		if (pExistingRequest != NULL) {
+			// still wanted, must not be cancelled
+			pExistingRequest->Generation = m_nGeneration;
+		} else if (sFileName != NULL) {
 //			if (GetProcessingFlag(PFLAG_NoProcessingAfterLoad, processParams.ProcFlags)) {
 				// The read ahead threads need this flag to be deleted - we can speculatively process the image with good hit rate
 //				CProcessParams paramsCopied = processParams;
 //				paramsCopied.ProcFlags = SetProcessingFlag(paramsCopied.ProcFlags, PFLAG_NoProcessingAfterLoad, false);
 //				StartNewRequest(sFileName, nFrameIndex, paramsCopied);
 //			} else {
-				StartNewRequest(sFileName, nFrameIndex, processParams);
+				CImageRequest* pRequest = QueueReadAheadRequest(sFileName, nFrameIndex, processParams, i + 1);
+				if (eDirection == TOGGLE) {
+					pRequest->FileIndex = -1;
+				} else {
+					SetFilePosition(pRequest, bSwitchImage ? ((eDirection == FORWARD) ? i + 1 : -(i + 1)) : 0);
+				}
 //			}
 		}
 	}
 }
 
+void CJPEGProvider::PrefetchFiles(CFileList* pFileList, EReadAheadDirection eDirection) {
+	if (m_pPrefetcher == NULL || pFileList == NULL || eDirection == NONE || eDirection == TOGGLE) {
+		return;
+	}
+	std::list<CString> fileNames;
+	LPCTSTR sCurrentFile = pFileList->Current();
+	CString sPreviousFile = sCurrentFile;
+	int nNumFiles = CSettingsProvider::This().PrefetchFiles();
+	for (int i = 1; i <= nNumFiles; i++) {
+		LPCTSTR sFileName = pFileList->PeekNextPrev(i, eDirection == FORWARD, false);
+		// stop at the end of the list (the last file is returned again) or when wrapping around to the current file
+		if (sFileName == NULL || sCurrentFile == NULL || sPreviousFile.CompareNoCase(sFileName) == 0 || _tcsicmp(sFileName, sCurrentFile) == 0) {
+			break;
+		}
+		sPreviousFile = sFileName;
+		// files with a request are read by the load threads
+		if (FindRequest(sFileName, 0) == NULL) {
+			fileNames.push_back(sFileName);
+		}
+	}
+	m_pPrefetcher->Prefetch(fileNames);
+}
+
 CJPEGProvider::CImageRequest* CJPEGProvider::StartNewRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams) {
 /*GF*/	TCHAR debugtext[512];
 /*GF*/	swprintf(debugtext,255,TEXT("Start new request:  %s"), sFileName);
 /*GF*/	::OutputDebugStringW(debugtext);
 
 	CImageRequest* pRequest = new CImageRequest(sFileName, nFrameIndex);
+	pRequest->Generation = m_nGeneration;
+	m_requestList.push_back(pRequest);
+	StartRequest(pRequest, SearchThreadForNewRequest(), processParams);
+	return pRequest;
+}
+
+void CJPEGProvider::StartRequest(CImageRequest* pRequest, CImageLoadThread* pThread, const CProcessParams & processParams) {
+	pRequest->HandlingThread = pThread;
+	pRequest->Handle = pThread->AsyncLoad(pRequest->FileName, pRequest->FrameIndex,
+		processParams, m_hHandlerWnd, pRequest->EventFinished, pRequest->Priority > 0);
+	// processParams may be the queued parameters, these have been copied into the request of the thread
+	delete pRequest->QueuedParams;
+	pRequest->QueuedParams = NULL;
+}
+
+CJPEGProvider::CImageRequest* CJPEGProvider::QueueReadAheadRequest(LPCTSTR sFileName, int nFrameIndex,
+																   const CProcessParams & processParams, int nPriority) {
+	CImageRequest* pRequest = new CImageRequest(sFileName, nFrameIndex);
+	pRequest->Priority = nPriority;
+	pRequest->Generation = m_nGeneration;
+	pRequest->QueuedParams = new CProcessParams(processParams);
 	m_requestList.push_back(pRequest);
-	pRequest->HandlingThread = SearchThreadForNewRequest();
-	pRequest->Handle = pRequest->HandlingThread->AsyncLoad(pRequest->FileName, nFrameIndex,
-		processParams, m_hHandlerWnd, pRequest->EventFinished);
 	return pRequest;
 }
 
+void CJPEGProvider::StartQueuedRequests() {
+	// Read ahead uses all threads but one, so the image requested next does not wait for read ahead to finish.
+	// With only one thread, read ahead runs when the thread is idle.
+	int nMaxReadAheadThreads = max(1, m_nNumThread - 1);
+	for (;;) {
+		int nNumReadAhead = 0;
+		CImageRequest* pNextRequest = NULL;
+		std::list<CImageRequest*>::iterator iter;
+		for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+			CImageRequest* pRequest = *iter;
+			if (pRequest->QueuedParams != NULL) {
+				if (pNextRequest == NULL || pRequest->Priority < pNextRequest->Priority) {
+					pNextRequest = pRequest;
+				}
+			} else if (pRequest->HandlingThread != NULL && pRequest->Priority > 0 && !IsFinished(pRequest)) {
+				nNumReadAhead++;
+			}
+		}
+		CImageLoadThread* pIdleThread = (pNextRequest != NULL && nNumReadAhead < nMaxReadAheadThreads) ? FindIdleThread() : NULL;
+		if (pIdleThread == NULL) {
+			break;
+		}
+		StartRequest(pNextRequest, pIdleThread, *pNextRequest->QueuedParams);
+	}
+}
+
+bool CJPEGProvider::CancelRequest(CImageRequest* pRequest) {
+	if (pRequest->QueuedParams != NULL) {
+		return true; // not started, can be deleted right away
+	}
+	if (!pRequest->Ready && !pRequest->Deleted && pRequest->HandlingThread != NULL && !IsFinished(pRequest)) {
+		pRequest->HandlingThread->CancelLoad(pRequest->Handle);
+		pRequest->Deleted = true; // deleted when the load thread has finished, see OnImageLoadCompleted()
+	}
+	return false;
+}
+
+void CJPEGProvider::RemoveQueuedRequests() {
+	std::list<CImageRequest*>::iterator iter = m_requestList.begin();
+	while (iter != m_requestList.end()) {
+		if ((*iter)->QueuedParams != NULL) {
+			delete *iter; // has no image yet
+			iter = m_requestList.erase(iter);
+		} else {
+			iter++;
+		}
+	}
+}
+
 void CJPEGProvider::GetLoadedImageFromWorkThread(CImageRequest* pRequest) {
 	if (pRequest->HandlingThread != NULL) {
 /*GF*/	TCHAR debugtext[512];
@@ -265,88 +472,110 @@ void CJPEGProvider::GetLoadedImageFromWorkThread(CImageRequest* pRequest) {
 }
 
 CImageLoadThread* CJPEGProvider::SearchThreadForNewRequest(void) {
+	CImageLoadThread* pIdleThread = FindIdleThread();
+	if (pIdleThread != NULL) {
+		return pIdleThread;
+	}
+	// all threads are occupied, return thread working on smallest handle (will finish earliest)
 	int nSmallestHandle = INT_MAX;
 	CImageLoadThread* pBestOccupiedThread = NULL;
+	std::list<CImageRequest*>::iterator iter;
+	for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
+		if ((*iter)->Handle < nSmallestHandle && (*iter)->HandlingThread != NULL) {
+			nSmallestHandle = (*iter)->Handle;
+			pBestOccupiedThread = (*iter)->HandlingThread;
+		}
+	}
+	return (pBestOccupiedThread == NULL) ? m_pWorkThreads[0] : pBestOccupiedThread;
+}
+
+CImageLoadThread* CJPEGProvider::FindIdleThread(void) {
 	for (int i = 0; i < m_nNumThread; i++) {
-		bool bFree = true;
-		CImageLoadThread* pThisThread = m_pWorkThreads[i];
+		bool bIdle = true;
 		std::list<CImageRequest*>::iterator iter;
 		for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
-			if ((*iter)->Handle < nSmallestHandle && (*iter)->HandlingThread != NULL) {
-				nSmallestHandle = (*iter)->Handle;
-				pBestOccupiedThread = (*iter)->HandlingThread;
-			}
-			if ((*iter)->HandlingThread == pThisThread) {
-				bFree = false;
+			// finished requests whose image has not been taken yet do not occupy the thread
+			if ((*iter)->HandlingThread == m_pWorkThreads[i] && !IsFinished(*iter)) {
+				bIdle = false;
 				break;
 			}
 		}
-		if (bFree) {
-			return pThisThread;
+		if (bIdle) {
+			return m_pWorkThreads[i];
 		}
 	}
-	// all threads are occupied, return thread working on smallest handle (will finish earliest)
-	return (pBestOccupiedThread == NULL) ? m_pWorkThreads[0] : pBestOccupiedThread;
+	return NULL;
 }
 
-void CJPEGProvider::RemoveUnusedImages(bool bRemoveAlsoActiveRequests) {
-	bool bRemoved = false;
-	int nTimeStampToRemove = -2;
-	do {
-		bRemoved = false;
-		int nSmallestTimeStamp = INT_MAX;
+bool CJPEGProvider::IsFinished(CImageRequest* pRequest) {
+	return ::WaitForSingleObject(pRequest->EventFinished, 0) == WAIT_OBJECT_0;
+}
+
+void CJPEGProvider::RemoveUnusedImages() {
+	__int64 nBudget = (__int64)CSettingsProvider::This().ImageCacheMB() * 1024 * 1024;
+	for (;;) {
+		__int64 nTotalMemSize = 0;
+		double dMaxScore = -1.0;
+		bool bRemoveAlways = false;
+		std::list<CImageRequest*>::iterator iterToRemove = m_requestList.end();
 		std::list<CImageRequest*>::iterator iter;
 		for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
-			if ((*iter)->InUse == false && (*iter)->Ready && ((*iter)->IsActive == false || bRemoveAlsoActiveRequests || IsDestructivelyProcessed((*iter)->Image))) {
-				// search element with smallest timestamp
-				if ((*iter)->AccessTimeStamp < nSmallestTimeStamp) {
-					nSmallestTimeStamp = (*iter)->AccessTimeStamp;
-				}
-				// remove the readahead images - if we get here with read ahead, the strategy was wrong and
-				// the read ahead image is not used.
-				if ((*iter)->AccessTimeStamp == nTimeStampToRemove || IsDestructivelyProcessed((*iter)->Image)) {
-					::OutputDebugString(_T("Delete request: ")); ::OutputDebugString((*iter)->FileName); ::OutputDebugString(_T("\n"));
-					DeleteElementAt(iter);
-					bRemoved = true;
-					break;
-				}
+			CImageRequest* pRequest = *iter;
+			if (!pRequest->Ready) {
+				continue; // the image is still owned by the loading thread
+			}
+			// the last requested image is needed soon, e.g. when its preview is shown
+			bool bCanRemove = !pRequest->InUse && pRequest->AccessTimeStamp != m_nCurrentTimeStamp - 1;
+			if (bCanRemove && IsDestructivelyProcessed(pRequest->Image)) {
+				// will never be reused
+				iterToRemove = iter;
+				bRemoveAlways = true;
+				break;
+			}
+			__int64 nMemSize = (pRequest->Image != NULL) ? pRequest->Image->GetMemSize() : 0;
+			nTotalMemSize += nMemSize;
+			double dScore = bCanRemove ? GetEvictionScore(pRequest, nMemSize) : -1.0;
+			if (dScore > dMaxScore) {
+				dMaxScore = dScore;
+				iterToRemove = iter;
 			}
 		}
-		nTimeStampToRemove = -2;
-		// Make one buffer free for next readahead (except when bRemoveAlsoActiveRequests)
-		int nMaxListSize = bRemoveAlsoActiveRequests ? (unsigned int)m_nNumBuffers : (unsigned int)m_nNumBuffers - 1;
-		if (m_requestList.size() > (unsigned int)nMaxListSize) {
-			// remove element with smallest timestamp
-			if (nSmallestTimeStamp < INT_MAX) {
-				bRemoved = true;
-				nTimeStampToRemove = nSmallestTimeStamp;
+		if (!bRemoveAlways) {
+			m_nCacheMemSize = nTotalMemSize;
+			if (iterToRemove == m_requestList.end() || (nTotalMemSize <= nBudget && m_requestList.size() <= MAX_CACHED_REQUESTS)) {
+				break;
 			}
 		}
-	} while (bRemoved); // repeat until no element could be removed anymore
+		::OutputDebugString(_T("Delete request: ")); ::OutputDebugString((*iterToRemove)->FileName); ::OutputDebugString(_T("\n"));
+		DeleteElementAt(iterToRemove);
+	}
 }
 
-void CJPEGProvider::ClearOldestInactiveRequest() {
-	if (m_requestList.size() >= (unsigned int)m_nNumBuffers) {
-		int nFirstHandle = INT_MAX;
-		CImageRequest* pFirstRequest = NULL;
-		std::list<CImageRequest*>::iterator iter;
-		for (iter = m_requestList.begin( ); iter != m_requestList.end( ); iter++ ) {
-			if ((*iter)->IsActive) {
-				// mark very old requests for removal
-				if (CImageLoadThread::GetCurHandleValue() - (*iter)->Handle > m_nNumBuffers) {
-					(*iter)->IsActive = false;
-				}
-				if ((*iter)->Handle < nFirstHandle) {
-					nFirstHandle = (*iter)->Handle;
-					pFirstRequest = *iter;
-				}
-			}
-		}
-		if (pFirstRequest != NULL) {
-			pFirstRequest->IsActive = false;
-			ClearOldestInactiveRequest();
-		}
+double CJPEGProvider::GetEvictionScore(CImageRequest* pRequest, __int64 nMemSize) {
+	// Distance from the current file in the file list. Files of other folders or at unknown positions are farther away
+	// than all files of the current folder, among these the least recently used is the farthest.
+	int nDistance;
+	if (pRequest->FileIndex >= 0 && m_nCurrentFileIndex >= 0 && pRequest->Folder.CompareNoCase(m_sCurrentFolder) == 0) {
+		nDistance = abs(pRequest->FileIndex - m_nCurrentFileIndex);
+		nDistance = min(nDistance, m_nFileListSize - nDistance); // the navigation may wrap around
+	} else {
+		nDistance = max(1, m_nFileListSize) + m_nCurrentTimeStamp - pRequest->AccessTimeStamp;
+	}
+	// Large images far away that are fast to load again are removed first. The load time is the measured time to read
+	// and process the image, so the score is roughly the memory freed per millisecond of loading again.
+	const double MIN_MEM_SIZE = 1024 * 1024;
+	const double MIN_LOAD_TIME = 10.0;
+	double dLoadTime = (pRequest->Image != NULL) ? pRequest->Image->GetLoadTickCount() : 0.0;
+	return (nDistance + 1) * (nMemSize + MIN_MEM_SIZE) / (dLoadTime + MIN_LOAD_TIME);
+}
+
+void CJPEGProvider::SetFilePosition(CImageRequest* pRequest, int nOffset) {
+	if (m_nCurrentFileIndex < 0 || m_nFileListSize <= 0) {
+		pRequest->FileIndex = -1;
+		return;
 	}
+	pRequest->FileIndex = ((m_nCurrentFileIndex + nOffset) % m_nFileListSize + m_nFileListSize) % m_nFileListSize;
+	pRequest->Folder = m_sCurrentFolder;
 }
 
 void CJPEGProvider::DeleteElementAt(std::list<CImageRequest*>::iterator iteratorAt) {
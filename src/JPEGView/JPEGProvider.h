@@ -1,12 +1,21 @@
 #pragma once
 
+#include "ProcessParams.h"
+
 class CJPEGImage;
 class CImageLoadThread;
 class CFileList;
-class CProcessParams;
+class CFilePrefetcher;
 
-// Class that reads and processes image files (not only JPEG, any supported format) using read ahead with
-// additional read ahead threads (typically only one).
+// Class that reads and processes image files (not only JPEG, any supported format) using read ahead on several load
+// threads. The read ahead requests are queued nearest file first and only started on idle threads, one thread is always
+// left for the image requested next. Read ahead that has not started yet is dropped when the next image is requested and
+// queued again for the new position (not at all when the browsing direction changed). Read ahead that is loading but no
+// longer wanted for the new position is cancelled, see CancelRequestsOlderThan(). Read ahead is processed in the
+// background and gives way to the processing for the display (see CCancelToken::IsBackground()). The content of the
+// files further ahead is prefetched into memory by a CFilePrefetcher (see INI settings PrefetchFiles and PrefetchCacheMB).
+// Loaded images are cached within a memory budget (INI setting ImageCacheMB). When the budget is exceeded, the images
+// using much memory, far away from the current file in the file list and fast to load again are removed first.
 class CJPEGProvider
 {
 public:
@@ -19,9 +28,8 @@ public:
 	};
 
 	// handlerWnd: Window to send the asynchronous message when an image has finished loading (WM_IMAGE_LOAD_COMPLETED)
-	// nNumThreads: Number of read ahead threads to start (should be 1)
-	// nNumBuffers: Number of buffers to use (in most situations nNumThreads+1 is a good choice)
-	CJPEGProvider(HWND handlerWnd, int nNumThreads, int nNumBuffers);
+	// nNumThreads: Number of load threads to start (see INI setting LoadThreads), read ahead uses all but one of them
+	CJPEGProvider(HWND handlerWnd, int nNumThreads);
 	~CJPEGProvider(void);
 
 	// Read and process the specified image file.
@@ -39,8 +47,16 @@ public:
 	// When the requested image is already cached, it is returned immediately. Otherwise the method
 	// blocks until the image is ready. If not specified otherwise, a read-ahead request for the next image is
 	// created automatically so that the next image will be ready immediately when requested in the future.
+	// If bAllowPreview is true and the image is not ready, a low resolution preview of large JPEGs is returned instead of
+	// blocking (see CImageLoadThread::LoadPreview()). The caller replaces it by the full image using RequestFullImage()
+	// when the WM_IMAGE_LOAD_COMPLETED message arrives. The preview must be passed to NotifyNotUsed() as any other image.
 	CJPEGImage* RequestImage(CFileList* pFileList, EReadAheadDirection eDirection, LPCTSTR strFileName, int nFrameIndex,
-		const CProcessParams & processParams, bool& bOutOfMemory, bool& bExceptionError);
+		const CProcessParams & processParams, bool& bOutOfMemory, bool& bExceptionError, bool bAllowPreview = false);
+
+	// Gets the full image of a preview returned by RequestImage(), NULL if it is still loading.
+	// Does no read-ahead and no cleanup, RequestImage() has done this already.
+	CJPEGImage* RequestFullImage(LPCTSTR strFileName, int nFrameIndex, const CProcessParams & processParams,
+		bool& bOutOfMemory, bool& bExceptionError);
 
 	// Notifies that the specified image is no longer used and its memory can be freed.
 	// The CJPEGProvider class may decide to keep the image cached.
@@ -63,6 +79,18 @@ public:
 	// Tells the provider that a file has been renamed externally so that pending requests to read this file can be updated.
 	void FileHasRenamed(LPCTSTR sOldFileName, LPCTSTR sNewFileName);
 
+	// Generation of the last call to RequestImage(). Each call starts a new generation, the requested image and the
+	// read ahead wanted for it belong to this generation.
+	int CurrentGeneration() const { return m_nGeneration; }
+
+	// Cancels the requests of all frames of the given file that have not finished loading. The load threads stop decoding
+	// and processing at the next check of the cancel token and the requests are removed.
+	void CancelRequests(LPCTSTR sFileName);
+
+	// Cancels the requests that have not finished loading and have not been requested or wanted for read ahead since the
+	// given generation. RequestImage() does this for the read ahead no longer wanted after each navigation step.
+	void CancelRequestsOlderThan(int nGeneration);
+
 	// Must be called by the message handler window (see constructor) when the WM_IMAGE_LOAD_COMPLETED
 	// message was received.
 	void OnImageLoadCompleted(int nHandle);
@@ -77,10 +105,14 @@ private:
 		int Handle; // request handle used for that request in ImageLoadThread
 		bool InUse; // true if the Image is currently in use and thus the request is locked for deletion
 		bool Deleted; // true if the request is marked for deletion (but cannot be deleted now as it is not ready)
-		bool IsActive; // true if this request is active (i.e. requested but not ready or ready and in use).
 		bool OutOfMemory; // true if the image failed loading due to out of memory
 		bool ExceptionError; // true if the image failed loading due to an unhandled exception
 		int AccessTimeStamp; // LRU handling
+		int FileIndex; // index of the file in the file list of Folder, -1 if unknown
+		CString Folder; // folder of the file list when the request was created or last accessed
+		int Priority; // 0 if requested, distance to the current file for read ahead (the nearest file is loaded first)
+		int Generation; // generation when the request was last requested or wanted for read ahead
+		CProcessParams* QueuedParams; // parameters of a read ahead request waiting for an idle thread, NULL once started
 		CImageLoadThread* HandlingThread; // thread that is loading the image, NULL when image is ready
 		HANDLE EventFinished; // event fired when image has finished loading
 
@@ -92,15 +124,19 @@ private:
 			Handle = -1;
 			InUse = false;
 			Deleted = false;
-			IsActive = true;
 			OutOfMemory = false;
 			ExceptionError = false;
 			AccessTimeStamp = -1;
+			FileIndex = -1;
+			Priority = 0;
+			Generation = 0;
+			QueuedParams = NULL;
 			HandlingThread = NULL;
 			EventFinished = ::CreateEvent(NULL, TRUE, FALSE, NULL);
 		}
 
 		~CImageRequest() {
+			delete QueuedParams;
 			::CloseHandle(EventFinished);
 			EventFinished = NULL;
 		}
@@ -110,19 +146,33 @@ private:
 	HWND m_hHandlerWnd;
 	CImageLoadThread** m_pWorkThreads;
 	int m_nNumThread; // number of threads in m_pWorkThreads
-	int m_nNumBuffers;
 	int m_nCurrentTimeStamp;
+	int m_nGeneration; // incremented by each call to RequestImage()
 	EReadAheadDirection m_eOldDirection;
+	int m_nCurrentFileIndex; // position in the file list of the last request, -1 if unknown
+	int m_nFileListSize;
+	CString m_sCurrentFolder;
+	__int64 m_nCacheMemSize; // memory used by the loaded images after the last call to RemoveUnusedImages()
+	CFilePrefetcher* m_pPrefetcher; // NULL if prefetching is disabled
 
 	bool WaitForAsyncRequest(int nHandle, int nMessage);
 	void GetLoadedImageFromWorkThread(CImageRequest* pRequest);
 	CImageLoadThread* SearchThreadForNewRequest(void);
-	void RemoveUnusedImages(bool bRemoveAlsoReadAhead);
+	CImageLoadThread* FindIdleThread(void);
+	bool IsFinished(CImageRequest* pRequest);
+	void RemoveUnusedImages();
+	double GetEvictionScore(CImageRequest* pRequest, __int64 nMemSize);
+	void SetFilePosition(CImageRequest* pRequest, int nOffset);
 	CImageRequest* StartRequestAndWaitUntilReady(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams);
 	CImageRequest* StartNewRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams);
+	void StartRequest(CImageRequest* pRequest, CImageLoadThread* pThread, const CProcessParams & processParams);
+	CImageRequest* QueueReadAheadRequest(LPCTSTR sFileName, int nFrameIndex, const CProcessParams & processParams, int nPriority);
+	void StartQueuedRequests();
+	void RemoveQueuedRequests();
+	bool CancelRequest(CImageRequest* pRequest);
 	void StartNewRequestBundle(CFileList* pFileList, EReadAheadDirection eDirection, const CProcessParams & processParams, int nNumRequests, CImageRequest* pLastReadyRequest);
+	void PrefetchFiles(CFileList* pFileList, EReadAheadDirection eDirection);
 	CImageRequest* FindRequest(LPCTSTR strFileName, int nFrameIndex);
-	void ClearOldestInactiveRequest();
 	void DeleteElementAt(std::list<CImageRequest*>::iterator iteratorAt); // also deletes the request and the image in the request
 	void DeleteElement(CImageRequest* pRequest);
 	bool IsDestructivelyProcessed(CJPEGImage* pImage);
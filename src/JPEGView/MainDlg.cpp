@@ -1,4 +1,4 @@
-// MainDlg.cpp : implementation of the CMainDlg class
+﻿// MainDlg.cpp : implementation of the CMainDlg class
 //
 /////////////////////////////////////////////////////////////////////////////
 
@@ -30,19 +30,8 @@
 // Constants
 //////////////////////////////////////////////////////////////////////////////////////////////
 
-static const int NUM_THREADS = 1; // number of readahead threads to use
-
-// number of readahead buffers to use (NUM_THREADS+1 is a good choice)
-// setting this to higher values will not only read more files ahead, since NUM_THREADS is still only 1,
-// it will keep more of the already read file data cached, and, more importantly, will prevent more resampled
-// DIBs from being thrown away. (DIBs are deleted the same time as file cache data)
-// Of course, with large images, we will be starting to use a crapload of memory really fast
-// Keep in mind that there is only this one pool for buffering images already seen and images that are read ahead,
-// so when using NUM_THREADS=1 and READ_AHEAD_BUFFERS=5, we will read ahead 1 image, and keep cached the 1 present
-// image as well as the previous 3 images.
-// When using READ_AHEAD_BUFFERS=2, as the original author suggested, we would have a file buffer of the
-// next and current current file and a DIB buffer of the current, but no file nor dib buffer for the previous files.
-static const int READ_AHEAD_BUFFERS = 5;
+// The number of image load threads is given by the INI setting LoadThreads, the number of images kept cached (seen
+// before and read ahead) is limited by the INI setting ImageCacheMB
 
 
 static const int ZOOM_TIMEOUT = 50; // refinement done after this many milliseconds
@@ -160,6 +149,10 @@ LRESULT CMainDlg::OnInitDialog(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam
 /* Debugging */		swprintf(sCPU,64,TEXT("%s"), TEXT("128 bit SSE2"));
 /* Debugging */	else if (cpu == Helpers::CPU_AVX2)
 /* Debugging */		swprintf(sCPU,64,TEXT("%s"), TEXT("256 bit AVX2"));
+/* Debugging */	else if (cpu == Helpers::CPU_AVX2_FMA)
+/* Debugging */		swprintf(sCPU,64,TEXT("%s"), TEXT("256 bit AVX2 + FMA"));
+/* Debugging */	else if (cpu == Helpers::CPU_AVX512)
+/* Debugging */		swprintf(sCPU,64,TEXT("%s"), TEXT("512 bit AVX-512"));
 
 /* Debugging */	if (filter == Filter_Downsampling_None)
 /* Debugging */		swprintf(sFilter,64,TEXT("%s"), TEXT("Filter_Downsampling_None"));
@@ -214,7 +207,7 @@ LRESULT CMainDlg::OnInitDialog(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam
 	CProcessingThreadPool::This().CreateThreadPoolThreads();
 
 	// create JPEG provider and request first image - do no processing yet if not in fullscreen mode (as we do not know the size yet)
-	m_pJPEGProvider = new CJPEGProvider(m_hWnd, NUM_THREADS, READ_AHEAD_BUFFERS);
+	m_pJPEGProvider = new CJPEGProvider(m_hWnd, CSettingsProvider::This().LoadThreads());
 	m_pCurrentImage = m_pJPEGProvider->RequestImage(m_pFileList, CJPEGProvider::FORWARD, m_pFileList->Current(), 0, CreateProcessParams(0), m_bOutOfMemoryLastImage, m_bExceptionErrorLastImage);
 
     if (m_pCurrentImage != NULL && m_pCurrentImage->IsAnimation())
@@ -1341,6 +1334,49 @@ LRESULT CMainDlg::OnImageLoadCompleted(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM
 	{
 	// route to JPEG provider
 	m_pJPEGProvider->OnImageLoadCompleted((int)lParam);
+
+	// replace the preview by the full image if it has finished loading
+	if (m_pCurrentImage != NULL && m_pCurrentImage->IsPreview())
+		{
+		// same parameters as when loading the image, but CreateProcessParams() also resets the view for a new image and
+		// the user may have zoomed, panned or rotated the preview already
+		CPoint offsets = m_offsets, offsetsCustom = m_offsets_custom;
+		std::list<int> previewTransforms;
+		previewTransforms.swap(m_previewTransforms);
+		double dZoom = m_dZoom;
+		int nRotation = m_nRotation;
+		bool bHQResampling = m_bHQResampling;
+		CProcessParams params = CreateProcessParams(false);
+		m_offsets = offsets;
+		m_offsets_custom = offsetsCustom;
+		m_dZoom = dZoom;
+		m_nRotation = nRotation;
+		m_bHQResampling = bHQResampling;
+		CJPEGImage* pFullImage = m_pJPEGProvider->RequestFullImage(CurrentFileName(), m_pCurrentImage->FrameIndex(), params,
+			m_bOutOfMemoryLastImage, m_bExceptionErrorLastImage);
+		if (pFullImage != NULL)
+			{
+			// apply the rotations and mirrorings of the preview in the same order, they do not commute
+			std::list<int>::iterator iter;
+			for (iter = previewTransforms.begin(); iter != previewTransforms.end(); iter++)
+				{
+				if (*iter == IDM_ROTATE_90 || *iter == IDM_ROTATE_270)
+					pFullImage->Rotate((*iter == IDM_ROTATE_90) ? 90 : 270);
+				else
+					pFullImage->Mirror(*iter == IDM_MIRROR_H);
+				}
+			m_pJPEGProvider->NotifyNotUsed(m_pCurrentImage);
+			m_pCurrentImage = pFullImage;
+			this->Invalidate(FALSE);
+			}
+		else
+			{
+			// still loading or failed, keep showing the preview
+			m_previewTransforms.swap(previewTransforms);
+			if (m_bOutOfMemoryLastImage || m_bExceptionErrorLastImage)
+				m_bOutOfMemoryLastImage = m_bExceptionErrorLastImage = false;
+			}
+		}
 	return 0;
 	}
 
@@ -1868,6 +1904,8 @@ void CMainDlg::ExecuteCommand(int nCommand)
 				uint32 nRotationDelta = (nCommand == IDM_ROTATE_90) ? 90 : 270;
 				m_nRotation = (m_nRotation + nRotationDelta) % 360;
 				m_pCurrentImage->Rotate(nRotationDelta);
+				if (m_pCurrentImage->IsPreview())
+					m_previewTransforms.push_back(nCommand);
 				m_dZoom = -1;
 				this->Invalidate(FALSE);
 				//this->UpdateWindow();
@@ -1878,6 +1916,8 @@ void CMainDlg::ExecuteCommand(int nCommand)
 			if (m_pCurrentImage != NULL)
 				{
 				m_pCurrentImage->Mirror(nCommand == IDM_MIRROR_H);
+				if (m_pCurrentImage->IsPreview())
+					m_previewTransforms.push_back(nCommand);
 				this->Invalidate(FALSE);
 				//this->UpdateWindow();
 				}
@@ -2133,9 +2173,9 @@ void CMainDlg::GotoImage(EImagePosition ePos, int nFlags)
 		return;
 
 	if (ePos == POS_Previous)
-		m_pCurrentImage = m_pJPEGProvider->RequestImage(m_pFileList, eDirection, m_pFileList->Current(), nFrameIndex, CreateProcessParams(1), m_bOutOfMemoryLastImage, m_bExceptionErrorLastImage);
+		m_pCurrentImage = m_pJPEGProvider->RequestImage(m_pFileList, eDirection, m_pFileList->Current(), nFrameIndex, CreateProcessParams(1), m_bOutOfMemoryLastImage, m_bExceptionErrorLastImage, true);
 	else
-		m_pCurrentImage = m_pJPEGProvider->RequestImage(m_pFileList, eDirection, m_pFileList->Current(), nFrameIndex, CreateProcessParams(0), m_bOutOfMemoryLastImage, m_bExceptionErrorLastImage);
+		m_pCurrentImage = m_pJPEGProvider->RequestImage(m_pFileList, eDirection, m_pFileList->Current(), nFrameIndex, CreateProcessParams(0), m_bOutOfMemoryLastImage, m_bExceptionErrorLastImage, true);
 
 	m_nLastLoadError = (m_pCurrentImage == NULL) ? HelpersGUI::FileLoad_LoadError : HelpersGUI::FileLoad_Ok;
 	
@@ -2547,6 +2587,7 @@ CProcessParams CMainDlg::CreateProcessParams(bool ToPreviousImage)
 
 	m_bHQResampling = true;
 	m_nRotation = 0;
+	m_previewTransforms.clear();
 	m_dZoom = -1;
 
 	// TargetWidth,TargetHeight is the dimension of the target output screen, the image is fit into this rectangle
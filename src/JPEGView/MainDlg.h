@@ -139,6 +139,7 @@ private:
 	
 	// Current parameter set
 	int m_nRotation; // this can only be 0, 90, 180 or 270
+	std::list<int> m_previewTransforms; // rotate and mirror commands applied to the preview, applied again to the full image
 	bool m_bZoomMode;
 	bool m_bMangaMode;
 	double m_dZoom;
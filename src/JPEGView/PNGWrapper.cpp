@@ -108,58 +108,58 @@ void BlendOver(unsigned char** rows_dst, unsigned char** rows_src, unsigned int
 }
 #endif
 
-void* PngReader::ReadNextFrame(void** exif_chunk, png_uint_32* exif_size)
+void* PngReader::ReadNextFrame(png_cache& c, void** exif_chunk, png_uint_32* exif_size)
 {
 	unsigned int j;
 	if (exif_chunk != NULL && exif_size != NULL) {
-		png_get_eXIf_1(cache.png_ptr, cache.info_ptr, exif_size, (png_bytep*)exif_chunk);
+		png_get_eXIf_1(c.png_ptr, c.info_ptr, exif_size, (png_bytep*)exif_chunk);
 	}
 #ifdef PNG_APNG_SUPPORTED
-	if (png_get_valid(cache.png_ptr, cache.info_ptr, PNG_INFO_acTL))
+	if (png_get_valid(c.png_ptr, c.info_ptr, PNG_INFO_acTL))
 	{
-		png_read_frame_head(cache.png_ptr, cache.info_ptr);
-		png_get_next_frame_fcTL(cache.png_ptr, cache.info_ptr, &cache.w0, &cache.h0, &cache.x0, &cache.y0, &cache.delay_num, &cache.delay_den, &cache.dop, &cache.bop);
+		png_read_frame_head(c.png_ptr, c.info_ptr);
+		png_get_next_frame_fcTL(c.png_ptr, c.info_ptr, &c.w0, &c.h0, &c.x0, &c.y0, &c.delay_num, &c.delay_den, &c.dop, &c.bop);
 	}
-	if (cache.frame_index == cache.first)
+	if (c.frame_index == c.first)
 	{
-		cache.bop = PNG_BLEND_OP_SOURCE;
-		if (cache.dop == PNG_DISPOSE_OP_PREVIOUS)
-			cache.dop = PNG_DISPOSE_OP_BACKGROUND;
+		c.bop = PNG_BLEND_OP_SOURCE;
+		if (c.dop == PNG_DISPOSE_OP_PREVIOUS)
+			c.dop = PNG_DISPOSE_OP_BACKGROUND;
 	}
 #endif
-	png_read_image(cache.png_ptr, cache.rows_frame);
+	png_read_image(c.png_ptr, c.rows_frame);
 
 #ifdef PNG_APNG_SUPPORTED
-	if (cache.dop == PNG_DISPOSE_OP_PREVIOUS)
-		memcpy(cache.p_temp, cache.p_image, cache.size);
+	if (c.dop == PNG_DISPOSE_OP_PREVIOUS)
+		memcpy(c.p_temp, c.p_image, c.size);
 
-	if (cache.bop == PNG_BLEND_OP_OVER)
-		BlendOver(cache.rows_image, cache.rows_frame, cache.x0, cache.y0, cache.w0, cache.h0);
+	if (c.bop == PNG_BLEND_OP_OVER)
+		BlendOver(c.rows_image, c.rows_frame, c.x0, c.y0, c.w0, c.h0);
 	else
 #endif
-		for (j = 0; j < cache.h0; j++)
-			memcpy(cache.rows_image[j + cache.y0] + cache.x0 * 4, cache.rows_frame[j], cache.w0 * 4);
+		for (j = 0; j < c.h0; j++)
+			memcpy(c.rows_image[j + c.y0] + c.x0 * 4, c.rows_frame[j], c.w0 * 4);
 
-	void* pixels = malloc(cache.width * cache.height * cache.channels);
+	void* pixels = malloc(c.width * c.height * c.channels);
 	if (pixels == NULL)
 		return NULL;
-	for (j = 0; j < cache.height; j++)
-		memcpy((char*)pixels + j * cache.width * cache.channels, cache.rows_image[j], cache.width * cache.channels);
+	for (j = 0; j < c.height; j++)
+		memcpy((char*)pixels + j * c.width * c.channels, c.rows_image[j], c.width * c.channels);
 
 #ifdef PNG_APNG_SUPPORTED
-	if (cache.dop == PNG_DISPOSE_OP_PREVIOUS)
-		memcpy(cache.p_image, cache.p_temp, cache.size);
+	if (c.dop == PNG_DISPOSE_OP_PREVIOUS)
+		memcpy(c.p_image, c.p_temp, c.size);
 	else
-		if (cache.dop == PNG_DISPOSE_OP_BACKGROUND)
-			for (j = 0; j < cache.h0; j++)
-				memset(cache.rows_image[j + cache.y0] + cache.x0 * 4, 0, cache.w0 * 4);
+		if (c.dop == PNG_DISPOSE_OP_BACKGROUND)
+			for (j = 0; j < c.h0; j++)
+				memset(c.rows_image[j + c.y0] + c.x0 * 4, 0, c.w0 * 4);
 #endif
-	cache.frame_index++;
-	cache.frame_index %= cache.frame_count;
+	c.frame_index++;
+	c.frame_index %= c.frame_count;
 	return pixels;
 }
 
-bool PngReader::BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory)
+bool PngReader::BeginReading(png_cache& c, void* buffer, size_t sizebytes, bool& outOfMemory)
 {
 	unsigned int    width, height, channels, rowbytes, size, j;
 	png_bytepp      rows_image;
@@ -178,7 +178,7 @@ bool PngReader::BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory)
 
 		if (setjmp(png_jmpbuf(png_ptr)))
 		{
-			PngReader::DeleteCache();
+			DeleteCacheInternal(c, true);
 			throw std::runtime_error::runtime_error("Image contains errors.");
 		}
 		// skip png signature since we already checked it
@@ -186,18 +186,18 @@ bool PngReader::BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory)
 		// custom read function so we can read from memory
 		png_rw_ptr read_data_fn = [](png_structp png_ptr, png_bytep outbuffer, png_size_t sizebytes)
 		{
-			png_voidp io_ptr = png_get_io_ptr(png_ptr);
+			png_cache* io_ptr = (png_cache*)png_get_io_ptr(png_ptr);
 			if (io_ptr == NULL)
 				png_error(png_ptr, "png_get_io_ptr returned NULL");
-			else if (cache.buffer_offset + sizebytes > cache.buffer_size)
+			else if (io_ptr->buffer_offset + sizebytes > io_ptr->buffer_size)
 				png_error(png_ptr, "Attempted to read out of bounds");
 			else
 			{
-				memcpy(outbuffer, (char*)io_ptr + cache.buffer_offset, sizebytes);
-				cache.buffer_offset += sizebytes;
+				memcpy(outbuffer, (char*)io_ptr->buffer + io_ptr->buffer_offset, sizebytes);
+				io_ptr->buffer_offset += sizebytes;
 			}
 		};
-		png_set_read_fn(png_ptr, (char*)buffer, read_data_fn);
+		png_set_read_fn(png_ptr, &c, read_data_fn);
 		png_read_info(png_ptr, info_ptr);
 		png_set_expand(png_ptr);
 		png_set_strip_16(png_ptr);
@@ -254,30 +254,30 @@ bool PngReader::BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory)
 				rows_frame[j] = p_frame + j * rowbytes;
 
 #ifdef PNG_APNG_SUPPORTED
-			cache.bop = bop;
-			// cache.plays = plays
-			cache.delay_den = delay_den;
-			cache.delay_num = delay_num;
-			cache.dop = dop;
-			cache.first = first;
+			c.bop = bop;
+			// c.plays = plays
+			c.delay_den = delay_den;
+			c.delay_num = delay_num;
+			c.dop = dop;
+			c.first = first;
 #endif
-			cache.channels = channels;
-			cache.h0 = h0;
-			cache.height = height;
+			c.channels = channels;
+			c.h0 = h0;
+			c.height = height;
 			// cache ptrs here, only if valid
-			cache.info_ptr = info_ptr;
-			cache.png_ptr = png_ptr;
-			cache.p_image = p_image;
-			cache.p_frame = p_frame;
-			cache.p_temp = p_temp;
-			cache.rows_frame = rows_frame;
-			cache.rows_image = rows_image;
-			cache.size = size;
-			cache.w0 = w0;
-			cache.width = width;
-			cache.x0 = x0;
-			cache.y0 = y0;
-			cache.frame_count = frames;
+			c.info_ptr = info_ptr;
+			c.png_ptr = png_ptr;
+			c.p_image = p_image;
+			c.p_frame = p_frame;
+			c.p_temp = p_temp;
+			c.rows_frame = rows_frame;
+			c.rows_image = rows_image;
+			c.size = size;
+			c.w0 = w0;
+			c.width = width;
+			c.x0 = x0;
+			c.y0 = y0;
+			c.frame_count = frames;
 			return frames > 0;
 		}
 		free(p_image);
@@ -291,6 +291,34 @@ bool PngReader::BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory)
 }
 
 void* PngReader::ReadImage(int& width,
+	int& height,
+	int& nchannels,
+	bool& has_animation,
+	int& frame_count,
+	int& frame_time,
+	void*& exif_chunk,
+	bool& outOfMemory,
+	void* buffer,
+	size_t sizebytes,
+	bool keep_decoder)
+{
+	if (keep_decoder) {
+		return ReadImageInternal(cache, width, height, nchannels, has_animation, frame_count, frame_time, exif_chunk, outOfMemory, buffer, sizebytes);
+	}
+	png_cache c = { 0 };
+	void* pixels = NULL;
+	try {
+		pixels = ReadImageInternal(c, width, height, nchannels, has_animation, frame_count, frame_time, exif_chunk, outOfMemory, buffer, sizebytes);
+	} catch (...) {
+		DeleteCacheInternal(c, true);
+		throw;
+	}
+	DeleteCacheInternal(c, true);
+	return pixels;
+}
+
+void* PngReader::ReadImageInternal(png_cache& c,
+	int& width,
 	int& height,
 	int& nchannels,
 	bool& has_animation,
@@ -302,21 +330,21 @@ void* PngReader::ReadImage(int& width,
 	size_t sizebytes)
 {
 	exif_chunk = NULL;
-	if (!cache.buffer) {
+	if (!c.buffer) {
 		if (sizebytes < 8)
 			return NULL;
-		cache.buffer = malloc(sizebytes-8);
-		if (!cache.buffer)
+		c.buffer = malloc(sizebytes-8);
+		if (!c.buffer)
 			return NULL;
 		// copy everything except the PNG signature (first 8 bytes)
-		memcpy(cache.buffer, (char*)buffer+8, sizebytes-8);
-		cache.buffer_size = sizebytes-8;
+		memcpy(c.buffer, (char*)buffer+8, sizebytes-8);
+		c.buffer_size = sizebytes-8;
 	}
-	buffer = cache.buffer;
-	sizebytes = cache.buffer_size;
-	if (!cache.png_ptr || cache.frame_index == 0) {
-		DeleteCacheInternal(false);
-		if (!buffer || !BeginReading(buffer, sizebytes, outOfMemory)) {
+	buffer = c.buffer;
+	sizebytes = c.buffer_size;
+	if (!c.png_ptr || c.frame_index == 0) {
+		DeleteCacheInternal(c, false);
+		if (!buffer || !BeginReading(c, buffer, sizebytes, outOfMemory)) {
 			return NULL;
 		}
 
@@ -324,22 +352,22 @@ void* PngReader::ReadImage(int& width,
 
 	void* exif = NULL;
 	unsigned int exif_size = 0;
-	bool read_two = cache.frame_index < cache.first;
-	void* pixels = ReadNextFrame(&exif, &exif_size);
+	bool read_two = c.frame_index < c.first;
+	void* pixels = ReadNextFrame(c, &exif, &exif_size);
 	if (pixels && read_two)
-		pixels = ReadNextFrame(&exif, &exif_size);
+		pixels = ReadNextFrame(c, &exif, &exif_size);
 	
-	width = cache.width;
-	height = cache.height;
-	nchannels = cache.channels;
-	has_animation = (cache.frame_count > 1);
-	frame_count = cache.frame_count;
+	width = c.width;
+	height = c.height;
+	nchannels = c.channels;
+	has_animation = (c.frame_count > 1);
+	frame_count = c.frame_count;
 
 	// https://wiki.mozilla.org/APNG_Specification
 	// "If the denominator is 0, it is to be treated as if it were 100"
-	if (!cache.delay_den)
-		cache.delay_den = 100;
-	frame_time = (int)(1000.0 * cache.delay_num / cache.delay_den);
+	if (!c.delay_den)
+		c.delay_den = 100;
+	frame_time = (int)(1000.0 * c.delay_num / c.delay_den);
 
 	if (exif_size > 8 && exif_size < 65528 && exif != NULL) {
 		exif_chunk = malloc(exif_size + 10);
@@ -351,32 +379,32 @@ void* PngReader::ReadImage(int& width,
 		
 	}
 	if (!has_animation)
-		DeleteCache();
+		DeleteCacheInternal(c, true);
 	return pixels;
 }
 
-void PngReader::DeleteCacheInternal(bool free_buffer)
+void PngReader::DeleteCacheInternal(png_cache& c, bool free_buffer)
 {
-	// png_read_end(cache.png_ptr, cache.info_ptr);
-	free(cache.rows_frame);
-	free(cache.rows_image);
-	free(cache.p_temp);
-	free(cache.p_frame);
-	free(cache.p_image);
-	png_destroy_read_struct(&cache.png_ptr, &cache.info_ptr, NULL);
-	void* temp_buffer = cache.buffer;
-	size_t temp_buffer_size = cache.buffer_size;
-	cache = { 0 };
+	// png_read_end(c.png_ptr, c.info_ptr);
+	free(c.rows_frame);
+	free(c.rows_image);
+	free(c.p_temp);
+	free(c.p_frame);
+	free(c.p_image);
+	png_destroy_read_struct(&c.png_ptr, &c.info_ptr, NULL);
+	void* temp_buffer = c.buffer;
+	size_t temp_buffer_size = c.buffer_size;
+	c = { 0 };
 	if (free_buffer) {
 		free(temp_buffer);
 	} else {
-		cache.buffer = temp_buffer;
-		cache.buffer_size = temp_buffer_size;
+		c.buffer = temp_buffer;
+		c.buffer_size = temp_buffer_size;
 	}
 }
 
 void PngReader::DeleteCache() {
-	DeleteCacheInternal(true);
+	DeleteCacheInternal(cache, true);
 }
 
 bool PngReader::IsAnimated(void* buffer, size_t sizebytes) {
@@ -5,7 +5,10 @@ class PngReader
 {
 public:
 #ifndef WINXP
-	// Returns data in 4 byte BGRA
+	// Returns data in 4 byte BGRA. With keep_decoder, the decoder is kept in a cache shared by all threads to read the next
+	// frame of an animated PNG on the next call, callers must serialize these calls and DeleteCache() before reading
+	// another file. Without keep_decoder, the image is decoded with a decoder of its own (only the first frame is read),
+	// this can be called on several threads at once.
 	static void* ReadImage(int& width,   // width of the image loaded.
 		int& height,  // height of the image loaded.
 		int& bpp,     // BYTES (not bits) PER PIXEL.
@@ -15,7 +18,8 @@ public:
 		void*& exif_chunk, // Pointer to Exif data (must be freed by caller)
 		bool& outOfMemory, // set to true when no memory to read image
 		void* buffer, // memory address containing png compressed data.
-		size_t sizebytes); // size of png compressed data
+		size_t sizebytes, // size of png compressed data
+		bool keep_decoder); // keep the decoder in the shared cache
 
 	static void DeleteCache();
 
@@ -29,8 +33,10 @@ public:
 private:
 	struct png_cache;
 	static png_cache cache;
-	static bool BeginReading(void* buffer, size_t sizebytes, bool& outOfMemory);
-	static void* ReadNextFrame(void** exif_chunk, unsigned int* exif_size);
-	static void DeleteCacheInternal(bool free_buffer);
+	static void* ReadImageInternal(png_cache& c, int& width, int& height, int& bpp, bool& has_animation, int& frame_count,
+		int& frame_time, void*& exif_chunk, bool& outOfMemory, void* buffer, size_t sizebytes);
+	static bool BeginReading(png_cache& c, void* buffer, size_t sizebytes, bool& outOfMemory);
+	static void* ReadNextFrame(png_cache& c, void** exif_chunk, unsigned int* exif_size);
+	static void DeleteCacheInternal(png_cache& c, bool free_buffer);
 #endif
 };
@@ -1,43 +1,93 @@
 #include "StdAfx.h"
 #include "ProcessingThreadPool.h"
 #include "SettingsProvider.h"
+#include <process.h>
 
 CProcessingThreadPool* CProcessingThreadPool::sm_instance;
 
+// Maximal number of threads processing a request, including the calling thread
+static const int MAX_PROCESSING_THREADS = 128;
+
+// Each thread gets at least this number of tiles, so threads that finish early (e.g. on efficiency cores or on cores
+// shared with other threads) can take over tiles of slower threads
+static const int MIN_TILES_PER_THREAD = 4;
+
+// Each thread gets at least this number of target pixels, for less the dispatch costs more than it gains
+static const int MIN_PIXELS_PER_THREAD = 4096;
+
+// Maximal number of requests dispatched to the thread pool threads at the same time (from different calling threads).
+// Further requests are processed on their calling thread only, all thread pool threads are busy anyway then.
+static const int MAX_DISPATCH_SLOTS = 16;
+
+// Number of polls of an idle thread pool thread for new requests before it blocks. Requests often come in bursts
+// (e.g. the tiles of a decode followed by the resample) and waking up a blocked thread takes much longer.
+static const int SPIN_COUNT = 2000;
+
 ///////////////////////////////////////////////////////////////////////////////////
 // Supporting classes
 ///////////////////////////////////////////////////////////////////////////////////
 
-// A request wrapping another request and adding information about the image strip to process.
-class CWrappedRequest : public CRequestBase {
-public:
-	// nOffset, nSize defines the strip to process: 'nSize' rows, starting at row 'nOffset'
-	CWrappedRequest(CProcessingRequest * pRequest, int nOffset, int nSize, HANDLE hEventFinished) : CRequestBase(hEventFinished) {
-		InnerRequest = pRequest;
-		Offset = nOffset;
-		SizeY = nSize;
+// Processes a tile of the request, returns false if processing failed. Requests decoding a file mapped into memory
+// (see CFileSource) raise an in-page exception when the file becomes unavailable, e.g. a network share disconnects or
+// the file is truncated. The thread pool threads have no exception handler, so this exception fails the request instead
+// of terminating the process. No C++ objects may be constructed here (structured exception handling).
+static bool ProcessTileGuarded(CProcessingRequest* pRequest, int nOffsetX, int nOffsetY, int nSizeX, int nSizeY) {
+	__try {
+		return pRequest->ProcessTile(nOffsetX, nOffsetY, nSizeX, nSizeY);
 	}
+	__except ((::GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR) ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+		return false;
+	}
+}
 
-	CProcessingRequest* InnerRequest;
-	int Offset;
-	int SizeY;
-};
-
-
-// Worker thread in thread pool, executing image processing operations on image strips
-class CProcessingThread : public CWorkThread {
+// Splits a request into tiles and distributes these to the threads processing the request. Each thread gets a range of
+// consecutive tiles and takes the tiles from the front of its range. When its range is empty, it steals tiles from the
+// back of the ranges of the other threads, so all threads work until no tile is left.
+class CTileScheduler {
 public:
-	CProcessingThread(void) : CWorkThread(false) {}
-	~CProcessingThread(void) {}
+	// nNumThreads: Number of ranges of tiles, normally the number of threads processing the request
+	CTileScheduler(CProcessingRequest* pRequest, int nNumThreads);
 
-	// Start a processing request on this thread asynchronously, returns immediately
-	void StartProcess(CWrappedRequest* pRequest);
+	// Processes tiles until there are none left (or processing failed). nThread is the index of the thread's range,
+	// threads with an index beyond the number of ranges only steal tiles.
+	// If pnPreempt is not NULL, returns false before taking the next tile when *pnPreempt is not zero.
+	bool Run(int nThread, volatile LONG* pnPreempt);
 
-	// Processes a request synchronously on the calling thread
-	static void DoProcess(CProcessingRequest* pRequest, int nOffsetY, int nSizeY);
 private:
+	// Range of tiles of a thread, the first tile in the low and the end of the range in the high 32 bits. Both ends are
+	// changed with one compare-exchange. Each range is in a cache line of its own.
+	struct __declspec(align(64)) CTileRange {
+		volatile LONG64 Range;
+	};
 
-	virtual void ProcessRequest(CRequestBase& request);
+	CProcessingRequest* m_pRequest;
+	int m_nNumThreads;
+	int m_nNumTiles;
+	int m_nNumTilesX; // number of tiles per row of tiles
+	int m_nTileWidth;
+	int m_nTileHeight;
+	CTileRange m_ranges[MAX_PROCESSING_THREADS];
+
+	bool TakeTile(int nThread, bool bFromFront, int& nTile);
+};
+
+// Slot to dispatch a request to the thread pool threads. The slots are created once with the threads, dispatching
+// a request neither allocates memory nor creates kernel objects.
+struct __declspec(align(64)) CDispatchSlot {
+	volatile LONG InUse; // the slot is taken by a caller of Process()
+	CTileScheduler* volatile Scheduler; // scheduler of the dispatched request, NULL if none
+	volatile LONG HasTiles; // reset as soon as all tiles of the request have been taken (see ClearHasTiles())
+	volatile bool Background; // the request is processed in the background, see CCancelToken::IsBackground()
+	volatile LONG NumHelpers; // number of thread pool threads currently processing tiles of the request
+	HANDLE EventHelpersLeft; // auto reset event, signaled when the last helper left a request no longer dispatched
+};
+
+// Thread pool thread, processes tiles of the dispatched requests
+class CProcessingThread {
+public:
+	CProcessingThreadPool* Pool;
+	int Index; // index of the thread in the tile schedulers, the calling thread of Process() has index 0
+	HANDLE Handle;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////
@@ -52,24 +102,51 @@ CProcessingThreadPool& CProcessingThreadPool::This() {
 }
 
 void CProcessingThreadPool::CreateThreadPoolThreads() {
-	m_nNumThreads = CSettingsProvider::This().NumberOfCoresToUse() - 1;
-	if (m_nNumThreads > 0) {
-		m_threads = new CProcessingThread*[m_nNumThreads];
-		for (int i = 0; i < m_nNumThreads; i++) {
-			m_threads[i] = new CProcessingThread();
-		}
-	} else {
-		m_threads = NULL;
+	m_nNumThreads = min(MAX_PROCESSING_THREADS, CSettingsProvider::This().NumberOfCoresToUse()) - 1;
+	if (m_nNumThreads <= 0) {
+		m_nNumThreads = 0;
+		return;
+	}
+	m_bTerminate = false;
+	m_nSleepingThreads = 0;
+	m_hWakeUp = ::CreateSemaphore(NULL, 0, MAX_PROCESSING_THREADS, NULL);
+	m_slots = new CDispatchSlot[MAX_DISPATCH_SLOTS];
+	for (int i = 0; i < MAX_DISPATCH_SLOTS; i++) {
+		m_slots[i].InUse = 0;
+		m_slots[i].Scheduler = NULL;
+		m_slots[i].HasTiles = 0;
+		m_slots[i].Background = false;
+		m_slots[i].NumHelpers = 0;
+		m_slots[i].EventHelpersLeft = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+	}
+	m_threads = new CProcessingThread[m_nNumThreads];
+	for (int i = 0; i < m_nNumThreads; i++) {
+		m_threads[i].Pool = this;
+		m_threads[i].Index = i + 1;
+		m_threads[i].Handle = (HANDLE)_beginthreadex(NULL, 0, ThreadFunc, &m_threads[i], 0, NULL);
 	}
 }
 
 void CProcessingThreadPool::StopAllThreads() {
+	if (m_nNumThreads == 0) {
+		return;
+	}
+	m_bTerminate = true;
+	::ReleaseSemaphore(m_hWakeUp, m_nNumThreads, NULL);
 	for (int i = 0; i < m_nNumThreads; i++) {
-		m_threads[i]->Terminate();
-		delete m_threads[i];
+		::WaitForSingleObject(m_threads[i].Handle, INFINITE);
+		::CloseHandle(m_threads[i].Handle);
 	}
+	for (int i = 0; i < MAX_DISPATCH_SLOTS; i++) {
+		::CloseHandle(m_slots[i].EventHelpersLeft);
+	}
+	::CloseHandle(m_hWakeUp);
+	delete[] m_threads;
+	delete[] m_slots;
 	m_nNumThreads = 0;
 	m_threads = NULL;
+	m_slots = NULL;
+	m_hWakeUp = NULL;
 }
 
 bool CProcessingThreadPool::Process(CProcessingRequest* pRequest) {
@@ -78,37 +155,38 @@ bool CProcessingThreadPool::Process(CProcessingRequest* pRequest) {
 
 	int nTargetCX = pRequest->ClippedTargetSize.cx;
 	int nTargetCY = pRequest->ClippedTargetSize.cy;
-	if (m_nNumThreads == 0) {
-		CProcessingThread::DoProcess(pRequest, 0, nTargetCY);
-	} else {
-		if (nTargetCX * nTargetCY < 100000 || nTargetCY <= 12) {
-			CProcessingThread::DoProcess(pRequest, 0, nTargetCY);
-		} else {
-			// Important: All slices must have a height dividable by 'StripPadding', except the last one
-			int nNumThreadsUsed = m_nNumThreads + 1; // we also use the calling thread, thus +1
-			int nSliceCY;
-			while ((nSliceCY = ~(pRequest->StripPadding - 1) & (nTargetCY / nNumThreadsUsed)) < pRequest->StripPadding) {
-				nNumThreadsUsed--;
-			}
-			int nLastCY = nTargetCY - (nNumThreadsUsed - 1)*nSliceCY;
-			volatile LONG nRequestThreadCounter = nNumThreadsUsed - 1;
-			int nCurrCY = 0;
-			HANDLE eventFinished = ::CreateEvent(0, TRUE, FALSE, NULL);
-			CWrappedRequest** pAllWrappedRequests = new CWrappedRequest*[nNumThreadsUsed-1];
-			for (int i = 0; i < nNumThreadsUsed-1; i++) {
-				pAllWrappedRequests[i] = new CWrappedRequest(pRequest, nCurrCY, nSliceCY, eventFinished);
-				pAllWrappedRequests[i]->EventFinishedCounter = &nRequestThreadCounter;
-				m_threads[i]->StartProcess(pAllWrappedRequests[i]);
-				nCurrCY += nSliceCY;
-			}
-			CProcessingThread::DoProcess(pRequest, nCurrCY, nLastCY);
-			::WaitForSingleObject(eventFinished, INFINITE);
-			::CloseHandle(eventFinished);
-			for (int i = 0; i < nNumThreadsUsed-1; i++) {
-				pAllWrappedRequests[i]->Deleted = true; // thread pool threads will remove the requests from the queue
-			}
-			delete [] pAllWrappedRequests;
+	if (pRequest->CancelToken == NULL) {
+		pRequest->CancelToken = CCancelToken::Current();
+	}
+	// we also use the calling thread, thus +1
+	int nNumThreadsUsed = (int)min((__int64)m_nNumThreads + 1, (__int64)nTargetCX * nTargetCY / MIN_PIXELS_PER_THREAD);
+	// each thread needs at least one tile of 'StripPadding' rows (and 'TilePaddingX' columns if the request has tiles)
+	__int64 nMaxTiles = (__int64)max(1, nTargetCY / pRequest->StripPadding) *
+		((pRequest->TilePaddingX > 0) ? max(1, nTargetCX / pRequest->TilePaddingX) : 1);
+	nNumThreadsUsed = max(1, (int)min((__int64)nNumThreadsUsed, nMaxTiles));
+	bool bBackground = pRequest->CancelToken != NULL && pRequest->CancelToken->IsBackground();
+	CTileScheduler scheduler(pRequest, nNumThreadsUsed);
+	CDispatchSlot* pSlot = (nNumThreadsUsed > 1) ? AcquireSlot() : NULL;
+	if (pSlot != NULL) {
+		pSlot->Background = bBackground;
+		if (!bBackground) {
+			::InterlockedIncrement(&m_nInteractiveRequests);
 		}
+		pSlot->HasTiles = 1;
+		::InterlockedExchangePointer((PVOID volatile*)&pSlot->Scheduler, &scheduler);
+		// only sleeping threads are woken up, so background requests use idle threads only
+		WakeUpThreads(nNumThreadsUsed - 1);
+	}
+	if (bBackground) {
+		// the calling thread also gives way to interactive requests and helps processing these
+		while (!scheduler.Run(0, &m_nInteractiveRequests)) {
+			HelpOnInteractiveRequests(m_nNumThreads + 1);
+		}
+	} else {
+		scheduler.Run(0, NULL);
+	}
+	if (pSlot != NULL) {
+		ReleaseSlot(pSlot);
 	}
 
 /* Debugging */ double dTotalTickCount = Helpers::GetExactTickCount() - dStartTickCount;
@@ -121,42 +199,200 @@ bool CProcessingThreadPool::Process(CProcessingRequest* pRequest) {
 CProcessingThreadPool::CProcessingThreadPool(void) {
 	m_threads = NULL;
 	m_nNumThreads = 0;
+	m_slots = NULL;
+	m_hWakeUp = NULL;
+	m_nSleepingThreads = 0;
+	m_nInteractiveRequests = 0;
+	m_bTerminate = false;
+}
+
+CDispatchSlot* CProcessingThreadPool::AcquireSlot() {
+	for (int i = 0; i < MAX_DISPATCH_SLOTS; i++) {
+		if (m_slots[i].InUse == 0 && ::InterlockedCompareExchange(&m_slots[i].InUse, 1, 0) == 0) {
+			return &m_slots[i];
+		}
+	}
+	return NULL;
+}
+
+void CProcessingThreadPool::ReleaseSlot(CDispatchSlot* pSlot) {
+	// Withdraw the request and wait until all helpers have left it, the scheduler is on the stack of the caller.
+	// The helpers are processing their last tile, so spin first.
+	ClearHasTiles(*pSlot);
+	::InterlockedExchangePointer((PVOID volatile*)&pSlot->Scheduler, NULL);
+	for (int nSpin = 0; pSlot->NumHelpers > 0; nSpin++) {
+		if (nSpin < SPIN_COUNT) {
+			YieldProcessor();
+		} else {
+			// the event may also be signaled from an earlier request, thus check the count again after waking up
+			::WaitForSingleObject(pSlot->EventHelpersLeft, INFINITE);
+		}
+	}
+	::InterlockedExchange(&pSlot->InUse, 0);
 }
 
+void CProcessingThreadPool::WakeUpThreads(int nNumThreads) {
+	// the interlocked exchange publishing the request is a full barrier, a thread going to sleep after this read
+	// finds the request when checking for requests after having counted itself as sleeping
+	LONG nSleepingThreads = m_nSleepingThreads;
+	if (nSleepingThreads > 0) {
+		::ReleaseSemaphore(m_hWakeUp, min(nSleepingThreads, (LONG)nNumThreads), NULL);
+	}
+}
 
-void CProcessingThread::StartProcess(CWrappedRequest* pRequest) {
-	ProcessAsync(pRequest);
+void CProcessingThreadPool::ClearHasTiles(CDispatchSlot& slot) {
+	// only the first thread finding no tiles counts the interactive request as done
+	if (::InterlockedExchange(&slot.HasTiles, 0) != 0 && !slot.Background) {
+		::InterlockedDecrement(&m_nInteractiveRequests);
+	}
 }
 
-void CProcessingThread::DoProcess(CProcessingRequest* pRequest, int nOffsetY, int nSizeY) {
-	// Processing is done in strips to reduce memory consumption and increase cache hit rate.
-	// The following constant gives the number of pixels to process per strip.
-	const uint32 MAX_SRC_PIXELS_PER_STRIP = 1024 * 100;
-	uint32 nNumberOfPixelsInSource = (uint32)((pRequest->SourceSize.cx * (double)pRequest->ClippedTargetSize.cx / pRequest->FullTargetSize.cx) *
-		(pRequest->SourceSize.cy * (double)nSizeY / pRequest->FullTargetSize.cy));
-	uint32 nStrips = 1 + nNumberOfPixelsInSource / MAX_SRC_PIXELS_PER_STRIP;
-	uint32 nStripHeight = nSizeY / nStrips;
-	uint32 minimalStripHeight = min(16, pRequest->StripPadding);
+bool CProcessingThreadPool::HasDispatchedRequests() {
+	for (int i = 0; i < MAX_DISPATCH_SLOTS; i++) {
+		if (m_slots[i].HasTiles && m_slots[i].Scheduler != NULL) {
+			return true;
+		}
+	}
+	return false;
+}
 
-	if (nStrips > 1) {
-		nStripHeight = nStripHeight & ~(pRequest->StripPadding - 1); // must be dividable by 'StripPadding', except last strip
-		nStripHeight = min(nSizeY, max(nStripHeight, minimalStripHeight));
+bool CProcessingThreadPool::HelpOnRequest(CDispatchSlot& slot, int nThread) {
+	CTileScheduler* pScheduler = slot.Scheduler;
+	if (pScheduler == NULL || !slot.HasTiles) {
+		return false;
 	}
-	int nSizeProcessed = 0;
-	int nCurrentSizeY = nStripHeight;
-	while (nSizeProcessed < nSizeY) {
-		int nCurrentOffsetY = nOffsetY + nSizeProcessed;
-			if (!pRequest->ProcessStrip(nCurrentOffsetY, nCurrentSizeY)) {
-			pRequest->Success = false;
-			break;
-			}
-		nSizeProcessed += nCurrentSizeY;
-		nCurrentSizeY = min(nStripHeight, nSizeY - nSizeProcessed);
+	// the slot cannot be released while we are counted as helper, check if the request is still dispatched after counting
+	::InterlockedIncrement(&slot.NumHelpers);
+	bool bHelped = slot.Scheduler == pScheduler;
+	if (bHelped && pScheduler->Run(nThread, slot.Background ? &m_nInteractiveRequests : NULL)) {
+		ClearHasTiles(slot);
+	}
+	if (::InterlockedDecrement(&slot.NumHelpers) == 0 && slot.Scheduler == NULL) {
+		::SetEvent(slot.EventHelpersLeft);
+	}
+	return bHelped;
+}
+
+bool CProcessingThreadPool::HelpOnInteractiveRequests(int nThread) {
+	bool bHelped = false;
+	for (int i = 0; i < MAX_DISPATCH_SLOTS; i++) {
+		if (!m_slots[i].Background) {
+			bHelped |= HelpOnRequest(m_slots[i], nThread);
 		}
 	}
+	return bHelped;
+}
+
+void CProcessingThreadPool::HelpUntilTerminated(int nThread) {
+	while (!m_bTerminate) {
+		// interactive requests first, background requests are left when an interactive request is dispatched
+		bool bHelped = HelpOnInteractiveRequests(nThread);
+		for (int i = 0; i < MAX_DISPATCH_SLOTS && !bHelped; i++) {
+			bHelped = m_slots[i].Background && HelpOnRequest(m_slots[i], nThread);
+		}
+		if (bHelped) {
+			continue;
+		}
+		for (int nSpin = 0; nSpin < SPIN_COUNT && !HasDispatchedRequests() && !m_bTerminate; nSpin++) {
+			YieldProcessor();
+		}
+		if (HasDispatchedRequests()) {
+			continue;
+		}
+		::InterlockedIncrement(&m_nSleepingThreads);
+		if (!HasDispatchedRequests() && !m_bTerminate) {
+			::WaitForSingleObject(m_hWakeUp, INFINITE);
+		}
+		::InterlockedDecrement(&m_nSleepingThreads);
+	}
+}
+
+unsigned int __stdcall CProcessingThreadPool::ThreadFunc(void* arg) {
+	CProcessingThread* pThread = (CProcessingThread*)arg;
+	pThread->Pool->HelpUntilTerminated(pThread->Index);
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+// CTileScheduler
+///////////////////////////////////////////////////////////////////////////////////
+
+CTileScheduler::CTileScheduler(CProcessingRequest* pRequest, int nNumThreads) {
+	m_pRequest = pRequest;
+	m_nNumThreads = nNumThreads;
+
+	// Processing is done in tiles to reduce memory consumption and increase cache hit rate.
+	// pRequest->MaxSourcePixelsPerStrip gives the number of pixels to process per tile.
+	int nTargetCX = pRequest->ClippedTargetSize.cx;
+	int nTargetCY = pRequest->ClippedTargetSize.cy;
+	double dNumberOfPixelsInSource = (pRequest->SourceSize.cx * (double)nTargetCX / pRequest->FullTargetSize.cx) *
+		(pRequest->SourceSize.cy * (double)nTargetCY / pRequest->FullTargetSize.cy);
+	int nTiles = 1 + (int)min((double)nTargetCX * nTargetCY, dNumberOfPixelsInSource / pRequest->MaxSourcePixelsPerStrip);
+	if (nNumThreads > 1) {
+		nTiles = max(nTiles, nNumThreads * MIN_TILES_PER_THREAD);
+	}
+	// Split into strips as far as there are rows, tile height must be dividable by 'StripPadding', except last row of tiles
+	int nPaddingY = pRequest->StripPadding;
+	int nTilesY = max(1, min(nTiles, nTargetCY / nPaddingY));
+	m_nTileHeight = max(nPaddingY, nTargetCY / nTilesY / nPaddingY * nPaddingY);
+	// Split the strips along x for the remaining tiles, tile width must be dividable by 'TilePaddingX', except last column
+	int nPaddingX = pRequest->TilePaddingX;
+	int nTilesX = (nPaddingX > 0) ? max(1, min((nTiles + nTilesY - 1) / nTilesY, nTargetCX / nPaddingX)) : 1;
+	m_nTileWidth = (nPaddingX > 0) ? max(nPaddingX, nTargetCX / nTilesX / nPaddingX * nPaddingX) : nTargetCX;
+	m_nNumTilesX = (nTargetCX <= 0) ? 0 : (nTargetCX + m_nTileWidth - 1) / m_nTileWidth;
+	m_nNumTiles = (nTargetCY <= 0) ? 0 : m_nNumTilesX * ((nTargetCY + m_nTileHeight - 1) / m_nTileHeight);
 
-void CProcessingThread::ProcessRequest(CRequestBase& request) {
-	CWrappedRequest* pWrappedRequest = (CWrappedRequest*)&request;
-	DoProcess(pWrappedRequest->InnerRequest, pWrappedRequest->Offset, pWrappedRequest->SizeY);
+	for (int i = 0; i < nNumThreads; i++) {
+		LONG64 nFirst = (LONG64)m_nNumTiles * i / nNumThreads;
+		LONG64 nEnd = (LONG64)m_nNumTiles * (i + 1) / nNumThreads;
+		m_ranges[i].Range = (nEnd << 32) | nFirst;
+	}
 }
 
+bool CTileScheduler::Run(int nThread, volatile LONG* pnPreempt) {
+	for (;;) {
+		if (!m_pRequest->Success || (m_pRequest->CancelToken != NULL && m_pRequest->CancelToken->IsCancelled())) {
+			// failed on another thread or cancelled, the remaining tiles are not needed
+			m_pRequest->Success = false;
+			return true;
+		}
+		if (pnPreempt != NULL && *pnPreempt != 0) {
+			return false;
+		}
+		int nTile;
+		bool bFound = false;
+		for (int i = 0; i < m_nNumThreads && !bFound; i++) {
+			// tiles are taken from the front of the own range and stolen from the back of the other ranges
+			int nRange = (nThread + i) % m_nNumThreads;
+			bFound = TakeTile(nRange, nRange == nThread, nTile);
+		}
+		if (!bFound) {
+			return true;
+		}
+		// the tiles are numbered row by row, neighboured tiles of a thread need neighboured source pixels
+		int nOffsetX = (nTile % m_nNumTilesX) * m_nTileWidth;
+		int nOffsetY = (nTile / m_nNumTilesX) * m_nTileHeight;
+		if (!ProcessTileGuarded(m_pRequest, nOffsetX, nOffsetY, min(m_nTileWidth, m_pRequest->ClippedTargetSize.cx - nOffsetX),
+			min(m_nTileHeight, m_pRequest->ClippedTargetSize.cy - nOffsetY))) {
+			m_pRequest->Success = false;
+			return true;
+		}
+	}
+}
+
+bool CTileScheduler::TakeTile(int nThread, bool bFromFront, int& nTile) {
+	volatile LONG64* pRange = &m_ranges[nThread].Range;
+	for (;;) {
+		LONG64 nRange = *pRange;
+		int nFirst = (int)(nRange & 0xFFFFFFFF);
+		int nEnd = (int)(nRange >> 32);
+		if (nFirst >= nEnd) {
+			return false;
+		}
+		LONG64 nNewRange = bFromFront ? (((LONG64)nEnd << 32) | (nFirst + 1)) : (((LONG64)(nEnd - 1) << 32) | nFirst);
+		if (::InterlockedCompareExchange64(pRange, nNewRange, nRange) == nRange) {
+			nTile = bFromFront ? nFirst : nEnd - 1;
+			return true;
+		}
+	}
+}
@@ -3,6 +3,7 @@
 #include "WorkThread.h"
 
 class CProcessingThread;
+struct CDispatchSlot;
 
 // Request for performing an image processing operation parallel on all thread pool threads
 class CProcessingRequest : public CRequestBase {
@@ -16,28 +17,49 @@ public:
 		FullTargetOffset = fullTargetOffset;
 		ClippedTargetSize = clippedTargetSize;
 		StripPadding = 8;
+		TilePaddingX = 0;
+		MaxSourcePixelsPerStrip = 1024 * 100;
+		CancelToken = NULL;
 		Success = true;
 	}
 
 	// Process one strip of the image, starting at row offsetY and having the specified y-size
 	virtual bool ProcessStrip(int offsetY, int sizeY) = 0;
 
+	// Process one tile of the image, starting at column offsetX and row offsetY and having the specified size.
+	// Only called with tiles narrower than the image if TilePaddingX is set, otherwise the tile is a strip.
+	virtual bool ProcessTile(int offsetX, int offsetY, int sizeX, int sizeY) {
+		return ProcessStrip(offsetY, sizeY);
+	}
+
 	// Geometrical parameters and pixels of the image to be processed.
-	// This is the full size image, ProcessStrip() passes the strip to be processed.
+	// This is the full size image, ProcessStrip() and ProcessTile() pass the part to be processed.
 	CSize SourceSize;
 	const void* SourcePixels;
 	void* TargetPixels;
 	CSize FullTargetSize;
 	CPoint FullTargetOffset;
 	CSize ClippedTargetSize;
-	int StripPadding; // Height of strip is padded to multiple of this
+	int StripPadding; // Height of tile is padded to multiple of this (except the last row of tiles)
+	// If not zero, the image can also be split along x and the width of tile is padded to multiple of this (except the last
+	// column of tiles). Zero if the request can only process full rows.
+	int TilePaddingX;
+	uint32 MaxSourcePixelsPerStrip; // The image is split into tiles of at most this size, smaller when using several threads
+	// Checked before each tile, the processing fails when cancelled. If NULL, CProcessingThreadPool::Process() sets the
+	// current cancel token of the calling thread.
+	const CCancelToken* CancelToken;
 
 	// Processing thread can signal failure by setting this flag to false. Must not be set to true by processing threads!
 	bool Success;
 };
 
-// Thread pool for executing processing requests on multiple threads in parallel, processing a strip
-// of the image on each thread.
+// Thread pool for executing processing requests on multiple threads in parallel. The image is split into strips, or
+// into tiles if the request supports it and there are not enough rows for all threads (e.g. the edges updated when
+// panning). Threads having processed their tiles take over the remaining tiles of the other threads (work stealing).
+// Requests are dispatched through preallocated slots, idle threads poll for requests for a short time before blocking.
+// Requests of background jobs (see CCancelToken::IsBackground()) are only processed by idle threads. At each tile,
+// they give way to interactive requests, so read ahead does not slow down zooming and panning.
+// A tile raising an in-page exception (reading a mapped file that became unavailable) fails the request.
 class CProcessingThreadPool {
 public:
 	// Singleton instance
@@ -49,15 +71,31 @@ public:
 
 	// Processes the request using all thread pool threads and the current thread.
 	// Note that the method does NOT take ownership of the passed request object.
-	// The processing work is distributed to the thread pool threads. The pRequest->ProcessStrip()
-	// method is called to process a strip of the image.
+	// The processing work is distributed to the thread pool threads. The pRequest->ProcessTile()
+	// method is called to process a tile of the image, the tiles are processed in no particular order.
+	// The current thread processes tiles too and returns when all tiles have been processed.
+	// Returns false if processing failed or has been cancelled (see CProcessingRequest::CancelToken).
 	bool Process(CProcessingRequest* pRequest);
 private:
 	static CProcessingThreadPool* sm_instance;
 
-	CProcessingThread** m_threads;
+	CProcessingThread* m_threads;
 	int m_nNumThreads;
+	CDispatchSlot* m_slots; // slots for dispatching requests to the threads, see MAX_DISPATCH_SLOTS
+	HANDLE m_hWakeUp; // semaphore waking up blocked threads
+	volatile LONG m_nSleepingThreads; // number of threads blocked (or about to block) on m_hWakeUp
+	volatile LONG m_nInteractiveRequests; // number of dispatched interactive requests with tiles not yet taken
+	volatile bool m_bTerminate;
 
 	CProcessingThreadPool(void);
+	CDispatchSlot* AcquireSlot();
+	void ReleaseSlot(CDispatchSlot* pSlot);
+	void WakeUpThreads(int nNumThreads);
+	void ClearHasTiles(CDispatchSlot& slot);
+	bool HasDispatchedRequests();
+	bool HelpOnRequest(CDispatchSlot& slot, int nThread);
+	bool HelpOnInteractiveRequests(int nThread);
+	void HelpUntilTerminated(int nThread);
+	static unsigned int __stdcall ThreadFunc(void* arg);
 };
 
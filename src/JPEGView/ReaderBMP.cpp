@@ -4,6 +4,7 @@
 #include "Helpers.h"
 #include "BasicProcessing.h"
 #include "MaxImageDef.h"
+#include "FileSource.h"
 
 //////////////////////////////////////////////////////////////////////////////////
 // BITMAP reading
@@ -27,50 +28,41 @@ struct BMINFOHEADER {
 	unsigned int importantcolours;   /* Important colours         */
 };
 
-static void ReadUShort(FILE* file, uint16* pUShort) {
-	fread(pUShort, sizeof(uint16), 1, file);
+static void ReadUShort(CMemoryReader& reader, uint16* pUShort) {
+	reader.Read(pUShort, sizeof(uint16));
 }
 
-static void ReadUInt(FILE* file, uint32* pUInt) {
-	fread(pUInt, sizeof(uint32), 1, file);
+static void ReadUInt(CMemoryReader& reader, uint32* pUInt) {
+	reader.Read(pUInt, sizeof(uint32));
 }
 
-CJPEGImage* CReaderBMP::ReadBmpImage(LPCTSTR strFileName, bool& bOutOfMemory) {
+CJPEGImage* CReaderBMP::ReadBmpImage(const void* pBuffer, unsigned int nSize, bool& bOutOfMemory) {
 	BMHEADER header;
 	BMINFOHEADER infoheader;
-	FILE *fptr;
+	CMemoryReader reader(pBuffer, nSize);
 
 	bOutOfMemory = false;
 
-	/* Open file */
-	if ((fptr = _tfopen(strFileName,_T("rb"))) == NULL) {
-		return NULL;
-	}
-
 	/* Read the header */
-	ReadUShort(fptr,&header.type);
-	ReadUInt(fptr,&header.size);
-	ReadUShort(fptr,&header.reserved1);
-	ReadUShort(fptr,&header.reserved2);
-	ReadUInt(fptr,&header.offset);
+	ReadUShort(reader,&header.type);
+	ReadUInt(reader,&header.size);
+	ReadUShort(reader,&header.reserved1);
+	ReadUShort(reader,&header.reserved2);
+	ReadUInt(reader,&header.offset);
 
 	/* Read and check the information header */
-	if (fread(&infoheader,sizeof(BMINFOHEADER),1,fptr) != 1) {
-		fclose(fptr);
+	if (!reader.Read(&infoheader,sizeof(BMINFOHEADER))) {
 		return NULL;
 	}
 	/* Only 24 and 32 bpp */
 	if (infoheader.bits != 24 && infoheader.bits != 32 && infoheader.bits != 8) {
-		fclose(fptr);
 		return NULL;
 	}
     /* Not too big files */
     if (infoheader.width > MAX_IMAGE_DIMENSION || infoheader.width <= 0 || abs(infoheader.height) > MAX_IMAGE_DIMENSION) {
-        fclose(fptr);
 		return NULL;
     }
 	if ((double)infoheader.width * abs(infoheader.height) > MAX_IMAGE_PIXELS) {
-		fclose(fptr);
 		bOutOfMemory = true;
 		return NULL;
 	}
@@ -78,15 +70,14 @@ CJPEGImage* CReaderBMP::ReadBmpImage(LPCTSTR strFileName, bool& bOutOfMemory) {
 	// read palette for 8 bpp DIBs
 	uint8 palette[4*256];
 	if (infoheader.bits == 8) {
-		fseek(fptr, infoheader.size + 14, SEEK_SET);
-		if (fread(palette, 256*4, 1, fptr) != 1) {
-			fclose(fptr);
+		reader.Seek(infoheader.size + 14);
+		if (!reader.Read(palette, 256*4)) {
 			return NULL;
 		}
 	}
 
 	/* Seek to the start of the image data */
-	fseek(fptr,header.offset,SEEK_SET);
+	reader.Seek(header.offset);
 
 	// DIBs are normally stored flipped vertically (meaning they are stored bottom-up)
 	bool bFlipped;
@@ -101,25 +92,26 @@ CJPEGImage* CReaderBMP::ReadBmpImage(LPCTSTR strFileName, bool& bOutOfMemory) {
 	int paddedWidth = Helpers::DoPadding(infoheader.width*bytesPerPixel, 4);
 	int fileSizeBytes = infoheader.height*paddedWidth;
 	if (fileSizeBytes <= 0 || fileSizeBytes > MAX_BMP_FILE_SIZE) {
-		fclose(fptr);
 		bOutOfMemory = fileSizeBytes > MAX_BMP_FILE_SIZE;
 		return NULL; // corrupt or manipulated header
 	}
+	if (header.offset > nSize || nSize - header.offset < (unsigned int)fileSizeBytes) {
+		return NULL; // truncated file
+	}
 
 	uint8* pDest = new(std::nothrow) uint8[fileSizeBytes];
 	if (pDest == NULL) {
-		fclose(fptr);
 		bOutOfMemory = true;
 		return NULL;
 	}
-	uint8* pStart = bFlipped ? pDest + paddedWidth*(infoheader.height-1) : pDest;
-	for (int nLine = 0; nLine < infoheader.height; nLine++) {
-		if (paddedWidth != fread(pStart, 1, paddedWidth, fptr)) {
-			delete[] pDest;
-			fclose(fptr);
-			return NULL;
+	if (bFlipped) {
+		uint8* pStart = pDest + paddedWidth*(infoheader.height-1);
+		for (int nLine = 0; nLine < infoheader.height; nLine++) {
+			reader.Read(pStart, paddedWidth);
+			pStart = pStart - paddedWidth;
 		}
-		pStart = pStart + (bFlipped ? -paddedWidth : paddedWidth);
+	} else {
+		reader.Read(pDest, fileSizeBytes);
 	}
 
 	// Convert 8 bpp DIBs
@@ -134,8 +126,6 @@ CJPEGImage* CReaderBMP::ReadBmpImage(LPCTSTR strFileName, bool& bOutOfMemory) {
 	CJPEGImage* pImage = (pDest == NULL) ? NULL : new CJPEGImage(infoheader.width, infoheader.height, pDest, NULL, infoheader.bits/8, 
 		0, IF_WindowsBMP, false, 0, 1, 0);
 
-	fclose(fptr);
-
 	bOutOfMemory = pImage == NULL;
 
 	return pImage;
@@ -6,7 +6,8 @@ class CJPEGImage;
 class CReaderBMP
 {
 public:
-	static CJPEGImage* ReadBmpImage(LPCTSTR strFileName, bool& bOutOfMemory);
+	// Reads the bitmap from the file content in pBuffer, returns NULL in case of errors
+	static CJPEGImage* ReadBmpImage(const void* pBuffer, unsigned int nSize, bool& bOutOfMemory);
 private:
 	CReaderBMP(void);
 };
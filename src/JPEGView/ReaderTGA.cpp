@@ -4,6 +4,7 @@
 #include "Helpers.h"
 #include "BasicProcessing.h"
 #include "MaxImageDef.h"
+#include "FileSource.h"
 
 // The TGA reader has been adapted and extended from the TGA reader used in an example of the BOINC project
 // http://www.filewatcher.com/p/boinc-server-maker_7.0.27+dfsg-5_armhf.deb.5191030/usr/share/doc/boinc-server-maker/examples/tgalib.h.html
@@ -57,7 +58,7 @@ static inline uint32 AlphaBlendBackground(uint32 pixel, uint32 backgroundColor)
 }
 
 
-CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundColor, bool& bOutOfMemory) {
+CJPEGImage* CReaderTGA::ReadTgaImage(const void* pBuffer, unsigned int nSize, COLORREF backgroundColor, bool& bOutOfMemory) {
 
 	bOutOfMemory = false;
 
@@ -69,41 +70,35 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 	byte imageType = 0;					// The image type (RLE, RGB, Alpha...)
 	byte bits = 0;						// The bits per pixel for the image (16, 24, 32)
 	byte attributes = 0;                // Image attributes
-	FILE *pFile = NULL;					// The file pointer
+	CMemoryReader reader(pBuffer, nSize); // Reader of the file content
 	int channels = 0;					// The channels of the image (3 = RGA : 4 = RGBA)
 	int stride = 0;						// The stride (channels * width)
 	int i = 0;							// A counter
 
-	// Open a file pointer to the targa file and check if it was found and opened 
-	if((pFile = _tfopen(strFileName, _T("rb"))) == NULL) 
-	{
-		return NULL;
-	}
-
 	// Read in the length in bytes from the header to the pixel data
-	fread(&length, sizeof(byte), 1, pFile);
+	reader.Read(&length, sizeof(byte));
 	
 	// Jump over one byte
-	fseek(pFile,1,SEEK_CUR); 
+	reader.Seek(reader.Position() + 1);
 
 	// Read in the imageType (RLE, RGB, etc...)
-	fread(&imageType, sizeof(byte), 1, pFile);
+	reader.Read(&imageType, sizeof(byte));
 
 	bool isIndexed = imageType == TGA_INDEXED || imageType == TGA_RLE_INDEXED;
 
 	// Read in palette info
-	fread(&colormapStart, sizeof(WORD), 1, pFile);
-	fread(&colormapLen, sizeof(WORD), 1, pFile);
-	fread(&colormapBits, sizeof(byte), 1, pFile);
+	reader.Read(&colormapStart, sizeof(WORD));
+	reader.Read(&colormapLen, sizeof(WORD));
+	reader.Read(&colormapBits, sizeof(byte));
 	
 	// Skip past general information we don't care about
-	fseek(pFile, 4, SEEK_CUR); 
+	reader.Seek(reader.Position() + 4);
 
 	// Read the width, height and bits per pixel (16, 24 or 32)
-	fread(&width,  sizeof(WORD), 1, pFile);
-	fread(&height, sizeof(WORD), 1, pFile);
-	fread(&bits,   sizeof(byte), 1, pFile);
-	fread(&attributes, sizeof(byte), 1, pFile);
+	reader.Read(&width,  sizeof(WORD));
+	reader.Read(&height, sizeof(WORD));
+	reader.Read(&bits,   sizeof(byte));
+	reader.Read(&attributes, sizeof(byte));
 
 	bool flipVertically = ((attributes >> 5) & 1) == 0;
 
@@ -119,7 +114,6 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 		((imageType == TGA_MONO || imageType == TGA_RLE_MONO) && bits != 8) ||
 		(isIndexed && (colormapStart != 0 || colormapLen != 256 || colormapBits != 24)))
 	{
-		fclose(pFile);
 		return NULL;
 	}
 
@@ -131,7 +125,6 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 	if ((double)width * height > MAX_IMAGE_PIXELS)
 	{
 		bOutOfMemory = true;
-		fclose(pFile);
 		return NULL;
 	}
 	
@@ -140,14 +133,13 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 	if (pImageData == NULL)
 	{
 		bOutOfMemory = true;
-		fclose(pFile);
 		return NULL;
 	}
 
 	// Now we move the file pointer to the pixel data
-	if (fseek(pFile, length, SEEK_CUR) != 0)
+	if (!reader.Seek(reader.Position() + length))
 	{
-		fclose(pFile);
+		delete[] pImageData;
 		return NULL;
 	}
 
@@ -155,7 +147,7 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 	byte palette[768];
 	if (isIndexed)
 	{  
-		fread(&palette, 768, 1, pFile);
+		reader.Read(&palette, 768);
 	}
 
 	byte* pImage = pImageData;
@@ -169,7 +161,7 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 			for(int x = 0; x < width; x++)
 			{
 				byte grey;
-				fread(&grey, sizeof(byte), 1, pFile);
+				reader.Read(&grey, sizeof(byte));
 				*pLine++ = grey;
 				*pLine++ = grey;
 				*pLine++ = grey;
@@ -185,7 +177,7 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 			for(int x = 0; x < width; x++)
 			{
 				byte index;
-				fread(&index, sizeof(byte), 1, pFile);
+				reader.Read(&index, sizeof(byte));
 				*pLine++ = palette[index*3];
 				*pLine++ = palette[index*3 + 1];
 				*pLine++ = palette[index*3 + 2];
@@ -206,7 +198,7 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 			// Load in all the pixel data line by line
 			for(int y = 0; y < height; y++)
 			{
-				fread(pImage, stride, 1, pFile);
+				reader.Read(pImage, stride);
 				pImage += targetStride;
 			}
 		}
@@ -228,7 +220,7 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 				for(int i = 0; i < width; i++)
 				{
 					// Read in the current pixel
-					fread(&pixel, sizeof(unsigned short), 1, pFile);
+					reader.Read(&pixel, sizeof(unsigned short));
 				
 					// To convert a 16-bit pixel into an R, G, B, we need to
 					// do some masking and such to isolate each color value.
@@ -283,7 +275,7 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 		while(i < numPixels)
 		{
 			// Read in the current color count + 1
-			fread(&rleID, sizeof(byte), 1, pFile);
+			reader.Read(&rleID, sizeof(byte));
 			
 			// Check if we don't have an encoded string of colors
 			bool useSameColor;
@@ -301,7 +293,7 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 				useSameColor = true;
 
 				// Read in the current color, which is the same for a while
-				fread(pColors, sizeof(byte) * channels, 1, pFile);
+				reader.Read(pColors, sizeof(byte) * channels);
 			}
 
 			// Go through and read all the unique colors found
@@ -310,7 +302,7 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 				if (!useSameColor)
 				{
 					// Read in the current color
-					fread(pColors, sizeof(byte) * channels, 1, pFile);
+					reader.Read(pColors, sizeof(byte) * channels);
 				}
 
 				if(bits == 32)
@@ -357,9 +349,6 @@ CJPEGImage* CReaderTGA::ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundCol
 		} // end of RLE pixel loop
 	}
 
-	// Close the file pointer that opened the file
-	fclose(pFile);
-
 	// If image needs to be flipped, do this inplace
 	if (flipVertically)
 	{
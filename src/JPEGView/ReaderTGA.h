@@ -6,8 +6,9 @@ class CJPEGImage;
 class CReaderTGA
 {
 public:
-	// Returns NULL in case of errors. backgroundColor is used for blending transparent parts of the image.
-	static CJPEGImage* ReadTgaImage(LPCTSTR strFileName, COLORREF backgroundColor, bool& bOutOfMemory);
+	// Reads the TGA from the file content in pBuffer, returns NULL in case of errors.
+	// backgroundColor is used for blending transparent parts of the image.
+	static CJPEGImage* ReadTgaImage(const void* pBuffer, unsigned int nSize, COLORREF backgroundColor, bool& bOutOfMemory);
 private:
 	CReaderTGA(void);
 };
@@ -264,17 +264,10 @@ void CResizeFilter::CalculateFilterKernels() {
 	m_kernels.Kernels = new FilterKernel[nTotalKernels];
 	memset(m_kernels.Kernels, 0, sizeof(FilterKernel)*nTotalKernels);
 
-	// calculate kernels for different fractional values (no border kernels yet)
+	// The first NUM_KERNELS_RESIZE kernels are the kernels for the different fractional values (phases).
+	// They are calculated when first used by a target index below. For rational scale factors, the sequence
+	// of phases is periodic and only a few of them are used, the others are left empty (FilterLen = 0).
 	uint32 nIncFrac = 65535/(NUM_KERNELS_RESIZE - 1);
-	uint32 nKFrac = 0;
-	for (int i = 0; i < NUM_KERNELS_RESIZE; i++) {
-		FilterKernel* pThisKernel = &(m_kernels.Kernels[i]);
-		pThisKernel->FilterLen = m_nFilterLen;
-		pThisKernel->FilterOffset = m_nFilterOffset;
-		int16* pKernel = GetFilter((uint16)nKFrac, m_eFilter);
-		memcpy(&(pThisKernel->Kernel), pKernel, m_nFilterLen*sizeof(int16));
-		nKFrac += nIncFrac;
-	}
 
 	int nIdxBorderKernel = NUM_KERNELS_RESIZE;
 	for (int i = 0; i < m_nTargetSize; i++) {
@@ -307,14 +300,21 @@ void CResizeFilter::CalculateFilterKernels() {
 		} else {
 			// normal kernels
 			uint32 nFilterIdx = nXFrac >> (16 - NUM_KERNELS_RESIZE_LOG2);
-			m_kernels.Indices[i] = &(m_kernels.Kernels[nFilterIdx]);
+			FilterKernel* pThisKernel = &(m_kernels.Kernels[nFilterIdx]);
+			if (pThisKernel->FilterLen == 0) {
+				pThisKernel->FilterLen = m_nFilterLen;
+				pThisKernel->FilterOffset = m_nFilterOffset;
+				int16* pKernel = GetFilter((uint16)(nFilterIdx*nIncFrac), m_eFilter);
+				memcpy(&(pThisKernel->Kernel), pKernel, m_nFilterLen*sizeof(int16));
+			}
+			m_kernels.Indices[i] = pThisKernel;
 		}
 		nX += nIncrementX;
 	}
 	m_kernels.NumKernels = nIdxBorderKernel;
 }
 
-// GF version with 4 x float32 (instead of 8 x int16)
+// GF version with float32 elements (instead of int16)
 void CResizeFilter::CalculateSSEFilterKernels() {
 	CalculateFilterKernels();
 	if (m_nTargetSize == 0) {
@@ -322,12 +322,11 @@ void CResizeFilter::CalculateSSEFilterKernels() {
 	}
 
 	// Get size of kernel array - this is not trivial as the kernels have different sizes and
-	// are packed
-	int nTotalKernelElements = 0;
+	// are packed. Each kernel is padded to 16 bytes.
+	uint32 nSizeOfKernels = 0;
 	for (int i = 0; i < m_kernels.NumKernels; i++) {
-		nTotalKernelElements += m_kernels.Kernels[i].FilterLen;
+		nSizeOfKernels += 16 + Helpers::DoPadding(m_kernels.Kernels[i].FilterLen, 4) * sizeof(float);
 	}
-	uint32 nSizeOfKernels = m_kernels.NumKernels * 32 + sizeof(SSEKernelElement) * nTotalKernelElements;
 
 	m_kernelsSSE.NumKernels = m_kernels.NumKernels;
 	m_kernelsSSE.Indices = new SSEFilterKernel*[m_nTargetSize];
@@ -345,11 +344,9 @@ void CResizeFilter::CalculateSSEFilterKernels() {
 		pCurKernelSSE->FilterLen = nCurFilterLen;
 		pCurKernelSSE->FilterOffset = m_kernels.Kernels[i].FilterOffset;
 		for (int j = 0; j < nCurFilterLen; j++) {
-			for (int k = 0; k < 4; k++) {
-				pCurKernelSSE->Kernel[j].valueRepeated[k] = (((float)(m_kernels.Kernels[i].Kernel[j])) / (float)FP_ONE);	// so output should be [0.0...1.0]
-			}
+			pCurKernelSSE->Kernel[j] = (((float)(m_kernels.Kernels[i].Kernel[j])) / (float)FP_ONE);	// so output should be [0.0...1.0]
 		}
-		pCurKernelSSE = (SSEFilterKernel*) ((PTR_INTEGRAL_TYPE)pCurKernelSSE + 32 + sizeof(SSEKernelElement)*nCurFilterLen);
+		pCurKernelSSE = (SSEFilterKernel*) ((PTR_INTEGRAL_TYPE)pCurKernelSSE + 16 + Helpers::DoPadding(nCurFilterLen, 4) * sizeof(float));
 	}
 
 	for (int i = 0; i < m_nTargetSize; i++) {
@@ -360,7 +357,7 @@ void CResizeFilter::CalculateSSEFilterKernels() {
 	delete[] pKernelStartAddress;
 }
 
-// GF version with 8 x float32
+// GF version with float32 elements, kernels aligned to 32 bytes
 void CResizeFilter::CalculateAVXFilterKernels() {
 	CalculateFilterKernels();
 	if (m_nTargetSize == 0) {
@@ -368,12 +365,11 @@ void CResizeFilter::CalculateAVXFilterKernels() {
 	}
 
 	// Get size of kernel array - this is not trivial as the kernels have different sizes and
-	// are packed
-	int nTotalKernelElements = 0;
+	// are packed. Each kernel is padded to 32 bytes.
+	uint32 nSizeOfKernels = 0;
 	for (int i = 0; i < m_kernels.NumKernels; i++) {
-		nTotalKernelElements += m_kernels.Kernels[i].FilterLen;
+		nSizeOfKernels += 32 + Helpers::DoPadding(m_kernels.Kernels[i].FilterLen, 8) * sizeof(float);
 	}
-	uint32 nSizeOfKernels = m_kernels.NumKernels * 64 + sizeof(AVXKernelElement)* nTotalKernelElements;
 
 	m_kernelsAVX.NumKernels = m_kernels.NumKernels;
 	m_kernelsAVX.Indices = new AVXFilterKernel*[m_nTargetSize];
@@ -391,11 +387,9 @@ void CResizeFilter::CalculateAVXFilterKernels() {
 		pCurKernelAVX->FilterLen = nCurFilterLen;
 		pCurKernelAVX->FilterOffset = m_kernels.Kernels[i].FilterOffset;
 		for (int j = 0; j < nCurFilterLen; j++) {
-			for (int k = 0; k < 8; k++) {
-				pCurKernelAVX->Kernel[j].valueRepeated[k] = (((float)(m_kernels.Kernels[i].Kernel[j])) / (float)FP_ONE);	// so output should be [0.0...1.0]
-			}
+			pCurKernelAVX->Kernel[j] = (((float)(m_kernels.Kernels[i].Kernel[j])) / (float)FP_ONE);	// so output should be [0.0...1.0]
 		}
-		pCurKernelAVX = (AVXFilterKernel*) ((PTR_INTEGRAL_TYPE)pCurKernelAVX + 64 + sizeof(AVXKernelElement)*nCurFilterLen);
+		pCurKernelAVX = (AVXFilterKernel*) ((PTR_INTEGRAL_TYPE)pCurKernelAVX + 32 + Helpers::DoPadding(nCurFilterLen, 8) * sizeof(float));
 	}
 
 	for (int i = 0; i < m_nTargetSize; i++) {
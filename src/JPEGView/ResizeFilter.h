@@ -24,16 +24,12 @@ struct FilterKernelBlock {
 };
 
 // Filter kernel and filter kernel block for SSE (SIMD).
-// For f32 in SSE, we need 4 repetitions of each kernel element (4 x 32 = 128 bit in total, SSE register size)
-/*GF*/	struct SSEKernelElement {
-/*GF*/		float valueRepeated[4];
-/*GF*/	};
-
+// Each kernel element is stored once as f32, the SIMD code broadcasts it to all lanes of the register when applying it
 struct SSEFilterKernel {
 	int FilterLen;
 	int FilterOffset;
 	int nPad1, nPad2; // padd to 16 bytes before kernel starts
-	SSEKernelElement Kernel[1]; // this is a placehoder for a kernel of FilterLen elements
+	float Kernel[1]; // this is a placehoder for a kernel of FilterLen elements
 };
 
 struct SSEFilterKernelBlock {
@@ -44,16 +40,12 @@ struct SSEFilterKernelBlock {
 };
 
 // Filter kernel and filter kernel block for AVX (SIMD).
-// For f32 in AVX2, we need 8 repetitions of each kernel element (8 x 32 = 256 bit in total, AVX2 register size)
-/*GF*/	struct AVXKernelElement {
-/*GF*/		float valueRepeated[8];
-/*GF*/	};
-
+// Each kernel element is stored once as f32, as for SSE
 struct AVXFilterKernel {
 	int FilterLen;
 	int FilterOffset;
 	int pad[6]; // padd to 32 bytes before kernel starts
-	AVXKernelElement Kernel[1]; // this is a placehoder for a kernel of FilterLen elements
+	float Kernel[1]; // this is a placehoder for a kernel of FilterLen elements
 };
 
 struct AVXFilterKernelBlock {
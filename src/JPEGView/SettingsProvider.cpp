@@ -93,10 +93,16 @@ CSettingsProvider::CSettingsProvider(void)
 	else if (sCPU.CompareNoCase(_T("AVX2")) == 0) {
 		m_eCPUAlgorithm = Helpers::CPU_AVX2;
 	}
+	else if (sCPU.CompareNoCase(_T("AVX2FMA")) == 0) {
+		m_eCPUAlgorithm = Helpers::CPU_AVX2_FMA;
+	}
+	else if (sCPU.CompareNoCase(_T("AVX512")) == 0) {
+		m_eCPUAlgorithm = Helpers::CPU_AVX512;
+	}
 	else {
 		m_eCPUAlgorithm = Helpers::ProbeCPU();
 	}
-/*GF*/	swprintf(debugtext,255,TEXT("m_eCPUAlgorithm: %d (0=unknown, 1=generic, 2=sse, 3=avx2)"), m_eCPUAlgorithm);
+/*GF*/	swprintf(debugtext,255,TEXT("m_eCPUAlgorithm: %d (0=unknown, 1=generic, 2=sse, 3=avx2, 4=avx2+fma, 5=avx512)"), m_eCPUAlgorithm);
 /*GF*/	::OutputDebugStringW(debugtext);
 
 
@@ -131,6 +137,54 @@ CSettingsProvider::CSettingsProvider(void)
 /*GF*/	swprintf(debugtext,255,TEXT("m_eDownsamplingFilter: %d (0=none, 1=hermite, 2=mitchell, 3=catrom, 4=lanczos2)"), m_eDownsamplingFilter);
 /*GF*/	::OutputDebugStringW(debugtext);
 
+	// Half float intermediate rows in the resampler, used with AVX2 + FMA and AVX-512 only
+	m_bHalfFloatIntermediates = GetBool(_T("HalfFloatIntermediates"), false);
+
+	// Memory budget per image for the downsampling resolution pyramid, 0 disables it
+	m_nPyramidCacheMB = GetInt(_T("PyramidCacheMB"), 256, 0, 16384);
+
+	// Memory budget per image for resampled tiles, the tiles of the visible section are always kept
+	m_nTileCacheMB = GetInt(_T("TileCacheMB"), 64, 0, 16384);
+
+	// Memory budget per image for the full resolution tiles of DCT scaled JPEGs decoded by region when zooming in.
+	// The tiles of the visible section are always kept, if these exceed the budget, the full image is decoded.
+	m_nRegionCacheMB = GetInt(_T("RegionCacheMB"), 512, 0, 65536);
+
+	// Decode JPEGs much larger than the screen with the DCT scaling of libjpeg-turbo (1/2, 1/4, 1/8)
+	m_bScaledJPEGDecoding = GetBool(_T("ScaledJPEGDecoding"), true);
+
+	// JPEGs with at least this size show a low resolution preview while loading, 0 disables the preview
+	m_nPreviewMinMegapixels = GetInt(_T("PreviewMinMegapixels"), 16, 0, 1000);
+
+	// Size limit of the random access indices of DCT scaled JPEGs kept in the JPEGIndex folder of the application data path,
+	// so zooming into a region of a huge JPEG opened before does not need to index its entropy coded data again.
+	// The least recently used indices are deleted when the limit is exceeded, 0 disables keeping the indices.
+	m_nJPEGIndexCacheMB = GetInt(_T("JPEGIndexCacheMB"), 32, 0, 16384);
+
+	// JPEGs decoded at full resolution with at least this size are kept as YCbCr planes instead of BGR (half the memory for
+	// 4:2:0 subsampling), the planes are converted row by row when resampling. 0 disables this.
+	m_nYCbCrMinMegapixels = GetInt(_T("YCbCrMinMegapixels"), 4, 0, 1000);
+
+	// Number of files ahead in the browsing direction whose content is read into memory before being decoded, 0 disables
+	// the prefetching. The prefetched files are limited by the memory budget in PrefetchCacheMB.
+	m_nPrefetchFiles = GetInt(_T("PrefetchFiles"), 8, 0, 100);
+	m_nPrefetchCacheMB = GetInt(_T("PrefetchCacheMB"), 256, 1, 16384);
+
+	// Memory budget for the loaded images kept for viewing them again and read ahead, including their DIBs and pyramids.
+	// The image shown is always kept, even if larger than the budget.
+#ifdef _WIN64
+	m_nImageCacheMB = GetInt(_T("ImageCacheMB"), 2048, 64, 1048576);
+#else
+	m_nImageCacheMB = GetInt(_T("ImageCacheMB"), 512, 64, 1536);
+#endif
+
+	// Number of threads loading images. One thread is kept free for the image to show, the others read ahead the next
+	// images in the browsing direction, nearest first. 0 selects 2 to 4 threads depending on the number of cores.
+	m_nLoadThreads = GetInt(_T("LoadThreads"), 0, 0, 16);
+	if (m_nLoadThreads == 0) {
+		m_nLoadThreads = max(2, min(4, m_nNumCores / 2));
+	}
+
 	//----------------------------------------------------------------------------------------
 
 	CString sSorting = GetString(_T("SortOrder"), _T("FileName"));
@@ -22,6 +22,18 @@ public:
 	int NumberOfCoresToUse() { return m_nNumCores; }
 	int MangaSinglePageVisibleHeight() { return m_nMangaSinglePageVisibleHeight; }
 	EFilterType DownsamplingFilter() { return m_eDownsamplingFilter; }
+	bool HalfFloatIntermediates() { return m_bHalfFloatIntermediates; }
+	int PyramidCacheMB() { return m_nPyramidCacheMB; }
+	int TileCacheMB() { return m_nTileCacheMB; }
+	int RegionCacheMB() { return m_nRegionCacheMB; }
+	bool ScaledJPEGDecoding() { return m_bScaledJPEGDecoding; }
+	int PreviewMinMegapixels() { return m_nPreviewMinMegapixels; }
+	int JPEGIndexCacheMB() { return m_nJPEGIndexCacheMB; }
+	int YCbCrMinMegapixels() { return m_nYCbCrMinMegapixels; }
+	int PrefetchFiles() { return m_nPrefetchFiles; }
+	int PrefetchCacheMB() { return m_nPrefetchCacheMB; }
+	int ImageCacheMB() { return m_nImageCacheMB; }
+	int LoadThreads() { return m_nLoadThreads; }
 	Helpers::ESorting Sorting() { return m_eSorting; }
 	bool IsSortedUpcounting() { return m_bIsSortedUpcounting; }
 	bool WrapAroundFolder() { return m_bWrapAroundFolder; }
@@ -57,6 +69,18 @@ private:
 	int m_nNumCores;
 	int m_nMangaSinglePageVisibleHeight;
 	EFilterType m_eDownsamplingFilter;
+	bool m_bHalfFloatIntermediates;
+	int m_nPyramidCacheMB;
+	int m_nTileCacheMB;
+	int m_nRegionCacheMB;
+	bool m_bScaledJPEGDecoding;
+	int m_nPreviewMinMegapixels;
+	int m_nJPEGIndexCacheMB;
+	int m_nYCbCrMinMegapixels;
+	int m_nPrefetchFiles;
+	int m_nPrefetchCacheMB;
+	int m_nImageCacheMB;
+	int m_nLoadThreads;
 	Helpers::ESorting m_eSorting;
 	bool m_bIsSortedUpcounting;
 	bool m_bWrapAroundFolder;
@@ -3,8 +3,89 @@
 #include "TJPEGWrapper.h"
 #include "libjpeg-turbo\include\turbojpeg.h"
 #include "MaxImageDef.h"
+#include "JPEGIndex.h"
+#include "ProcessingThreadPool.h"
+#include "YCbCrImage.h"
 #include <cmath>		// needed for abs() double overload
 
+// JPEGs with restart markers and at least this number of pixels are decoded in parallel
+static const int MIN_PIXELS_PARALLEL_DECODE = 2 * 1024 * 1024;
+
+// Request to decode a JPEG in bands of MCU rows, each band is decoded from a JPEG stream containing only its MCU rows.
+// The target is a 24 bpp DIB or, if pYCbCrImage is not NULL, the planes of a CYCbCrImage.
+class CRequestDecodeBands : public CProcessingRequest {
+public:
+    CRequestDecodeBands(const void* pJPEGStream, int nStreamSize, const CJPEGIndex& index, void* pTargetPixels, int nWidth, int nHeight,
+        CYCbCrImage* pYCbCrImage = NULL)
+        : CProcessingRequest(pJPEGStream, CSize(nWidth, nHeight), pTargetPixels, CSize(nWidth, nHeight), CPoint(0, 0), CSize(nWidth, nHeight)),
+        m_index(index) {
+        m_nStreamSize = nStreamSize;
+        m_pYCbCrImage = pYCbCrImage;
+        StripPadding = index.MCURowHeight();
+        // Bands have the overhead of creating their stream, so they are large. The bands are not larger than this so
+        // that a cancelled decode stops soon (the cancel token is checked between the bands).
+        MaxSourcePixelsPerStrip = 8 * 1024 * 1024;
+    }
+
+    virtual bool ProcessStrip(int offsetY, int sizeY) {
+        int nSubImageSize, nSubImageFirstRow;
+        void* pSubImage = m_index.CreateSubImage(SourcePixels, m_nStreamSize, offsetY, offsetY + sizeY, nSubImageSize, nSubImageFirstRow);
+        if (pSubImage == NULL) {
+            return false;
+        }
+        bool bSuccess = false;
+        tjhandle hDecoder = tj3Init(TJINIT_DECOMPRESS);
+        if (hDecoder != NULL && m_pYCbCrImage != NULL) {
+            bSuccess = tj3DecompressHeader(hDecoder, (unsigned char*)pSubImage, nSubImageSize) == 0 &&
+                DecodePlanes(hDecoder, pSubImage, nSubImageSize, offsetY, sizeY, nSubImageFirstRow);
+            tj3Destroy(hDecoder);
+        } else if (hDecoder != NULL) {
+            tjregion region = { 0, offsetY - nSubImageFirstRow, FullTargetSize.cx, sizeY };
+            int nPitch = TJPAD(FullTargetSize.cx * 3);
+            bSuccess = tj3DecompressHeader(hDecoder, (unsigned char*)pSubImage, nSubImageSize) == 0 &&
+                tj3SetCroppingRegion(hDecoder, region) == 0 &&
+                tj3Decompress8(hDecoder, (unsigned char*)pSubImage, nSubImageSize, (unsigned char*)TargetPixels + (size_t)nPitch * offsetY, nPitch, TJPF_BGR) == 0;
+            tj3Destroy(hDecoder);
+        }
+        delete[] pSubImage;
+        return bSuccess;
+    }
+
+private:
+    const CJPEGIndex& m_index;
+    int m_nStreamSize;
+    CYCbCrImage* m_pYCbCrImage;
+
+    // The planes cannot be cropped by libjpeg-turbo, the band is decoded to planes of its own and its rows are copied
+    bool DecodePlanes(tjhandle hDecoder, void* pSubImage, int nSubImageSize, int offsetY, int sizeY, int nSubImageFirstRow) {
+        int nSubsampling = tj3Get(hDecoder, TJPARAM_SUBSAMP);
+        CYCbCrImage bandImage(tj3Get(hDecoder, TJPARAM_JPEGWIDTH), tj3Get(hDecoder, TJPARAM_JPEGHEIGHT), (TJSAMP)nSubsampling);
+        if (bandImage.Plane(0) == NULL) {
+            return false;
+        }
+        unsigned char* pPlanes[3];
+        int nStrides[3];
+        for (int i = 0; i < 3; i++) {
+            pPlanes[i] = bandImage.Plane(i);
+            nStrides[i] = bandImage.PlaneWidth(i);
+        }
+        if (tj3DecompressToYUVPlanes8(hDecoder, (unsigned char*)pSubImage, nSubImageSize, pPlanes, nStrides) != 0) {
+            return false;
+        }
+        int nMaxShiftY = (nSubsampling == TJSAMP_420) ? 1 : 0;
+        for (int i = 0; i < 3 && pPlanes[i] != NULL; i++) {
+            // bands start at MCU rows, so the rows of the band are aligned to the chroma rows
+            int nShiftY = (i == 0) ? 0 : nMaxShiftY;
+            int nFirstRow = offsetY >> nShiftY;
+            int nRows = ((offsetY + sizeY - 1) >> nShiftY) - nFirstRow + 1;
+            int nWidth = m_pYCbCrImage->PlaneWidth(i);
+            memcpy(m_pYCbCrImage->Plane(i) + (size_t)nFirstRow * nWidth,
+                pPlanes[i] + (size_t)((offsetY - nSubImageFirstRow) >> nShiftY) * nWidth, (size_t)nRows * nWidth);
+        }
+        return true;
+    }
+};
+
 void * TurboJpeg::ReadImage(int &width,
                        int &height,
                        int &nchannels,
@@ -12,9 +93,27 @@ void * TurboJpeg::ReadImage(int &width,
 					   bool &outOfMemory,
                        const void *buffer,
                        int sizebytes)
+{
+    int fullWidth, fullHeight;
+    return ReadImageScaled(width, height, fullWidth, fullHeight, nchannels, chromoSubsampling, outOfMemory, buffer, sizebytes, 0, 0);
+}
+
+void * TurboJpeg::ReadImageScaled(int &width,
+                       int &height,
+                       int &fullWidth,
+                       int &fullHeight,
+                       int &nchannels,
+                       TJSAMP &chromoSubsampling,
+					   bool &outOfMemory,
+                       const void *buffer,
+                       int sizebytes,
+                       int minWidth,
+                       int minHeight,
+                       bool fastDecode)
 {
     outOfMemory = false;
     width = height = 0;
+    fullWidth = fullHeight = 0;
     nchannels = 3;
     chromoSubsampling = TJSAMP_420;
 
@@ -26,16 +125,159 @@ void * TurboJpeg::ReadImage(int &width,
     unsigned char* pPixelData = NULL;
 	int nResult = tj3DecompressHeader(hDecoder, (unsigned char*)buffer, sizebytes);
 	if (nResult == 0) {
-		width = tj3Get(hDecoder, TJPARAM_JPEGWIDTH);
-		height = tj3Get(hDecoder, TJPARAM_JPEGHEIGHT);
+		int jpegWidth = tj3Get(hDecoder, TJPARAM_JPEGWIDTH);
+		int jpegHeight = tj3Get(hDecoder, TJPARAM_JPEGHEIGHT);
+		fullWidth = width = jpegWidth;
+		fullHeight = height = jpegHeight;
 		chromoSubsampling = (TJSAMP)tj3Get(hDecoder, TJPARAM_SUBSAMP);
+        int limitDenom = SizeLimitDenominator(jpegWidth, jpegHeight);
+        if (limitDenom == 0) {
+            outOfMemory = true;
+        } else if (chromoSubsampling != TJSAMP_UNKNOWN) {
+            // JPEGs beyond the size limits are reduced in the DCT domain, the reduced size is the full size of the image
+            tjscalingfactor limitFactor = { 1, limitDenom };
+            fullWidth = width = TJSCALED(jpegWidth, limitFactor);
+            fullHeight = height = TJSCALED(jpegHeight, limitFactor);
+            // scaling is done in the DCT domain, this reduces decode time and memory by up to the square of the factor
+            tjscalingfactor scalingFactor = { 1, max(limitDenom, ScalingDenominator(jpegWidth, jpegHeight, minWidth, minHeight)) };
+            if (scalingFactor.denom > 1) {
+                if (tj3SetScalingFactor(hDecoder, scalingFactor) == 0) {
+                    width = TJSCALED(jpegWidth, scalingFactor);
+                    height = TJSCALED(jpegHeight, scalingFactor);
+                } else if (limitDenom > 1) {
+                    tj3Destroy(hDecoder);
+                    return NULL;
+                } else {
+                    scalingFactor.denom = 1;
+                }
+            }
+            if (fastDecode) {
+                tj3Set(hDecoder, TJPARAM_FASTDCT, 1);
+                tj3Set(hDecoder, TJPARAM_FASTUPSAMPLE, 1);
+            }
+            if (scalingFactor.denom == 1 && !fastDecode && (double)width * height >= MIN_PIXELS_PARALLEL_DECODE) {
+                // libjpeg-turbo decodes on one thread, JPEGs with restart markers are decoded in bands on all threads
+                CJPEGIndex* pIndex = CJPEGIndex::Build(buffer, sizebytes, true);
+                if (pIndex != NULL) {
+                    pPixelData = (unsigned char*)ReadImageParallel(width, height, nchannels, chromoSubsampling, outOfMemory, buffer, sizebytes, *pIndex);
+                    delete pIndex;
+                }
+            }
+            // Limitation: The serial decode cannot be cancelled once started. TurboJPEG has no callback or row by row
+            // output to check the cancel token, and decoding in bands without an index would entropy decode the scan from
+            // its start for each band. The token is only checked before the decode (it is not started when the parallel
+            // decode has been cancelled) and by the caller afterwards, so a cancelled load of a huge JPEG without restart
+            // markers keeps its load thread busy until the decode ends.
+            if (pPixelData == NULL && !outOfMemory && !CCancelToken::IsCurrentCancelled()) {
+                pPixelData = new(std::nothrow) unsigned char[(size_t)TJPAD(width * 3) * height];
+                if (pPixelData != NULL) {
+                    nResult = tj3Decompress8(hDecoder, (unsigned char*)buffer, sizebytes, pPixelData, TJPAD(width * 3), TJPF_BGR);
+                    if (nResult != 0) {
+                        delete[] pPixelData;
+                        pPixelData = NULL;
+                    }
+                } else {
+                    outOfMemory = true;
+                }
+            }
+        }
+    }
+
+    tj3Destroy(hDecoder);
+
+    return pPixelData;
+}
+
+void * TurboJpeg::ReadImageRegion(int &x,
+                       int &y,
+                       int &width,
+                       int &height,
+                       int &nchannels,
+                       bool &outOfMemory,
+                       const void *buffer,
+                       int sizebytes)
+{
+    outOfMemory = false;
+    nchannels = 3;
+
+    tjhandle hDecoder = tj3Init(TJINIT_DECOMPRESS);
+    if (hDecoder == NULL) {
+        return NULL;
+    }
+
+    unsigned char* pPixelData = NULL;
+    int nResult = tj3DecompressHeader(hDecoder, (unsigned char*)buffer, sizebytes);
+    if (nResult == 0) {
+        int jpegWidth = tj3Get(hDecoder, TJPARAM_JPEGWIDTH);
+        int jpegHeight = tj3Get(hDecoder, TJPARAM_JPEGHEIGHT);
+        int subsampling = tj3Get(hDecoder, TJPARAM_SUBSAMP);
+        // JPEGs beyond the size limits are decoded DCT scaled as by ReadImageScaled(), the region is in scaled pixels
+        tjscalingfactor limitFactor = { 1, SizeLimitDenominator(jpegWidth, jpegHeight) };
+        if (subsampling >= 0 && subsampling < TJ_NUMSAMP && limitFactor.denom > 0 &&
+            (limitFactor.denom == 1 || tj3SetScalingFactor(hDecoder, limitFactor) == 0)) {
+            int fullWidth = TJSCALED(jpegWidth, limitFactor);
+            int fullHeight = TJSCALED(jpegHeight, limitFactor);
+            // the left border of the cropping region must be on an iMCU boundary (of the scaled image)
+            int right = min(x + width, fullWidth);
+            int bottom = min(y + height, fullHeight);
+            x = max(0, x);
+            x -= x % TJSCALED(tjMCUWidth[subsampling], limitFactor);
+            y = max(0, y);
+            width = right - x;
+            height = bottom - y;
+            tjregion region = { x, y, width, height };
+            if (width > 0 && height > 0 && tj3SetCroppingRegion(hDecoder, region) == 0) {
+                // not cancellable, see ReadImageScaled()
+                pPixelData = new(std::nothrow) unsigned char[(size_t)TJPAD(width * 3) * height];
+                if (pPixelData != NULL) {
+                    nResult = tj3Decompress8(hDecoder, (unsigned char*)buffer, sizebytes, pPixelData, TJPAD(width * 3), TJPF_BGR);
+                    if (nResult != 0) {
+                        delete[] pPixelData;
+                        pPixelData = NULL;
+                    }
+                } else {
+                    outOfMemory = true;
+                }
+            }
+        }
+    }
+
+    tj3Destroy(hDecoder);
+
+    return pPixelData;
+}
+
+void * TurboJpeg::ReadImageParallel(int &width,
+                       int &height,
+                       int &nchannels,
+                       TJSAMP &chromoSubsampling,
+                       bool &outOfMemory,
+                       const void *buffer,
+                       int sizebytes,
+                       const CJPEGIndex &index)
+{
+    outOfMemory = false;
+    width = height = 0;
+    nchannels = 3;
+    chromoSubsampling = TJSAMP_420;
+
+    tjhandle hDecoder = tj3Init(TJINIT_DECOMPRESS);
+    if (hDecoder == NULL) {
+        return NULL;
+    }
+
+    unsigned char* pPixelData = NULL;
+    if (tj3DecompressHeader(hDecoder, (unsigned char*)buffer, sizebytes) == 0) {
+        width = tj3Get(hDecoder, TJPARAM_JPEGWIDTH);
+        height = tj3Get(hDecoder, TJPARAM_JPEGHEIGHT);
+        chromoSubsampling = (TJSAMP)tj3Get(hDecoder, TJPARAM_SUBSAMP);
         if (abs((double)width * height) > MAX_IMAGE_PIXELS) {
             outOfMemory = true;
         } else if (width <= MAX_IMAGE_DIMENSION && height <= MAX_IMAGE_DIMENSION && chromoSubsampling != TJSAMP_UNKNOWN) {
-            pPixelData = new(std::nothrow) unsigned char[TJPAD(width * 3) * height];
+            pPixelData = new(std::nothrow) unsigned char[(size_t)TJPAD(width * 3) * height];
             if (pPixelData != NULL) {
-	            nResult = tj3Decompress8(hDecoder, (unsigned char*)buffer, sizebytes, pPixelData, TJPAD(width * 3), TJPF_BGR);
-                if (nResult != 0) {
+                CRequestDecodeBands request(buffer, sizebytes, index, pPixelData, width, height);
+                if (!CProcessingThreadPool::This().Process(&request)) {
                     delete[] pPixelData;
                     pPixelData = NULL;
                 }
@@ -50,6 +292,103 @@ void * TurboJpeg::ReadImage(int &width,
     return pPixelData;
 }
 
+CYCbCrImage * TurboJpeg::ReadImageYCbCr(TJSAMP &chromoSubsampling,
+                       bool &outOfMemory,
+                       const void *buffer,
+                       int sizebytes)
+{
+    outOfMemory = false;
+    chromoSubsampling = TJSAMP_420;
+
+    tjhandle hDecoder = tj3Init(TJINIT_DECOMPRESS);
+    if (hDecoder == NULL) {
+        return NULL;
+    }
+
+    CYCbCrImage* pImage = NULL;
+    if (tj3DecompressHeader(hDecoder, (unsigned char*)buffer, sizebytes) == 0) {
+        int width = tj3Get(hDecoder, TJPARAM_JPEGWIDTH);
+        int height = tj3Get(hDecoder, TJPARAM_JPEGHEIGHT);
+        chromoSubsampling = (TJSAMP)tj3Get(hDecoder, TJPARAM_SUBSAMP);
+        // the planes are converted with the YCbCr to RGB conversion, JPEGs stored as RGB (Adobe transform 0) or CMYK
+        // are decoded by ReadImageScaled()
+        int colorspace = tj3Get(hDecoder, TJPARAM_COLORSPACE);
+        bool bSupportedColorspace = colorspace == TJCS_YCbCr || colorspace == TJCS_GRAY;
+        // JPEGs beyond the size limits are only decoded DCT scaled by ReadImageScaled()
+        if (SizeLimitDenominator(width, height) == 1 && bSupportedColorspace &&
+            CYCbCrImage::IsSupported(width, chromoSubsampling)) {
+            pImage = new CYCbCrImage(width, height, chromoSubsampling);
+            bool bSuccess = false;
+            if (pImage->Plane(0) == NULL) {
+                outOfMemory = true;
+            } else {
+                CJPEGIndex* pIndex = ((double)width * height >= MIN_PIXELS_PARALLEL_DECODE) ? CJPEGIndex::Build(buffer, sizebytes, true) : NULL;
+                if (pIndex != NULL) {
+                    CRequestDecodeBands request(buffer, sizebytes, *pIndex, NULL, width, height, pImage);
+                    bSuccess = CProcessingThreadPool::This().Process(&request);
+                    delete pIndex;
+                }
+                if (!bSuccess && !CCancelToken::IsCurrentCancelled()) {
+                    // serial decode, not cancellable once started, see ReadImageScaled()
+                    unsigned char* pPlanes[3];
+                    int nStrides[3];
+                    for (int i = 0; i < 3; i++) {
+                        pPlanes[i] = pImage->Plane(i);
+                        nStrides[i] = pImage->PlaneWidth(i);
+                    }
+                    bSuccess = tj3DecompressToYUVPlanes8(hDecoder, (unsigned char*)buffer, sizebytes, pPlanes, nStrides) == 0;
+                }
+            }
+            if (!bSuccess) {
+                delete pImage;
+                pImage = NULL;
+            }
+        }
+    }
+
+    tj3Destroy(hDecoder);
+
+    return pImage;
+}
+
+int TurboJpeg::ScalingDenominator(int fullWidth, int fullHeight, int minWidth, int minHeight)
+{
+    int denom = 1;
+    while (minWidth > 0 && minHeight > 0 && denom < 8 &&
+        fullWidth / (denom * 2) >= minWidth && fullHeight / (denom * 2) >= minHeight) {
+        denom *= 2;
+    }
+    return denom;
+}
+
+int TurboJpeg::SizeLimitDenominator(int jpegWidth, int jpegHeight)
+{
+    for (int denom = 1; denom <= 8; denom *= 2) {
+        int width = (jpegWidth + denom - 1) / denom;
+        int height = (jpegHeight + denom - 1) / denom;
+        if (width <= MAX_IMAGE_DIMENSION && height <= MAX_IMAGE_DIMENSION && (double)width * height <= MAX_IMAGE_PIXELS) {
+            return denom;
+        }
+    }
+    return 0;
+}
+
+bool TurboJpeg::ReadImageSize(int &width, int &height, const void *buffer, int sizebytes)
+{
+    width = height = 0;
+    tjhandle hDecoder = tj3Init(TJINIT_DECOMPRESS);
+    if (hDecoder == NULL) {
+        return false;
+    }
+    bool bSuccess = tj3DecompressHeader(hDecoder, (unsigned char*)buffer, sizebytes) == 0;
+    if (bSuccess) {
+        width = tj3Get(hDecoder, TJPARAM_JPEGWIDTH);
+        height = tj3Get(hDecoder, TJPARAM_JPEGHEIGHT);
+    }
+    tj3Destroy(hDecoder);
+    return bSuccess;
+}
+
 void * TurboJpeg::Compress(const void *source,
                       int width,
                       int height,
@@ -2,6 +2,8 @@
 #pragma once
 
 enum TJSAMP;
+class CJPEGIndex;
+class CYCbCrImage;
 
 class TurboJpeg
 {
@@ -15,6 +17,65 @@ public:
                          const void *buffer, // memory address containing jpeg compressed data.
                          int sizebytes); // size of jpeg compressed data.
 
+	// Same as ReadImage() but decodes with the largest libjpeg-turbo scaling factor (1/2, 1/4 or 1/8) that keeps the image
+	// at least minWidth x minHeight pixels. width and height return the decoded size, fullWidth and fullHeight the size of
+	// the JPEG. If minWidth or minHeight is zero, the image is decoded at full resolution.
+	// JPEGs exceeding MAX_IMAGE_DIMENSION or MAX_IMAGE_PIXELS are always decoded with at least the scaling factor of
+	// SizeLimitDenominator(), fullWidth and fullHeight then return this reduced size. This also applies to ReadImage().
+	// Only the parallel decode checks the cancel token of the thread (see CCancelToken) while decoding.
+	static void * ReadImageScaled(int &width, // width of the image loaded.
+                         int &height, // height of the image loaded.
+                         int &fullWidth, // width of the JPEG image
+                         int &fullHeight, // height of the JPEG image
+                         int &bpp, // BYTES (not bits) PER PIXEL.
+                         TJSAMP &chromoSubsampling, // chromo subsampling of image
+						 bool &outOfMemory, // set to true when no memory to read image
+                         const void *buffer, // memory address containing jpeg compressed data.
+                         int sizebytes, // size of jpeg compressed data.
+                         int minWidth, // minimal width of the decoded image
+                         int minHeight, // minimal height of the decoded image
+                         bool fastDecode = false); // use the fast (less accurate) IDCT and upsampling
+
+	// Decodes only the given region of the JPEG at full resolution, using the cropping support of libjpeg-turbo.
+	// x, y, width, height: Region in pixels of the JPEG image. The region is clipped to the image and extended to the left
+	// to the next iMCU boundary, the parameters return the region actually decoded. Returns data as ReadImage().
+	// For JPEGs exceeding the size limits, the region is in pixels of the reduced full size of ReadImageScaled().
+	static void * ReadImageRegion(int &x, int &y, int &width, int &height, // region to decode, returns decoded region
+                         int &bpp, // BYTES (not bits) PER PIXEL.
+						 bool &outOfMemory, // set to true when no memory to read image
+                         const void *buffer, // memory address containing jpeg compressed data.
+                         int sizebytes); // size of jpeg compressed data.
+
+	// Same as ReadImage() but decodes bands of MCU rows in parallel on the processing thread pool, using the random access
+	// index of the JPEG to start the bands.
+	static void * ReadImageParallel(int &width, // width of the image loaded.
+                         int &height, // height of the image loaded.
+                         int &bpp, // BYTES (not bits) PER PIXEL.
+                         TJSAMP &chromoSubsampling, // chromo subsampling of image
+						 bool &outOfMemory, // set to true when no memory to read image
+                         const void *buffer, // memory address containing jpeg compressed data.
+                         int sizebytes, // size of jpeg compressed data.
+                         const CJPEGIndex &index); // index of the jpeg compressed data
+
+	// Decodes the JPEG at full resolution to the planes of its Y, Cb and Cr components, without chroma upsampling and
+	// color conversion (see CYCbCrImage). JPEGs with restart markers are decoded in parallel as by ReadImageScaled().
+	// Returns NULL without setting outOfMemory if the chroma subsampling is not supported by CYCbCrImage or the JPEG is not
+	// stored as YCbCr or grayscale.
+	static CYCbCrImage * ReadImageYCbCr(TJSAMP &chromoSubsampling, // chromo subsampling of image
+						 bool &outOfMemory, // set to true when no memory to read image
+                         const void *buffer, // memory address containing jpeg compressed data.
+                         int sizebytes); // size of jpeg compressed data.
+
+	// Denominator of the scaling factor (1, 2, 4 or 8) used by ReadImageScaled() for the given sizes, 1 if not scaled
+	static int ScalingDenominator(int fullWidth, int fullHeight, int minWidth, int minHeight);
+
+	// Smallest denominator of the scaling factor (1, 2, 4 or 8) that reduces a JPEG of the given size to within
+	// MAX_IMAGE_DIMENSION and MAX_IMAGE_PIXELS, 0 if the JPEG is too large even at 1/8
+	static int SizeLimitDenominator(int jpegWidth, int jpegHeight);
+
+	// Reads the size of the JPEG image from its header, returns false if the header is invalid
+	static bool ReadImageSize(int &width, int &height, const void *buffer, int sizebytes);
+
 	// Compress image data into JPEG stream, returns compressed data.
     // The returned buffer must be freed with tjFree()!
 	static void * Compress(const void *buffer, // address of image in memory, format must be 3 bytes per pixel BRGBGR with padding to 4 byte boundary
@@ -0,0 +1,70 @@
+#include "StdAfx.h"
+#include "TileCache.h"
+
+CTileCache::CTileCache() {
+	m_nBytes = 0;
+	m_nCurrentTimeStamp = 0;
+}
+
+CTileCache::~CTileCache() {
+	Clear();
+}
+
+const void* CTileCache::GetTile(CSize fullTargetSize, bool bHighQuality, EFilterType eFilter, int nTileX, int nTileY) {
+	std::list<CTile*>::iterator iter;
+	for (iter = m_tileList.begin( ); iter != m_tileList.end( ); iter++ ) {
+		CTile* pTile = *iter;
+		if (pTile->TileX == nTileX && pTile->TileY == nTileY && pTile->FullTargetSize == fullTargetSize &&
+			pTile->HighQuality == bHighQuality && (!bHighQuality || pTile->Filter == eFilter)) {
+			pTile->AccessTimeStamp = m_nCurrentTimeStamp;
+			m_tileList.splice(m_tileList.begin(), m_tileList, iter); // move to top in list
+			return pTile->DIB;
+		}
+	}
+	return NULL;
+}
+
+void CTileCache::AddTile(CSize fullTargetSize, bool bHighQuality, EFilterType eFilter, int nTileX, int nTileY, void* pDIB) {
+	CTile* pTile = new CTile;
+	pTile->FullTargetSize = fullTargetSize;
+	pTile->HighQuality = bHighQuality;
+	pTile->Filter = eFilter;
+	pTile->TileX = nTileX;
+	pTile->TileY = nTileY;
+	pTile->DIB = pDIB;
+	pTile->AccessTimeStamp = m_nCurrentTimeStamp;
+	m_tileList.push_front(pTile);
+	CSize tileSize = TileSize(fullTargetSize, nTileX, nTileY);
+	m_nBytes += tileSize.cx * tileSize.cy * 4;
+}
+
+void CTileCache::Trim(__int64 nBudget) {
+	// the list is ordered by last access, free from the end until a tile used since the last call is reached
+	while (m_nBytes > nBudget && !m_tileList.empty()) {
+		CTile* pTile = m_tileList.back();
+		if (pTile->AccessTimeStamp == m_nCurrentTimeStamp) {
+			break;
+		}
+		CSize tileSize = TileSize(pTile->FullTargetSize, pTile->TileX, pTile->TileY);
+		m_nBytes -= tileSize.cx * tileSize.cy * 4;
+		m_tileList.pop_back();
+		delete[] pTile->DIB;
+		delete pTile;
+	}
+	m_nCurrentTimeStamp++;
+}
+
+void CTileCache::Clear() {
+	std::list<CTile*>::iterator iter;
+	for (iter = m_tileList.begin( ); iter != m_tileList.end( ); iter++ ) {
+		delete[] (*iter)->DIB;
+		delete (*iter);
+	}
+	m_tileList.clear();
+	m_nBytes = 0;
+}
+
+CSize CTileCache::TileSize(CSize fullTargetSize, int nTileX, int nTileY) {
+	return CSize(min(TILE_CACHE_TILE_SIZE, fullTargetSize.cx - nTileX * TILE_CACHE_TILE_SIZE),
+		min(TILE_CACHE_TILE_SIZE, fullTargetSize.cy - nTileY * TILE_CACHE_TILE_SIZE));
+}
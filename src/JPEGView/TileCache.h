@@ -0,0 +1,52 @@
+#pragma once
+
+// Size of the tiles of the tile cache in pixels (width and height)
+#define TILE_CACHE_TILE_SIZE 256
+
+// Cache of resampled tiles of an image (LRU cache). The tiles are 32 bpp DIBs of fixed size, aligned to multiples
+// of the tile size in the full target image, only the tiles at the right and bottom border of the full target image
+// are smaller. Tiles are kept for all target sizes, so they can be reused when panning and when returning to an
+// earlier zoom level. The cache is not thread safe, it is owned and used by one CJPEGImage.
+// The key does not contain the source the tiles were resampled from, the owner must only add tiles of the source that
+// is used for the target size (not the upsampled DCT scaled pixels used as fallback, see CJPEGImage::ResampleTiled()).
+class CTileCache
+{
+public:
+	CTileCache();
+	~CTileCache();
+
+	// Gets the tile at tile index (nTileX, nTileY) resampled to the full target size with the given filter, NULL if not cached.
+	// bHighQuality is false for point sampling, eFilter is ignored in this case.
+	// The tile stays owned by the cache and is marked as used since the last call to Trim().
+	const void* GetTile(CSize fullTargetSize, bool bHighQuality, EFilterType eFilter, int nTileX, int nTileY);
+
+	// Adds a tile, the cache takes ownership of pDIB. Its size must be TileSize(fullTargetSize, nTileX, nTileY).
+	void AddTile(CSize fullTargetSize, bool bHighQuality, EFilterType eFilter, int nTileX, int nTileY, void* pDIB);
+
+	// Frees the least recently used tiles until the cache uses at most nBudget bytes.
+	// Tiles used since the last call to Trim() are never freed.
+	void Trim(__int64 nBudget);
+
+	// Frees all tiles
+	void Clear();
+
+	// Memory in bytes used by the cached tiles
+	__int64 GetMemSize() const { return m_nBytes; }
+
+	// Size of the tile at tile index (nTileX, nTileY) in the full target image
+	static CSize TileSize(CSize fullTargetSize, int nTileX, int nTileY);
+
+private:
+	struct CTile {
+		CSize FullTargetSize;
+		bool HighQuality;
+		EFilterType Filter;
+		int TileX, TileY;
+		void* DIB;
+		int AccessTimeStamp; // LRU handling
+	};
+
+	std::list<CTile*> m_tileList; // most recently used first
+	__int64 m_nBytes;
+	int m_nCurrentTimeStamp;
+};
@@ -0,0 +1,144 @@
+#include "StdAfx.h"
+#include "TiledPixelStore.h"
+
+static const int MEMORY_PAGE_SIZE = 4096;
+
+CTiledPixelStore::CTiledPixelStore(int nWidth, int nHeight) {
+	m_nWidth = nWidth;
+	m_nHeight = nHeight;
+	m_nTilesX = (nWidth + TILED_PIXEL_STORE_TILE_SIZE - 1) / TILED_PIXEL_STORE_TILE_SIZE;
+	m_nTilesY = (nHeight + TILED_PIXEL_STORE_TILE_SIZE - 1) / TILED_PIXEL_STORE_TILE_SIZE;
+	m_nCurrentTimeStamp = 1;
+	m_nResidentBytes = 0;
+	m_pTileTimeStamps = new int[m_nTilesX * m_nTilesY];
+	memset(m_pTileTimeStamps, 0, m_nTilesX * m_nTilesY * sizeof(int));
+
+	unsigned __int64 nSize = (unsigned __int64)nWidth * nHeight * 4;
+	m_pPixels = (nWidth < TILED_PIXEL_STORE_TILE_SIZE || nSize > (SIZE_T)-1) ? NULL :
+		::VirtualAlloc(NULL, (SIZE_T)nSize, MEM_RESERVE, PAGE_READWRITE);
+}
+
+CTiledPixelStore::~CTiledPixelStore() {
+	if (m_pPixels != NULL) {
+		::VirtualFree(m_pPixels, 0, MEM_RELEASE);
+	}
+	delete[] m_pTileTimeStamps;
+}
+
+CRect CTiledPixelStore::Touch(CRect rect) {
+	CRect tiles = TilesIntersecting(rect);
+	CRect missingRect(0, 0, 0, 0);
+	for (int nTileY = tiles.top; nTileY < tiles.bottom; nTileY++) {
+		for (int nTileX = tiles.left; nTileX < tiles.right; nTileX++) {
+			int& nTimeStamp = m_pTileTimeStamps[nTileY * m_nTilesX + nTileX];
+			if (nTimeStamp == 0) {
+				missingRect.UnionRect(missingRect, TileRect(nTileX, nTileY));
+			} else {
+				nTimeStamp = m_nCurrentTimeStamp;
+			}
+		}
+	}
+	return missingRect;
+}
+
+__int64 CTiledPixelStore::GetMemSize(CRect rect) const {
+	CRect tiles = TilesIntersecting(rect);
+	if (tiles.IsRectEmpty()) {
+		return 0;
+	}
+	CRect tilesRect;
+	tilesRect.UnionRect(TileRect(tiles.left, tiles.top), TileRect(tiles.right - 1, tiles.bottom - 1));
+	return (__int64)tilesRect.Width() * tilesRect.Height() * 4;
+}
+
+bool CTiledPixelStore::Store(CRect rect, const void* pPixels, CRect pixelsRect) {
+	if (m_pPixels == NULL) {
+		return false;
+	}
+	int nRowBytes = rect.Width() * 4;
+	const uint8* pSource = (const uint8*)pPixels + ((__int64)(rect.top - pixelsRect.top) * pixelsRect.Width() + (rect.left - pixelsRect.left)) * 4;
+	for (int y = rect.top; y < rect.bottom; y++) {
+		uint8* pTarget = (uint8*)m_pPixels + ((__int64)y * m_nWidth + rect.left) * 4;
+		// committing pages that are already committed keeps their content
+		if (::VirtualAlloc(pTarget, nRowBytes, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+			return false;
+		}
+		memcpy(pTarget, pSource, nRowBytes);
+		pSource += pixelsRect.Width() * 4;
+	}
+
+	CRect tiles = TilesIntersecting(rect);
+	for (int nTileY = tiles.top; nTileY < tiles.bottom; nTileY++) {
+		for (int nTileX = tiles.left; nTileX < tiles.right; nTileX++) {
+			int& nTimeStamp = m_pTileTimeStamps[nTileY * m_nTilesX + nTileX];
+			if (nTimeStamp == 0) {
+				CRect tileRect = TileRect(nTileX, nTileY);
+				m_nResidentBytes += (__int64)tileRect.Width() * tileRect.Height() * 4;
+			}
+			nTimeStamp = m_nCurrentTimeStamp;
+		}
+	}
+	return true;
+}
+
+void CTiledPixelStore::Trim(__int64 nBudget) {
+	while (m_nResidentBytes > nBudget) {
+		// find the least recently used tile not used since the last call
+		int nOldest = -1;
+		for (int i = 0; i < m_nTilesX * m_nTilesY; i++) {
+			int nTimeStamp = m_pTileTimeStamps[i];
+			if (nTimeStamp != 0 && nTimeStamp != m_nCurrentTimeStamp && (nOldest < 0 || nTimeStamp < m_pTileTimeStamps[nOldest])) {
+				nOldest = i;
+			}
+		}
+		if (nOldest < 0) {
+			break;
+		}
+		FreeTile(nOldest % m_nTilesX, nOldest / m_nTilesX);
+	}
+	m_nCurrentTimeStamp++;
+}
+
+CRect CTiledPixelStore::TileRect(int nTileX, int nTileY) const {
+	return CRect(nTileX * TILED_PIXEL_STORE_TILE_SIZE, nTileY * TILED_PIXEL_STORE_TILE_SIZE,
+		min(m_nWidth, (nTileX + 1) * TILED_PIXEL_STORE_TILE_SIZE), min(m_nHeight, (nTileY + 1) * TILED_PIXEL_STORE_TILE_SIZE));
+}
+
+CRect CTiledPixelStore::TilesIntersecting(CRect rect) const {
+	CRect clippedRect;
+	if (!clippedRect.IntersectRect(rect, CRect(0, 0, m_nWidth, m_nHeight))) {
+		return CRect(0, 0, 0, 0);
+	}
+	return CRect(clippedRect.left / TILED_PIXEL_STORE_TILE_SIZE, clippedRect.top / TILED_PIXEL_STORE_TILE_SIZE,
+		(clippedRect.right - 1) / TILED_PIXEL_STORE_TILE_SIZE + 1, (clippedRect.bottom - 1) / TILED_PIXEL_STORE_TILE_SIZE + 1);
+}
+
+bool CTiledPixelStore::IsResident(int nX, int nY) const {
+	return m_pTileTimeStamps[(nY / TILED_PIXEL_STORE_TILE_SIZE) * m_nTilesX + nX / TILED_PIXEL_STORE_TILE_SIZE] != 0;
+}
+
+void CTiledPixelStore::FreeTile(int nTileX, int nTileY) {
+	CRect tileRect = TileRect(nTileX, nTileY);
+	m_pTileTimeStamps[nTileY * m_nTilesX + nTileX] = 0;
+	m_nResidentBytes -= (__int64)tileRect.Width() * tileRect.Height() * 4;
+
+	// The rows are not page aligned, a page can contain pixels of the neighbouring tiles and is only decommitted if these
+	// tiles are not resident either. As the tiles are at least one page wide, a page contains pixels of at most two tiles
+	// of a row, if it wraps around to the next row, of the last tile of its first row and the first tile of the next row.
+	__int64 nImageBytes = (__int64)m_nWidth * m_nHeight * 4;
+	for (int y = tileRect.top; y < tileRect.bottom; y++) {
+		__int64 nStart = ((__int64)y * m_nWidth + tileRect.left) * 4;
+		__int64 nEnd = ((__int64)y * m_nWidth + tileRect.right) * 4;
+		for (__int64 nPage = nStart / MEMORY_PAGE_SIZE * MEMORY_PAGE_SIZE; nPage < nEnd; nPage += MEMORY_PAGE_SIZE) {
+			__int64 nFirstPixel = nPage / 4;
+			__int64 nLastPixel = (min(nPage + MEMORY_PAGE_SIZE, nImageBytes) - 1) / 4;
+			int nFirstX = (int)(nFirstPixel % m_nWidth), nFirstY = (int)(nFirstPixel / m_nWidth);
+			int nLastX = (int)(nLastPixel % m_nWidth), nLastY = (int)(nLastPixel / m_nWidth);
+			bool bFree = !IsResident(nFirstX, nFirstY) && !IsResident(nLastX, nLastY) &&
+				(nFirstY == nLastY || !IsResident(m_nWidth - 1, nFirstY));
+			if (bFree) {
+				::VirtualFree((uint8*)m_pPixels + nPage, MEMORY_PAGE_SIZE, MEM_DECOMMIT);
+			}
+		}
+	}
+}
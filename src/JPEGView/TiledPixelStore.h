@@ -0,0 +1,55 @@
+#pragma once
+
+// Size of the tiles of the tiled pixel store in pixels (width and height)
+#define TILED_PIXEL_STORE_TILE_SIZE 1024
+
+// Out-of-core storage of a large 32 bpp image in tiles of fixed size. The address space of the whole image is reserved,
+// so the image can be addressed as a normal DIB (rows of width pixels, e.g. by the resampling methods), but memory is
+// only committed for the resident tiles. The tiles are filled by the owner (e.g. by decoding a region of a JPEG) and the
+// least recently used tiles are freed when the store exceeds its memory budget.
+// Reading pixels of tiles that are not resident causes an access violation, the owner must make all tiles needed resident.
+// The store is not thread safe.
+// Only JPEGs are backed by the store, as only they can be decoded by region (see CJPEGImage::DecodeRegion()). JPEGs beyond
+// MAX_IMAGE_DIMENSION or MAX_IMAGE_PIXELS are reduced by DCT scaling to within these limits, the reduced size is then the
+// size of the store. All other formats are still decoded into one buffer and are limited by MAX_IMAGE_PIXELS.
+class CTiledPixelStore
+{
+public:
+	// The image must be at least one tile wide
+	CTiledPixelStore(int nWidth, int nHeight);
+	~CTiledPixelStore();
+
+	// Start address of the image, NULL if the address space could not be reserved
+	const void* Pixels() const { return m_pPixels; }
+
+	// Marks the tiles intersecting rect as used since the last call to Trim(). Returns the bounding rectangle of the
+	// tiles intersecting rect that are not resident, an empty rectangle if all are resident.
+	CRect Touch(CRect rect);
+
+	// Memory in bytes used by the tiles intersecting rect when they are resident
+	__int64 GetMemSize(CRect rect) const;
+
+	// Memory in bytes used by the resident tiles
+	__int64 GetResidentMemSize() const { return m_nResidentBytes; }
+
+	// Makes the tiles in rect resident and copies their pixels from pPixels, a 32 bpp image covering pixelsRect.
+	// rect must be aligned to the tiles and contained in pixelsRect. Returns false if out of memory.
+	bool Store(CRect rect, const void* pPixels, CRect pixelsRect);
+
+	// Frees the least recently used tiles until the resident tiles use at most nBudget bytes.
+	// Tiles used since the last call to Trim() are never freed.
+	void Trim(__int64 nBudget);
+
+private:
+	void* m_pPixels;
+	int m_nWidth, m_nHeight;
+	int m_nTilesX, m_nTilesY;
+	int* m_pTileTimeStamps; // time stamp of the last access per tile, 0 if the tile is not resident
+	int m_nCurrentTimeStamp;
+	__int64 m_nResidentBytes;
+
+	CRect TileRect(int nTileX, int nTileY) const;
+	CRect TilesIntersecting(CRect rect) const;
+	bool IsResident(int nX, int nY) const;
+	void FreeTile(int nTileX, int nTileY);
+};
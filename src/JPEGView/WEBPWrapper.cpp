@@ -20,6 +20,28 @@ struct WebpReaderWriter::webp_cache {
 WebpReaderWriter::webp_cache WebpReaderWriter::cache = { 0 };
 
 void* WebpReaderWriter::ReadImage(int& width,
+	int& height,
+	int& nchannels,
+	bool& has_animation,
+	int& frame_count,
+	int& frame_time,
+	void*& exif_chunk,
+	bool& outOfMemory,
+	const void* buffer,
+	int sizebytes,
+	bool keep_decoder)
+{
+	if (keep_decoder) {
+		return ReadImageInternal(cache, width, height, nchannels, has_animation, frame_count, frame_time, exif_chunk, outOfMemory, buffer, sizebytes);
+	}
+	webp_cache c = { 0 };
+	void* pPixelData = ReadImageInternal(c, width, height, nchannels, has_animation, frame_count, frame_time, exif_chunk, outOfMemory, buffer, sizebytes);
+	DeleteCacheInternal(c);
+	return pPixelData;
+}
+
+void* WebpReaderWriter::ReadImageInternal(webp_cache& c,
+	int& width,
 	int& height,
 	int& nchannels,
 	bool& has_animation,
@@ -37,7 +59,7 @@ void* WebpReaderWriter::ReadImage(int& width,
 	outOfMemory = false;
 	exif_chunk = NULL;
 
-	if (!cache.decoder || !cache.data.bytes) {
+	if (!c.decoder || !c.data.bytes) {
 		if (!WebPGetInfo((const uint8_t*)buffer, sizebytes, &width, &height))
 			return NULL;
 		if (width > MAX_IMAGE_DIMENSION || height > MAX_IMAGE_DIMENSION)
@@ -93,23 +115,23 @@ void* WebpReaderWriter::ReadImage(int& width,
 		}
 	
 		// Cache WebP data and decoder to keep track of where we are in the file
-		DeleteCache();
+		DeleteCacheInternal(c);
 		WebPAnimDecoderOptions anim_config;
 		WebPAnimDecoderOptionsInit(&anim_config);
 		anim_config.color_mode = MODE_BGRA;
 		uint8_t* cached_webp_bytes = new uint8_t[sizebytes];
 		memcpy(cached_webp_bytes, buffer, sizebytes);
-		cache.data.bytes = cached_webp_bytes;
-		cache.data.size = sizebytes;
-		cache.decoder = WebPAnimDecoderNew(&cache.data, &anim_config);
-		cache.width = width;
-		cache.height = height;
-		cache.transform = transform;
+		c.data.bytes = cached_webp_bytes;
+		c.data.size = sizebytes;
+		c.decoder = WebPAnimDecoderNew(&c.data, &anim_config);
+		c.width = width;
+		c.height = height;
+		c.transform = transform;
 	}
-	WebPAnimDecoder* decoder = cache.decoder;
-	WebPData webp_data = cache.data;
-	width = cache.width;
-	height = cache.height;
+	WebPAnimDecoder* decoder = c.decoder;
+	WebPData webp_data = c.data;
+	width = c.width;
+	height = c.height;
 
 	if (decoder == NULL)
 		return NULL;
@@ -127,10 +149,10 @@ void* WebpReaderWriter::ReadImage(int& width,
 	WebPAnimDecoderGetInfo(decoder, &anim_info);
 	frame_count = max(anim_info.frame_count, 1);
 	timestamp = max(timestamp, 0);
-	if (timestamp < cache.prev_frame_timestamp)
-		cache.prev_frame_timestamp = 0;
-	frame_time = timestamp - cache.prev_frame_timestamp;
-	cache.prev_frame_timestamp = timestamp;
+	if (timestamp < c.prev_frame_timestamp)
+		c.prev_frame_timestamp = 0;
+	frame_time = timestamp - c.prev_frame_timestamp;
+	c.prev_frame_timestamp = timestamp;
 
 	pPixelData = new(std::nothrow) unsigned char[width * height * nchannels];
 	if (pPixelData == NULL) {
@@ -139,7 +161,7 @@ void* WebpReaderWriter::ReadImage(int& width,
 	}
 
 	// Try copying with ICCP transform
-	if (!ICCProfileTransform::DoTransform(cache.transform, buf, pPixelData, width, height)) {
+	if (!ICCProfileTransform::DoTransform(c.transform, buf, pPixelData, width, height)) {
 		// Copy frame to output buffer directly otherwise
 		memcpy(pPixelData, buf, width * height * nchannels);
 	}
@@ -149,10 +171,19 @@ void* WebpReaderWriter::ReadImage(int& width,
 }
 
 void WebpReaderWriter::DeleteCache() {
-	WebPAnimDecoderDelete(cache.decoder);
-	WebPDataClear(&cache.data);
-	ICCProfileTransform::DeleteTransform(cache.transform);
-	cache = { 0 };
+	DeleteCacheInternal(cache);
+}
+
+void WebpReaderWriter::DeleteCacheInternal(webp_cache& c) {
+	WebPAnimDecoderDelete(c.decoder);
+	WebPDataClear(&c.data);
+	ICCProfileTransform::DeleteTransform(c.transform);
+	c = { 0 };
+}
+
+bool WebpReaderWriter::IsAnimated(const void* buffer, int sizebytes) {
+	WebPBitstreamFeatures features;
+	return WebPGetFeatures((const uint8_t*)buffer, sizebytes, &features) == VP8_STATUS_OK && features.has_animation;
 }
 
 void* WebpReaderWriter::Compress(const void* source,
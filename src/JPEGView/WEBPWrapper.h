@@ -4,7 +4,10 @@
 class WebpReaderWriter
 {
 public:
-	// Returns data in 4 byte BGRA
+	// Returns data in 4 byte BGRA. With keep_decoder, the decoder of an animated WebP is kept in a cache shared by all
+	// threads to read the next frame on the next call, callers must serialize these calls and DeleteCache() before reading
+	// another file. Without keep_decoder, the image is decoded with a decoder of its own (only the first frame is read),
+	// this can be called on several threads at once.
 	static void* ReadImage(int& width,   // width of the image loaded.
 		int& height,  // height of the image loaded.
 		int& bpp,     // BYTES (not bits) PER PIXEL.
@@ -14,10 +17,14 @@ public:
 		void*& exif, // Pointer to Exif data (must be freed by caller)
 		bool& outOfMemory, // set to true when no memory to read image
 		const void* buffer, // memory address containing webp compressed data.
-		int sizebytes); // size of webp compressed data
+		int sizebytes, // size of webp compressed data
+		bool keep_decoder); // keep the decoder of an animated WebP in the shared cache
 
 	static void DeleteCache();
 
+	// Returns true if the WebP is animated, false otherwise
+	static bool IsAnimated(const void* buffer, int sizebytes);
+
 	// Compress image data into WEBP stream, returns compressed data.
 	static void* Compress(const void* buffer, // address of image in memory, format must be 3 bytes per pixel BRGBGR with padding to 4 byte boundary
 		int width, // width of image in pixels
@@ -31,4 +38,7 @@ public:
 private:
 	struct webp_cache;
 	static webp_cache cache;
+	static void* ReadImageInternal(webp_cache& c, int& width, int& height, int& bpp, bool& has_animation, int& frame_count,
+		int& frame_time, void*& exif, bool& outOfMemory, const void* buffer, int sizebytes);
+	static void DeleteCacheInternal(webp_cache& c);
 };
@@ -3,6 +3,25 @@
 #include "WorkThread.h"
 #include <process.h>
 
+static __declspec(thread) const CCancelToken* s_pCurrentCancelToken = NULL;
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// CCancelToken
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+const CCancelToken* CCancelToken::Current() {
+	return s_pCurrentCancelToken;
+}
+
+CCancelToken::CScope::CScope(const CCancelToken* pToken) {
+	m_pPreviousToken = s_pCurrentCancelToken;
+	s_pCurrentCancelToken = pToken;
+}
+
+CCancelToken::CScope::~CScope() {
+	s_pCurrentCancelToken = m_pPreviousToken;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 // Public
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -27,6 +27,44 @@ public:
 	volatile bool Deleted; // Marks requests for deletion from the request queue
 };
 
+// Cooperative cancellation of a job, e.g. loading an image. Any thread can cancel the job, the job checks the token at
+// safe points (between processed strips, between decoding and processing) and stops early. While a thread runs the job,
+// the token is the current token of the thread (see CScope), so code called by the job finds it without passing it around.
+// The token also tells if the job runs in the background, e.g. read ahead. CProcessingThreadPool processes background jobs
+// only on idle threads and lets interactive jobs go first.
+class CCancelToken {
+public:
+	CCancelToken() { m_bCancelled = false; m_bBackground = false; }
+
+	void Cancel() { m_bCancelled = true; }
+	bool IsCancelled() const { return m_bCancelled; }
+
+	void SetBackground(bool bBackground) { m_bBackground = bBackground; }
+	bool IsBackground() const { return m_bBackground; }
+
+	// Token of the job running on the calling thread, NULL if none
+	static const CCancelToken* Current();
+
+	// Returns if the job running on the calling thread has been cancelled
+	static bool IsCurrentCancelled() {
+		const CCancelToken* pToken = Current();
+		return pToken != NULL && pToken->IsCancelled();
+	}
+
+	// Makes a token the current token of the calling thread during the lifetime of the scope object
+	class CScope {
+	public:
+		CScope(const CCancelToken* pToken);
+		~CScope();
+	private:
+		const CCancelToken* m_pPreviousToken;
+	};
+
+private:
+	volatile bool m_bCancelled;
+	volatile bool m_bBackground;
+};
+
 
 // Represents a worker thread processing requests in a request queue
 class CWorkThread
@@ -1,6 +1,17 @@
 #include "StdAfx.h"
 #include "XMMImage.h"
 #include "Helpers.h"
+#include <xmmintrin.h>
+
+// sRGB8_LinRGB12 as f32, saves the int to float conversion per channel
+static struct CLinFloatTable {
+	float Values[256];
+	CLinFloatTable() {
+		for (int i = 0; i < 256; i++) {
+			Values[i] = (float)sRGB8_LinRGB12[i];
+		}
+	}
+} s_sRGB8_LinFloat;
 
 CFloatImage::CFloatImage(int nWidth, int nHeight, int padding)
 	{
@@ -12,6 +23,11 @@ CFloatImage::CFloatImage(int nWidth, int nHeight, bool bPadHeight, int padding)
 	Init(nWidth, nHeight, bPadHeight, padding);
 	}
 
+CFloatImage::CFloatImage(int nWidth, int nHeight, int padding, bool bHalfFloat)
+	{
+	Init(nWidth, nHeight, false, padding, bHalfFloat);
+	}
+
 //GF: version for f32 SSE & AVX2
 CFloatImage::CFloatImage(int nWidth, int nHeight, int nFirstX, int nLastX, int nFirstY, int nLastY, const void* pDIB, int nChannels, int padding)
 	{
@@ -20,39 +36,7 @@ CFloatImage::CFloatImage(int nWidth, int nHeight, int nFirstX, int nLastX, int n
 	Init(nSectionWidth, nSectionHeight, false, padding);
 
 	if (m_pMemory != NULL) {
-		int nSrcLineWidthPadded = Helpers::DoPadding(nWidth * nChannels, 4);
-		const uint8* pSrc = (uint8*)pDIB + (long long)nFirstY*(long long)nSrcLineWidthPadded + (long long)nFirstX*(long long)nChannels;
-
-		float* pDst = (float*) m_pMemory;
-		for (int j = 0; j < nSectionHeight; j++) {
-			if (nChannels == 4) {
-				for (int i = 0; i < nSectionWidth; i++) {
-					uint32 sourcePixel = ((uint32*)pSrc)[i];
-					int d = i;
-					uint32 nBlue = sourcePixel & 0xFF;
-					uint32 nGreen = (sourcePixel >> 8) & 0xFF;
-					uint32 nRed = (sourcePixel >> 16) & 0xFF;
-
-					pDst[d] = ((float)sRGB8_LinRGB12[nBlue]);
-					d += m_nPaddedWidth;
-					pDst[d] = ((float)sRGB8_LinRGB12[nGreen]);
-					d += m_nPaddedWidth;
-					pDst[d] = ((float)sRGB8_LinRGB12[nRed]);
-				}
-			} else {
-				for (int i = 0; i < nSectionWidth; i++)	{
-					int s = i*3;
-					int d = i;
-					pDst[d] = ((float)sRGB8_LinRGB12[pSrc[s]]);
-					d += m_nPaddedWidth;
-					pDst[d] = ((float)sRGB8_LinRGB12[pSrc[s+1]]);
-					d += m_nPaddedWidth;
-					pDst[d] = ((float)sRGB8_LinRGB12[pSrc[s+2]]);
-				}
-			}
-			pDst += 3*m_nPaddedWidth;
-			pSrc += nSrcLineWidthPadded;
-		}
+		ConvertFromDIB(nWidth, nFirstX, nLastX, nFirstY, nLastY, pDIB, nChannels);
 	}
 }
 
@@ -90,11 +74,46 @@ void* CFloatImage::ConvertToDIBRGBA() const {
 	return pDIB;
 }
 
+void CFloatImage::ConvertFromDIB(int nWidth, int nFirstX, int nLastX, int nFirstY, int nLastY, const void* pDIB, int nChannels, int nTargetRow) {
+	int nSectionWidth = nLastX - nFirstX + 1;
+	int nSectionHeight = nLastY - nFirstY + 1;
+	int nSrcLineWidthPadded = Helpers::DoPadding(nWidth * nChannels, 4);
+	const uint8* pSrc = (uint8*)pDIB + (long long)nFirstY*(long long)nSrcLineWidthPadded + (long long)nFirstX*(long long)nChannels;
+
+	// Half float images are filled by the AVX resampler with its own conversion, see ConvertRowFromDIB_AVX()
+	assert(!m_bHalfFloat);
+	// SSE has no gather, the table lookups stay scalar. Four pixels are stored per channel at once.
+	const float* pTable = s_sRGB8_LinFloat.Values;
+	float* pDst = (float*) m_pMemory + nTargetRow*3*m_nPaddedWidth;
+	for (int j = 0; j < nSectionHeight; j++) {
+		float* pDstB = pDst;
+		float* pDstG = pDst + m_nPaddedWidth;
+		float* pDstR = pDst + 2*m_nPaddedWidth;
+		const uint8* p = pSrc;
+		int i = 0;
+		for (; i + 4 <= nSectionWidth; i += 4) {
+			_mm_storeu_ps(pDstB + i, _mm_setr_ps(pTable[p[0]], pTable[p[nChannels]], pTable[p[2*nChannels]], pTable[p[3*nChannels]]));
+			_mm_storeu_ps(pDstG + i, _mm_setr_ps(pTable[p[1]], pTable[p[nChannels + 1]], pTable[p[2*nChannels + 1]], pTable[p[3*nChannels + 1]]));
+			_mm_storeu_ps(pDstR + i, _mm_setr_ps(pTable[p[2]], pTable[p[nChannels + 2]], pTable[p[2*nChannels + 2]], pTable[p[3*nChannels + 2]]));
+			p += 4*nChannels;
+		}
+		for (; i < nSectionWidth; i++) {
+			pDstB[i] = pTable[p[0]];
+			pDstG[i] = pTable[p[1]];
+			pDstR[i] = pTable[p[2]];
+			p += nChannels;
+		}
+		pDst += 3*m_nPaddedWidth;
+		pSrc += nSrcLineWidthPadded;
+	}
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////
 // Private
 /////////////////////////////////////////////////////////////////////////////////////////
 
-void CFloatImage::Init(int nWidth, int nHeight, bool bPadHeight, int padding) {
+void CFloatImage::Init(int nWidth, int nHeight, bool bPadHeight, int padding, bool bHalfFloat) {
+	m_bHalfFloat = bHalfFloat;
 	// pad scanlines
 	m_nPaddedWidth = Helpers::DoPadding(nWidth, padding);
 	if (bPadHeight) {
@@ -106,12 +125,16 @@ void CFloatImage::Init(int nWidth, int nHeight, bool bPadHeight, int padding) {
 	m_nHeight = nHeight;
 	// source would have (m_nPaddedWidth * 1((Bytes/ChannelPixel)*3 ChannelPixels)) * 1 (SingleComponentLines/SourceLine)
 	//int nMemSize = GetMemSize();	// = (m_nPaddedWidth * 2(Bytes/ChannelPixel)) * (m_nPaddedHeight * 3(SingleComponentLines/SourceLine));
-	int nMemSize = GetMemSize();	// = (m_nPaddedWidth * 4(Bytes/ChannelPixel)) * (m_nPaddedHeight * 3(SingleComponentLines/SourceLine));
+	__int64 nMemSize = GetMemSize();	// = (m_nPaddedWidth * 4(Bytes/ChannelPixel)) * (m_nPaddedHeight * 3(SingleComponentLines/SourceLine));
+	if ((unsigned __int64)nMemSize > (SIZE_T)-1) {
+		m_pMemory = NULL; // does not fit into the address space of 32 bit builds
+		return;
+	}
 
 	// Allocate memory aligned on page boundaries
 	m_pMemory = ::VirtualAlloc(
 						NULL,	  // let the call determine the start address
-						nMemSize, // the size
+						(SIZE_T)nMemSize, // the size
 						MEM_RESERVE | MEM_COMMIT,	// I want that memory, now
 						PAGE_READWRITE);			// need both read and write
 }
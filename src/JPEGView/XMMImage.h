@@ -2,6 +2,11 @@
 
 #include "ImageProcessingTypes.h"
 
+// The fused resampler processes strips in tiles of target columns. Each tile streams its source rows through a ring
+// of filter length rows, converted to linear light in a CFloatImage. The tile width is chosen such that this ring has
+// at most this size in bytes and stays in the L2 cache.
+#define FUSED_TILE_SOURCE_BYTES (256 * 1024)
+
 // Represents an image with line interleaving and padding rows to 2^x bytes (16 for SSE, 32 for AVX) optimal for
 // SIMD processing. Each pixel has 16 bits per channel, channel order is B, G, R, x stands for padding:
 // BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBxxx
@@ -15,6 +20,10 @@ class CFloatImage
 public:
 	// padding is in pixels (not bytes)
 	CFloatImage(int nWidth, int nHeight, int padding);
+	// padding is in pixels (not bytes). If bHalfFloat is true, the channels are stored as IEEE half floats (16 bit) instead of
+	// f32. Half floats hold the 12 bit linear values exactly up to 2048 and with an error of at most 1 above, the SIMD code
+	// converts them with F16C when loading.
+	CFloatImage(int nWidth, int nHeight, int padding, bool bHalfFloat);
 	CFloatImage(int nWidth, int nHeight, bool bPadHeight, int padding); // padding is in pixels (not bytes), width is always padded, height only when bPadHeight is true
 	// convert from section of 24 or 32 bpp DIB, from first to (and including) last column and row
 	// padding is in pixels(not bytes)
@@ -30,19 +39,27 @@ public:
 	int GetHeight() const { return m_nHeight; }
 	int GetPaddedWidth() const { return m_nPaddedWidth; }
 	int GetPaddedHeight() const { return m_nPaddedHeight; }
+	bool IsHalfFloat() const { return m_bHalfFloat; }
 
 	// Generate a BGRA (32 bit) DIB and return it, caller gets ownership of returned object
 	void* ConvertToDIBRGBA() const;
 
+	// Convert a section of a 24 or 32 bpp DIB to linear light, from first to (and including) last column and row.
+	// The section is stored starting at row nTargetRow, column 0 of this image. Used to reload an image that is reused
+	// for several tiles or as ring buffer of rows, the section must fit into the allocated padded size.
+	// Only for f32 images, the AVX resampler converts the rows of half float images itself.
+	void ConvertFromDIB(int nWidth, int nFirstX, int nLastX, int nFirstY, int nLastY, const void* pDIB, int nChannels, int nTargetRow = 0);
+
 private:
 	//int GetLineSize() const { return m_nPaddedWidth*2; }	// Gernot i16
-	int GetLineSize() const { return m_nPaddedWidth*4; }	// Gernot f32
+	int GetLineSize() const { return m_bHalfFloat ? m_nPaddedWidth*2 : m_nPaddedWidth*4; }	// Gernot f32 (or f16)
 
-	int GetMemSize() const { return (GetLineSize()*3*m_nPaddedHeight); }
-	void Init(int nWidth, int nHeight, bool bPadHeight, int padding);
+	__int64 GetMemSize() const { return ((__int64)GetLineSize()*3*m_nPaddedHeight); }
+	void Init(int nWidth, int nHeight, bool bPadHeight, int padding, bool bHalfFloat = false);
 
 	void* m_pMemory;
 	int m_nWidth, m_nHeight;
 	int m_nPaddedWidth; // in pixels
 	int m_nPaddedHeight; // in pixels
+	bool m_bHalfFloat;
 };
@@ -0,0 +1,171 @@
+#include "StdAfx.h"
+#include "YCbCrImage.h"
+#include "Helpers.h"
+#include "libjpeg-turbo\include\turbojpeg.h"
+
+// Fixed point color conversion tables of libjpeg (jdcolor.c), 16 fractional bits
+static struct CColorTables {
+	int Cr_R[256];
+	int Cb_B[256];
+	int Cr_G[256];
+	int Cb_G[256];
+	CColorTables() {
+		const int ONE_HALF = 1 << 15;
+		for (int i = 0; i < 256; i++) {
+			int x = i - 128;
+			Cr_R[i] = (91881 * x + ONE_HALF) >> 16; // FIX(1.40200)
+			Cb_B[i] = (116130 * x + ONE_HALF) >> 16; // FIX(1.77200)
+			Cr_G[i] = -46802 * x; // FIX(0.71414)
+			Cb_G[i] = -22554 * x + ONE_HALF; // FIX(0.34414)
+		}
+	}
+} s_ColorTables;
+
+static inline uint8 RangeLimit(int nValue) {
+	return (uint8)((nValue < 0) ? 0 : (nValue > 255) ? 255 : nValue);
+}
+
+CYCbCrImage::CYCbCrImage(int nWidth, int nHeight, TJSAMP eSubsampling) {
+	m_nWidth = nWidth;
+	m_nHeight = nHeight;
+	m_nShiftX = (eSubsampling == TJSAMP_420 || eSubsampling == TJSAMP_422) ? 1 : 0;
+	m_nShiftY = (eSubsampling == TJSAMP_420) ? 1 : 0;
+	int nComponents = (eSubsampling == TJSAMP_GRAY) ? 1 : 3;
+	__int64 nSize = 0;
+	for (int i = 0; i < 3; i++) {
+		bool bChroma = i > 0;
+		m_nPlaneWidth[i] = (i < nComponents) ? (bChroma ? (nWidth + (1 << m_nShiftX) - 1) >> m_nShiftX : nWidth) : 0;
+		m_nPlaneHeight[i] = (i < nComponents) ? (bChroma ? (nHeight + (1 << m_nShiftY) - 1) >> m_nShiftY : nHeight) : 0;
+		nSize += (__int64)m_nPlaneWidth[i] * m_nPlaneHeight[i];
+	}
+	m_pMemory = (nSize > (SIZE_T)-1) ? NULL : new(std::nothrow) uint8[(size_t)nSize];
+	uint8* pPlane = m_pMemory;
+	for (int i = 0; i < 3; i++) {
+		m_pPlanes[i] = (pPlane == NULL || i >= nComponents) ? NULL : pPlane;
+		if (pPlane != NULL) {
+			pPlane += (__int64)m_nPlaneWidth[i] * m_nPlaneHeight[i];
+		}
+	}
+}
+
+CYCbCrImage::~CYCbCrImage() {
+	delete[] m_pMemory;
+}
+
+bool CYCbCrImage::IsSupported(int nWidth, TJSAMP eSubsampling) {
+	switch (eSubsampling) {
+	case TJSAMP_GRAY:
+	case TJSAMP_444:
+		return true;
+	case TJSAMP_422:
+	case TJSAMP_420:
+		// libjpeg-turbo replicates the chroma samples instead of fancy upsampling for chroma planes of up to two columns
+		return (nWidth + 1) / 2 > 2;
+	default:
+		return false;
+	}
+}
+
+__int64 CYCbCrImage::GetMemSize() const {
+	if (m_pMemory == NULL) return 0;
+	__int64 nSize = 0;
+	for (int i = 0; i < 3; i++) {
+		nSize += (__int64)m_nPlaneWidth[i] * m_nPlaneHeight[i];
+	}
+	return nSize;
+}
+
+void CYCbCrImage::UpsampleChromaRow(int nComponent, int nY, int nFirstX, int nLastX, uint8* pTarget) const {
+	const uint8* pPlane = m_pPlanes[nComponent];
+	int nWidth = m_nPlaneWidth[nComponent];
+	if (m_nShiftX == 0) {
+		memcpy(pTarget, pPlane + (__int64)nY * nWidth + nFirstX, nLastX - nFirstX + 1);
+		return;
+	}
+	if (m_nShiftY == 0) {
+		// h2v1 fancy upsampling: triangle filter 3/4 * nearer sample + 1/4 * further sample
+		const uint8* pRow = pPlane + (__int64)nY * nWidth;
+		for (int x = nFirstX; x <= nLastX; x++) {
+			int c = x >> 1;
+			int nValue = pRow[c] * 3;
+			*pTarget++ = (x & 1) ? (uint8)((nValue + pRow[min(c + 1, nWidth - 1)] + 2) >> 2) :
+				(uint8)((nValue + pRow[max(c - 1, 0)] + 1) >> 2);
+		}
+		return;
+	}
+	// h2v2 fancy upsampling: the triangle filter vertically into column sums, then horizontally.
+	// The rows beyond the edges of the plane are replicated like the context rows of libjpeg.
+	int nRow = nY >> 1;
+	int nFarRow = (nY & 1) ? min(nRow + 1, m_nPlaneHeight[nComponent] - 1) : max(nRow - 1, 0);
+	const uint8* pNear = pPlane + (__int64)nRow * nWidth;
+	const uint8* pFar = pPlane + (__int64)nFarRow * nWidth;
+	for (int x = nFirstX; x <= nLastX; x++) {
+		int c = x >> 1;
+		int nColSum = pNear[c] * 3 + pFar[c];
+		if (x & 1) {
+			int n = min(c + 1, nWidth - 1);
+			*pTarget++ = (uint8)((nColSum * 3 + pNear[n] * 3 + pFar[n] + 7) >> 4);
+		} else {
+			int n = max(c - 1, 0);
+			*pTarget++ = (uint8)((nColSum * 3 + pNear[n] * 3 + pFar[n] + 8) >> 4);
+		}
+	}
+}
+
+void CYCbCrImage::ConvertRowToBGR(int nY, int nFirstX, int nLastX, uint8* pTarget) const {
+	const uint8* pLuma = m_pPlanes[0] + (__int64)nY * m_nWidth;
+	if (m_pPlanes[1] == NULL) {
+		for (int x = nFirstX; x <= nLastX; x++) {
+			pTarget[0] = pTarget[1] = pTarget[2] = pLuma[x];
+			pTarget += 3;
+		}
+		return;
+	}
+
+	// the chroma is upsampled in blocks on the stack
+	const int BLOCK_SIZE = 256;
+	uint8 cb[BLOCK_SIZE], cr[BLOCK_SIZE];
+	const CColorTables& tables = s_ColorTables;
+	for (int nBlockX = nFirstX; nBlockX <= nLastX; nBlockX += BLOCK_SIZE) {
+		int nCount = min(BLOCK_SIZE, nLastX - nBlockX + 1);
+		UpsampleChromaRow(1, nY, nBlockX, nBlockX + nCount - 1, cb);
+		UpsampleChromaRow(2, nY, nBlockX, nBlockX + nCount - 1, cr);
+		for (int i = 0; i < nCount; i++) {
+			int nLuma = pLuma[nBlockX + i];
+			pTarget[0] = RangeLimit(nLuma + tables.Cb_B[cb[i]]);
+			pTarget[1] = RangeLimit(nLuma + ((tables.Cb_G[cb[i]] + tables.Cr_G[cr[i]]) >> 16));
+			pTarget[2] = RangeLimit(nLuma + tables.Cr_R[cr[i]]);
+			pTarget += 3;
+		}
+	}
+}
+
+void* CYCbCrImage::ConvertToBGR() const {
+	int nStride = Helpers::DoPadding(m_nWidth * 3, 4);
+	uint8* pDIB = new(std::nothrow) uint8[(__int64)nStride * m_nHeight];
+	if (pDIB == NULL) return NULL;
+	for (int y = 0; y < m_nHeight; y++) {
+		ConvertRowToBGR(y, 0, m_nWidth - 1, pDIB + (__int64)nStride * y);
+	}
+	return pDIB;
+}
+
+void* CYCbCrImage::ConvertToBGRA(CRect rect) const {
+	int nWidth = rect.Width();
+	uint32* pDIB = new(std::nothrow) uint32[(__int64)nWidth * rect.Height()];
+	uint8* pRow = new(std::nothrow) uint8[nWidth * 3];
+	if (pDIB == NULL || pRow == NULL) {
+		delete[] pDIB;
+		delete[] pRow;
+		return NULL;
+	}
+	uint32* pTarget = pDIB;
+	for (int y = rect.top; y < rect.bottom; y++) {
+		ConvertRowToBGR(y, rect.left, rect.right - 1, pRow);
+		for (int x = 0; x < nWidth; x++) {
+			*pTarget++ = 0xFF000000 | (pRow[x * 3 + 2] << 16) | (pRow[x * 3 + 1] << 8) | pRow[x * 3];
+		}
+	}
+	delete[] pRow;
+	return pDIB;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+enum TJSAMP;
+
+// Number of channels to pass with a CYCbCrImage as source image to the SIMD resampling methods of CBasicProcessing
+#define YCBCR_IMAGE_CHANNELS 0
+
+// Decoded JPEG kept as the planes of its Y, Cb and Cr components, the chroma planes subsampled as in the JPEG. For 4:2:0
+// subsampling this is half the memory of a 24 bpp DIB, for grayscale a third.
+// The planes are converted to BGR row by row when needed, with the chroma upsampling ('fancy upsampling') and the color
+// conversion of libjpeg-turbo, so the pixels are identical to decoding the JPEG to BGR.
+// Supported subsamplings are grayscale, 4:4:4, 4:2:2 and 4:2:0.
+class CYCbCrImage
+{
+public:
+	// Allocates the planes, the image is invalid (Plane(0) is NULL) if out of memory
+	CYCbCrImage(int nWidth, int nHeight, TJSAMP eSubsampling);
+	~CYCbCrImage();
+
+	// Returns if the subsampling is supported by this class
+	static bool IsSupported(int nWidth, TJSAMP eSubsampling);
+
+	int Width() const { return m_nWidth; }
+	int Height() const { return m_nHeight; }
+
+	// Plane of the component (0: Y, 1: Cb, 2: Cr) and its size, the chroma planes are NULL for grayscale images
+	uint8* Plane(int nComponent) const { return m_pPlanes[nComponent]; }
+	int PlaneWidth(int nComponent) const { return m_nPlaneWidth[nComponent]; }
+	int PlaneHeight(int nComponent) const { return m_nPlaneHeight[nComponent]; }
+
+	// Memory in bytes used by the planes
+	__int64 GetMemSize() const;
+
+	// Converts the pixels nFirstX to nLastX (including) of row nY to 24 bpp BGR at pTarget
+	void ConvertRowToBGR(int nY, int nFirstX, int nLastX, uint8* pTarget) const;
+
+	// Converts the image to a 24 bpp BGR DIB, NULL if out of memory
+	void* ConvertToBGR() const;
+
+	// Converts the given rectangle of the image to a 32 bpp BGRA DIB with opaque alpha, NULL if out of memory
+	void* ConvertToBGRA(CRect rect) const;
+
+private:
+	int m_nWidth, m_nHeight;
+	int m_nShiftX, m_nShiftY; // chroma subsampling as shift, 0 or 1
+	uint8* m_pMemory;
+	uint8* m_pPlanes[3];
+	int m_nPlaneWidth[3], m_nPlaneHeight[3];
+
+	void UpsampleChromaRow(int nComponent, int nY, int nFirstX, int nLastX, uint8* pTarget) const;
+};